@@ -7,10 +7,26 @@ HEADERS += \
     src/Field/anisotropy.h \
     src/Render/constraints.h \
     src/Render/montecarlo.h \
+    src/Render/memoryallocator.h \
+    src/Render/offscreen.h \
+    src/Render/errormetrics.h \
+    src/Render/dynamicresolution.h \
+    src/Render/viewcache.h \
+    src/Render/stagingring.h \
     src/Render/mesh.h \
     src/Render/objloader.h \
     src/Render/render.h \
+    src/Render/vulkanfunctions.h \
+    src/Render/vulkancontext.h \
+    src/Render/headlesscontext.h \
     src/Texture/texture.h \
+    src/Texture/exrwriter.h \
+    src/Texture/exrreader.h \
+    src/Texture/imagewriter.h \
+    src/Texture/pngwriter.h \
+    src/Texture/bcwriter.h \
+    src/Texture/texturecontainer.h \
+    src/Texture/imagedecoder.h \
     src/UI/constraintseditor.h \
     src/UI/menubar.h \
     src/UI/newproject.h \
@@ -19,6 +35,7 @@ HEADERS += \
     src/UI/toolbar.h \
     src/UI/bottombar.h \
     src/UI/vulkanwindow.h \
+    src/UI/embeddedshaders.h \
     src/UI/mainapp.h
 
 SOURCES += \
@@ -27,10 +44,26 @@ SOURCES += \
     src/Field/anisotropy.cpp \
     src/Render/constraints.cpp \
     src/Render/montecarlo.cpp \
+    src/Render/memoryallocator.cpp \
+    src/Render/offscreen.cpp \
+    src/Render/errormetrics.cpp \
+    src/Render/dynamicresolution.cpp \
+    src/Render/viewcache.cpp \
+    src/Render/stagingring.cpp \
     src/Render/mesh.cpp \
     src/Render/objloader.cpp \
     src/Render/render.cpp \
+    src/Render/vulkanfunctions.cpp \
+    src/Render/vulkancontext.cpp \
+    src/Render/headlesscontext.cpp \
     src/Texture/texture.cpp \
+    src/Texture/exrwriter.cpp \
+    src/Texture/exrreader.cpp \
+    src/Texture/imagewriter.cpp \
+    src/Texture/pngwriter.cpp \
+    src/Texture/bcwriter.cpp \
+    src/Texture/texturecontainer.cpp \
+    src/Texture/imagedecoder.cpp \
     src/UI/constraintseditor.cpp \
     src/UI/menubar.cpp \
     src/UI/newproject.cpp \
@@ -39,6 +72,7 @@ SOURCES += \
     src/UI/toolbar.cpp \
     src/UI/bottombar.cpp \
     src/UI/vulkanwindow.cpp \
+    src/UI/embeddedshaders.cpp \
     src/UI/mainapp.cpp \
     src/main.cpp
 
@@ -59,6 +93,8 @@ SHADERS += \
     src/Field/Shaders/restrict.comp \
     src/Field/Shaders/prolong.comp \
     src/Texture/Shaders/cubeIntegrator.comp \
+    src/Texture/Shaders/equirectToCube.comp \
+    src/Texture/Shaders/cubeIrradiance.comp \
     src/Render/Shaders/accurate.vert \
     src/Render/Shaders/accurate.frag \
     src/Render/Shaders/fast.vert \
@@ -75,8 +111,15 @@ SHADERS += \
     src/Render/Shaders/reference.frag \
     src/Render/Shaders/resolve.vert \
     src/Render/Shaders/resolve.frag \
+    src/Render/Shaders/upsample.vert \
+    src/Render/Shaders/upsample.frag \
     src/Render/Shaders/copy.vert \
     src/Render/Shaders/copy.frag \
+    src/Render/Shaders/mask.frag \
+    src/Render/Shaders/convergence.comp \
+    src/Render/Shaders/errorMetrics.comp \
+    src/Render/Shaders/brdfLut.comp \
+    src/Render/Shaders/viewCache.comp \
     src/Render/Shaders/constraint.vert \
     src/Render/Shaders/constraint.frag \
     src/Render/Shaders/constraint.tese \
@@ -84,25 +127,29 @@ SHADERS += \
     src/Render/Shaders/handle.vert \
     src/Render/Shaders/handle.frag
 
-createShaderDir.target = $$PWD/assets/shaders
-createShaderDir.commands = $(MKDIR) $$shell_path($$PWD/assets/shaders)
-QMAKE_EXTRA_TARGETS += createShaderDir
-PRE_TARGETDEPS += $$PWD/assets/shaders
+# SPIR-V is linked into the executable: each shader is compiled to a list of words included by
+# the table below, src/UI/embeddedshaders.cpp looks modules up there without touching the disk
+spirv.input = SHADERS
+spirv.output = $$OUT_PWD/shaders/${QMAKE_FILE_IN_BASE}${QMAKE_FILE_EXT}.inc
+spirv.commands = glslc -mfmt=num ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+spirv.CONFIG = no_link target_predeps
+QMAKE_EXTRA_COMPILERS += spirv
 
+shaderTable =
+shaderEntries =
+shaderNames =
 for (in, SHADERS) {
     nameList = $$split(in, ".")
     ext = $$member(nameList, -1, -1)
     nameListNoExt = $$member(nameList, 0, -2)
-    shader = $$join(nameListNoExt, ".")
+    shader = $$basename($$join(nameListNoExt, "."))_$${ext}
 
-    name = compile_$$in
-    target = "compile_$${in}.target"
-    commands = "compile_$${in}.commands"
-    depends = "compile_$${in}.depends"
-
-    $$target = $$PWD/assets/shaders/$$basename(shader)_$${ext}.spv
-    $$commands = glslc $$PWD/$${shader}.$${ext} -o $$PWD/assets/shaders/$$basename(shader)_$${ext}.spv
-    $$depends = $$PWD/$${shader}.$${ext}
-    QMAKE_EXTRA_TARGETS += $$name
-    POST_TARGETDEPS += $$PWD/assets/shaders/$$basename(shader)_$${ext}.spv
+    shaderTable += "static const uint32_t $${shader}[] = {" "$${LITERAL_HASH}include \"$$basename(in).inc\"" "};"
+    shaderEntries += "    { \"$${shader}.spv\", $${shader}, sizeof($${shader}) },"
+    shaderNames += "\"$${shader}.spv\","
 }
+shaderTable += "const Shader shaders[] = {" $$shaderEntries "};"
+write_file($$OUT_PWD/shaders/shaders.inc, shaderTable)
+# Names only, embeddedshaders.h checks shader names against them at compile time
+write_file($$OUT_PWD/shaders/shaderNames.inc, shaderNames)
+INCLUDEPATH += $$OUT_PWD/shaders
@@ -1,23 +1,24 @@
 #include "anisotropy.h"
 #include <QCoreApplication>
 #include "src/Render/montecarlo.h"
+#include "src/Render/stagingring.h"
 
-Anisotropy::Anisotropy(VulkanWindow *window, MonteCarlo*& monteCarlo) : m_window(window), m_monteCarlo(monteCarlo) {
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+Anisotropy::Anisotropy(VulkanContext *context, MonteCarlo*& monteCarlo) : m_context(context), m_monteCarlo(monteCarlo) {
+    VkDevice dev = m_context->device();
+    m_devFuncs = m_context->deviceFunctions();
 
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = m_window->getComputeQueueFamilyIndex();
+    poolInfo.queueFamilyIndex = m_context->getComputeQueueFamilyIndex();
     if (m_devFuncs->vkCreateCommandPool(dev, &poolInfo, nullptr, &m_computeCommandPool) != VK_SUCCESS) {
-        m_window->crash("failed to create compute command pool!");
+        m_context->crash("failed to create compute command pool!");
     }
 
-    Texture tmp(QCoreApplication::applicationDirPath()+"/assets/textures/wave.png", m_window);
-    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    Texture tmp(QCoreApplication::applicationDirPath()+"/assets/textures/wave.png", m_context);
+    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
     m_anisoDir->blitTextureImage(tmp);
-    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
 
     createComputeUniformBuffer();
     createComputeDescriptorSet();
@@ -35,7 +36,7 @@ Anisotropy::~Anisotropy() {
     delete m_anisoDir;
     delete m_anisoMap;
 
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     if (m_computeCommandPool) {
         m_devFuncs->vkDestroyCommandPool(dev, m_computeCommandPool, nullptr);
@@ -92,10 +93,7 @@ Anisotropy::~Anisotropy() {
         m_computeUniformBuf = VK_NULL_HANDLE;
     }
 
-    if (m_computeUniformBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_computeUniformBufMem, nullptr);
-        m_computeUniformBufMem = VK_NULL_HANDLE;
-    }
+    m_context->getAllocator()->free(m_computeUniformBufMem);
 }
 
 Texture* Anisotropy::getMap() {
@@ -106,16 +104,18 @@ Texture* Anisotropy::getDir() {
     return m_anisoDir;
 }
 
+uint64_t Anisotropy::getRevision() {
+    return m_revision;
+}
+
 void Anisotropy::newAnisoDirTexture(uint32_t width, uint32_t heigth) {
     Texture *oldAnisoDir = m_anisoDir;
     Texture *oldAnisoMap = m_anisoMap;
-    m_anisoDir = new Texture(width, heigth, m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    m_anisoDir = new Texture(width, heigth, m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
     m_anisoDir->clear(1, 0.5, 0.5, 1.0);
-    m_anisoMap = new Texture(width, heigth, m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    m_anisoMap = new Texture(width, heigth, m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
     updateAnisotropyTextureDescriptor();
 
-    VkDevice dev = m_window->device();
-    m_devFuncs->vkDeviceWaitIdle(dev);
     delete oldAnisoDir;
     delete oldAnisoMap;
 }
@@ -126,14 +126,14 @@ void Anisotropy::setAnisoDirTexture(const QString &path) {
     Texture *oldAnisoMap = m_anisoMap;
 
     bool result = true;
-    Texture tmp(path, m_window, 1, true, false, false, VK_SAMPLE_COUNT_1_BIT, &result);
+    Texture tmp(path, m_context, 1, true, false, false, VK_SAMPLE_COUNT_1_BIT, &result);
     if (!result) {
         return;
     }
-    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
+    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
     m_anisoDir->blitTextureImage(tmp);
 
-    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
     updateAnisotropyTextureDescriptor();
     delete oldAnisoDir;
     delete oldAnisoMap;
@@ -144,14 +144,14 @@ void Anisotropy::setAnisoAngleTexture(const QString &path, bool half) {
     Texture *oldAnisoMap = m_anisoMap;
 
     bool result = true;
-    Texture tmp(path, m_window, 1, true, false, false, VK_SAMPLE_COUNT_1_BIT, &result);
+    Texture tmp(path, m_context, 1, true, false, false, VK_SAMPLE_COUNT_1_BIT, &result);
     if (!result) {
         return;
     }
-    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
+    m_anisoDir = new Texture(tmp.getWidth(), tmp.getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
     m_anisoDir->blitTextureImage(tmp);
 
-    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
+    m_anisoMap = new Texture(m_anisoDir->getWidth(), m_anisoDir->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true);
     convertAnisoAngleTexture(half);
     updateAnisotropyTextureDescriptor();
     delete oldAnisoDir;
@@ -159,7 +159,7 @@ void Anisotropy::setAnisoAngleTexture(const QString &path, bool half) {
 }
 
 void Anisotropy::updateAnisotropyTextureMap() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -186,16 +186,17 @@ void Anisotropy::updateAnisotropyTextureMap() {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_anisoMap->generateMipmaps();
+    m_revision++;
 
     if (m_monteCarlo) m_monteCarlo->clear();
 }
 
-void Anisotropy::saveZebra(const QString &path) {
-    VkDevice dev = m_window->device();
+void Anisotropy::saveZebra(const QString &path, Texture::ExportFormat format) {
+    VkDevice dev = m_context->device();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -222,33 +223,31 @@ void Anisotropy::saveZebra(const QString &path) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
 
-    Texture tmp(m_anisoMap->getWidth(), m_anisoMap->getHeight(),
-                m_window, 1, VK_FORMAT_R8G8B8A8_UNORM, true);
-    tmp.blitTextureImage(*m_anisoMap);
-    tmp.saveToPng(path);
+    // Block compressed files ship the mip chain, built from the exported values by the same blits as the renderer
+    if (format == Texture::Bc5 || format == Texture::Bc7) {
+        m_anisoMap->generateMipmaps();
+    }
+
+    // The map is read back as it is, the compute pass below overwrites it once the copy is done
+    m_context->getStagingRing()->wait(m_anisoMap->saveToFile(path, format));
 
     updateAnisotropyTextureMap();
 }
 
 void Anisotropy::setAnisoValues(float roughness, float anisotropy) {
-    VkDevice dev = m_window->device();
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, 2*sizeof(float), 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
     p[0] = roughness;
     p[1] = anisotropy;
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
 
     updateAnisotropyTextureMap();
 }
 
 void Anisotropy::convertAnisoAngleTexture(bool half) {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     VkDescriptorImageInfo imageInfo{};
     imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -264,7 +263,7 @@ void Anisotropy::convertAnisoAngleTexture(bool half) {
     descWrites.descriptorCount = 1;
     descWrites.pImageInfo = &imageInfo;
 
-    m_devFuncs->vkUpdateDescriptorSets(m_window->device(), 1, &descWrites, 0, nullptr);
+    m_devFuncs->vkUpdateDescriptorSets(m_context->device(), 1, &descWrites, 0, nullptr);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -291,7 +290,7 @@ void Anisotropy::convertAnisoAngleTexture(bool half) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -299,7 +298,7 @@ void Anisotropy::convertAnisoAngleTexture(bool half) {
 }
 
 void Anisotropy::updateAnisotropyTextureDescriptor() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
     imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -332,7 +331,7 @@ void Anisotropy::updateAnisotropyTextureDescriptor() {
 }
 
 void Anisotropy::createComputeDescriptorSet() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     // Set up descriptor set and its layout.
     std::array<VkDescriptorPoolSize, 3> poolSizes{};
@@ -352,7 +351,7 @@ void Anisotropy::createComputeDescriptorSet() {
 
     VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_computeDescPool);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor pool");
+        m_context->crash("Failed to create descriptor pool");
 
     VkDescriptorSetLayoutBinding uniformBinding = {
         0, // binding
@@ -394,7 +393,7 @@ void Anisotropy::createComputeDescriptorSet() {
 
     err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_computeDescSetLayout);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor set layout");
+        m_context->crash("Failed to create descriptor set layout");
 
     VkDescriptorSetAllocateInfo descSetAllocInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -406,7 +405,7 @@ void Anisotropy::createComputeDescriptorSet() {
 
     err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_computeDescSet);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate descriptor set");
+        m_context->crash("Failed to allocate descriptor set");
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
     imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -446,7 +445,7 @@ void Anisotropy::createComputeDescriptorSet() {
 }
 
 void Anisotropy::createComputePipelineLayout() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     VkPipelineLayoutCreateInfo m_computePipelineLayoutInfo{};
     m_computePipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -454,14 +453,13 @@ void Anisotropy::createComputePipelineLayout() {
     m_computePipelineLayoutInfo.pSetLayouts = &m_computeDescSetLayout;
 
     if (m_devFuncs->vkCreatePipelineLayout(dev, &m_computePipelineLayoutInfo, nullptr, &m_computePipelineLayout) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline layout!");
+        m_context->crash("failed to create compute pipeline layout!");
     }
 }
 
 void Anisotropy::createDir2CovPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/dir2cov_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("dir2cov_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -474,17 +472,16 @@ void Anisotropy::createDir2CovPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_dir2CovPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_dir2CovPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createDir2DirPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/dir2dir_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("dir2dir_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -497,17 +494,16 @@ void Anisotropy::createDir2DirPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_dir2DirPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_dir2DirPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createDir2ZebraPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/dir2zebra_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("dir2zebra_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -520,17 +516,16 @@ void Anisotropy::createDir2ZebraPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_dir2ZebraPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_dir2ZebraPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createExportPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/imageExporter_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("imageExporter_comp.spv"), true);
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -543,17 +538,16 @@ void Anisotropy::createExportPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_exportPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_exportPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createAngle2DirPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/imageImporter_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("imageImporter_comp.spv"), true);
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -566,17 +560,16 @@ void Anisotropy::createAngle2DirPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_angle2DirPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_angle2DirPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createHalfAngle2DirPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/half2dir_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("half2dir_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -589,50 +582,31 @@ void Anisotropy::createHalfAngle2DirPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_halfAngle2DirPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_halfAngle2DirPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Anisotropy::createComputeUniformBuffer() {
-    VkDevice dev = m_window->device();
-    const VkPhysicalDeviceLimits *pdevLimits = &m_window->physicalDeviceProperties()->limits;
+    VkDevice dev = m_context->device();
+    const VkPhysicalDeviceLimits *pdevLimits = &m_context->physicalDeviceProperties()->limits;
     const VkDeviceSize uniAlign = pdevLimits->minUniformBufferOffsetAlignment;
 
     VkBufferCreateInfo uniformBufInfo{};
     uniformBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    const VkDeviceSize uniformAllocSize = m_window->aligned(2*sizeof(float), uniAlign);
+    const VkDeviceSize uniformAllocSize = m_context->aligned(2*sizeof(float), uniAlign);
     uniformBufInfo.size = uniformAllocSize;
     uniformBufInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &uniformBufInfo, nullptr, &m_computeUniformBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
-
-    VkMemoryRequirements uniformMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_computeUniformBuf, &uniformMemReq);
-
-    VkMemoryAllocateInfo uniformMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        uniformMemReq.size,
-        m_window->findMemoryType(uniformMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &uniformMemAllocInfo, nullptr, &m_computeUniformBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
+        m_context->crash("Failed to create buffer");
 
-    err = m_devFuncs->vkBindBufferMemory(dev, m_computeUniformBuf, m_computeUniformBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
+    m_computeUniformBufMem = m_context->getAllocator()->allocateBuffer(m_computeUniformBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    float *p;
-    err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, uniformMemReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
 
     p[0] = 0.2; //roughness
     p[1] = 0.7; //anisotropy
@@ -640,11 +614,10 @@ void Anisotropy::createComputeUniformBuffer() {
     memset(&m_computeUniformBufInfo, 0, sizeof(m_computeUniformBufInfo));
     m_computeUniformBufInfo.buffer = m_computeUniformBuf;
     m_computeUniformBufInfo.range = uniformAllocSize;
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
 }
 
-void Anisotropy::saveAnisoAngle(const QString &path) {
-    VkDevice dev = m_window->device();
+void Anisotropy::saveAnisoAngle(const QString &path, Texture::ExportFormat format) {
+    VkDevice dev = m_context->device();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -671,20 +644,23 @@ void Anisotropy::saveAnisoAngle(const QString &path) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
 
-    Texture tmp(m_anisoMap->getWidth(), m_anisoMap->getHeight(),
-                m_window, 1, VK_FORMAT_R8G8B8A8_UNORM, true);
-    tmp.blitTextureImage(*m_anisoMap);
-    tmp.saveToPng(path);
+    // Block compressed files ship the mip chain, built from the exported values by the same blits as the renderer
+    if (format == Texture::Bc5 || format == Texture::Bc7) {
+        m_anisoMap->generateMipmaps();
+    }
+
+    // The map is read back as it is, the compute pass below overwrites it once the copy is done
+    m_context->getStagingRing()->wait(m_anisoMap->saveToFile(path, format));
 
     updateAnisotropyTextureMap();
 }
 
-void Anisotropy::saveAnisoDir(const QString &path) {
-    VkDevice dev = m_window->device();
+void Anisotropy::saveAnisoDir(const QString &path, Texture::ExportFormat format) {
+    VkDevice dev = m_context->device();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -711,14 +687,17 @@ void Anisotropy::saveAnisoDir(const QString &path) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
 
-    Texture tmp(m_anisoMap->getWidth(), m_anisoMap->getHeight(),
-                m_window, 1, VK_FORMAT_R8G8B8A8_UNORM, true);
-    tmp.blitTextureImage(*m_anisoMap);
-    tmp.saveToPng(path);
+    // Block compressed files ship the mip chain, built from the exported values by the same blits as the renderer
+    if (format == Texture::Bc5 || format == Texture::Bc7) {
+        m_anisoMap->generateMipmaps();
+    }
+
+    // The map is read back as it is, the compute pass below overwrites it once the copy is done
+    m_context->getStagingRing()->wait(m_anisoMap->saveToFile(path, format));
 
     updateAnisotropyTextureMap();
 }
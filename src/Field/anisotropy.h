@@ -1,11 +1,11 @@
 #pragma once
-#include "src/UI/vulkanwindow.h"
+#include "src/Render/vulkancontext.h"
 #include "src/Texture/texture.h"
 class MonteCarloReference;
 
 class Anisotropy {
 public:
-    Anisotropy(VulkanWindow *window, MonteCarlo*& monteCarlo);
+    Anisotropy(VulkanContext *context, MonteCarlo*& monteCarlo);
     ~Anisotropy();
 
     Anisotropy(const Anisotropy&) = delete;
@@ -15,15 +15,17 @@ public:
 
     Texture* getDir();
     Texture* getMap();
+    // Bumped by every rebuild of the map, views cached from the field compare it to know they are stale
+    uint64_t getRevision();
 
     void newAnisoDirTexture(uint32_t width, uint32_t heigth);
     void setAnisoDirTexture(const QString &path);
     void setAnisoAngleTexture(const QString &path, bool half);
     void updateAnisotropyTextureMap();
     void setAnisoValues(float roughness, float anisotropy);
-    void saveZebra(const QString &path);
-    void saveAnisoDir(const QString &path);
-    void saveAnisoAngle(const QString &path);
+    void saveZebra(const QString &path, Texture::ExportFormat format = Texture::Png8);
+    void saveAnisoDir(const QString &path, Texture::ExportFormat format = Texture::Png8);
+    void saveAnisoAngle(const QString &path, Texture::ExportFormat format = Texture::Png8);
 
 private:
     void createComputePipelineLayout();
@@ -39,8 +41,8 @@ private:
     void updateAnisotropyTextureDescriptor();
     void convertAnisoAngleTexture(bool half);
 
-    VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
 
     VkCommandPool m_computeCommandPool = VK_NULL_HANDLE;
 
@@ -56,12 +58,13 @@ private:
     VkDescriptorPool m_computeDescPool = VK_NULL_HANDLE;
     VkDescriptorSetLayout m_computeDescSetLayout = VK_NULL_HANDLE;
 
-    VkDeviceMemory m_computeUniformBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_computeUniformBufMem;
     VkBuffer m_computeUniformBuf = VK_NULL_HANDLE;
     VkDescriptorBufferInfo m_computeUniformBufInfo;
 
     Texture* m_anisoMap = nullptr;
     Texture* m_anisoDir = nullptr;
+    uint64_t m_revision = 0;
     MonteCarlo*& m_monteCarlo;
 };
 
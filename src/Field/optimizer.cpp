@@ -1,24 +1,25 @@
 #include "optimizer.h"
-#include <QCoreApplication>
+#include "src/UI/vulkanwindow.h"
 #include <QDateTime>
 #include <fstream>
 #include <iostream>
 
-Optimizer::Optimizer(VulkanWindow *window, Anisotropy *anisotropy) : m_window(window), m_anisotropy(anisotropy) {
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+Optimizer::Optimizer(VulkanContext *context, Anisotropy *anisotropy, Render *render, VulkanWindow *window)
+    : m_context(context), m_window(window), m_render(render), m_anisotropy(anisotropy) {
+    VkDevice dev = m_context->device();
+    m_devFuncs = m_context->deviceFunctions();
 
-    m_buffer[0] = new Texture(anisotropy->getDir()->getWidth(), anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, false, true);
-    m_buffer[1] = new Texture(anisotropy->getDir()->getWidth(), anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
-    m_depth = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
-    m_frameImage = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, true, true);
+    m_buffer[0] = new Texture(anisotropy->getDir()->getWidth(), anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, false, true);
+    m_buffer[1] = new Texture(anisotropy->getDir()->getWidth(), anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
+    m_depth = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
+    m_frameImage = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, true, true);
 
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = m_window->getComputeQueueFamilyIndex();
+    poolInfo.queueFamilyIndex = m_context->getComputeQueueFamilyIndex();
     if (m_devFuncs->vkCreateCommandPool(dev, &poolInfo, nullptr, &m_computeCommandPool) != VK_SUCCESS) {
-        m_window->crash("failed to create compute command pool!");
+        m_context->crash("failed to create compute command pool!");
     }
 
     createComputeUniformBuffer();
@@ -48,14 +49,14 @@ Optimizer::Optimizer(VulkanWindow *window, Anisotropy *anisotropy) : m_window(wi
     framebufferInfo.height =  m_frameImage->getHeight();
     framebufferInfo.layers = 1;
 
-    m_devFuncs->vkCreateFramebuffer(m_window->device(), &framebufferInfo, NULL, &m_frameBuffer);
+    m_devFuncs->vkCreateFramebuffer(m_context->device(), &framebufferInfo, NULL, &m_frameBuffer);
 
-    m_listWidget = m_window->getConstraintWidgetList();
+    m_listWidget = m_window ? m_window->getConstraintWidgetList() : nullptr;
     commitChange();
 }
 
 Optimizer::~Optimizer() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     delete m_buffer[0];
     delete m_buffer[1];
@@ -91,10 +92,6 @@ Optimizer::~Optimizer() {
         m_devFuncs->vkDestroyPipeline(dev, m_linePipeline, nullptr);
     }
 
-    if (m_pipelineCache) {
-        m_devFuncs->vkDestroyPipelineCache(dev, m_pipelineCache, nullptr);
-    }
-
     if (m_computePipelineLayout) {
         m_devFuncs->vkDestroyPipelineLayout(dev, m_computePipelineLayout, nullptr);
     }
@@ -119,9 +116,7 @@ Optimizer::~Optimizer() {
         m_devFuncs->vkDestroyBuffer(dev, m_computeUniformBuf, nullptr);
     }
 
-    if (m_computeUniformBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_computeUniformBufMem, nullptr);
-    }
+    m_context->getAllocator()->free(m_computeUniformBufMem);
 
     if (m_renderPass) {
         m_devFuncs->vkDestroyRenderPass(dev, m_renderPass, nullptr);
@@ -135,13 +130,11 @@ Optimizer::~Optimizer() {
         m_devFuncs->vkDestroyBuffer(dev, m_meshBuf, nullptr);
     }
 
-    if (m_meshBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_meshBufMem, nullptr);
-    }
+    m_context->getAllocator()->free(m_meshBufMem);
 }
 
 void Optimizer::createComputeDescriptorSet() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     // Set up descriptor set and its layout.
     std::array<VkDescriptorPoolSize, 3> poolSizes{};
@@ -161,7 +154,7 @@ void Optimizer::createComputeDescriptorSet() {
 
     VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_computeDescPool);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor pool");
+        m_context->crash("Failed to create descriptor pool");
 
     VkDescriptorSetLayoutBinding uniformBinding = {
         0, // binding
@@ -193,7 +186,7 @@ void Optimizer::createComputeDescriptorSet() {
 
     err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo0, nullptr, &m_computeDescSetLayout[0]);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor set layout");
+        m_context->crash("Failed to create descriptor set layout");
 
     VkDescriptorSetLayoutCreateInfo descLayoutInfo1{};
     std::array<VkDescriptorBindingFlags, 2> flags{VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT, VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT};
@@ -212,7 +205,7 @@ void Optimizer::createComputeDescriptorSet() {
 
     err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo1, nullptr, &m_computeDescSetLayout[1]);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor set layout");
+        m_context->crash("Failed to create descriptor set layout");
 
     VkDescriptorSetAllocateInfo descSetAllocInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -224,7 +217,7 @@ void Optimizer::createComputeDescriptorSet() {
 
     err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, m_computeDescSet);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate descriptor set");
+        m_context->crash("Failed to allocate descriptor set");
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
     imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -263,15 +256,9 @@ void Optimizer::createComputeDescriptorSet() {
 }
 
 void Optimizer::createPipelineLayout() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
-    // Pipeline cache
-    VkPipelineCacheCreateInfo pipelineCacheInfo;
-    memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
-    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VkResult err = m_devFuncs->vkCreatePipelineCache(dev, &pipelineCacheInfo, nullptr, &m_pipelineCache);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to create pipeline cache");
+    m_pipelineCache = m_context->getPipelineCache();
 
     // Pipeline layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo;
@@ -279,13 +266,13 @@ void Optimizer::createPipelineLayout() {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 2;
     pipelineLayoutInfo.pSetLayouts = m_computeDescSetLayout;
-    err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+    VkResult err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create pipeline layout");
+        m_context->crash("Failed to create pipeline layout");
 }
 
 void Optimizer::createComputePipelineLayout() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     VkPipelineLayoutCreateInfo m_computePipelineLayoutInfo{};
     m_computePipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -293,59 +280,38 @@ void Optimizer::createComputePipelineLayout() {
     m_computePipelineLayoutInfo.pSetLayouts = m_computeDescSetLayout;
 
     if (m_devFuncs->vkCreatePipelineLayout(dev, &m_computePipelineLayoutInfo, nullptr, &m_computePipelineLayout) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline layout!");
+        m_context->crash("failed to create compute pipeline layout!");
     }
 }
 
 void Optimizer::createComputeUniformBuffer() {
-    VkDevice dev = m_window->device();
-    const VkPhysicalDeviceLimits *pdevLimits = &m_window->physicalDeviceProperties()->limits;
+    VkDevice dev = m_context->device();
+    const VkPhysicalDeviceLimits *pdevLimits = &m_context->physicalDeviceProperties()->limits;
     const VkDeviceSize uniAlign = pdevLimits->minUniformBufferOffsetAlignment;
 
     VkBufferCreateInfo uniformBufInfo{};
     uniformBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    const VkDeviceSize uniformAllocSize = m_window->aligned(18*sizeof(float), uniAlign);
+    const VkDeviceSize uniformAllocSize = m_context->aligned(18*sizeof(float), uniAlign);
     m_dynamicAlignment = uniformAllocSize;
     uniformBufInfo.size = MAX_CONSTRAINTS * uniformAllocSize;
     uniformBufInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &uniformBufInfo, nullptr, &m_computeUniformBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
-
-    VkMemoryRequirements uniformMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_computeUniformBuf, &uniformMemReq);
-
-    VkMemoryAllocateInfo uniformMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        uniformMemReq.size,
-        m_window->findMemoryType(uniformMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &uniformMemAllocInfo, nullptr, &m_computeUniformBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
+        m_context->crash("Failed to create buffer");
 
-    err = m_devFuncs->vkBindBufferMemory(dev, m_computeUniformBuf, m_computeUniformBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
+    m_computeUniformBufMem = m_context->getAllocator()->allocateBuffer(m_computeUniformBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    float *p;
-    err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, uniformMemReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
 
     memset(&m_computeUniformBufInfo, 0, sizeof(m_computeUniformBufInfo));
     m_computeUniformBufInfo.buffer = m_computeUniformBuf;
     m_computeUniformBufInfo.range = uniformAllocSize;
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
 }
 
 void Optimizer::createOptimizeSmoothPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/smooth_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("smooth_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -358,17 +324,16 @@ void Optimizer::createOptimizeSmoothPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_optimizeSmoothPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_optimizeSmoothPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Optimizer::createOptimizeRestrictPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/restrict_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("restrict_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -381,25 +346,21 @@ void Optimizer::createOptimizeRestrictPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_optimizeRestrictPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_optimizeRestrictPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Optimizer::createLinePipeline() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/init_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/init_frag.spv");
-    VkShaderModule controlShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/init_tesc.spv");
-    VkShaderModule evaluationShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                   "/assets/shaders/init_tese.spv");
+    VkShaderModule vertShaderModule = m_context->createShader(SHADER("init_vert.spv"));
+    VkShaderModule fragShaderModule = m_context->createShader(SHADER("init_frag.spv"));
+    VkShaderModule controlShaderModule = m_context->createShader(SHADER("init_tesc.spv"));
+    VkShaderModule evaluationShaderModule = m_context->createShader(SHADER("init_tese.spv"));
 
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
@@ -532,7 +493,7 @@ void Optimizer::createLinePipeline() {
 
     VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_linePipeline);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create graphics pipeline");
+        m_context->crash("Failed to create graphics pipeline");
 
     if (vertShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, vertShaderModule, nullptr);
@@ -545,9 +506,8 @@ void Optimizer::createLinePipeline() {
 }
 
 void Optimizer::createOptimizeProlongPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/prolong_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("prolong_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -560,17 +520,16 @@ void Optimizer::createOptimizeProlongPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_optimizeProlongPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_optimizeProlongPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Optimizer::createOptimizeInitPipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/init_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("init_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -583,17 +542,16 @@ void Optimizer::createOptimizeInitPipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_optimizeInitPipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_optimizeInitPipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Optimizer::createOptimizeFinalizePipeline() {
-    VkDevice dev = m_window->device();
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/finalize_comp.spv");
+    VkDevice dev = m_context->device();
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("finalize_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -606,15 +564,15 @@ void Optimizer::createOptimizeFinalizePipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (m_devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_optimizeFinalizePipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_optimizeFinalizePipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
 void Optimizer::optimizeInitTexture() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
     imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -668,7 +626,7 @@ void Optimizer::optimizeInitTexture() {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -676,7 +634,7 @@ void Optimizer::optimizeInitTexture() {
 
 
 void Optimizer::optimizeFinalize() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
     imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -730,7 +688,7 @@ void Optimizer::optimizeFinalize() {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -740,7 +698,7 @@ void Optimizer::optimizeFinalize() {
 }
 
 void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkImageView, 2> imageView;
     std::array<VkImageViewCreateInfo, 2> viewInfo{};
@@ -765,11 +723,11 @@ void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
     viewInfo[1].subresourceRange.layerCount = 1;
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[0], nullptr, &imageView[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[1], nullptr, &imageView[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
@@ -813,10 +771,7 @@ void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
 
     m_devFuncs->vkBeginCommandBuffer(commandBuffer, &beginInfo);
     m_devFuncs->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_optimizeSmoothPipeline);
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, MAX_CONSTRAINTS*m_dynamicAlignment, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
 
     for (uint32_t i = 0; i < iterations; i++) {
         float *curr = p + m_dynamicAlignment/4 * i;
@@ -850,7 +805,6 @@ void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
         m_devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
     }
 
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
     m_devFuncs->vkEndCommandBuffer(commandBuffer);
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -858,7 +812,7 @@ void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -868,7 +822,7 @@ void Optimizer::optimizeSmooth(uint32_t targetLod, uint32_t iterations) {
 }
 
 void Optimizer::optimizeRestrict(uint32_t destLod) {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkImageView, 2> imageView;
     std::array<VkImageViewCreateInfo, 2> viewInfo{};
@@ -893,11 +847,11 @@ void Optimizer::optimizeRestrict(uint32_t destLod) {
     viewInfo[1].subresourceRange.layerCount = 1;
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[0], nullptr, &imageView[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[1], nullptr, &imageView[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
@@ -944,12 +898,8 @@ void Optimizer::optimizeRestrict(uint32_t destLod) {
     uint32_t dynamicOffset = 0;
     m_devFuncs->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_computePipelineLayout, 0, 2, m_computeDescSet, 1, &dynamicOffset);
 
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, MAX_CONSTRAINTS*m_dynamicAlignment, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
     p[7] = m_optimizationMethod;
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
 
     m_devFuncs->vkCmdDispatch(commandBuffer, ceil((m_buffer[0]->getWidth() >> destLod)/16.0), ceil((m_buffer[0]->getHeight() >> destLod)/16.0), 1);
     m_devFuncs->vkEndCommandBuffer(commandBuffer);
@@ -960,7 +910,7 @@ void Optimizer::optimizeRestrict(uint32_t destLod) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -970,7 +920,7 @@ void Optimizer::optimizeRestrict(uint32_t destLod) {
 }
 
 void Optimizer::optimizeProlong(uint32_t destLod) {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     std::array<VkImageView, 2> imageView;
     std::array<VkImageViewCreateInfo, 2> viewInfo{};
@@ -995,11 +945,11 @@ void Optimizer::optimizeProlong(uint32_t destLod) {
     viewInfo[1].subresourceRange.layerCount = 1;
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[0], nullptr, &imageView[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     if (m_devFuncs->vkCreateImageView(dev, &viewInfo[1], nullptr, &imageView[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     std::array<VkDescriptorImageInfo, 2> imageInfo{};
@@ -1054,7 +1004,7 @@ void Optimizer::optimizeProlong(uint32_t destLod) {
     submitInfo.pCommandBuffers = &commandBuffer;
 
     VkQueue computeQueue;
-    m_devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    m_devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
     m_devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
     m_devFuncs->vkQueueWaitIdle(computeQueue);
     m_devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
@@ -1073,12 +1023,12 @@ void Optimizer::optimize(uint32_t iteration) {
         delete m_buffer[1];
         delete m_depth;
         delete m_frameImage;
-        m_buffer[0] = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
-        m_buffer[1] = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
-        m_frameImage = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, true, true);
-        m_depth = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_window, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
+        m_buffer[0] = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
+        m_buffer[1] = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true);
+        m_frameImage = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT , true, true, true);
+        m_depth = new Texture(m_anisotropy->getDir()->getWidth(), m_anisotropy->getDir()->getHeight(), m_context, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
 
-        m_devFuncs->vkDestroyFramebuffer(m_window->device(), m_frameBuffer, nullptr);
+        m_devFuncs->vkDestroyFramebuffer(m_context->device(), m_frameBuffer, nullptr);
         std::array<VkImageView, 2> attachments = {
             m_frameImage->getImageView(),
             m_depth->getImageView()
@@ -1093,7 +1043,7 @@ void Optimizer::optimize(uint32_t iteration) {
         framebufferInfo.height =  m_frameImage->getHeight();
         framebufferInfo.layers = 1;
 
-        m_devFuncs->vkCreateFramebuffer(m_window->device(), &framebufferInfo, NULL, &m_frameBuffer);
+        m_devFuncs->vkCreateFramebuffer(m_context->device(), &framebufferInfo, NULL, &m_frameBuffer);
     }
 
     if (m_constraints.empty() && m_directionBackup) {
@@ -1115,7 +1065,7 @@ void Optimizer::optimize(uint32_t iteration) {
 }
 
 void Optimizer::createRenderPass() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     // Renderpass
     VkAttachmentDescription colorAttachment{};
@@ -1181,7 +1131,7 @@ void Optimizer::createRenderPass() {
     renderPassInfo.pDependencies = dependencies;
 
     if (m_devFuncs->vkCreateRenderPass(dev, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
-        m_window->crash("failed to create render pass!");
+        m_context->crash("failed to create render pass!");
     }
 }
 
@@ -1224,12 +1174,12 @@ void Optimizer::load(const QString &path) {
 
     uint32_t width = ((uint32_t *)buffer.data())[1];
     uint32_t height = ((uint32_t *)buffer.data())[2];
-    m_window->getRender()->newAnisoDirTexture(width, height);
+    m_render->newAnisoDirTexture(width, height);
 
     m_changesQueue.clear();
     m_currChange = 0;
     m_constraints.clear();
-    m_listWidget->clear();
+    if (m_listWidget) m_listWidget->clear();
 
     uint32_t constraintCount = ((uint32_t *)buffer.data())[3];
     char *curr = (char*)(buffer.data()+4*sizeof(uint32_t));
@@ -1247,8 +1197,9 @@ void Optimizer::load(const QString &path) {
         }
         m_maxId = std::max(m_maxId, constraint.id);
         m_constraints.push_back(constraint);
-        new QListWidgetItem((lineCount ? "Line " : constraint.tesselationLod == 1 ? "Rectangle " : "Ellipse ")+QString::number(constraint.id), m_listWidget);
+        if (m_listWidget) new QListWidgetItem((lineCount ? "Line " : constraint.tesselationLod == 1 ? "Rectangle " : "Ellipse ")+QString::number(constraint.id), m_listWidget);
     }
+    m_revision++;
 #if defined(__GNUC__) && !defined(__INTEL_COMPILER) && (((__GNUC__ * 100) + __GNUC_MINOR__) >= 800)
 #pragma GCC diagnostic pop
 #endif
@@ -1262,6 +1213,7 @@ void Optimizer::addRectangle(float x0, float y0, float x1, float y1) {
 
     m_constraints.push_back({(x0+x1)/2, 1.0f-(y0+y1)/2, abs(x0-x1), abs(y0-y1), 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, ++m_maxId, std::vector<Constraint::Line>()});
     new QListWidgetItem("Rectangle "+QString::number(m_maxId), m_listWidget);
+    m_revision++;
     optimize(m_iteration);
     commitChange();
 }
@@ -1272,6 +1224,7 @@ void Optimizer::addEllipse(float x0, float y0, float x1, float y1) {
 
     m_constraints.push_back({(x0+x1)/2, 1.0f-(y0+y1)/2, abs(x0-x1), abs(y0-y1), 1, 0, 0, 0, 0, 0, 0, 1, 1, 32, 1, ++m_maxId, std::vector<Constraint::Line>()});
     new QListWidgetItem("Ellipse "+QString::number(m_maxId), m_listWidget);
+    m_revision++;
     optimize(m_iteration);
     commitChange();
 }
@@ -1290,6 +1243,7 @@ void Optimizer::addLine(const std::vector<std::array<float, 2>> &pointList) {
 
     m_constraints.push_back({(x0+x1)/2, 1.0f-(y0+y1)/2, 1, 1, 1, 0, 0, 0, 0, (x0+x1)/2, 1.0f-(y0+y1)/2, abs(x0-x1), abs(y0-y1), 1, 0, ++m_maxId, std::move(lines)});
     new QListWidgetItem("Line "+QString::number(m_maxId), m_listWidget);
+    m_revision++;
     optimize(m_iteration);
     commitChange();
 }
@@ -1305,6 +1259,7 @@ void Optimizer::clear() {
     m_constraints.clear();
     m_listWidget->clear();
     m_maxId = 0;
+    m_revision++;
 
     optimize(m_iteration);
     commitChange();
@@ -1391,6 +1346,7 @@ void Optimizer::movePoint(uint32_t id, uint32_t offset, float x, float y) {
     }
 
     recreateLineAABB(rect);
+    m_revision++;
 
     if (m_window->getOptimizeOnMove()) {
         optimize(m_iterationOnMove);
@@ -1407,12 +1363,14 @@ void Optimizer::addPoint(uint32_t id, uint32_t offset, float x, float y) {
     rect.lines.insert(rect.lines.begin()+offset+1, line);
 
     recreateLineAABB(rect);
+    m_revision++;
     commitChange();
 }
 
 
 void Optimizer::duplicateRectangle(uint32_t id) {
     m_constraints.push_back(m_constraints[id]);
+    m_revision++;
     new QListWidgetItem((m_constraints[id].tesselationLod > 1 ? "Ellipse " : m_constraints[id].lines.empty() ? "Rectangle " : "Line ")+QString::number(++m_maxId), m_listWidget);
     commitChange();
 }
@@ -1420,6 +1378,7 @@ void Optimizer::duplicateRectangle(uint32_t id) {
 void Optimizer::rotateRectangle(uint32_t id, float angle, bool opt) {
     if (fabs(m_constraints[id].rotAngle-fmod(angle+M_PI, 2*M_PI)+M_PI) > 0.001) {
         m_constraints[id].rotAngle = angle - 2*M_PI * floor((angle+M_PI)/2/M_PI);
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1432,6 +1391,7 @@ void Optimizer::rotateRectangle(uint32_t id, float angle, bool opt) {
 void Optimizer::setAlignPhase(uint32_t id, bool val) {
     if (m_constraints[id].alignPhases != val) {
         m_constraints[id].alignPhases = val;
+        m_revision++;
         optimize(m_iteration);
         commitChange();
     }
@@ -1440,6 +1400,7 @@ void Optimizer::setAlignPhase(uint32_t id, bool val) {
 void Optimizer::moveRectangleX(uint32_t id, float x, bool opt) {
     if (fabs(m_constraints[id].centerX - x) > 0.001) {
         m_constraints[id].centerX = x;
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1452,6 +1413,7 @@ void Optimizer::moveRectangleX(uint32_t id, float x, bool opt) {
 void Optimizer::moveRectangleY(uint32_t id, float y, bool opt) {
     if (fabs(m_constraints[id].centerY - y) > 0.001) {
         m_constraints[id].centerY = y;
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1464,6 +1426,7 @@ void Optimizer::moveRectangleY(uint32_t id, float y, bool opt) {
 void Optimizer::scaleRectangleX(uint32_t id, float x, bool opt) {
     if (fabs(m_constraints[id].width - x) > 0.001) {
         m_constraints[id].width = x;
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1476,6 +1439,7 @@ void Optimizer::scaleRectangleX(uint32_t id, float x, bool opt) {
 void Optimizer::scaleRectangleY(uint32_t id, float y, bool opt) {
     if (fabs(m_constraints[id].height - y) > 0.001) {
         m_constraints[id].height = y;
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1488,6 +1452,7 @@ void Optimizer::scaleRectangleY(uint32_t id, float y, bool opt) {
 void Optimizer::skewRectangleX(uint32_t id, float x) {
     if (fabs(m_constraints[id].skewH - x) > 0.001) {
         m_constraints[id].skewH = x;
+        m_revision++;
         optimize(m_iteration);
         commitChange();
     }
@@ -1496,6 +1461,7 @@ void Optimizer::skewRectangleX(uint32_t id, float x) {
 void Optimizer::skewRectangleY(uint32_t id, float y) {
     if (fabs(m_constraints[id].skewV - y) > 0.001) {
         m_constraints[id].skewV = y;
+        m_revision++;
         optimize(m_iteration);
         commitChange();
     }
@@ -1505,6 +1471,7 @@ void Optimizer::fillRectangle(uint32_t id, float angle, bool opt) {
     if (fabs(m_constraints[id].dirX - cos(angle)) > 0.001 && fabs(m_constraints[id].dirY - cos(angle)) > 0.001) {
         m_constraints[id].dirX = cos(angle);
         m_constraints[id].dirY = sin(angle);
+        m_revision++;
         if (opt) {
             optimize(m_iteration);
             commitChange();
@@ -1521,6 +1488,7 @@ void Optimizer::removeRectangle(uint32_t id) {
             m_maxId--;
         }
         m_constraints.erase(m_constraints.begin()+id);
+        m_revision++;
         optimize(m_iteration);
         commitChange();
     }
@@ -1530,15 +1498,19 @@ const std::vector<Optimizer::Constraint>& Optimizer::getConstraints() {
     return m_constraints;
 }
 
+uint64_t Optimizer::getRevision() {
+    return m_revision;
+}
+
 void Optimizer::optimizeInit() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
     m_frameImage->clear(0, 0, 0, 0);
 
     uint32_t drawn = 0;
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
+    allocInfo.commandPool = m_context->graphicsCommandPool();
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer cb;
@@ -1587,10 +1559,7 @@ void Optimizer::optimizeInit() {
     m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
 
     m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_linePipeline);
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_computeUniformBufMem, 0, MAX_CONSTRAINTS*m_dynamicAlignment, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    float *p = static_cast<float *>(m_computeUniformBufMem.mapped);
 
     static const VkDeviceSize zero = 0;
     m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_meshBuf, &zero);
@@ -1651,7 +1620,6 @@ void Optimizer::optimizeInit() {
             }
         }
     }
-    m_devFuncs->vkUnmapMemory(dev, m_computeUniformBufMem);
 
     m_devFuncs->vkCmdEndRenderPass(cb);
     m_devFuncs->vkEndCommandBuffer(cb);
@@ -1661,14 +1629,14 @@ void Optimizer::optimizeInit() {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &cb;
 
-    m_devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-    m_devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-    m_devFuncs->vkFreeCommandBuffers(dev, m_window->graphicsCommandPool(), 1, &cb);
+    m_devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+    m_devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+    m_devFuncs->vkFreeCommandBuffers(dev, m_context->graphicsCommandPool(), 1, &cb);
     m_buffer[0]->blitTextureImage(*m_frameImage);
 }
 
 void Optimizer::createMeshData() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     float data[] = {-1.0, -1.0, 0.0, 1.0,
                     -1.0, 1.0, 0.0, 1.0,
@@ -1690,33 +1658,13 @@ void Optimizer::createMeshData() {
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &meshBufInfo, nullptr, &m_meshBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
+        m_context->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_meshBuf, &meshMemReq);
+    m_meshBufMem = m_context->getAllocator()->allocateBuffer(m_meshBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_meshBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_meshBuf, m_meshBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    void *p;
-    err = m_devFuncs->vkMapMemory(dev, m_meshBufMem, 0, meshMemReq.size, 0, &p);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    void *p = m_meshBufMem.mapped;
 
     memcpy(p, data, sizeof(data));
-    m_devFuncs->vkUnmapMemory(dev, m_meshBufMem);
 }
 
 bool Optimizer::canUndo() {
@@ -1738,7 +1686,7 @@ void Optimizer::commitChange() {
 
     m_changesQueue.push_back(m_constraints);
     m_currChange = m_changesQueue.size();
-    m_window->dirtyUndoMenu();
+    if (m_window) m_window->dirtyUndoMenu();
 }
 
 void Optimizer::revertChange() {
@@ -1751,9 +1699,10 @@ void Optimizer::revertChange() {
             new QListWidgetItem((rect.tesselationLod > 1 ? "Ellipse " : rect.lines.empty() ? "Rectangle " : "Line ")+QString::number(rect.id), m_listWidget);
             m_maxId = std::max(rect.id, m_maxId);
         }
+        m_revision++;
         optimize(m_iteration);
     }
-    m_window->dirtyUndoMenu();
+    if (m_window) m_window->dirtyUndoMenu();
 }
 
 void Optimizer::redoChange() {
@@ -1766,9 +1715,10 @@ void Optimizer::redoChange() {
             new QListWidgetItem((rect.tesselationLod > 1 ? "Ellipse " : rect.lines.empty() ? "Rectangle " : "Line ")+QString::number(rect.id), m_listWidget);
             m_maxId = std::max(rect.id, m_maxId);
         }
+        m_revision++;
         optimize(m_iteration);
     }
-    m_window->dirtyUndoMenu();
+    if (m_window) m_window->dirtyUndoMenu();
 }
 
 void Optimizer::setIteration(uint32_t val) {
@@ -1,13 +1,16 @@
 #pragma once
-#include "src/UI/vulkanwindow.h"
+#include "src/Render/vulkancontext.h"
 #include "src/Texture/texture.h"
 #include "src/Field/anisotropy.h"
 #include <QListWidget>
 #include <deque>
 
+class Render;
+class VulkanWindow;
+
 class Optimizer {
 public:
-    Optimizer(VulkanWindow *window, Anisotropy *anisotropy);
+    Optimizer(VulkanContext *context, Anisotropy *anisotropy, Render *render, VulkanWindow *window = nullptr);
     ~Optimizer();
 
     void addRectangle(float x0, float y0, float x1, float y1);
@@ -61,6 +64,8 @@ public:
     };
 
     const std::vector<Constraint>& getConstraints();
+    // Bumped on every edit of the constraint list, lets the overlay skip re-uploading unchanged data
+    uint64_t getRevision();
 
     void optimize();
     bool canUndo();
@@ -103,8 +108,11 @@ private:
     void bakeLine(Constraint &rect);
     void recreateLineAABB(Constraint &rect);
 
+    VulkanContext *m_context;
+    // Null in batch rendering, which only loads projects
     VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    Render *m_render;
+    VulkanDeviceFunctions *m_devFuncs;
 
     VkCommandPool m_computeCommandPool = VK_NULL_HANDLE;
 
@@ -115,7 +123,7 @@ private:
     VkPipeline m_optimizeRestrictPipeline = VK_NULL_HANDLE;
     VkPipeline m_optimizeInitPipeline = VK_NULL_HANDLE;
 
-    VkDeviceMemory m_computeUniformBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_computeUniformBufMem;
     VkBuffer m_computeUniformBuf = VK_NULL_HANDLE;
     VkDescriptorBufferInfo m_computeUniformBufInfo;
 
@@ -130,7 +138,7 @@ private:
     Texture *m_depth = nullptr;
     Texture *m_frameImage = nullptr;
 
-    VkDeviceMemory m_meshBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_meshBufMem;
     VkBuffer m_meshBuf = VK_NULL_HANDLE;
 
     VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
@@ -157,4 +165,5 @@ private:
     float m_angleOffset = 0;
 
     uint32_t m_maxId = 0;
+    uint64_t m_revision = 0;
 };
@@ -1,6 +1,7 @@
 #version 440
 layout(binding = 1) uniform sampler2D anisoMap;
 layout(binding = 3) uniform samplerCube cubeMap;
+layout(binding = 6) uniform sampler2D brdfLut;
 
 layout(location = 0) in vec3 i_worldPos;
 layout(location = 1) in vec2 i_texCoord;
@@ -18,12 +19,23 @@ layout(std140, binding = 0) uniform buf {
     float uvMode;
     float monteCarlo;
     float exposure;
+    vec4 sh[9];
 } u;
 
 layout(location = 0) out vec4 fragColor;
 
 const float PI = 3.14159265359;
 
+// Irradiance from the nine spherical harmonics coefficients of the environment, already convolved
+vec3 irradiance(vec3 n)
+{
+    return max(u.sh[0].rgb*0.282095
+             + (u.sh[1].rgb*n.y + u.sh[2].rgb*n.z + u.sh[3].rgb*n.x)*0.488603
+             + (u.sh[4].rgb*n.x*n.y + u.sh[5].rgb*n.y*n.z + u.sh[7].rgb*n.x*n.z)*1.092548
+             + u.sh[6].rgb*0.315392*(3*n.z*n.z - 1)
+             + u.sh[8].rgb*0.546274*(n.x*n.x - n.y*n.y), 0.0);
+}
+
 vec4 textureNoFiltering(sampler2D tex, vec2 coord)
 {
     vec2 texSize = textureSize(tex, 0);
@@ -74,6 +86,13 @@ vec3 sampleGGXVNDF(vec3 Ve, float alpha_x, float alpha_y, float U1, float U2)
     return Ne;
 }
 
+// Scale and bias of F0 for the directional albedo of the specular lobe, baked by brdfLut.comp
+vec2 specularAlbedo(float NoV, float rough)
+{
+    vec2 size = textureSize(brdfLut, 0);
+    return textureLod(brdfLut, (clamp(vec2(NoV, rough), 0, 1)*(size-1)+0.5)/size, 0).rg;
+}
+
 vec3 fresnelSchlick(float cosTheta, vec3 F0)
 {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
@@ -100,7 +119,6 @@ void main()
     float G1V = 1.0/(1.0+LV);
 
     const uint N = 16;
-    vec3 Ftot = vec3(0);
     for (uint i = 0; i < N; i++) {
         float tmp = random(rand);
         rand = random(tmp);
@@ -113,12 +131,13 @@ void main()
         float LL = (-1 + sqrt(1 + (lvt.x+lvt.y)/lvt.z))*0.5;
         float G2 = 1.0/(1.0+LV+LL);
         vec3 F = fresnelSchlick(dot(wo, wm), mix(vec3(0.04), u.albedo, u.metallic));
-        Ftot += F;
         monteCarloIBL += F*Li*G2/G1V;
     }
 
+    // The estimate above stays the reference, the lookup only gives the energy left to the diffuse term
     vec3 res = monteCarloIBL/N;
-    res += (1-Ftot/N)*u.albedo/PI * textureLod(cubeMap, reflect(-view, i_TBN[2]), log2(textureSize(cubeMap, 0).x)).rgb;
+    vec2 dfg = specularAlbedo(wo.z, sqrt(0.5*(alpha.x+alpha.y)));
+    res += (1-mix(vec3(0.04), u.albedo, u.metallic)*dfg.x-dfg.y)*u.albedo/PI * irradiance(i_TBN[2]);
 
     // Tonemapping
     float luma = dot(res, vec3(0.212671, 0.715160, 0.072169));
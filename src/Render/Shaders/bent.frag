@@ -18,12 +18,23 @@ layout(std140, binding = 0) uniform buf {
     float sampleCount;
     float unused5;
     float exposure;
+    vec4 sh[9];
 } u;
 
 layout(location = 0) out vec4 fragColor;
 
 const float PI = 3.14159265359;
 
+// Irradiance from the nine spherical harmonics coefficients of the environment, already convolved
+vec3 irradiance(vec3 n)
+{
+    return max(u.sh[0].rgb*0.282095
+             + (u.sh[1].rgb*n.y + u.sh[2].rgb*n.z + u.sh[3].rgb*n.x)*0.488603
+             + (u.sh[4].rgb*n.x*n.y + u.sh[5].rgb*n.y*n.z + u.sh[7].rgb*n.x*n.z)*1.092548
+             + u.sh[6].rgb*0.315392*(3*n.z*n.z - 1)
+             + u.sh[8].rgb*0.546274*(n.x*n.x - n.y*n.y), 0.0);
+}
+
 vec3 fresnelSchlick(float cosTheta, vec3 F0)
 {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
@@ -66,7 +77,7 @@ void main()
     float bias = pow(2., -7.*(NoV+4.*rough*rough));
     float scale = 1. - bias - rough*rough*max(bias, min(rough, 0.739+0.323*NoV)-0.434);
     res *= F * scale + bias;
-    res += (1-F)*u.albedo/PI * textureLod(cubeMap, reflect(-view, normal), log2(textureSize(cubeMap, 0).x)).rgb;
+    res += (1-F)*u.albedo/PI * irradiance(normal);
 
     // Tonemapping
     float luma = dot(res, vec3(0.212671, 0.715160, 0.072169));
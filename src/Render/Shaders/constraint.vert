@@ -1,5 +1,6 @@
 #version 440
 layout(location = 0) in vec2 a_position;
+layout(location = 0) out int o_instance;
 
 out gl_PerVertex {
     vec4 gl_Position;
@@ -10,4 +11,5 @@ out gl_PerVertex {
 void main()
 {
     gl_Position = vec4(a_position, 0, 1);
+    o_instance = gl_InstanceIndex;
 }
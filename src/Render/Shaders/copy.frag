@@ -1,11 +1,19 @@
 #version 440
 
 layout(binding = 0) uniform sampler2D tex;
+layout(binding = 2) uniform sampler2D mask;
 
 layout(location = 0) in vec2 uv;
 layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragMoments;
 
 void main()
 {
-    fragColor = texture(tex, uv);
+    // Converged tiles were not rendered this pass, keep their accumulation untouched
+    if (texelFetch(mask, ivec2(gl_FragCoord.xy)/16, 0).r > 0.5) discard;
+
+    // Same pixel of the pass, which may only cover the top left corner of the targets
+    fragColor = texelFetch(tex, ivec2(gl_FragCoord.xy), 0);
+    float luma = dot(fragColor.rgb, vec3(0.212671, 0.715160, 0.072169));
+    fragMoments = vec4(luma, luma*luma, 0.0, 1.0);
 }
@@ -1,6 +1,7 @@
 #version 440
 layout(binding = 1) uniform sampler2D anisoMap;
 layout(binding = 5) uniform samplerCube cubeMap;
+layout(binding = 6) uniform sampler2D brdfLut;
 
 layout(location = 0) in vec3 i_worldPos;
 layout(location = 1) in vec2 i_texCoord;
@@ -18,15 +19,28 @@ layout(std140, binding = 0) uniform buf {
     float sampleCount;
     float unused5;
     float exposure;
+    vec4 sh[9];
 } u;
 
 layout(location = 0) out vec4 fragColor;
 
 const float PI = 3.14159265359;
 
-vec3 fresnelSchlick(float cosTheta, vec3 F0)
+// Irradiance from the nine spherical harmonics coefficients of the environment, already convolved
+vec3 irradiance(vec3 n)
 {
-    return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+    return max(u.sh[0].rgb*0.282095
+             + (u.sh[1].rgb*n.y + u.sh[2].rgb*n.z + u.sh[3].rgb*n.x)*0.488603
+             + (u.sh[4].rgb*n.x*n.y + u.sh[5].rgb*n.y*n.z + u.sh[7].rgb*n.x*n.z)*1.092548
+             + u.sh[6].rgb*0.315392*(3*n.z*n.z - 1)
+             + u.sh[8].rgb*0.546274*(n.x*n.x - n.y*n.y), 0.0);
+}
+
+// Scale and bias of F0 for the directional albedo of the specular lobe, baked by brdfLut.comp
+vec2 specularAlbedo(float NoV, float rough)
+{
+    vec2 size = textureSize(brdfLut, 0);
+    return textureLod(brdfLut, (clamp(vec2(NoV, rough), 0, 1)*(size-1)+0.5)/size, 0).rg;
 }
 
 void main()
@@ -91,30 +105,31 @@ void main()
     wm0 = ellipseToWorld*normalize(wc + rateo*(wm0-wc));
     wm1 = ellipseToWorld*normalize(wc + rateo*(wm1-wc));
 
+    // Only take as many samples as it needs for their footprints to cover the arc, the sample
+    // count setting is the budget for the most anisotropic pixels
+    const float N = clamp(ceil(2.3*maxLength/max(minLength, 1e-4)), 1, u.sampleCount);
+
     // LOD selecion
-    const float N = u.sampleCount;
     float sampleWidth = max(minLength, 2.3*maxLength/N)/2;
     float level = log2(float(textureSize(cubeMap, 0).x))*sqrt(sampleWidth);
 
-    // Sample the environment map
+    // Sample the environment map, a single sample sits in the middle of the arc
     vec3 res = vec3(0.0);
     for (float i = 0; i < N; i++) {
-        vec3 wm = normalize(mix(wm0, wm1, i/(N-1)));
+        vec3 wm = normalize(mix(wm0, wm1, N > 1 ? i/(N-1) : 0.5));
         vec3 wi = reflect(-view, wm);
         res += textureLod(cubeMap, wi, level).rgb;
     }
     res /= N;
 
-    // Pesce and Iwanicki 2015
+    // Split sum, the lookup replaces the Pesce and Iwanicki 2015 fit
     float rough = sqrt(0.5*(sqrt(2*lambda1)+sqrt(2*lambda2)));
-    float NoV = dot(view, i_TBN[2]);
-    vec3 F = fresnelSchlick(NoV, mix(vec3(0.04), u.albedo, u.metallic));
-    float bias = pow(2., -7.*(NoV+4.*rough*rough));
-    float scale = 1. - bias - rough*rough*max(bias, min(rough, 0.739+0.323*NoV)-0.434);
-    res *= F * scale + bias;
-
-    // Use the last LOD rather than computing the radiance map, for now.
-    res += (1-F)*u.albedo/PI * textureLod(cubeMap, wc, log2(textureSize(cubeMap, 0).x)).rgb;
+    vec2 dfg = specularAlbedo(dot(view, i_TBN[2]), rough);
+    vec3 F = mix(vec3(0.04), u.albedo, u.metallic)*dfg.x + dfg.y;
+    res *= F;
+
+    // Lambertian diffuse
+    res += (1-F)*u.albedo/PI * irradiance(i_TBN[2]);
 
     // Tonemapping
     float luma = dot(res, vec3(0.212671, 0.715160, 0.072169));
@@ -4,21 +4,80 @@ layout(location = 0) out vec2 o_uv;
 
 layout(std140, binding = 0) uniform buf {
     mat4 MVP;
+    int selected;
+    int mode;
+    int lines;
+    float tesselationLOD;
+    float objScale;
+} u;
+
+struct Constraint {
     vec2 position;
     vec2 scale;
-    vec2 atlasPosition;
+    vec2 dir;
     float angle;
     float skewH;
     float skewV;
-    float mode;
-    float objScale;
-} u;
+    float lineCenterX;
+    float lineCenterY;
+    float lineWidth;
+    float lineHeight;
+    float tesselationLOD;
+    uint firstLine;
+    uint lineCount;
+};
+
+struct Line {
+    vec2 p0;
+    vec2 p1;
+    uint constraint;
+};
+
+layout(std430, binding = 2) readonly buffer constraintBuf {
+    Constraint constraints[];
+};
+
+layout(std430, binding = 3) readonly buffer lineBuf {
+    Line lines[];
+};
 
 out gl_PerVertex { vec4 gl_Position; };
 
+const float PI = 3.14159265359;
+
+// Corner and edge handles of the box, offset and rotation of each one
+const vec3 BOX[8] = vec3[](vec3(1, 1, 0), vec3(1, 0, 0), vec3(1, -1, PI/2), vec3(0, 1, PI/2),
+                           vec3(0, -1, PI/2), vec3(-1, 1, -PI/2), vec3(-1, 0, 0), vec3(-1, -1, PI));
+
 void main()
 {
-    mat2 R = mat2(cos(u.angle), sin(u.angle), -sin(u.angle), cos(u.angle));
-    gl_Position = u.MVP*vec4(R*(a_position*u.scale) + 2*(u.position - 0.5)*vec2(1, -1), 0.0, 1.0f);
-    o_uv = vec2((1.0+a_position+2*u.atlasPosition)/16.0);
+    Constraint c = constraints[u.selected];
+    float w = abs(c.scale.x*c.lineWidth);
+    float h = abs(c.scale.y*c.lineHeight);
+
+    vec2 offset;
+    vec2 atlasPosition;
+    float angle = c.angle;
+    if (gl_InstanceIndex < 8) {
+        vec3 t = BOX[gl_InstanceIndex];
+        offset = vec2(((1.0+c.skewV*c.skewH)*t.x*w - t.y*c.skewH*h)/2, (t.y*h - t.x*c.skewV*w)/2);
+        atlasPosition = vec2(t.x == 0 || t.y == 0 ? 1 : 2, 0);
+        angle += t.z;
+    } else {
+        // One handle at the start of every segment and one at the end of the last
+        uint point = uint(gl_InstanceIndex-8);
+        Line line = lines[c.firstLine + min(point, c.lineCount-1)];
+        vec2 p = point < c.lineCount ? line.p0 : line.p1;
+        float x = 2*(p.x - c.lineCenterX)/c.lineWidth;
+        float y = 2*(1.0-p.y - c.lineCenterY)/c.lineHeight;
+        x = (c.scale.x > 0 ? 1 : -1)*((1.0+c.skewV*c.skewH)*x*w - y*c.skewH*h)/2;
+        y = (c.scale.y > 0 ? 1 : -1)*(y*h - x*c.skewV*w)/2;
+        offset = vec2(x, y);
+        atlasPosition = vec2(4, 0);
+    }
+
+    vec2 position = c.position + vec2(offset.x*cos(c.angle) + offset.y*sin(c.angle), -offset.x*sin(c.angle) + offset.y*cos(c.angle));
+    mat2 R = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    gl_Position = u.MVP*vec4(R*(a_position*(0.07/u.objScale)) + 2*(position - 0.5)*vec2(1, -1), 0.0, 1.0f);
+    o_uv = vec2((1.0+a_position+2*atlasPosition)/16.0);
 }
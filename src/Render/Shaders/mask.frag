@@ -0,0 +1,10 @@
+#version 440
+
+layout(binding = 2) uniform sampler2D mask;
+
+void main()
+{
+    // Occlude converged tiles so the expensive shading fails the early depth test
+    if (texelFetch(mask, ivec2(gl_FragCoord.xy)/16, 0).r < 0.5) discard;
+    gl_FragDepth = 0.0;
+}
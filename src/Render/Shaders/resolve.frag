@@ -2,11 +2,17 @@
 
 layout(binding = 1) uniform sampler2D tex;
 
+layout(push_constant) uniform constants {
+    vec2 scale;
+} pc;
+
 layout(location = 0) in vec2 uv;
 layout(location = 0) out vec4 fragColor;
 
 void main()
 {
-    vec4 col = texture(tex, uv);
+    // The accumulation covers the top left corner of the target, keep the filter from reading past it
+    vec2 size = textureSize(tex, 0);
+    vec4 col = textureLod(tex, clamp(uv*pc.scale, 0.5/size, pc.scale-0.5/size), 0);
     fragColor = col/col.a;
 }
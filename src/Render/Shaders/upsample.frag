@@ -0,0 +1,20 @@
+#version 440
+
+layout(binding = 0) uniform sampler2D color;
+layout(binding = 1) uniform sampler2D depth;
+
+layout(push_constant) uniform constants {
+    vec2 scale;
+} pc;
+
+layout(location = 0) in vec2 uv;
+layout(location = 0) out vec4 fragColor;
+
+void main()
+{
+    // The scene only covers the top left corner of the targets, keep the filter from reading past it
+    vec2 size = textureSize(color, 0);
+    vec2 coord = clamp(uv*pc.scale, 0.5/size, pc.scale-0.5/size);
+    fragColor = textureLod(color, coord, 0);
+    gl_FragDepth = texelFetch(depth, ivec2(coord*size), 0).r;
+}
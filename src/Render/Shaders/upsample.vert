@@ -0,0 +1,11 @@
+#version 440
+layout(location = 0) out vec2 uv;
+
+out gl_PerVertex { vec4 gl_Position; };
+
+void main()
+{
+    // One triangle covering the viewport, uv is 0 to 1 over the visible part
+    uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(uv*2.0-1.0, 0.0, 1.0);
+}
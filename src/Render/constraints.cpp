@@ -1,15 +1,16 @@
 #include "constraints.h"
+#include "src/Render/stagingring.h"
 #include <QCoreApplication>
 
 ConstraintsRenderer::ConstraintsRenderer(VulkanWindow *window) : m_window(window) {
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    m_devFuncs = m_window->deviceFunctions();
 
     m_atlas = new Texture(QCoreApplication::applicationDirPath()+"/assets/textures/atlas.png", m_window);
 
     createRectData();
     createHandleData();
     createUniformBuffer();
+    createStorageBuffers();
     createDescriptors();
     createPipelineLayout();
     createPipeline();
@@ -25,20 +26,14 @@ ConstraintsRenderer::~ConstraintsRenderer() {
         m_rectBuf = VK_NULL_HANDLE;
     }
 
-    if (m_rectBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_rectBufMem, nullptr);
-        m_rectBufMem = VK_NULL_HANDLE;
-    }
+    m_window->getAllocator()->free(m_rectBufMem);
 
     if (m_handleBuf) {
         m_devFuncs->vkDestroyBuffer(dev, m_handleBuf, nullptr);
         m_handleBuf = VK_NULL_HANDLE;
     }
 
-    if (m_handleBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_handleBufMem, nullptr);
-        m_handleBufMem = VK_NULL_HANDLE;
-    }
+    m_window->getAllocator()->free(m_handleBufMem);
 
     if (m_pipeline) {
         m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
@@ -60,11 +55,6 @@ ConstraintsRenderer::~ConstraintsRenderer() {
         m_pipelineLayout = VK_NULL_HANDLE;
     }
 
-    if (m_pipelineCache) {
-        m_devFuncs->vkDestroyPipelineCache(dev, m_pipelineCache, nullptr);
-        m_pipelineCache = VK_NULL_HANDLE;
-    }
-
     if (m_descSetLayout) {
         m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
         m_descSetLayout = VK_NULL_HANDLE;
@@ -80,10 +70,21 @@ ConstraintsRenderer::~ConstraintsRenderer() {
         m_uniformBuf = VK_NULL_HANDLE;
     }
 
-    if (m_uniformBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_uniformBufMem, nullptr);
-        m_uniformBufMem = VK_NULL_HANDLE;
+    m_window->getAllocator()->free(m_uniformBufMem);
+
+    if (m_constraintBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_constraintBuf, nullptr);
+        m_constraintBuf = VK_NULL_HANDLE;
+    }
+
+    m_window->getAllocator()->free(m_constraintBufMem);
+
+    if (m_previewBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_previewBuf, nullptr);
+        m_previewBuf = VK_NULL_HANDLE;
     }
+
+    m_window->getAllocator()->free(m_previewBufMem);
 }
 
 void ConstraintsRenderer::createRectData() {
@@ -106,31 +107,11 @@ void ConstraintsRenderer::createRectData() {
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_rectBuf, &meshMemReq);
+    m_rectBufMem = m_window->getAllocator()->allocateBuffer(m_rectBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_rectBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_rectBuf, m_rectBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    void *p;
-    err = m_devFuncs->vkMapMemory(dev, m_rectBufMem, 0, meshMemReq.size, 0, &p);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    void *p = m_rectBufMem.mapped;
 
     memcpy(p, data, sizeof(data));
-    m_devFuncs->vkUnmapMemory(dev, m_rectBufMem);
 }
 
 void ConstraintsRenderer::createHandleData() {
@@ -148,45 +129,21 @@ void ConstraintsRenderer::createHandleData() {
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_handleBuf, &meshMemReq);
+    m_handleBufMem = m_window->getAllocator()->allocateBuffer(m_handleBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_handleBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_handleBuf, m_handleBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    void *p;
-    err = m_devFuncs->vkMapMemory(dev, m_handleBufMem, 0, meshMemReq.size, 0, &p);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    void *p = m_handleBufMem.mapped;
 
     memcpy(p, data, sizeof(data));
-    m_devFuncs->vkUnmapMemory(dev, m_handleBufMem);
 }
 
 void ConstraintsRenderer::createPipeline() {
     VkDevice dev = m_window->device();
 
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/constraint_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/constraint_frag.spv");
-    VkShaderModule controlShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/constraint_tesc.spv");
-    VkShaderModule evaluationShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/constraint_tese.spv");
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("constraint_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("constraint_frag.spv"));
+    VkShaderModule controlShaderModule = m_window->createShader(SHADER("constraint_tesc.spv"));
+    VkShaderModule evaluationShaderModule = m_window->createShader(SHADER("constraint_tese.spv"));
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -356,10 +313,8 @@ void ConstraintsRenderer::createHandlePipeline() {
     VkDevice dev = m_window->device();
 
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/handle_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/handle_frag.spv");
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("handle_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("handle_frag.spv"));
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -495,13 +450,7 @@ void ConstraintsRenderer::createHandlePipeline() {
 void ConstraintsRenderer::createPipelineLayout() {
     VkDevice dev = m_window->device();
 
-    // Pipeline cache
-    VkPipelineCacheCreateInfo pipelineCacheInfo;
-    memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
-    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VkResult err = m_devFuncs->vkCreatePipelineCache(dev, &pipelineCacheInfo, nullptr, &m_pipelineCache);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to create pipeline cache");
+    m_pipelineCache = m_window->getPipelineCache();
 
     // Pipeline layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo;
@@ -509,7 +458,7 @@ void ConstraintsRenderer::createPipelineLayout() {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
-    err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+    VkResult err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create pipeline layout");
 }
@@ -521,61 +470,73 @@ void ConstraintsRenderer::createUniformBuffer() {
     const VkPhysicalDeviceLimits *pdevLimits = &m_window->physicalDeviceProperties()->limits;
     const VkDeviceSize uniAlign = pdevLimits->minUniformBufferOffsetAlignment;
 
+    // Only a header per draw call is left here, the shapes themselves come from the storage buffers
     VkBufferCreateInfo uniformBufInfo;
     memset(&uniformBufInfo, 0, sizeof(uniformBufInfo));
     uniformBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    const VkDeviceSize uniformAllocSize = m_window->aligned(34*sizeof(float), uniAlign);
+    const VkDeviceSize uniformAllocSize = m_window->aligned(21*sizeof(float), uniAlign);
     m_dynamicAlignment = uniformAllocSize;
-    uniformBufInfo.size = MAX_CONSTRAINTS * concurrentFrameCount * uniformAllocSize;
+    uniformBufInfo.size = MAX_DRAWS * concurrentFrameCount * uniformAllocSize;
     uniformBufInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &uniformBufInfo, nullptr, &m_uniformBuf);
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create buffer");
 
-    VkMemoryRequirements uniformMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_uniformBuf, &uniformMemReq);
-
-    VkMemoryAllocateInfo uniformMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        uniformMemReq.size,
-        m_window->findMemoryType(uniformMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &uniformMemAllocInfo, nullptr, &m_uniformBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_uniformBuf, m_uniformBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_uniformBufMem, 0, uniformMemReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    m_uniformBufMem = m_window->getAllocator()->allocateBuffer(m_uniformBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
     memset(m_uniformBufInfo, 0, sizeof(m_uniformBufInfo));
     for (int i = 0; i < concurrentFrameCount; ++i) {
-        const VkDeviceSize offset = i * MAX_CONSTRAINTS * uniformAllocSize;
+        const VkDeviceSize offset = i * MAX_DRAWS * uniformAllocSize;
         m_uniformBufInfo[i].buffer = m_uniformBuf;
         m_uniformBufInfo[i].offset = offset;
         m_uniformBufInfo[i].range = uniformAllocSize;
     }
-    m_devFuncs->vkUnmapMemory(dev, m_uniformBufMem);
+}
+
+void ConstraintsRenderer::createStorageBuffers() {
+    VkDevice dev = m_window->device();
+
+    const int concurrentFrameCount = m_window->concurrentFrameCount();
+    const VkDeviceSize storageAlign = m_window->physicalDeviceProperties()->limits.minStorageBufferOffsetAlignment;
+
+    VkBufferCreateInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(bufInfo));
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    m_lineOffset = m_window->aligned(MAX_CONSTRAINTS * sizeof(ConstraintData), storageAlign);
+    bufInfo.size = m_lineOffset + MAX_LINES * sizeof(LineData);
+    bufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_constraintBuf);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create buffer");
+
+    m_constraintBufMem = m_window->getAllocator()->allocateBuffer(m_constraintBuf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // One constraint record followed by the stroke being drawn, per frame in flight
+    m_previewSliceSize = m_window->aligned(sizeof(ConstraintData) + MAX_PREVIEW_LINES * sizeof(LineData), storageAlign);
+    bufInfo.size = m_previewSliceSize * concurrentFrameCount;
+    bufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_previewBuf);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create buffer");
+
+    m_previewBufMem = m_window->getAllocator()->allocateBuffer(m_previewBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 }
 
 void ConstraintsRenderer::createDescriptors() {
     VkDevice dev = m_window->device();
     const int concurrentFrameCount = m_window->concurrentFrameCount();
 
-    // Set up descriptor set and its layout.
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    // Set up descriptor set and its layout, every frame has one set for the constraints and one for the preview
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(2*concurrentFrameCount);
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(2*concurrentFrameCount);
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = static_cast<uint32_t>(4*concurrentFrameCount);
 
     VkDescriptorPoolCreateInfo descPoolInfo;
     memset(&descPoolInfo, 0, sizeof(descPoolInfo));
@@ -583,7 +544,7 @@ void ConstraintsRenderer::createDescriptors() {
     descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     descPoolInfo.pPoolSizes = poolSizes.data();
     descPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
-    descPoolInfo.maxSets = static_cast<uint32_t>(concurrentFrameCount);
+    descPoolInfo.maxSets = static_cast<uint32_t>(2*concurrentFrameCount);
     VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create descriptor pool");
@@ -602,15 +563,29 @@ void ConstraintsRenderer::createDescriptors() {
         VK_SHADER_STAGE_FRAGMENT_BIT,
         nullptr
     };
+    VkDescriptorSetLayoutBinding constraintBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        1,
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding lineBinding = {
+        3, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        1,
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+        nullptr
+    };
 
-    std::array<VkDescriptorBindingFlags, 2> flags{0};
+    std::array<VkDescriptorBindingFlags, 4> flags{0};
     VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags{};
     bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
     bindingFlags.pNext = nullptr;
     bindingFlags.pBindingFlags = flags.data();
     bindingFlags.bindingCount = static_cast<uint32_t>(flags.size());;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, atlasBinding};
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings = {uboLayoutBinding, atlasBinding, constraintBinding, lineBinding};
     VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
     descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -622,7 +597,11 @@ void ConstraintsRenderer::createDescriptors() {
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create descriptor set layout");
 
-    for (int i = 0; i < concurrentFrameCount; ++i) {
+    for (int i = 0; i < 2*concurrentFrameCount; ++i) {
+        const int frame = i % concurrentFrameCount;
+        const bool preview = i >= concurrentFrameCount;
+        VkDescriptorSet &set = preview ? m_previewDescSet[frame] : m_descSet[frame];
+
         VkDescriptorSetAllocateInfo descSetAllocInfo = {
             VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             nullptr,
@@ -630,7 +609,7 @@ void ConstraintsRenderer::createDescriptors() {
             1,
             &m_descSetLayout
         };
-        err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSet[i]);
+        err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &set);
         if (err != VK_SUCCESS)
             m_window->crash("Failed to allocate descriptor set");
 
@@ -639,381 +618,217 @@ void ConstraintsRenderer::createDescriptors() {
         imageInfo[0].imageView = m_atlas->getImageView();
         imageInfo[0].sampler = m_atlas->getTextureSampler();
 
-        std::array<VkWriteDescriptorSet, 2> descWrites{};
+        std::array<VkDescriptorBufferInfo, 2> storageInfo{};
+        if (preview) {
+            storageInfo[0] = { m_previewBuf, frame*m_previewSliceSize, sizeof(ConstraintData) };
+            storageInfo[1] = { m_previewBuf, frame*m_previewSliceSize + sizeof(ConstraintData), MAX_PREVIEW_LINES * sizeof(LineData) };
+        } else {
+            storageInfo[0] = { m_constraintBuf, 0, MAX_CONSTRAINTS * sizeof(ConstraintData) };
+            storageInfo[1] = { m_constraintBuf, m_lineOffset, MAX_LINES * sizeof(LineData) };
+        }
+
+        std::array<VkWriteDescriptorSet, 4> descWrites{};
 
         descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descWrites[0].dstSet = m_descSet[i];
+        descWrites[0].dstSet = set;
         descWrites[0].dstBinding = 0;
         descWrites[0].dstArrayElement = 0;
         descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         descWrites[0].descriptorCount = 1;
-        descWrites[0].pBufferInfo = &m_uniformBufInfo[i];
+        descWrites[0].pBufferInfo = &m_uniformBufInfo[frame];
         descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descWrites[1].dstSet = m_descSet[i];
+        descWrites[1].dstSet = set;
         descWrites[1].dstBinding = 1;
         descWrites[1].dstArrayElement = 0;
         descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         descWrites[1].descriptorCount = 1;
         descWrites[1].pImageInfo = &imageInfo[0];
+        for (uint32_t j = 0; j < 2; j++) {
+            descWrites[2+j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descWrites[2+j].dstSet = set;
+            descWrites[2+j].dstBinding = 2+j;
+            descWrites[2+j].dstArrayElement = 0;
+            descWrites[2+j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descWrites[2+j].descriptorCount = 1;
+            descWrites[2+j].pBufferInfo = &storageInfo[j];
+        }
 
         m_devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
     }
 }
 
+void ConstraintsRenderer::uploadConstraints(const std::vector<Optimizer::Constraint> &constraints) {
+    const uint32_t count = std::min(static_cast<uint32_t>(constraints.size()), MAX_CONSTRAINTS);
+    if (count < constraints.size()) {
+        qWarning("Only the first %u constraints are drawn", MAX_CONSTRAINTS);
+    }
+
+    m_constraintData.resize(count);
+    std::vector<LineData> lines;
+    for (uint32_t i = 0; i < count; ++i) {
+        const Optimizer::Constraint &c = constraints[i];
+        const uint32_t firstLine = static_cast<uint32_t>(lines.size());
+        for (const auto &line : c.lines) {
+            if (lines.size() == MAX_LINES) {
+                break;
+            }
+            lines.push_back({ line.x0, line.y0, line.x1, line.y1, i, 0 });
+        }
+        m_constraintData[i] = { c.centerX, c.centerY, c.width, c.height, c.dirX, c.dirY, c.rotAngle, c.skewH, c.skewV,
+                                c.lineCenterX, c.lineCenterY, c.lineWidth, c.lineHeight, c.tesselationLod,
+                                firstLine, static_cast<uint32_t>(lines.size()) - firstLine };
+    }
+    m_lineCount = static_cast<uint32_t>(lines.size());
+
+    if (!count) {
+        return;
+    }
+
+    const VkDeviceSize constraintSize = count * sizeof(ConstraintData);
+    const VkDeviceSize lineSize = m_lineCount * sizeof(LineData);
+    StagingRing *staging = m_window->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(constraintSize + lineSize);
+    memcpy(transfer.mapped, m_constraintData.data(), constraintSize);
+    if (lineSize) {
+        memcpy(static_cast<char*>(transfer.mapped) + constraintSize, lines.data(), lineSize);
+    }
+
+    // Frames already submitted may still read the old records, the copy waits for them
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    std::array<VkBufferCopy, 2> regions = {{
+        { transfer.offset, 0, constraintSize },
+        { transfer.offset + constraintSize, m_lineOffset, lineSize },
+    }};
+    m_devFuncs->vkCmdCopyBuffer(transfer.commandBuffer, transfer.buffer, m_constraintBuf, lineSize ? 2 : 1, regions.data());
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    staging->submit(transfer);
+}
+
+void ConstraintsRenderer::writePreview(const QPointF& lastDown, const QPointF& currentDown, const std::vector<std::array<float, 2>> &pointList) {
+    char *slice = static_cast<char *>(m_previewBufMem.mapped) + m_window->currentFrame()*m_previewSliceSize;
+    ConstraintData *data = reinterpret_cast<ConstraintData *>(slice);
+    LineData *lines = reinterpret_cast<LineData *>(slice + sizeof(ConstraintData));
+
+    if (pointList.empty()) {
+        const float centerX = (lastDown.x()+currentDown.x())/2;
+        const float centerY = 1.0f-(lastDown.y()+currentDown.y())/2;
+        *data = { centerX, centerY, float(fabs(lastDown.x()-currentDown.x())), float(fabs(lastDown.y()-currentDown.y())),
+                  1, 0, 0, 0, 0, centerX, centerY, 1, 1,
+                  m_window->getTool() == VulkanWindow::Tools::Rectangle ? 1.0f : 32.0f, 0, 0 };
+        m_previewLineCount = 0;
+        return;
+    }
+
+    // The stroke is in texture space already, an identity transform places its segments as they are
+    *data = { 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0 };
+    m_previewLineCount = std::min(static_cast<uint32_t>(pointList.size()), MAX_PREVIEW_LINES);
+    for (uint32_t i = 0; i < m_previewLineCount; i++) {
+        Optimizer::Constraint::Line line = {pointList[pointList.size()-1][0], pointList[pointList.size()-1][1], (float)currentDown.x(), (float)currentDown.y()};
+        if (i < pointList.size()-1) {
+            line = {pointList[i][0], pointList[i][1], pointList[i+1][0], pointList[i+1][1]};
+        }
+        lines[i] = { line.x0, line.y0, line.x1, line.y1, 0, 0 };
+    }
+}
+
+void ConstraintsRenderer::bindDraw(VkCommandBuffer cb, VkDescriptorSet set, uint32_t &drawn, const QMatrix4x4& mvp, float scale,
+                                   int selected, Mode mode, bool lines, float lod) {
+    float *p = reinterpret_cast<float *>(static_cast<char *>(m_uniformBufMem.mapped) + m_uniformBufInfo[m_window->currentFrame()].offset + drawn*m_dynamicAlignment);
+    memcpy(p, mvp.constData(), 16 * sizeof(float));
+    int32_t *header = reinterpret_cast<int32_t *>(p + 16);
+    header[0] = selected;
+    header[1] = mode;
+    header[2] = lines ? 1 : 0;
+    p[19] = lod;
+    p[20] = scale;
+
+    uint32_t dynamicOffset = drawn++ * static_cast<uint32_t>(m_dynamicAlignment);
+    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &set, 1, &dynamicOffset);
+}
+
 void ConstraintsRenderer::draw(VkCommandBuffer cb, Optimizer *opt, const QMatrix4x4& mvp, float scale,
                                const QPointF& lastDown, const QPointF& currentDown, const std::vector<std::array<float, 2>> &pointList) {
-    VkDevice dev = m_window->device();
-    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+    if (opt->getRevision() != m_revision) {
+        uploadConstraints(opt->getConstraints());
+        m_revision = opt->getRevision();
+    }
+
+    const VkDescriptorSet set = m_descSet[m_window->currentFrame()];
+    const uint32_t count = static_cast<uint32_t>(m_constraintData.size());
+    int selected = m_window->getConstraintWidgetList()->currentRow();
+    if (selected >= static_cast<int>(count)) {
+        selected = -1;
+    }
 
     static const VkDeviceSize zero = 0;
     m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_rectBuf, &zero);
+    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
 
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_uniformBufMem, m_uniformBufInfo[m_window->currentFrame()].offset,
-                                           MAX_CONSTRAINTS*m_dynamicAlignment, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
-
-    auto &constraints = opt->getConstraints();
-
-    int selected = m_window->getConstraintWidgetList()->currentRow();
+    // Rectangles and ellipses are one instance per constraint, line constraints hide theirs in the
+    // control shader and draw one instance per segment instead
     uint32_t drawn = 0;
-    for (uint32_t i = 0; i < constraints.size(); ++i) {
-        if (constraints[i].lines.empty()) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-            *curr++ = constraints[i].centerX;
-            *curr++ = constraints[i].centerY;
-            *curr++ = constraints[i].width;
-            *curr++ = constraints[i].height;
-            *curr++ = constraints[i].dirX;
-            *curr++ = constraints[i].dirY;
-            *curr++ = constraints[i].rotAngle;
-            *curr++ = constraints[i].skewH;
-            *curr++ = constraints[i].skewV;
-            *curr++ = (int)i == selected ? 2 : 0;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-            *curr++ = constraints[i].tesselationLod;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 8, 1, 2, 0);
-        } else {
-            for (uint32_t j = 0; j < constraints[i].lines.size(); j++) {
-                float *curr = p + m_dynamicAlignment/4 * ++drawn;
-                memcpy(curr, mvp.constData(), 16 * sizeof(float));
-                curr += 16;
-                *curr++ = constraints[i].centerX;
-                *curr++ = constraints[i].centerY;
-                *curr++ = constraints[i].width;
-                *curr++ = constraints[i].height;
-                *curr++ = constraints[i].dirX;
-                *curr++ = constraints[i].dirY;
-                *curr++ = constraints[i].rotAngle;
-                *curr++ = constraints[i].skewH;
-                *curr++ = constraints[i].skewV;
-                *curr++ = (int)i == selected ? 2 : 0;
-                *curr++ = scale;
-                auto line = constraints[i].lines[j];
-                float lineLength = sqrt((line.x0-line.x1)*(line.x0-line.x1) + (line.y0-line.y1)*(line.y0-line.y1));
-                *curr++ = (line.x0+line.x1)/2;
-                *curr++ = 1.0-(line.y0+line.y1)/2;
-                *curr++ = atan2(line.y0-line.y1, line.x0-line.x1);
-                *curr++ = constraints[i].lineCenterX;
-                *curr++ = constraints[i].lineCenterY;
-                *curr++ = lineLength;
-                *curr++ = 1;
-
-                uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-                m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-                m_devFuncs->vkCmdDraw(cb, 2, 1, 10, 0);
-            }
-        }
+    if (count) {
+        bindDraw(cb, set, drawn, mvp, scale, selected, Constraints, false);
+        m_devFuncs->vkCmdDraw(cb, 8, count, 2, 0);
+    }
+    if (m_lineCount) {
+        bindDraw(cb, set, drawn, mvp, scale, selected, Constraints, true);
+        m_devFuncs->vkCmdDraw(cb, 2, m_lineCount, 10, 0);
     }
 
     if (lastDown != currentDown) {
         m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_noStencilPipeline);
+        writePreview(lastDown, currentDown, pointList);
 
+        const VkDescriptorSet previewSet = m_previewDescSet[m_window->currentFrame()];
         if (pointList.empty()) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-
-            qreal data[9] = {(lastDown.x()+currentDown.x())/2, 1.0f-(lastDown.y()+currentDown.y())/2,
-                             abs(lastDown.x()-currentDown.x()), abs(lastDown.y()-currentDown.y()), 0, 0, 0, 0, 0};
-
-            *curr++ = data[0];
-            *curr++ = data[1];
-            *curr++ = data[2];
-            *curr++ = data[3];
-            *curr++ = data[4];
-            *curr++ = data[5];
-            *curr++ = data[6];
-            *curr++ = data[7];
-            *curr++ = data[8];
-            *curr++ = 1;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-            *curr++ = m_window->getTool() == VulkanWindow::Tools::Rectangle ? 1 : 32;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
+            bindDraw(cb, previewSet, drawn, mvp, scale, -1, Preview, false);
             m_devFuncs->vkCmdDraw(cb, 8, 1, 2, 0);
         } else {
-            for (uint32_t i = 0; i < pointList.size(); i++) {
-                float *curr = p + m_dynamicAlignment/4 * ++drawn;
-                memcpy(curr, mvp.constData(), 16 * sizeof(float));
-                curr += 16;
-
-                Optimizer::Constraint::Line line = {pointList[pointList.size()-1][0], pointList[pointList.size()-1][1], (float)currentDown.x(), (float)currentDown.y()};
-                if (i < pointList.size()-1) {
-                    line = {pointList[i][0], pointList[i][1], pointList[i+1][0], pointList[i+1][1]};
-                }
-
-                float lineLength = sqrt((line.x0-line.x1)*(line.x0-line.x1) + (line.y0-line.y1)*(line.y0-line.y1));
-                *curr++ = (line.x0+line.x1)/2;
-                *curr++ = 1.0-(line.y0+line.y1)/2;
-                *curr++ = lineLength;
-                *curr++ = 1.0;
-                *curr++ = 1.0;
-                *curr++ = 0.0;
-                *curr++ = atan2(line.y0-line.y1, line.x0-line.x1);
-                *curr++ = 0.0;
-                *curr++ = 0.0;
-                *curr++ = 1;
-                *curr++ = scale;
-                *curr++ = 0;
-                *curr++ = 0;
-                *curr++ = 0;
-                *curr++ = 0;
-                *curr++ = 0;
-                *curr++ = -1;
-                *curr++ = 1;
-
-                uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-                m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-                m_devFuncs->vkCmdDraw(cb, 2, 1, 10, 0);
-            }
+            bindDraw(cb, previewSet, drawn, mvp, scale, -1, Preview, true);
+            m_devFuncs->vkCmdDraw(cb, 2, m_previewLineCount, 10, 0);
         }
     }
 
     if (m_window->getTool() == VulkanWindow::Tools::Select && selected != -1) {
         m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_noStencilPipeline);
+        const ConstraintData &data = m_constraintData[selected];
 
         if (m_window->getSelectedLine() == -1) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-            *curr++ = constraints[selected].centerX;
-            *curr++ = constraints[selected].centerY;
-            *curr++ = constraints[selected].width * constraints[selected].lineWidth;
-            *curr++ = constraints[selected].height * constraints[selected].lineHeight;
-            *curr++ = constraints[selected].dirX;
-            *curr++ = constraints[selected].dirY;
-            *curr++ = constraints[selected].rotAngle;
-            *curr++ = constraints[selected].skewH;
-            *curr++ = constraints[selected].skewV;
-            *curr++ = 3;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-            *curr++ = 1;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 8, 1, 2, 0);
+            bindDraw(cb, set, drawn, mvp, scale, selected, Outline, false, 1);
+            m_devFuncs->vkCmdDraw(cb, 8, 1, 2, selected);
         }
 
-        if (constraints[selected].tesselationLod > 1) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-            *curr++ = constraints[selected].centerX;
-            *curr++ = constraints[selected].centerY;
-            *curr++ = constraints[selected].width * constraints[selected].lineWidth;
-            *curr++ = constraints[selected].height * constraints[selected].lineHeight;
-            *curr++ = constraints[selected].dirX;
-            *curr++ = constraints[selected].dirY;
-            *curr++ = constraints[selected].rotAngle;
-            *curr++ = constraints[selected].skewH;
-            *curr++ = constraints[selected].skewV;
-            *curr++ = 3;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-            *curr++ = constraints[selected].tesselationLod;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 8, 1, 2, 0);
+        if (data.tesselationLod > 1) {
+            bindDraw(cb, set, drawn, mvp, scale, selected, Outline, false, data.tesselationLod);
+            m_devFuncs->vkCmdDraw(cb, 8, 1, 2, selected);
         }
 
-        for (uint32_t j = 0; j < constraints[selected].lines.size(); j++) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-            *curr++ = constraints[selected].centerX;
-            *curr++ = constraints[selected].centerY;
-            *curr++ = constraints[selected].width;
-            *curr++ = constraints[selected].height;
-            *curr++ = constraints[selected].dirX;
-            *curr++ = constraints[selected].dirY;
-            *curr++ = constraints[selected].rotAngle;
-            *curr++ = constraints[selected].skewH;
-            *curr++ = constraints[selected].skewV;
-            *curr++ = 3;
-            *curr++ = scale;
-            auto line = constraints[selected].lines[j];
-            float lineLength = sqrt((line.x0-line.x1)*(line.x0-line.x1) + (line.y0-line.y1)*(line.y0-line.y1));
-            *curr++ = (line.x0+line.x1)/2;
-            *curr++ = 1.0-(line.y0+line.y1)/2;
-            *curr++ = atan2(line.y0-line.y1, line.x0-line.x1);
-            *curr++ = constraints[selected].lineCenterX;
-            *curr++ = constraints[selected].lineCenterY;
-            *curr++ = lineLength;
-            *curr++ = 1;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 2, 1, 10, 0);
+        if (data.lineCount) {
+            bindDraw(cb, set, drawn, mvp, scale, selected, Outline, true);
+            m_devFuncs->vkCmdDraw(cb, 2, data.lineCount, 10, data.firstLine);
         }
 
-        drawHandles(cb, drawn, mvp, scale, p, selected, constraints);
-    }
-
-    m_devFuncs->vkUnmapMemory(dev, m_uniformBufMem);
-}
-
-void ConstraintsRenderer::drawHandles(VkCommandBuffer cb, uint32_t &drawn, const QMatrix4x4& mvp, float scale, float *p, int selected, const std::vector<Optimizer::Constraint>& constraints) {
-    static const VkDeviceSize zero = 0;
-
-    m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_handleBuf, &zero);
-    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_handlePipeline);
-
-    if (m_window->getSelectedLine() == -1) {
-        static float transf[8][3]{{1,1, 0}, {1,0, 0}, {1,-1, M_PI/2}, {0,1, M_PI/2}, {0,-1, M_PI/2}, {-1,1, -M_PI/2}, {-1,0, 0}, {-1,-1, M_PI}};
-        for (uint32_t i = 0; i < 8; i++) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-
-            float w = fabs(constraints[selected].width * constraints[selected].lineWidth);
-            float h = fabs(constraints[selected].height * constraints[selected].lineHeight);
-            float x = ((1.0+constraints[selected].skewV*constraints[selected].skewH)*transf[i][0]*w - transf[i][1]*constraints[selected].skewH*h)/2;
-            float y = (transf[i][1]*h - transf[i][0]*constraints[selected].skewV*w)/2;
-            *curr++ = constraints[selected].centerX + x*cosf(constraints[selected].rotAngle) + y*sinf(constraints[selected].rotAngle);
-            *curr++ = constraints[selected].centerY - x*sinf(constraints[selected].rotAngle) + y*cosf(constraints[selected].rotAngle);
-            *curr++ = 0.07/scale;
-            *curr++ = 0.07/scale;
-            *curr++ = transf[i][0] == 0 || transf[i][1] == 0 ? 1 : 2;
-            *curr++ = 0;
-            *curr++ = constraints[selected].rotAngle + (transf[i][0] == 0 && transf[i][1] == 0 ? atan2(constraints[selected].dirY, constraints[selected].dirX) : transf[i][2]);
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 1;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 4, 1, 0, 0);
+        // The handles are placed by the vertex shader, eight around the box and one per line point
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_handleBuf, &zero);
+        m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_handlePipeline);
+        bindDraw(cb, set, drawn, mvp, scale, selected, Outline, false);
+        if (m_window->getSelectedLine() == -1) {
+            m_devFuncs->vkCmdDraw(cb, 4, 8, 0, 0);
         }
-    }
-
-    for (uint32_t i = 0; i < constraints[selected].lines.size(); i++) {
-        float *curr = p + m_dynamicAlignment/4 * ++drawn;
-        memcpy(curr, mvp.constData(), 16 * sizeof(float));
-        curr += 16;
-
-        auto line = constraints[selected].lines[i];
-        float w = fabs(constraints[selected].width * constraints[selected].lineWidth);
-        float h = fabs(constraints[selected].height * constraints[selected].lineHeight);
-        float x = 2*(line.x0 - constraints[selected].lineCenterX)/constraints[selected].lineWidth;
-        float y = 2*(1.0-line.y0 - constraints[selected].lineCenterY)/constraints[selected].lineHeight;
-
-        x = (constraints[selected].width > 0 ? 1 : -1)*((1.0+constraints[selected].skewV*constraints[selected].skewH)*x*w - y*constraints[selected].skewH*h)/2;
-        y = (constraints[selected].height > 0 ? 1 : -1)*(y*h - x*constraints[selected].skewV*w)/2;
-        *curr++ = constraints[selected].centerX + x*cosf(constraints[selected].rotAngle) + y*sinf(constraints[selected].rotAngle);
-        *curr++ = constraints[selected].centerY - x*sinf(constraints[selected].rotAngle) + y*cosf(constraints[selected].rotAngle);
-        *curr++ = 0.07/scale;
-        *curr++ = 0.07/scale;
-        *curr++ = 4;
-        *curr++ = 0;
-        *curr++ = constraints[selected].rotAngle;
-        *curr++ = 0;
-        *curr++ = 0;
-        *curr++ = 1;
-        *curr++ = scale;
-        *curr++ = 0;
-        *curr++ = 0;
-        *curr++ = 0;
-        *curr++ = 0;
-        *curr++ = 0;
-        *curr++ = -1;
-
-        uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-        m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-        m_devFuncs->vkCmdDraw(cb, 4, 1, 0, 0);
-
-        if (i == constraints[selected].lines.size()-1) {
-            float *curr = p + m_dynamicAlignment/4 * ++drawn;
-            memcpy(curr, mvp.constData(), 16 * sizeof(float));
-            curr += 16;
-
-            auto line = constraints[selected].lines[i];
-            float w = fabs(constraints[selected].width * constraints[selected].lineWidth);
-            float h = fabs(constraints[selected].height * constraints[selected].lineHeight);
-            float x = 2*(line.x1 - constraints[selected].lineCenterX)/constraints[selected].lineWidth;
-            float y = 2*(1.0-line.y1 - constraints[selected].lineCenterY)/constraints[selected].lineHeight;
-
-            x = (constraints[selected].width > 0 ? 1 : -1)*((1.0+constraints[selected].skewV*constraints[selected].skewH)*x*w - y*constraints[selected].skewH*h)/2;
-            y = (constraints[selected].height > 0 ? 1 : -1)*(y*h - x*constraints[selected].skewV*w)/2;
-            *curr++ = constraints[selected].centerX + x*cosf(constraints[selected].rotAngle) + y*sinf(constraints[selected].rotAngle);
-            *curr++ = constraints[selected].centerY - x*sinf(constraints[selected].rotAngle) + y*cosf(constraints[selected].rotAngle);
-            *curr++ = 0.07/scale;
-            *curr++ = 0.07/scale;
-            *curr++ = 4;
-            *curr++ = 0;
-            *curr++ = constraints[selected].rotAngle;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 1;
-            *curr++ = scale;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = 0;
-            *curr++ = -1;
-
-            uint32_t dynamicOffset = drawn * static_cast<uint32_t>(m_dynamicAlignment);
-            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descSet[m_window->currentFrame()], 1, &dynamicOffset);
-            m_devFuncs->vkCmdDraw(cb, 4, 1, 0, 0);
+        if (data.lineCount) {
+            m_devFuncs->vkCmdDraw(cb, 4, data.lineCount+1, 0, 8);
         }
     }
 }
@@ -1,6 +1,5 @@
 #pragma once
 #include <QVulkanWindow>
-#include <QVulkanFunctions>
 #include "src/UI/vulkanwindow.h"
 #include "src/Texture/texture.h"
 #include "src/Field/optimizer.h"
@@ -15,25 +14,72 @@ public:
               const QPointF& lastDown, const QPointF& currentDown, const std::vector<std::array<float, 2>> &pointList);
 
 private:
+    // Mirrors the std430 structs of the overlay shaders, one record per constraint and per line segment
+    struct ConstraintData {
+        float centerX, centerY;
+        float width, height;
+        float dirX, dirY;
+        float rotAngle;
+        float skewH;
+        float skewV;
+        float lineCenterX;
+        float lineCenterY;
+        float lineWidth;
+        float lineHeight;
+        float tesselationLod;
+        uint32_t firstLine;
+        uint32_t lineCount;
+    };
+    struct LineData {
+        float x0, y0, x1, y1;
+        uint32_t constraint;
+        uint32_t padding;
+    };
+
+    // Per draw header in the dynamic uniform buffer
+    enum Mode {
+        Constraints = 0,
+        Preview = 1,
+        Outline = 3,
+    };
+
     void createRectData();
     void createHandleData();
     void createPipeline();
     void createHandlePipeline();
     void createPipelineLayout();
     void createUniformBuffer();
+    void createStorageBuffers();
     void createDescriptors();
-    void drawHandles(VkCommandBuffer cb, uint32_t &drawn, const QMatrix4x4& mvp, float scale, float *p, int selected, const std::vector<Optimizer::Constraint>& constraints);
+    void uploadConstraints(const std::vector<Optimizer::Constraint> &constraints);
+    void writePreview(const QPointF& lastDown, const QPointF& currentDown, const std::vector<std::array<float, 2>> &pointList);
+    void bindDraw(VkCommandBuffer cb, VkDescriptorSet set, uint32_t &drawn, const QMatrix4x4& mvp, float scale,
+                  int selected, Mode mode, bool lines, float lod = 0);
 
     VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    VulkanDeviceFunctions *m_devFuncs;
 
-    VkDeviceMemory m_uniformBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_uniformBufMem;
     VkBuffer m_uniformBuf = VK_NULL_HANDLE;
     VkDescriptorBufferInfo m_uniformBufInfo[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
 
+    // Constraints live in device memory and are only uploaded when the optimizer revision changes,
+    // the shape being drawn goes to a small host visible slice per frame
+    MemoryAllocation m_constraintBufMem;
+    VkBuffer m_constraintBuf = VK_NULL_HANDLE;
+    MemoryAllocation m_previewBufMem;
+    VkBuffer m_previewBuf = VK_NULL_HANDLE;
+    VkDeviceSize m_lineOffset;
+    VkDeviceSize m_previewSliceSize;
+    uint64_t m_revision = ~0ull;
+    std::vector<ConstraintData> m_constraintData;
+    uint32_t m_lineCount = 0;
+    uint32_t m_previewLineCount = 0;
+
     VkDescriptorPool m_descPool = VK_NULL_HANDLE;
     VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
     VkDescriptorSet m_descSet[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    VkDescriptorSet m_previewDescSet[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
 
     VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
     VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
@@ -41,13 +87,16 @@ private:
     VkPipeline m_noStencilPipeline = VK_NULL_HANDLE;
     VkPipeline m_handlePipeline = VK_NULL_HANDLE;
 
-    VkDeviceMemory m_rectBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_rectBufMem;
     VkBuffer m_rectBuf = VK_NULL_HANDLE;
-    VkDeviceMemory m_handleBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_handleBufMem;
     VkBuffer m_handleBuf = VK_NULL_HANDLE;
 
     uint32_t m_dynamicAlignment;
     static constexpr uint32_t MAX_CONSTRAINTS = 65536;
+    static constexpr uint32_t MAX_LINES = 65536;
+    static constexpr uint32_t MAX_PREVIEW_LINES = 8192;
+    static constexpr uint32_t MAX_DRAWS = 8;
 
     Texture *m_atlas;
 };
@@ -0,0 +1,472 @@
+#include "src/Render/dynamicresolution.h"
+#include <algorithm>
+#include <cmath>
+
+DynamicResolution::DynamicResolution(VulkanWindow *window, VkPipelineCache &pipelineCache)
+    : m_window(window), m_pipelineCache(pipelineCache) {
+    m_devFuncs = m_window->deviceFunctions();
+
+    createRenderPass();
+    createQueryPool();
+    createDescriptors();
+    createUpsamplePipeline();
+}
+
+DynamicResolution::~DynamicResolution() {
+    VkDevice dev = m_window->device();
+
+    delete m_color;
+    delete m_depth;
+
+    if (m_frameBuffer) {
+        m_devFuncs->vkDestroyFramebuffer(dev, m_frameBuffer, nullptr);
+    }
+    if (m_renderPass) {
+        m_devFuncs->vkDestroyRenderPass(dev, m_renderPass, nullptr);
+    }
+    if (m_upsamplePipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_upsamplePipeline, nullptr);
+    }
+    if (m_upsamplePipelineLayout) {
+        m_devFuncs->vkDestroyPipelineLayout(dev, m_upsamplePipelineLayout, nullptr);
+    }
+    if (m_descSetLayout) {
+        m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
+    }
+    if (m_descPool) {
+        m_devFuncs->vkDestroyDescriptorPool(dev, m_descPool, nullptr);
+    }
+    if (m_queryPool) {
+        m_devFuncs->vkDestroyQueryPool(dev, m_queryPool, nullptr);
+    }
+}
+
+VkRenderPass DynamicResolution::getRenderPass() {
+    return m_renderPass;
+}
+
+float DynamicResolution::getScale() {
+    return m_scale;
+}
+
+bool DynamicResolution::isTimed() {
+    return m_queryPool != VK_NULL_HANDLE;
+}
+
+void DynamicResolution::setTargetFrameTime(float ms) {
+    m_targetTime = ms;
+}
+
+void DynamicResolution::createRenderPass() {
+    VkDevice dev = m_window->device();
+
+    // Renderpass
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference colorAttachmentRef{};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    // Kept so the upsample can write it to the default depth buffer, the overlays test against it
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // The upsample of the previous frame reads both targets before they are cleared again
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency readDependency = {};
+    readDependency.srcSubpass = 0;
+    readDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    readDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    readDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    readDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkSubpassDependency dependencies[2] = { dependency, readDependency };
+
+    std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = dependencies;
+
+    if (m_devFuncs->vkCreateRenderPass(dev, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+        m_window->crash("failed to create render pass!");
+    }
+}
+
+void DynamicResolution::createQueryPool() {
+    const VkPhysicalDeviceLimits *limits = &m_window->physicalDeviceProperties()->limits;
+    if (!limits->timestampComputeAndGraphics) {
+        qWarning("Timestamps are not supported, dynamic resolution stays at full resolution");
+        return;
+    }
+    m_timestampPeriod = limits->timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2*QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+    if (m_devFuncs->vkCreateQueryPool(m_window->device(), &queryPoolInfo, nullptr, &m_queryPool) != VK_SUCCESS) {
+        m_window->crash("failed to create query pool!");
+    }
+}
+
+void DynamicResolution::createDescriptors() {
+    VkDevice dev = m_window->device();
+
+    VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 };
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.poolSizeCount = 1;
+    descPoolInfo.pPoolSizes = &poolSize;
+    descPoolInfo.maxSets = 1;
+    VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create descriptor pool");
+
+    VkDescriptorSetLayoutBinding colorBinding = {
+        0, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding depthBinding = {
+        1, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+        nullptr
+    };
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {colorBinding, depthBinding};
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    descLayoutInfo.pBindings = bindings.data();
+    err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_descSetLayout);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create descriptor set layout");
+
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        nullptr,
+        m_descPool,
+        1,
+        &m_descSetLayout
+    };
+    err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSet);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to allocate descriptor set");
+
+    // Size of the scaled corner relative to the targets
+    VkPushConstantRange pushConstant = { VK_SHADER_STAGE_FRAGMENT_BIT, 0, 2*sizeof(float) };
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+    err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_upsamplePipelineLayout);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create pipeline layout");
+}
+
+void DynamicResolution::createUpsamplePipeline() {
+    VkDevice dev = m_window->device();
+
+    // Shaders
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("upsample_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("upsample_frag.spv"));
+    // Graphics pipeline
+    VkGraphicsPipelineCreateInfo pipelineInfo;
+    memset(&pipelineInfo, 0, sizeof(pipelineInfo));
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_SHADER_STAGE_VERTEX_BIT,
+            vertShaderModule,
+            "main",
+            nullptr
+        },
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            fragShaderModule,
+            "main",
+            nullptr
+        }
+    };
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+
+    // A single triangle covering the viewport is generated from the vertex index
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+
+    VkPipelineInputAssemblyStateCreateInfo ia;
+    memset(&ia, 0, sizeof(ia));
+    ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    pipelineInfo.pInputAssemblyState = &ia;
+
+    // The viewport and scissor will be set dynamically via vkCmdSetViewport/Scissor.
+    // This way the pipeline does not need to be touched when resizing the window.
+    VkPipelineViewportStateCreateInfo vp;
+    memset(&vp, 0, sizeof(vp));
+    vp.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    vp.viewportCount = 1;
+    vp.scissorCount = 1;
+    pipelineInfo.pViewportState = &vp;
+
+    VkPipelineRasterizationStateCreateInfo rs;
+    memset(&rs, 0, sizeof(rs));
+    rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rs.polygonMode = VK_POLYGON_MODE_FILL;
+    rs.cullMode = VK_CULL_MODE_NONE;
+    rs.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rs.lineWidth = 1.0f;
+    pipelineInfo.pRasterizationState = &rs;
+
+    VkPipelineMultisampleStateCreateInfo ms;
+    memset(&ms, 0, sizeof(ms));
+    ms.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    // Enable multisampling.
+    ms.rasterizationSamples = m_window->sampleCountFlagBits();
+    pipelineInfo.pMultisampleState = &ms;
+
+    // Every pixel takes the scene depth, whatever the cleared buffer holds
+    VkPipelineDepthStencilStateCreateInfo ds;
+    memset(&ds, 0, sizeof(ds));
+    ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    ds.depthTestEnable = VK_TRUE;
+    ds.depthWriteEnable = VK_TRUE;
+    ds.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+    pipelineInfo.pDepthStencilState = &ds;
+
+    VkPipelineColorBlendStateCreateInfo cb;
+    memset(&cb, 0, sizeof(cb));
+    cb.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+    VkPipelineColorBlendAttachmentState att{};
+    att.colorWriteMask = 0xF;
+    cb.attachmentCount = 1;
+    cb.pAttachments = &att;
+    pipelineInfo.pColorBlendState = &cb;
+
+    VkDynamicState dynEnable[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dyn;
+    memset(&dyn, 0, sizeof(dyn));
+    dyn.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dyn.dynamicStateCount = sizeof(dynEnable) / sizeof(VkDynamicState);
+    dyn.pDynamicStates = dynEnable;
+    pipelineInfo.pDynamicState = &dyn;
+
+    pipelineInfo.layout = m_upsamplePipelineLayout;
+    pipelineInfo.renderPass = m_window->defaultRenderPass();
+
+    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_upsamplePipeline);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create graphics pipeline");
+
+    if (vertShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, vertShaderModule, nullptr);
+    if (fragShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
+}
+
+void DynamicResolution::resizeFrameBuffer() {
+    const QSize sz = m_window->swapChainImageSize();
+    m_width = sz.width();
+    m_height = sz.height();
+
+    // Allocated at full size once, changing the scale only moves the viewport
+    delete m_color;
+    m_color = new Texture(m_width, m_height, m_window, 1, VK_FORMAT_R16G16B16A16_SFLOAT, false, true, true);
+    delete m_depth;
+    m_depth = new Texture(m_width, m_height, m_window, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
+
+    if (m_frameBuffer) {
+        m_devFuncs->vkDestroyFramebuffer(m_window->device(), m_frameBuffer, nullptr);
+    }
+
+    std::array<VkImageView, 2> attachments = {
+        m_color->getImageView(),
+        m_depth->getImageView()
+    };
+
+    VkFramebufferCreateInfo framebufferInfo {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = m_renderPass;
+    framebufferInfo.attachmentCount = attachments.size();
+    framebufferInfo.pAttachments = attachments.data();
+    framebufferInfo.width = m_width;
+    framebufferInfo.height = m_height;
+    framebufferInfo.layers = 1;
+
+    if (m_devFuncs->vkCreateFramebuffer(m_window->device(), &framebufferInfo, nullptr, &m_frameBuffer) != VK_SUCCESS) {
+        m_window->crash("failed to create framebuffer!");
+    }
+
+    std::array<VkDescriptorImageInfo, 2> imageInfo{};
+    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[0].imageView = m_color->getImageView();
+    imageInfo[0].sampler = m_color->getTextureSampler();
+    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[1].imageView = m_depth->getImageView();
+    imageInfo[1].sampler = m_depth->getTextureSampler();
+
+    std::array<VkWriteDescriptorSet, 2> descWrites{};
+    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[0].dstSet = m_descSet;
+    descWrites[0].dstBinding = 0;
+    descWrites[0].dstArrayElement = 0;
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[0].descriptorCount = 1;
+    descWrites[0].pImageInfo = &imageInfo[0];
+    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[1].dstSet = m_descSet;
+    descWrites[1].dstBinding = 1;
+    descWrites[1].dstArrayElement = 0;
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[1].descriptorCount = 1;
+    descWrites[1].pImageInfo = &imageInfo[1];
+
+    m_devFuncs->vkUpdateDescriptorSets(m_window->device(), 2, descWrites.data(), 0, nullptr);
+
+    // Timestamps recorded before the resize measured another size
+    std::fill(std::begin(m_queried), std::end(m_queried), false);
+    m_frameTime = 0.0f;
+}
+
+void DynamicResolution::updateScale(float ms) {
+    m_frameTime = m_frameTime > 0 ? 0.9f*m_frameTime + 0.1f*ms : ms;
+
+    // The cost follows the pixel count, so the side goes with the square root of the time ratio. Small
+    // errors are left alone and the step is capped, a single slow frame should not make the image jump.
+    const float ratio = m_targetTime/m_frameTime;
+    if (ratio > 0.95f && ratio < 1.05f) {
+        return;
+    }
+    m_scale = std::clamp(m_scale*std::clamp(std::sqrt(ratio), 0.9f, 1.05f), MIN_SCALE, 1.0f);
+}
+
+void DynamicResolution::beginFrame(VkCommandBuffer cb, bool adapt) {
+    if (!m_queryPool) {
+        return;
+    }
+
+    // The fence of this frame slot has been waited on, its queries are normally available
+    const uint32_t first = 2*m_window->currentFrame();
+    uint64_t timestamps[2];
+    if (adapt && m_queried[m_window->currentFrame()] &&
+        m_devFuncs->vkGetQueryPoolResults(m_window->device(), m_queryPool, first, 2, sizeof(timestamps), timestamps,
+                                          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        updateScale((timestamps[1]-timestamps[0])*m_timestampPeriod*1e-6f);
+    }
+
+    m_devFuncs->vkCmdResetQueryPool(cb, m_queryPool, first, 2);
+    m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, first);
+}
+
+void DynamicResolution::endFrame(VkCommandBuffer cb) {
+    if (!m_queryPool) {
+        return;
+    }
+    m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 2*m_window->currentFrame()+1);
+    m_queried[m_window->currentFrame()] = true;
+}
+
+void DynamicResolution::beginScene(VkCommandBuffer cb) {
+    VkClearValue clearValues[2];
+    memset(clearValues, 0, sizeof(clearValues));
+    clearValues[0].color = {{ 0.45, 0.45, 0.45, 1 }};
+    clearValues[1].depthStencil = { 1, 0 };
+
+    const uint32_t width = std::max(uint32_t(std::ceil(m_width*m_scale)), 1u);
+    const uint32_t height = std::max(uint32_t(std::ceil(m_height*m_scale)), 1u);
+
+    VkRenderPassBeginInfo rpBeginInfo{};
+    rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    rpBeginInfo.renderPass = m_renderPass;
+    rpBeginInfo.framebuffer = m_frameBuffer;
+    rpBeginInfo.renderArea.extent.width = width;
+    rpBeginInfo.renderArea.extent.height = height;
+    rpBeginInfo.clearValueCount = 2;
+    rpBeginInfo.pClearValues = clearValues;
+    m_devFuncs->vkCmdBeginRenderPass(cb, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    // Same projection as the full window, only squeezed into the corner
+    VkViewport viewport;
+    viewport.x = viewport.y = 0;
+    viewport.width = width;
+    viewport.height = height;
+    viewport.minDepth = 0;
+    viewport.maxDepth = 1;
+    m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
+
+    VkRect2D scissor;
+    scissor.offset.x = scissor.offset.y = 0;
+    scissor.extent.width = width;
+    scissor.extent.height = height;
+    m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
+}
+
+void DynamicResolution::endScene(VkCommandBuffer cb) {
+    m_devFuncs->vkCmdEndRenderPass(cb);
+}
+
+void DynamicResolution::upsample(VkCommandBuffer cb) {
+    const float scale[2] = {
+        std::max(std::ceil(m_width*m_scale), 1.0f)/m_width,
+        std::max(std::ceil(m_height*m_scale), 1.0f)/m_height
+    };
+
+    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_upsamplePipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_upsamplePipelineLayout, 0, 1, &m_descSet, 0, nullptr);
+    m_devFuncs->vkCmdPushConstants(cb, m_upsamplePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(scale), scale);
+    m_devFuncs->vkCmdDraw(cb, 3, 1, 0, 0);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "src/UI/vulkanwindow.h"
+#include "src/Render/memoryallocator.h"
+
+// Renders the scene into the top left corner of swapchain sized targets and stretches it over the
+// window. The corner is scaled from GPU timestamps around every frame so the frame time holds the
+// target, overlays drawn afterwards in the default render pass stay at native resolution.
+class DynamicResolution {
+public:
+    DynamicResolution(VulkanWindow *window, VkPipelineCache &pipelineCache);
+    ~DynamicResolution();
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    void resizeFrameBuffer();
+    // Views drawn in beginScene() are created against this single sampled render pass
+    VkRenderPass getRenderPass();
+
+    // Read the timestamps of the last use of this frame slot and pick the scale unless adapt is
+    // false, then start timing
+    void beginFrame(VkCommandBuffer cb, bool adapt = true);
+    // Begin the scene render pass, viewport and scissor cover the scaled corner
+    void beginScene(VkCommandBuffer cb);
+    void endScene(VkCommandBuffer cb);
+    // Draw the scene over the whole default render pass, depth included for the overlays
+    void upsample(VkCommandBuffer cb);
+    void endFrame(VkCommandBuffer cb);
+
+    void setTargetFrameTime(float ms);
+    float getScale();
+    // Timestamps are optional on some devices, the scene is then kept at full resolution
+    bool isTimed();
+
+private:
+    void createRenderPass();
+    void createQueryPool();
+    void createDescriptors();
+    void createUpsamplePipeline();
+    void updateScale(float ms);
+
+    VulkanWindow *m_window;
+    VulkanDeviceFunctions *m_devFuncs;
+    VkPipelineCache &m_pipelineCache;
+
+    VkRenderPass m_renderPass = VK_NULL_HANDLE;
+    VkFramebuffer m_frameBuffer = VK_NULL_HANDLE;
+    Texture *m_color = nullptr;
+    Texture *m_depth = nullptr;
+
+    VkDescriptorPool m_descPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet m_descSet = VK_NULL_HANDLE;
+    VkPipelineLayout m_upsamplePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_upsamplePipeline = VK_NULL_HANDLE;
+
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+    bool m_queried[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT]{};
+    float m_timestampPeriod = 1.0f;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    float m_scale = 1.0f;
+    float m_frameTime = 0.0f;
+    float m_targetTime = 1000.0f/60.0f;
+    static constexpr float MIN_SCALE = 0.25f;
+};
@@ -0,0 +1,235 @@
+#include "src/Render/errormetrics.h"
+#include "src/Render/stagingring.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+ErrorMetrics::ErrorMetrics(VulkanContext *context, uint32_t width, uint32_t height)
+    : m_context(context), m_tilesX((width+TILE_SIZE-1)/TILE_SIZE), m_tilesY((height+TILE_SIZE-1)/TILE_SIZE) {
+    m_devFuncs = m_context->deviceFunctions();
+
+    m_map = new Texture(width, height, m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true, true);
+
+    createStatsBuffer();
+    createDescriptors();
+    createPipeline();
+}
+
+ErrorMetrics::~ErrorMetrics() {
+    VkDevice dev = m_context->device();
+
+    delete m_map;
+
+    if (m_pipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+    }
+    if (m_pipelineLayout) {
+        m_devFuncs->vkDestroyPipelineLayout(dev, m_pipelineLayout, nullptr);
+    }
+    if (m_descSetLayout) {
+        m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
+    }
+    if (m_descPool) {
+        m_devFuncs->vkDestroyDescriptorPool(dev, m_descPool, nullptr);
+    }
+    if (m_statsBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_statsBuf, nullptr);
+    }
+    m_context->getAllocator()->free(m_statsBufMem);
+}
+
+Texture* ErrorMetrics::getMap() {
+    return m_map;
+}
+
+void ErrorMetrics::createStatsBuffer() {
+    VkDevice dev = m_context->device();
+
+    // Maximum Delta E and padding, then squared error, relative squared error, Delta E and pixel count per tile
+    m_statsSize = 4*sizeof(uint32_t) + VkDeviceSize(m_tilesX)*m_tilesY*4*sizeof(float);
+
+    VkBufferCreateInfo statsBufInfo{};
+    statsBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    statsBufInfo.size = m_statsSize;
+    statsBufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VkResult err = m_devFuncs->vkCreateBuffer(dev, &statsBufInfo, nullptr, &m_statsBuf);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to create buffer");
+
+    m_statsBufMem = m_context->getAllocator()->allocateBuffer(m_statsBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void ErrorMetrics::createDescriptors() {
+    VkDevice dev = m_context->device();
+
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = 2;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = 1;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descPoolInfo.pPoolSizes = poolSizes.data();
+    descPoolInfo.maxSets = 1;
+    VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor pool");
+
+    VkDescriptorSetLayoutBinding referenceBinding = {
+        0, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding testBinding = {
+        1, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding mapBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding statsBinding = {
+        3, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings = {referenceBinding, testBinding, mapBinding, statsBinding};
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    descLayoutInfo.pBindings = bindings.data();
+    err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_descSetLayout);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor set layout");
+
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        nullptr,
+        m_descPool,
+        1,
+        &m_descSetLayout
+    };
+    err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSet);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to allocate descriptor set");
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
+    if (m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline layout!");
+    }
+}
+
+void ErrorMetrics::createPipeline() {
+    VkDevice dev = m_context->device();
+
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("errorMetrics_comp.spv"));
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = m_pipelineLayout;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = computeShaderModule;
+    pipelineInfo.stage.pName = "main";
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_pipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
+    }
+    m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
+}
+
+void ErrorMetrics::updateDescriptors(Texture *reference, Texture *test) {
+    std::array<VkDescriptorImageInfo, 3> imageInfo{};
+    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[0].imageView = reference->getImageView();
+    imageInfo[0].sampler = reference->getTextureSampler();
+    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[1].imageView = test->getImageView();
+    imageInfo[1].sampler = test->getTextureSampler();
+    imageInfo[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[2].imageView = m_map->getImageView();
+
+    VkDescriptorBufferInfo bufferInfo = { m_statsBuf, 0, m_statsSize };
+
+    std::array<VkWriteDescriptorSet, 4> descWrites{};
+    for (uint32_t i = 0; i < descWrites.size(); i++) {
+        descWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[i].dstSet = m_descSet;
+        descWrites[i].dstBinding = i;
+        descWrites[i].dstArrayElement = 0;
+        descWrites[i].descriptorCount = 1;
+    }
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[0].pImageInfo = &imageInfo[0];
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[1].pImageInfo = &imageInfo[1];
+    descWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descWrites[2].pImageInfo = &imageInfo[2];
+    descWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descWrites[3].pBufferInfo = &bufferInfo;
+
+    m_devFuncs->vkUpdateDescriptorSets(m_context->device(), static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+}
+
+ErrorMetrics::Result ErrorMetrics::compare(Texture *reference, Texture *test) {
+    // Only the maximum is accumulated across tiles, every tile overwrites its own sums
+    updateDescriptors(reference, test);
+    memset(m_statsBufMem.mapped, 0, 4*sizeof(uint32_t));
+
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(0);
+
+    VkMemoryBarrier renderBarrier{};
+    renderBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    renderBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    renderBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &renderBarrier, 0, nullptr, 0, nullptr);
+    m_devFuncs->vkCmdBindPipeline(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descSet, 0, nullptr);
+    m_devFuncs->vkCmdDispatch(transfer.commandBuffer, m_tilesX, m_tilesY, 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+    staging->wait(staging->submit(transfer));
+
+    const uint32_t *header = static_cast<const uint32_t *>(m_statsBufMem.mapped);
+    const float *tiles = reinterpret_cast<const float *>(header + 4);
+    double sum[4] = {};
+    for (size_t i = 0; i < size_t(m_tilesX)*m_tilesY; i++) {
+        for (size_t c = 0; c < 4; c++) {
+            sum[c] += tiles[4*i+c];
+        }
+    }
+
+    Result result;
+    const double count = std::max(sum[3], 1.0);
+    result.rmse = std::sqrt(sum[0]/count);
+    result.relMse = sum[1]/count;
+    result.meanDeltaE = sum[2]/count;
+    memcpy(&result.maxDeltaE, header, sizeof(float));
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "src/Render/vulkancontext.h"
+#include "src/Render/memoryallocator.h"
+#include "src/Texture/texture.h"
+
+// Compares two renders of the same view on the GPU. Every 16x16 tile reduces its errors in shared
+// memory and only the per tile sums are read back. The error map holds the CIELAB Delta E of each
+// pixel divided by 10, so a PNG of it saturates where the difference is obvious.
+class ErrorMetrics {
+public:
+    struct Result {
+        double rmse;
+        double relMse;
+        double meanDeltaE;
+        float maxDeltaE;
+    };
+
+    ErrorMetrics(VulkanContext *context, uint32_t width, uint32_t height);
+    ~ErrorMetrics();
+
+    ErrorMetrics(const ErrorMetrics&) = delete;
+    ErrorMetrics& operator=(const ErrorMetrics&) = delete;
+
+    // Both are accumulations of Offscreen, pixels either of them never drew are skipped
+    Result compare(Texture *reference, Texture *test);
+    Texture* getMap();
+
+private:
+    void createStatsBuffer();
+    void createDescriptors();
+    void createPipeline();
+    void updateDescriptors(Texture *reference, Texture *test);
+
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+
+    VkDescriptorPool m_descPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet m_descSet = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    MemoryAllocation m_statsBufMem;
+    VkBuffer m_statsBuf = VK_NULL_HANDLE;
+    VkDeviceSize m_statsSize = 0;
+
+    Texture *m_map = nullptr;
+    uint32_t m_tilesX;
+    uint32_t m_tilesY;
+    static constexpr uint32_t TILE_SIZE = 16;
+};
@@ -0,0 +1,212 @@
+#include "src/Render/headlesscontext.h"
+#include <cstring>
+#include <vector>
+
+HeadlessContext::HeadlessContext() {
+    loadLoader();
+    createInstance();
+    pickPhysicalDevice();
+    createDevice();
+    createCommandPool();
+}
+
+HeadlessContext::~HeadlessContext() {
+    if (m_device) {
+        VulkanDeviceFunctions *devFuncs = deviceFunctions();
+        devFuncs->vkDeviceWaitIdle(m_device);
+        if (m_commandPool) {
+            devFuncs->vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+        }
+        devFuncs->vkDestroyDevice(m_device, nullptr);
+    }
+    if (m_instance) {
+        functions()->vkDestroyInstance(m_instance, nullptr);
+    }
+}
+
+VkInstance HeadlessContext::vkInstance() const {
+    return m_instance;
+}
+
+PFN_vkGetInstanceProcAddr HeadlessContext::getInstanceProcAddr() const {
+    return m_getInstanceProcAddr;
+}
+
+VkPhysicalDevice HeadlessContext::physicalDevice() const {
+    return m_physicalDevice;
+}
+
+const VkPhysicalDeviceProperties *HeadlessContext::physicalDeviceProperties() const {
+    return &m_physicalDeviceProperties;
+}
+
+VkDevice HeadlessContext::device() const {
+    return m_device;
+}
+
+VkQueue HeadlessContext::graphicsQueue() const {
+    return m_queue;
+}
+
+uint32_t HeadlessContext::graphicsQueueFamilyIndex() const {
+    return m_queueFamilyIndex;
+}
+
+VkCommandPool HeadlessContext::graphicsCommandPool() const {
+    return m_commandPool;
+}
+
+int HeadlessContext::concurrentFrameCount() const {
+    return 1;
+}
+
+int HeadlessContext::currentFrame() const {
+    return 0;
+}
+
+QMatrix4x4 HeadlessContext::clipCorrectionMatrix() {
+    // Same as QVulkanWindow: Y down and depth in [0, 1]
+    return QMatrix4x4(1.0f, 0.0f, 0.0f, 0.0f,
+                      0.0f, -1.0f, 0.0f, 0.0f,
+                      0.0f, 0.0f, 0.5f, 0.5f,
+                      0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+void HeadlessContext::loadLoader() {
+#ifdef Q_OS_WIN
+    m_loader.setFileName("vulkan-1");
+#else
+    m_loader.setFileNameAndVersion("vulkan", 1);
+#endif
+    if (!m_loader.load())
+        crash("Failed to load the Vulkan loader: "+m_loader.errorString());
+
+    m_getInstanceProcAddr = reinterpret_cast<PFN_vkGetInstanceProcAddr>(m_loader.resolve("vkGetInstanceProcAddr"));
+    if (!m_getInstanceProcAddr)
+        crash("Failed to resolve vkGetInstanceProcAddr");
+}
+
+void HeadlessContext::createInstance() {
+    PFN_vkCreateInstance createInstance = reinterpret_cast<PFN_vkCreateInstance>(
+        m_getInstanceProcAddr(VK_NULL_HANDLE, "vkCreateInstance"));
+
+    std::vector<const char *> layers;
+#ifdef QT_DEBUG
+    PFN_vkEnumerateInstanceLayerProperties enumerateLayers = reinterpret_cast<PFN_vkEnumerateInstanceLayerProperties>(
+        m_getInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceLayerProperties"));
+    uint32_t layerCount = 0;
+    enumerateLayers(&layerCount, nullptr);
+    std::vector<VkLayerProperties> availableLayers(layerCount);
+    enumerateLayers(&layerCount, availableLayers.data());
+    for (const VkLayerProperties &layer: availableLayers) {
+        if (strcmp(layer.layerName, "VK_LAYER_KHRONOS_validation") == 0) {
+            layers.push_back("VK_LAYER_KHRONOS_validation");
+        }
+    }
+#endif
+
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Tangent Field Editor";
+    appInfo.apiVersion = VK_API_VERSION_1_1;
+
+    VkInstanceCreateInfo instanceInfo{};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+    instanceInfo.enabledLayerCount = layers.size();
+    instanceInfo.ppEnabledLayerNames = layers.data();
+
+    VkResult err = createInstance(&instanceInfo, nullptr, &m_instance);
+    if (err != VK_SUCCESS)
+        crash("Failed to create Vulkan instance: "+QString::number(err));
+}
+
+void HeadlessContext::pickPhysicalDevice() {
+    VulkanFunctions *f = functions();
+
+    uint32_t count = 0;
+    f->vkEnumeratePhysicalDevices(m_instance, &count, nullptr);
+    if (!count)
+        crash("No Vulkan physical device");
+    std::vector<VkPhysicalDevice> devices(count);
+    f->vkEnumeratePhysicalDevices(m_instance, &count, devices.data());
+
+    // Same override as the window
+    uint32_t index = qEnvironmentVariableIntValue("QT_VK_PHYSICAL_DEVICE_INDEX");
+    if (index >= count) index = 0;
+    m_physicalDevice = devices[index];
+    f->vkGetPhysicalDeviceProperties(m_physicalDevice, &m_physicalDeviceProperties);
+}
+
+void HeadlessContext::createDevice() {
+    VulkanFunctions *f = functions();
+
+    // A single queue serves both the graphics and the compute work
+    uint32_t familyCount = 0;
+    f->vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    f->vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &familyCount, families.data());
+    const VkQueueFlags flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+    m_queueFamilyIndex = familyCount;
+    for (uint32_t i = 0; i < familyCount; i++) {
+        if ((families[i].queueFlags & flags) == flags) {
+            m_queueFamilyIndex = i;
+            break;
+        }
+    }
+    if (m_queueFamilyIndex == familyCount)
+        crash("No queue family with graphics and compute");
+    setComputeQueueFamilyIndex(m_queueFamilyIndex);
+
+    const float prio[] = {0};
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = m_queueFamilyIndex;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = prio;
+
+    uint32_t extensionCount = 0;
+    f->vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    f->vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+    std::vector<const char *> extensions;
+    for (const VkExtensionProperties &extension: availableExtensions) {
+        if (strcmp(extension.extensionName, "VK_EXT_descriptor_indexing") == 0) {
+            extensions.push_back("VK_EXT_descriptor_indexing");
+        }
+    }
+
+    // Everything the device supports is enabled, like the features modifier of the window
+    VkPhysicalDeviceDescriptorIndexingFeatures indexFeatures{};
+    VkPhysicalDeviceHostQueryResetFeatures resetFeatures{};
+    indexFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    resetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &indexFeatures;
+    indexFeatures.pNext = &resetFeatures;
+    f->vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &features;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+    deviceInfo.enabledExtensionCount = extensions.size();
+    deviceInfo.ppEnabledExtensionNames = extensions.data();
+
+    VkResult err = f->vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device);
+    if (err != VK_SUCCESS)
+        crash("Failed to create Vulkan device: "+QString::number(err));
+
+    deviceFunctions()->vkGetDeviceQueue(m_device, m_queueFamilyIndex, 0, &m_queue);
+}
+
+void HeadlessContext::createCommandPool() {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = m_queueFamilyIndex;
+    if (deviceFunctions()->vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS)
+        crash("Failed to create command pool");
+}
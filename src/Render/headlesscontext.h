@@ -0,0 +1,44 @@
+#pragma once
+#include "src/Render/vulkancontext.h"
+#include <QLibrary>
+
+// Instance and device created straight through the Vulkan loader for the command line outputs.
+// QVulkanInstance needs a platform plugin with Vulkan support, so it would not run without a display
+class HeadlessContext : public VulkanContext {
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    VkInstance vkInstance() const override;
+    PFN_vkGetInstanceProcAddr getInstanceProcAddr() const override;
+    VkPhysicalDevice physicalDevice() const override;
+    const VkPhysicalDeviceProperties *physicalDeviceProperties() const override;
+    VkDevice device() const override;
+    VkQueue graphicsQueue() const override;
+    uint32_t graphicsQueueFamilyIndex() const override;
+    VkCommandPool graphicsCommandPool() const override;
+    // Every submission waits for completion, there is a single frame
+    int concurrentFrameCount() const override;
+    int currentFrame() const override;
+    QMatrix4x4 clipCorrectionMatrix() override;
+
+private:
+    void loadLoader();
+    void createInstance();
+    void pickPhysicalDevice();
+    void createDevice();
+    void createCommandPool();
+
+    QLibrary m_loader;
+    PFN_vkGetInstanceProcAddr m_getInstanceProcAddr = nullptr;
+    VkInstance m_instance = VK_NULL_HANDLE;
+    VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties m_physicalDeviceProperties{};
+    VkDevice m_device = VK_NULL_HANDLE;
+    uint32_t m_queueFamilyIndex = 0;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+};
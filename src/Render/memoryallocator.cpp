@@ -0,0 +1,210 @@
+#include "memoryallocator.h"
+#include "src/Render/vulkancontext.h"
+#include <algorithm>
+
+MemoryAllocator::MemoryAllocator(VulkanContext *context) : m_context(context) {
+    m_devFuncs = m_context->deviceFunctions();
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    VkDevice dev = m_context->device();
+    for (Pool &pool: m_pools) {
+        for (Block &block: pool.blocks) {
+            if (block.allocations) {
+                qWarning("Memory block released with %u live allocations", block.allocations);
+            }
+            if (block.memory) {
+                m_devFuncs->vkFreeMemory(dev, block.memory, nullptr);
+            }
+        }
+    }
+    if (m_dedicatedCount) {
+        qWarning("%u dedicated allocations leaked", m_dedicatedCount);
+    }
+}
+
+VkDeviceSize MemoryAllocator::sizeClass(VkDeviceSize size) {
+    // Power of two classes up to 1 MB, then 64 KB granularity
+    if (size <= MAX_SIZE_CLASS) {
+        VkDeviceSize c = MIN_SIZE_CLASS;
+        while (c < size) c *= 2;
+        return c;
+    }
+    return m_context->aligned(size, 64*1024);
+}
+
+VkDeviceMemory MemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryType, void **mapped) {
+    VkDevice dev = m_context->device();
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (m_devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        m_context->crash("failed to allocate device memory!");
+    }
+
+    *mapped = nullptr;
+    const VkPhysicalDeviceMemoryProperties *memProperties = m_context->physicalDeviceMemoryProperties();
+    if (memProperties->memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (m_devFuncs->vkMapMemory(dev, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            m_context->crash("failed to map device memory!");
+        }
+    }
+    return memory;
+}
+
+bool MemoryAllocator::allocateFromBlock(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+    // Best fit over the free ranges, the leftover in front of an aligned offset stays free
+    size_t best = block.free.size();
+    VkDeviceSize bestWaste = ~VkDeviceSize(0);
+    for (size_t i = 0; i < block.free.size(); i++) {
+        const Range &range = block.free[i];
+        const VkDeviceSize start = m_context->aligned(range.offset, alignment);
+        if (start + size > range.offset + range.size) continue;
+        const VkDeviceSize waste = range.size - size;
+        if (waste < bestWaste) {
+            bestWaste = waste;
+            best = i;
+        }
+    }
+    if (best == block.free.size()) return false;
+
+    Range range = block.free[best];
+    block.free.erase(block.free.begin() + best);
+    offset = m_context->aligned(range.offset, alignment);
+
+    if (offset > range.offset) {
+        block.free.push_back({ range.offset, offset - range.offset });
+    }
+    if (offset + size < range.offset + range.size) {
+        block.free.push_back({ offset + size, range.offset + range.size - offset - size });
+    }
+    std::sort(block.free.begin(), block.free.end(), [](const Range &a, const Range &b) { return a.offset < b.offset; });
+
+    block.allocations++;
+    return true;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const uint32_t memoryType = m_context->findMemoryType(requirements.memoryTypeBits, properties);
+    const VkDeviceSize size = sizeClass(requirements.size);
+    // Linear and optimal resources never share a block, so bufferImageGranularity never applies
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+    MemoryAllocation allocation;
+    allocation.size = size;
+
+    if (size > BLOCK_SIZE/2) {
+        allocation.memory = allocateMemory(requirements.size, memoryType, &allocation.mapped);
+        allocation.size = requirements.size;
+        m_dedicatedCount++;
+        return allocation;
+    }
+
+    size_t poolIndex = 0;
+    while (poolIndex < m_pools.size() && (m_pools[poolIndex].memoryType != memoryType || m_pools[poolIndex].linear != linear)) {
+        poolIndex++;
+    }
+    if (poolIndex == m_pools.size()) {
+        m_pools.push_back({ memoryType, linear, {} });
+    }
+    Pool &pool = m_pools[poolIndex];
+
+    size_t blockIndex = 0;
+    for (; blockIndex < pool.blocks.size(); blockIndex++) {
+        Block &block = pool.blocks[blockIndex];
+        if (block.memory && allocateFromBlock(block, size, alignment, allocation.offset)) break;
+    }
+
+    if (blockIndex == pool.blocks.size()) {
+        // Reuse a slot released by trim() so indices held by live allocations stay valid
+        blockIndex = 0;
+        while (blockIndex < pool.blocks.size() && pool.blocks[blockIndex].memory) blockIndex++;
+        if (blockIndex == pool.blocks.size()) pool.blocks.emplace_back();
+
+        Block &block = pool.blocks[blockIndex];
+        block.size = BLOCK_SIZE;
+        block.memory = allocateMemory(block.size, memoryType, &block.mapped);
+        block.free = { { 0, block.size } };
+        allocateFromBlock(block, size, alignment, allocation.offset);
+    }
+
+    Block &block = pool.blocks[blockIndex];
+    allocation.memory = block.memory;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + allocation.offset : nullptr;
+    allocation.pool = poolIndex;
+    allocation.block = blockIndex;
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements memRequirements;
+    m_devFuncs->vkGetBufferMemoryRequirements(m_context->device(), buffer, &memRequirements);
+
+    MemoryAllocation allocation = allocate(memRequirements, properties, true);
+    m_devFuncs->vkBindBufferMemory(m_context->device(), buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties, bool linear) {
+    VkMemoryRequirements memRequirements;
+    m_devFuncs->vkGetImageMemoryRequirements(m_context->device(), image, &memRequirements);
+
+    MemoryAllocation allocation = allocate(memRequirements, properties, linear);
+    m_devFuncs->vkBindImageMemory(m_context->device(), image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation) {
+    if (!allocation) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (allocation.pool < 0) {
+        m_devFuncs->vkFreeMemory(m_context->device(), allocation.memory, nullptr);
+        m_dedicatedCount--;
+        allocation = MemoryAllocation();
+        return;
+    }
+
+    Block &block = m_pools[allocation.pool].blocks[allocation.block];
+    block.allocations--;
+
+    // Insert back and merge with the neighbours
+    Range range = { allocation.offset, allocation.size };
+    auto it = std::lower_bound(block.free.begin(), block.free.end(), range,
+                               [](const Range &a, const Range &b) { return a.offset < b.offset; });
+    it = block.free.insert(it, range);
+    if (it+1 != block.free.end() && it->offset + it->size == (it+1)->offset) {
+        it->size += (it+1)->size;
+        block.free.erase(it+1);
+    }
+    if (it != block.free.begin() && (it-1)->offset + (it-1)->size == it->offset) {
+        (it-1)->size += it->size;
+        block.free.erase(it);
+    }
+
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::trim() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Keep one empty block per pool around, the next resource of the same kind will need it
+    for (Pool &pool: m_pools) {
+        bool keptOne = false;
+        for (Block &block: pool.blocks) {
+            if (!block.memory || block.allocations) continue;
+            if (!keptOne) {
+                keptOne = true;
+                continue;
+            }
+            m_devFuncs->vkFreeMemory(m_context->device(), block.memory, nullptr);
+            block = Block();
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <QVulkanWindow>
+#include <mutex>
+#include <vector>
+
+class VulkanContext;
+
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Host visible memory stays mapped for its whole life, this points at offset
+    void *mapped = nullptr;
+
+    int32_t pool = -1;
+    int32_t block = -1;
+
+    operator bool() const { return memory != VK_NULL_HANDLE; }
+};
+
+// Sub-allocates resources from large device memory blocks instead of one vkAllocateMemory each.
+// Sizes are rounded to size classes so freed ranges are easy to reuse, buffers and linear images
+// live in different blocks than optimal images and big resources get a dedicated allocation.
+class MemoryAllocator {
+public:
+    MemoryAllocator(VulkanContext *context);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    // Allocate and bind, crash on failure like the rest of the resource creation code
+    MemoryAllocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+    MemoryAllocation allocateImage(VkImage image, VkMemoryPropertyFlags properties, bool linear = false);
+    void free(MemoryAllocation &allocation);
+
+    // Release empty blocks, called when the field or the window is resized
+    void trim();
+
+private:
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t allocations = 0;
+        void *mapped = nullptr;
+        std::vector<Range> free;
+    };
+
+    struct Pool {
+        uint32_t memoryType;
+        bool linear;
+        std::vector<Block> blocks;
+    };
+
+    MemoryAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear);
+    bool allocateFromBlock(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+    VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, void **mapped);
+    VkDeviceSize sizeClass(VkDeviceSize size);
+
+    static constexpr VkDeviceSize BLOCK_SIZE = 64*1024*1024;
+    static constexpr VkDeviceSize MIN_SIZE_CLASS = 256;
+    static constexpr VkDeviceSize MAX_SIZE_CLASS = 1024*1024;
+
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+    std::mutex m_mutex;
+
+    std::vector<Pool> m_pools;
+    uint32_t m_dedicatedCount = 0;
+};
@@ -1,9 +1,8 @@
 #include "mesh.h"
 #include "objloader.h"
-#include <QVulkanFunctions>
-#include "src/UI/vulkanwindow.h"
+#include "src/Render/vulkancontext.h"
 
-Mesh::Mesh(const QString& path, VulkanWindow *w) : m_window(w) {
+Mesh::Mesh(const QString& path, VulkanContext *context) : m_context(context) {
     ObjLoader loader;
 #ifdef _WIN32
     loader.load(path.toStdWString().c_str());
@@ -47,8 +46,8 @@ Mesh::Mesh(const QString& path, VulkanWindow *w) : m_window(w) {
     size_t vertexDataSize = loader.getVertCount()*sizeof(Vertex);
     size_t indexDataSize = m_indexCount*sizeof(uint32_t);
 
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    m_devFuncs = m_context->deviceFunctions();
 
     VkBufferCreateInfo meshBufInfo;
     memset(&meshBufInfo, 0, sizeof(meshBufInfo));
@@ -59,81 +58,60 @@ Mesh::Mesh(const QString& path, VulkanWindow *w) : m_window(w) {
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &meshBufInfo, nullptr, &m_meshBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
+        m_context->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_meshBuf, &meshMemReq);
+    m_meshBufMem = m_context->getAllocator()->allocateBuffer(m_meshBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_meshBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_meshBuf, m_meshBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_meshBufMem, 0, meshMemReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    quint8 *p = static_cast<quint8 *>(m_meshBufMem.mapped);
     memcpy(p, vertexData, vertexDataSize);
     memcpy(p+vertexDataSize, indexData, indexDataSize);
-    m_devFuncs->vkUnmapMemory(dev, m_meshBufMem);
 }
 
 Mesh::~Mesh() {
-    VkDevice dev = m_window->device();
     if (!m_isValid) {
         return;
     }
 
-    m_devFuncs->vkDeviceWaitIdle(dev);
-    if (m_meshBuf) {
-        m_devFuncs->vkDestroyBuffer(dev, m_meshBuf, nullptr);
-        m_meshBuf = VK_NULL_HANDLE;
-    }
+    release();
+}
 
-    if (m_meshBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_meshBufMem, nullptr);
-        m_meshBufMem = VK_NULL_HANDLE;
-    }
+void Mesh::release() {
+    // Frames in flight may still read the vertices, destroy the buffer once they are done
+    VulkanContext *context = m_context;
+    VkBuffer buffer = m_meshBuf;
+    MemoryAllocation memory = m_meshBufMem;
+    m_context->deferDestroy([context, buffer, memory]() mutable {
+        VkDevice dev = context->device();
+        if (buffer) {
+            context->deviceFunctions()->vkDestroyBuffer(dev, buffer, nullptr);
+        }
+        context->getAllocator()->free(memory);
+    });
+
+    m_meshBuf = VK_NULL_HANDLE;
+    m_meshBufMem = MemoryAllocation();
 }
 
 Mesh::Mesh(Mesh&& other) {
-    m_window = other.m_window;
+    m_context = other.m_context;
     m_devFuncs = other.m_devFuncs;
     m_meshBufMem = other.m_meshBufMem;
     m_vbOffset = other.m_vbOffset;
     m_ibOffset = other.m_ibOffset;
     m_indexCount = other.m_indexCount;
-    other.m_meshBufMem = VK_NULL_HANDLE;
+    other.m_meshBufMem = MemoryAllocation();
     other.m_meshBuf = VK_NULL_HANDLE;
 }
 
 Mesh& Mesh::operator=(Mesh&& other) {
-    VkDevice dev = m_window->device();
-    m_devFuncs->vkDeviceWaitIdle(dev);
-    if (m_meshBuf) {
-        m_devFuncs->vkDestroyBuffer(dev, m_meshBuf, nullptr);
-    }
-
-    if (m_meshBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_meshBufMem, nullptr);
-    }
-    m_window = other.m_window;
+    release();
+    m_context = other.m_context;
     m_devFuncs = other.m_devFuncs;
     m_meshBufMem = other.m_meshBufMem;
     m_vbOffset = other.m_vbOffset;
     m_ibOffset = other.m_ibOffset;
     m_indexCount = other.m_indexCount;
-    other.m_meshBufMem = VK_NULL_HANDLE;
+    other.m_meshBufMem = MemoryAllocation();
     other.m_meshBuf = VK_NULL_HANDLE;
 
     return *this;
@@ -1,7 +1,8 @@
 #pragma once
 #include <QVulkanWindow>
+#include "src/Render/memoryallocator.h"
 
-class VulkanWindow;
+class VulkanContext;
 class Mesh {
 public:
     struct Vec4 {
@@ -23,7 +24,7 @@ public:
         Vec2 texcoord;
     };
 
-    Mesh(const QString& path, VulkanWindow *w);
+    Mesh(const QString& path, VulkanContext *context);
     ~Mesh();
     Mesh(const Mesh&) = delete;
     Mesh(Mesh&& other);
@@ -36,10 +37,12 @@ public:
     static VkPipelineVertexInputStateCreateInfo *getVertexInputInfo();
 
 private:
-    VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    void release();
 
-    VkDeviceMemory m_meshBufMem = VK_NULL_HANDLE;
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+
+    MemoryAllocation m_meshBufMem;
     VkBuffer m_meshBuf = VK_NULL_HANDLE;
     VkDeviceSize m_vbOffset = 0;
     VkDeviceSize m_ibOffset = 0;
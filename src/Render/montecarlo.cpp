@@ -1,11 +1,11 @@
 #include "src/Render/montecarlo.h"
-#include <QCoreApplication>
 #include "src/Render/mesh.h"
+#include <algorithm>
+#include <cmath>
 
 MonteCarlo::MonteCarlo(VulkanWindow *window, VkPipelineCache &pipelineCache, VkPipelineLayout &pipelineLayout)
     : m_window(window), m_pipelineCache(pipelineCache), m_pipelineLayout(pipelineLayout) {
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    m_devFuncs = m_window->deviceFunctions();
 
     createMeshData();
     createRenderPass();
@@ -14,6 +14,10 @@ MonteCarlo::MonteCarlo(VulkanWindow *window, VkPipelineCache &pipelineCache, VkP
     createResolvePipelineLayout();
     createResolvePipeline();
     createCopyPipeline();
+    createMaskPipeline();
+    createStatsBuffer();
+    createConvergenceDescriptors();
+    createConvergencePipeline();
 }
 
 MonteCarlo::~MonteCarlo() {
@@ -22,6 +26,8 @@ MonteCarlo::~MonteCarlo() {
     delete m_result;
     delete m_temp;
     delete m_depth;
+    delete m_moments;
+    delete m_mask;
 
     if (m_renderPass) {
         m_devFuncs->vkDestroyRenderPass(dev, m_renderPass, nullptr);
@@ -35,8 +41,8 @@ MonteCarlo::~MonteCarlo() {
     if (m_copyFrameBuffer) {
         m_devFuncs->vkDestroyFramebuffer(dev, m_copyFrameBuffer, nullptr);
     }
-    if (m_pipeline) {
-        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+    for (auto &pipeline: m_pipelines) {
+        m_devFuncs->vkDestroyPipeline(dev, pipeline.second, nullptr);
     }
     if (m_resolvePipeline) {
         m_devFuncs->vkDestroyPipeline(dev, m_resolvePipeline, nullptr);
@@ -44,6 +50,25 @@ MonteCarlo::~MonteCarlo() {
     if (m_copyPipeline) {
         m_devFuncs->vkDestroyPipeline(dev, m_copyPipeline, nullptr);
     }
+    if (m_maskPipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_maskPipeline, nullptr);
+    }
+    if (m_convergencePipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_convergencePipeline, nullptr);
+    }
+    if (m_convergencePipelineLayout) {
+        m_devFuncs->vkDestroyPipelineLayout(dev, m_convergencePipelineLayout, nullptr);
+    }
+    if (m_convergenceDescSetLayout) {
+        m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_convergenceDescSetLayout, nullptr);
+    }
+    if (m_convergenceDescPool) {
+        m_devFuncs->vkDestroyDescriptorPool(dev, m_convergenceDescPool, nullptr);
+    }
+    if (m_statsBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_statsBuf, nullptr);
+    }
+    m_window->getAllocator()->free(m_statsBufMem);
     if (m_resolveDescSetLayout) {
         m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_resolveDescSetLayout, nullptr);
     }
@@ -56,9 +81,7 @@ MonteCarlo::~MonteCarlo() {
     if (m_meshBuf) {
         m_devFuncs->vkDestroyBuffer(dev, m_meshBuf, nullptr);
     }
-    if (m_meshBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_meshBufMem, nullptr);
-    }
+    m_window->getAllocator()->free(m_meshBufMem);
 }
 
 void MonteCarlo::createMeshData() {
@@ -77,31 +100,11 @@ void MonteCarlo::createMeshData() {
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_meshBuf, &meshMemReq);
-
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
+    m_meshBufMem = m_window->getAllocator()->allocateBuffer(m_meshBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_meshBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_meshBuf, m_meshBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    void *p;
-    err = m_devFuncs->vkMapMemory(dev, m_meshBufMem, 0, meshMemReq.size, 0, &p);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    void *p = m_meshBufMem.mapped;
 
     memcpy(p, data, 12*sizeof(float));
-    m_devFuncs->vkUnmapMemory(dev, m_meshBufMem);
 }
 
 void MonteCarlo::createResolvePipelineLayout() {
@@ -113,6 +116,10 @@ void MonteCarlo::createResolvePipelineLayout() {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &m_resolveDescSetLayout;
+    // Size of the accumulated corner relative to the targets, only read by the resolve
+    VkPushConstantRange pushConstant = { VK_SHADER_STAGE_FRAGMENT_BIT, 0, 2*sizeof(float) };
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
     VkResult err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_resolvePipelineLayout);
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create pipeline layout");
@@ -203,9 +210,14 @@ void MonteCarlo::createCopyRenderPass() {
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-    VkAttachmentReference colorAttachmentRef{};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    // Running sum of luma and squared luma, used to estimate the variance
+    VkAttachmentDescription momentsAttachment = colorAttachment;
+
+    std::array<VkAttachmentReference, 2> colorAttachmentRefs{};
+    colorAttachmentRefs[0].attachment = 0;
+    colorAttachmentRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachmentRefs[1].attachment = 1;
+    colorAttachmentRefs[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = VK_FORMAT_D32_SFLOAT;
@@ -218,13 +230,13 @@ void MonteCarlo::createCopyRenderPass() {
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
 
     VkAttachmentReference depthAttachmentRef{};
-    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.attachment = 2;
     depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentRefs.size());
+    subpass.pColorAttachments = colorAttachmentRefs.data();
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
     VkSubpassDependency dependency = {};
@@ -245,10 +257,10 @@ void MonteCarlo::createCopyRenderPass() {
 
     VkSubpassDependency dependencies[2] = { dependency, depth_dependency };
 
-    std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+    std::array<VkAttachmentDescription, 3> attachments = {colorAttachment, momentsAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
@@ -265,11 +277,13 @@ void MonteCarlo::createDescriptors() {
     const int concurrentFrameCount = m_window->concurrentFrameCount();
 
     // Set up descriptor set and its layout.
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     poolSizes[0].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     poolSizes[1].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
 
     VkDescriptorPoolCreateInfo descPoolInfo;
     memset(&descPoolInfo, 0, sizeof(descPoolInfo));
@@ -298,14 +312,23 @@ void MonteCarlo::createDescriptors() {
         nullptr
     };
 
-    std::array<VkDescriptorBindingFlags, 2> flags{VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT};
+    VkDescriptorSetLayoutBinding maskSamplerBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+        nullptr
+    };
+
+    std::array<VkDescriptorBindingFlags, 3> flags{VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+                                                  VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT};
     VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags{};
     bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
     bindingFlags.pNext = nullptr;
     bindingFlags.pBindingFlags = flags.data();
     bindingFlags.bindingCount = static_cast<uint32_t>(flags.size());;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {tempSamplerBinding,resultSamplerBinding};
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {tempSamplerBinding,resultSamplerBinding,maskSamplerBinding};
     VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
     descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -335,10 +358,8 @@ void MonteCarlo::createResolvePipeline() {
     VkDevice dev = m_window->device();
 
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                        "/assets/shaders/resolve_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                        "/assets/shaders/resolve_frag.spv");
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("resolve_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("resolve_frag.spv"));
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -459,10 +480,8 @@ void MonteCarlo::createCopyPipeline() {
     VkDevice dev = m_window->device();
 
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/copy_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                             "/assets/shaders/copy_frag.spv");
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("copy_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("copy_frag.spv"));
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -561,8 +580,9 @@ void MonteCarlo::createCopyPipeline() {
     att.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
     att.alphaBlendOp = VK_BLEND_OP_ADD;
     att.colorWriteMask = 0xF;
-    cb.attachmentCount = 1;
-    cb.pAttachments = &att;
+    VkPipelineColorBlendAttachmentState atts[2] = { att, att };
+    cb.attachmentCount = 2;
+    cb.pAttachments = atts;
     pipelineInfo.pColorBlendState = &cb;
 
     VkDynamicState dynEnable[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
@@ -586,18 +606,325 @@ void MonteCarlo::createCopyPipeline() {
         m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
 }
 
-void MonteCarlo::setPipeline(const std::string &name) {
+void MonteCarlo::createMaskPipeline() {
     VkDevice dev = m_window->device();
-    if (m_pipeline) {
-        m_devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+
+    // Shaders
+    VkShaderModule vertShaderModule = m_window->createShader(SHADER("copy_vert.spv"));
+    VkShaderModule fragShaderModule = m_window->createShader(SHADER("mask_frag.spv"));
+    // Graphics pipeline
+    VkGraphicsPipelineCreateInfo pipelineInfo;
+    memset(&pipelineInfo, 0, sizeof(pipelineInfo));
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_SHADER_STAGE_VERTEX_BIT,
+            vertShaderModule,
+            "main",
+            nullptr
+        },
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            fragShaderModule,
+            "main",
+            nullptr
+        }
+    };
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+
+    static VkVertexInputBindingDescription vertexBindingDesc = {
+        0, // binding
+        2*sizeof(float),
+        VK_VERTEX_INPUT_RATE_VERTEX
+    };
+
+    VkVertexInputAttributeDescription vertexAttrDesc[] = {{0, 0, VK_FORMAT_R32G32_SFLOAT, 0}};
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.pNext = nullptr;
+    vertexInputInfo.flags = 0;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &vertexBindingDesc;
+    vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    vertexInputInfo.pVertexAttributeDescriptions = vertexAttrDesc;
+
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+
+    VkPipelineInputAssemblyStateCreateInfo ia;
+    memset(&ia, 0, sizeof(ia));
+    ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    pipelineInfo.pInputAssemblyState = &ia;
+
+    // The viewport and scissor will be set dynamically via vkCmdSetViewport/Scissor.
+    // This way the pipeline does not need to be touched when resizing the window.
+    VkPipelineViewportStateCreateInfo vp;
+    memset(&vp, 0, sizeof(vp));
+    vp.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    vp.viewportCount = 1;
+    vp.scissorCount = 1;
+    pipelineInfo.pViewportState = &vp;
+
+    VkPipelineRasterizationStateCreateInfo rs;
+    memset(&rs, 0, sizeof(rs));
+    rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rs.polygonMode = VK_POLYGON_MODE_FILL;
+    rs.cullMode = VK_CULL_MODE_BACK_BIT;
+    rs.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rs.lineWidth = 1.0f;
+    pipelineInfo.pRasterizationState = &rs;
+
+    VkPipelineMultisampleStateCreateInfo ms;
+    memset(&ms, 0, sizeof(ms));
+    ms.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    // Enable multisampling.
+    ms.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    pipelineInfo.pMultisampleState = &ms;
+
+    VkPipelineDepthStencilStateCreateInfo ds;
+    memset(&ds, 0, sizeof(ds));
+    ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    ds.depthTestEnable = VK_TRUE;
+    ds.depthWriteEnable = VK_TRUE;
+    ds.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+    pipelineInfo.pDepthStencilState = &ds;
+
+    VkPipelineColorBlendStateCreateInfo cb;
+    memset(&cb, 0, sizeof(cb));
+    cb.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+    // Depth only, the color is left to the clear value
+    VkPipelineColorBlendAttachmentState att{};
+    att.colorWriteMask = 0;
+    cb.attachmentCount = 1;
+    cb.pAttachments = &att;
+    pipelineInfo.pColorBlendState = &cb;
+
+    VkDynamicState dynEnable[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dyn;
+    memset(&dyn, 0, sizeof(dyn));
+    dyn.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dyn.dynamicStateCount = sizeof(dynEnable) / sizeof(VkDynamicState);
+    dyn.pDynamicStates = dynEnable;
+    pipelineInfo.pDynamicState = &dyn;
+
+    pipelineInfo.layout = m_resolvePipelineLayout;
+    pipelineInfo.renderPass = m_renderPass;
+
+    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_maskPipeline);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create graphics pipeline");
+
+    if (vertShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, vertShaderModule, nullptr);
+    if (fragShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
+}
+
+void MonteCarlo::createStatsBuffer() {
+    VkDevice dev = m_window->device();
+
+    // Target, minimum passes, max error, active tiles and the size of the accumulated corner
+    const VkDeviceSize alignment = m_window->physicalDeviceProperties()->limits.minStorageBufferOffsetAlignment;
+    m_statsStride = (STATS_SIZE+alignment-1)/alignment*alignment;
+
+    VkBufferCreateInfo statsBufInfo{};
+    statsBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    statsBufInfo.size = m_statsStride*QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+    statsBufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VkResult err = m_devFuncs->vkCreateBuffer(dev, &statsBufInfo, nullptr, &m_statsBuf);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create buffer");
+
+    m_statsBufMem = m_window->getAllocator()->allocateBuffer(m_statsBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void MonteCarlo::createConvergenceDescriptors() {
+    VkDevice dev = m_window->device();
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = 2*QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descPoolInfo.pPoolSizes = poolSizes.data();
+    descPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    descPoolInfo.maxSets = QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+
+    VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_convergenceDescPool);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create descriptor pool");
+
+    VkDescriptorSetLayoutBinding momentsBinding = {
+        0, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding maskBinding = {
+        1, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding statsBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+
+    std::array<VkDescriptorBindingFlags, 3> flags{VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT, VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT, 0};
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags{};
+    bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlags.pNext = nullptr;
+    bindingFlags.pBindingFlags = flags.data();
+    bindingFlags.bindingCount = static_cast<uint32_t>(flags.size());
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {momentsBinding, maskBinding, statsBinding};
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    descLayoutInfo.pBindings = bindings.data();
+    descLayoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    descLayoutInfo.pNext = &bindingFlags;
+
+    err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_convergenceDescSetLayout);
+    if (err != VK_SUCCESS)
+        m_window->crash("Failed to create descriptor set layout");
+
+    // Each frame slot writes its own stats slice
+    for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i) {
+        VkDescriptorSetAllocateInfo descSetAllocInfo = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            m_convergenceDescPool,
+            1,
+            &m_convergenceDescSetLayout
+        };
+        err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_convergenceDescSet[i]);
+        if (err != VK_SUCCESS)
+            m_window->crash("Failed to allocate descriptor set");
+
+        VkDescriptorBufferInfo statsInfo{};
+        statsInfo.buffer = m_statsBuf;
+        statsInfo.offset = m_statsStride*i;
+        statsInfo.range = STATS_SIZE;
+
+        VkWriteDescriptorSet descWrite{};
+        descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrite.dstSet = m_convergenceDescSet[i];
+        descWrite.dstBinding = 2;
+        descWrite.dstArrayElement = 0;
+        descWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descWrite.descriptorCount = 1;
+        descWrite.pBufferInfo = &statsInfo;
+
+        m_devFuncs->vkUpdateDescriptorSets(dev, 1, &descWrite, 0, nullptr);
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_convergenceDescSetLayout;
+
+    if (m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_convergencePipelineLayout) != VK_SUCCESS) {
+        m_window->crash("failed to create compute pipeline layout!");
+    }
+}
+
+void MonteCarlo::createConvergencePipeline() {
+    VkDevice dev = m_window->device();
+    VkShaderModule computeShaderModule = m_window->createShader(SHADER("convergence_comp.spv"));
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShaderModule;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = m_convergencePipelineLayout;
+    pipelineInfo.stage = computeShaderStageInfo;
+
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_window->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_convergencePipeline) != VK_SUCCESS) {
+        m_window->crash("failed to create compute pipeline!");
     }
 
+    m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
+}
+
+void MonteCarlo::updateConvergenceDescriptors() {
+    VkDevice dev = m_window->device();
+
+    std::array<VkDescriptorImageInfo, 2> imageInfo{};
+    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[0].imageView = m_moments->getImageView();
+    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[1].imageView = m_mask->getImageView();
+
+    for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i) {
+        std::array<VkWriteDescriptorSet, 2> descWrites{};
+        descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[0].dstSet = m_convergenceDescSet[i];
+        descWrites[0].dstBinding = 0;
+        descWrites[0].dstArrayElement = 0;
+        descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descWrites[0].descriptorCount = 1;
+        descWrites[0].pImageInfo = &imageInfo[0];
+        descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[1].dstSet = m_convergenceDescSet[i];
+        descWrites[1].dstBinding = 1;
+        descWrites[1].dstArrayElement = 0;
+        descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descWrites[1].descriptorCount = 1;
+        descWrites[1].pImageInfo = &imageInfo[1];
+
+        m_devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+    }
+}
+
+void MonteCarlo::setPipeline(const std::string &name) {
+    auto it = m_pipelines.find(name);
+    if (it == m_pipelines.end()) {
+        it = m_pipelines.emplace(name, createPipeline(name)).first;
+    }
+    m_pipeline = it->second;
+
+    clear();
+}
+
+void MonteCarlo::addPipeline(const std::string &name, VkPipeline pipeline) {
+    if (m_pipelines.count(name)) {
+        m_devFuncs->vkDestroyPipeline(m_window->device(), pipeline, nullptr);
+        return;
+    }
+    m_pipelines[name] = pipeline;
+}
+
+VkPipeline MonteCarlo::createPipeline(const std::string &name) {
+    VkDevice dev = m_window->device();
+
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                        "/assets/shaders/"+QString::fromStdString(name)+"_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                        "/assets/shaders/"+QString::fromStdString(name)+"_frag.spv");
+    VkShaderModule vertShaderModule = m_window->createShader(QString::fromStdString(name)+"_vert.spv");
+    VkShaderModule fragShaderModule = m_window->createShader(QString::fromStdString(name)+"_frag.spv");
 
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
@@ -731,7 +1058,8 @@ void MonteCarlo::setPipeline(const std::string &name) {
     pipelineInfo.layout = m_pipelineLayout;
     pipelineInfo.renderPass = m_renderPass;
 
-    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_pipeline);
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
     if (err != VK_SUCCESS)
         m_window->crash("Failed to create graphics pipeline");
 
@@ -740,7 +1068,7 @@ void MonteCarlo::setPipeline(const std::string &name) {
     if (fragShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
 
-    clear();
+    return pipeline;
 }
 
 void MonteCarlo::resizeFrameBuffer() {
@@ -752,6 +1080,11 @@ void MonteCarlo::resizeFrameBuffer() {
     m_temp = new Texture(sz.width(), sz.height(), m_window, 1, VK_FORMAT_R32G32B32A32_SFLOAT, true, true, true);
     delete m_depth;
     m_depth = new Texture(sz.width(), sz.height(), m_window, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
+    delete m_moments;
+    m_moments = new Texture(sz.width(), sz.height(), m_window, 1, VK_FORMAT_R32G32B32A32_SFLOAT, true, true, true);
+    delete m_mask;
+    m_mask = new Texture(ceil(sz.width()/16.0), ceil(sz.height()/16.0), m_window, 1, VK_FORMAT_R32_SFLOAT, true, true);
+    updateConvergenceDescriptors();
     clear();
 
     if (m_frameBuffer) {
@@ -777,8 +1110,9 @@ void MonteCarlo::resizeFrameBuffer() {
 
     m_devFuncs->vkCreateFramebuffer(m_window->device(), &framebufferInfo, NULL, &m_frameBuffer);
 
-    std::array<VkImageView, 2> copyAttachments = {
+    std::array<VkImageView, 3> copyAttachments = {
         m_result->getImageView(),
+        m_moments->getImageView(),
         m_depth->getImageView()
     };
 
@@ -795,15 +1129,18 @@ void MonteCarlo::resizeFrameBuffer() {
 
     VkDevice dev = m_window->device();
     for (int i = 0; i < m_window->concurrentFrameCount(); ++i) {
-        std::array<VkDescriptorImageInfo, 2> imageInfo{};
+        std::array<VkDescriptorImageInfo, 3> imageInfo{};
         imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[0].imageView = m_temp->getImageView();
         imageInfo[0].sampler = m_temp->getTextureSampler();
         imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[1].imageView = m_result->getImageView();
         imageInfo[1].sampler = m_result->getTextureSampler();
+        imageInfo[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo[2].imageView = m_mask->getImageView();
+        imageInfo[2].sampler = m_mask->getTextureSampler();
 
-        std::array<VkWriteDescriptorSet, 2> descWrites{};
+        std::array<VkWriteDescriptorSet, 3> descWrites{};
         descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descWrites[0].dstSet = m_resolveDescSet[i];
         descWrites[0].dstBinding = 0;
@@ -818,35 +1155,61 @@ void MonteCarlo::resizeFrameBuffer() {
         descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         descWrites[1].descriptorCount = 1;
         descWrites[1].pImageInfo = &imageInfo[1];
-
-        m_devFuncs->vkUpdateDescriptorSets(dev, 2, &descWrites[0], 0, nullptr);
+        descWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[2].dstSet = m_resolveDescSet[i];
+        descWrites[2].dstBinding = 2;
+        descWrites[2].dstArrayElement = 0;
+        descWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descWrites[2].descriptorCount = 1;
+        descWrites[2].pImageInfo = &imageInfo[2];
+
+        m_devFuncs->vkUpdateDescriptorSets(dev, 3, &descWrites[0], 0, nullptr);
     }
 }
 
 void MonteCarlo::clear() {
     if (m_result) m_result->clear(0, 0, 0, 0);
+    if (m_moments) m_moments->clear(0, 0, 0, 0);
+    if (m_mask) m_mask->clear(0, 0, 0, 0);
     m_sampleCount = 0;
+    m_error = 1.0;
+    m_activeTiles = m_temp ? tileCount() : 0;
+    m_converged = false;
+    // Frames still in flight carry the stats of the previous accumulation
+    std::fill(std::begin(m_statsPending), std::end(m_statsPending), false);
 }
 
-void MonteCarlo::render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet) {
-    if (m_sampleCount == 1 << 16) return;
+void MonteCarlo::setScale(float scale) {
+    if (!m_sampleCount) {
+        m_scale = scale;
+    }
+}
 
-    VkDevice dev = m_window->device();
+QSize MonteCarlo::getExtent() {
+    // Rounded like the scaled corner of dynamic resolution
+    return QSize(std::max(int(std::ceil(m_temp->getWidth()*m_scale)), 1),
+                 std::max(int(std::ceil(m_temp->getHeight()*m_scale)), 1));
+}
 
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
-    allocInfo.commandBufferCount = 1;
+uint32_t MonteCarlo::tileCount() {
+    const QSize extent = getExtent();
+    return ((extent.width()+15)/16)*((extent.height()+15)/16);
+}
 
-    VkCommandBuffer cb;
-    m_devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &cb);
+void MonteCarlo::render(VkCommandBuffer cb, Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet) {
+    readStats();
+    if (m_sampleCount == 1 << 16 || m_converged) return;
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    const QSize extent = getExtent();
 
-    m_devFuncs->vkBeginCommandBuffer(cb, &beginInfo);
+    // The previous pass may still be sampling the targets written here
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                                     VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
 
     VkClearColorValue clearColor = {{ 0.45, 0.45, 0.45, 1 }};
     VkClearDepthStencilValue clearDS = { 1, 0 };
@@ -862,16 +1225,16 @@ void MonteCarlo::render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet)
     rp_begin.framebuffer = m_frameBuffer;
     rp_begin.renderArea.offset.x = 0;
     rp_begin.renderArea.offset.y = 0;
-    rp_begin.renderArea.extent.width = m_temp->getWidth();
-    rp_begin.renderArea.extent.height = m_temp->getHeight();
+    rp_begin.renderArea.extent.width = extent.width();
+    rp_begin.renderArea.extent.height = extent.height();
     rp_begin.clearValueCount = 2;
     rp_begin.pClearValues = clearValues;
 
 
     m_devFuncs->vkCmdBeginRenderPass(cb, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
     VkViewport viewport;
-    viewport.height = m_temp->getHeight();
-    viewport.width = m_temp->getWidth();
+    viewport.height = extent.height();
+    viewport.width = extent.width();
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     viewport.x = 0;
@@ -879,12 +1242,21 @@ void MonteCarlo::render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet)
     m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
 
     VkRect2D scissor;
-    scissor.extent.width = m_temp->getWidth();
-    scissor.extent.height = m_temp->getHeight();
+    scissor.extent.width = extent.width();
+    scissor.extent.height = extent.height();
     scissor.offset.x = 0;
     scissor.offset.y = 0;
     m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
 
+    static const VkDeviceSize zero = 0;
+    if (m_sampleCount >= MIN_PASSES) {
+        m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_maskPipeline);
+        m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 0, 1,
+                                            m_resolveDescSet, 0, nullptr);
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_meshBuf, &zero);
+        m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
+    }
+
     m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
     m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
                                         &descSet, 0, nullptr);
@@ -892,44 +1264,36 @@ void MonteCarlo::render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet)
     if (mesh) {
         mesh->draw(cb);
     } else {
-        static const VkDeviceSize zero = 0;
         m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, quadBuf, &zero);
         m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
     }
 
     m_devFuncs->vkCmdEndRenderPass(cb);
-    m_devFuncs->vkEndCommandBuffer(cb);
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cb;
+    // The copy samples the new pass and reuses its depth buffer
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-    m_devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-    m_devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-    m_devFuncs->vkFreeCommandBuffers(dev, m_window->graphicsCommandPool(), 1, &cb);
-
-    copy();
+    copy(cb);
     m_sampleCount++;
 }
 
-void MonteCarlo::copy() {
-    VkDevice dev = m_window->device();
-
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
-    allocInfo.commandBufferCount = 1;
+void MonteCarlo::copy(VkCommandBuffer cb) {
+    const QSize extent = getExtent();
+    const int frame = m_window->currentFrame();
 
-    VkCommandBuffer cb;
-    m_devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &cb);
+    // The fence of this frame slot has been waited on, its slice was read back by readStats()
+    uint32_t *stats = reinterpret_cast<uint32_t *>(static_cast<char *>(m_statsBufMem.mapped)+m_statsStride*frame);
+    memcpy(&stats[0], &m_targetError, sizeof(float));
+    stats[1] = MIN_PASSES;
+    stats[2] = 0;
+    stats[3] = 0;
+    stats[4] = extent.width();
+    stats[5] = extent.height();
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    m_devFuncs->vkBeginCommandBuffer(cb, &beginInfo);
     VkRenderPassBeginInfo rp_begin {};
     rp_begin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     rp_begin.pNext = NULL;
@@ -937,8 +1301,8 @@ void MonteCarlo::copy() {
     rp_begin.framebuffer = m_copyFrameBuffer;
     rp_begin.renderArea.offset.x = 0;
     rp_begin.renderArea.offset.y = 0;
-    rp_begin.renderArea.extent.width = m_temp->getWidth();
-    rp_begin.renderArea.extent.height = m_temp->getHeight();
+    rp_begin.renderArea.extent.width = extent.width();
+    rp_begin.renderArea.extent.height = extent.height();
 
     m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_copyPipeline);
     m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 0, 1,
@@ -946,8 +1310,8 @@ void MonteCarlo::copy() {
     m_devFuncs->vkCmdBeginRenderPass(cb, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
 
     VkViewport viewport;
-    viewport.height = m_temp->getHeight();
-    viewport.width = m_temp->getWidth();
+    viewport.height = extent.height();
+    viewport.width = extent.width();
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     viewport.x = 0;
@@ -955,8 +1319,8 @@ void MonteCarlo::copy() {
     m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
 
     VkRect2D scissor;
-    scissor.extent.width = m_temp->getWidth();
-    scissor.extent.height = m_temp->getHeight();
+    scissor.extent.width = extent.width();
+    scissor.extent.height = extent.height();
     scissor.offset.x = 0;
     scissor.offset.y = 0;
     m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
@@ -966,26 +1330,75 @@ void MonteCarlo::copy() {
     m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
 
     m_devFuncs->vkCmdEndRenderPass(cb);
-    m_devFuncs->vkEndCommandBuffer(cb);
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cb;
+    // Estimate the per tile error from the accumulated moments and refresh the convergence mask
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_convergencePipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_convergencePipelineLayout, 0, 1,
+                                        &m_convergenceDescSet[frame], 0, nullptr);
+    m_devFuncs->vkCmdDispatch(cb, (extent.width()+15)/16, (extent.height()+15)/16, 1);
+
+    // The resolve of this frame samples the result, the next pass the mask
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+    m_statsPending[frame] = true;
+}
 
-    m_devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-    m_devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-    m_devFuncs->vkFreeCommandBuffers(dev, m_window->graphicsCommandPool(), 1, &cb);
+void MonteCarlo::readStats() {
+    const int frame = m_window->currentFrame();
+    if (!m_statsPending[frame]) {
+        return;
+    }
+    m_statsPending[frame] = false;
+
+    const uint32_t *stats = reinterpret_cast<const uint32_t *>(static_cast<const char *>(m_statsBufMem.mapped)+m_statsStride*frame);
+    memcpy(&m_error, &stats[2], sizeof(float));
+    m_activeTiles = stats[3];
+    m_converged = m_activeTiles == 0;
 }
 
 uint32_t MonteCarlo::getSampleCount() {
     return m_sampleCount*16;
 }
 
+void MonteCarlo::setTargetError(float val) {
+    m_targetError = val;
+    m_converged = false;
+}
+
+float MonteCarlo::getError() {
+    return m_error;
+}
+
+float MonteCarlo::getConvergedRatio() {
+    if (!m_temp) return 0.0;
+    return 1.0 - std::min(float(m_activeTiles)/tileCount(), 1.0f);
+}
+
+bool MonteCarlo::isConverged() {
+    return m_converged;
+}
+
 void MonteCarlo::resolve(VkCommandBuffer cb) {
+    const QSize extent = getExtent();
+    const float scale[2] = {
+        float(extent.width())/m_temp->getWidth(),
+        float(extent.height())/m_temp->getHeight()
+    };
+
     m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipeline);
     m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 0, 1,
         &m_resolveDescSet[m_window->currentFrame()], 0, nullptr);
+    m_devFuncs->vkCmdPushConstants(cb, m_resolvePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(scale), scale);
 
     static const VkDeviceSize zero = 0;
     m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_meshBuf, &zero);
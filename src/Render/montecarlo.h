@@ -1,5 +1,7 @@
 #pragma once
 #include "src/UI/vulkanwindow.h"
+#include "src/Render/memoryallocator.h"
+#include <map>
 
 class Mesh;
 class MonteCarlo {
@@ -9,15 +11,36 @@ public:
 
     void resizeFrameBuffer();
     void setPipeline(const std::string &name);
+    // Thread safe, the result is handed back with addPipeline on the main thread
+    VkPipeline createPipeline(const std::string &name);
+    void addPipeline(const std::string &name, VkPipeline pipeline);
 
-    void render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet);
+    // Recorded into the frame, convergence is read back once the frame slot comes around again
+    void render(VkCommandBuffer cb, Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet);
     void resolve(VkCommandBuffer cb);
 
+    // Accumulate into the top left corner of the targets, like dynamic resolution. The scale is only
+    // taken when the accumulation starts, so converging tiles never throw the samples away
+    void setScale(float scale);
+    QSize getExtent();
+
     void clear();
     uint32_t getSampleCount();
 
+    void setTargetError(float val);
+    float getError();
+    float getConvergedRatio();
+    bool isConverged();
+
 private:
-    void copy();
+    void copy(VkCommandBuffer cb);
+    void readStats();
+    uint32_t tileCount();
+    void createConvergenceDescriptors();
+    void createConvergencePipeline();
+    void createMaskPipeline();
+    void createStatsBuffer();
+    void updateConvergenceDescriptors();
     void createMeshData();
     void createResolvePipelineLayout();
     void createRenderPass();
@@ -27,7 +50,7 @@ private:
     void createCopyPipeline();
 
     VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    VulkanDeviceFunctions *m_devFuncs;
 
     VkPipelineCache &m_pipelineCache;
     VkPipelineLayout &m_pipelineLayout;
@@ -38,11 +61,25 @@ private:
     VkDescriptorSet m_resolveDescSet[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
     VkPipeline m_resolvePipeline = VK_NULL_HANDLE;
     VkPipeline m_copyPipeline = VK_NULL_HANDLE;
+    VkPipeline m_maskPipeline = VK_NULL_HANDLE;
+
+    VkDescriptorPool m_convergenceDescPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_convergenceDescSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet m_convergenceDescSet[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    VkPipelineLayout m_convergencePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_convergencePipeline = VK_NULL_HANDLE;
 
-    VkDeviceMemory m_meshBufMem = VK_NULL_HANDLE;
+    // One slice per frame slot, m_statsPending marks the ones written by a frame of this accumulation
+    MemoryAllocation m_statsBufMem;
+    VkBuffer m_statsBuf = VK_NULL_HANDLE;
+    VkDeviceSize m_statsStride = 0;
+    bool m_statsPending[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT]{};
+
+    MemoryAllocation m_meshBufMem;
     VkBuffer m_meshBuf = VK_NULL_HANDLE;
 
     VkPipeline m_pipeline = VK_NULL_HANDLE;
+    std::map<std::string, VkPipeline> m_pipelines;
 
     VkRenderPass m_renderPass = VK_NULL_HANDLE;
     VkFramebuffer m_frameBuffer = VK_NULL_HANDLE;
@@ -51,6 +88,17 @@ private:
     Texture* m_result = nullptr;
     Texture* m_temp = nullptr;
     Texture* m_depth  = nullptr;
+    Texture* m_moments = nullptr;
+    Texture* m_mask = nullptr;
 
     uint32_t m_sampleCount = 0;
+    float m_scale = 1.0f;
+
+    // Standard error of the mean luma, in display units, at which a 16x16 tile stops sampling
+    float m_targetError = 0.004;
+    static constexpr uint32_t MIN_PASSES = 16;
+    static constexpr VkDeviceSize STATS_SIZE = 6*sizeof(uint32_t);
+    float m_error = 1.0;
+    uint32_t m_activeTiles = 0;
+    bool m_converged = false;
 };
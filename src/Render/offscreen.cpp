@@ -0,0 +1,336 @@
+#include "src/Render/offscreen.h"
+#include "src/Render/mesh.h"
+
+Offscreen::Offscreen(VulkanContext *context, uint32_t width, uint32_t height, VkPipelineLayout &pipelineLayout)
+    : m_context(context), m_pipelineLayout(pipelineLayout), m_width(width), m_height(height) {
+    m_devFuncs = m_context->deviceFunctions();
+
+    m_color = new Texture(m_width, m_height, m_context, 1, VK_FORMAT_R32G32B32A32_SFLOAT, false, true, true);
+    m_depth = new Texture(m_width, m_height, m_context, 1, VK_FORMAT_D32_SFLOAT, false, true, false, true);
+
+    createRenderPass();
+    createFrameBuffer();
+    createReadbackBuffer();
+    createQueryPool();
+    clear();
+}
+
+Offscreen::~Offscreen() {
+    VkDevice dev = m_context->device();
+    m_devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+
+    if (m_pipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+    }
+    if (m_readbackBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_readbackBuf, nullptr);
+    }
+    if (m_queryPool) {
+        m_devFuncs->vkDestroyQueryPool(dev, m_queryPool, nullptr);
+    }
+    m_context->getAllocator()->free(m_readbackBufMem);
+    if (m_frameBuffer) {
+        m_devFuncs->vkDestroyFramebuffer(dev, m_frameBuffer, nullptr);
+    }
+    if (m_renderPass) {
+        m_devFuncs->vkDestroyRenderPass(dev, m_renderPass, nullptr);
+    }
+
+    delete m_color;
+    delete m_depth;
+}
+
+uint32_t Offscreen::getWidth() {
+    return m_width;
+}
+
+uint32_t Offscreen::getHeight() {
+    return m_height;
+}
+
+Texture* Offscreen::getColor() {
+    return m_color;
+}
+
+float Offscreen::getRenderTime() {
+    return m_renderTime;
+}
+
+void Offscreen::createQueryPool() {
+    const VkPhysicalDeviceLimits *limits = &m_context->physicalDeviceProperties()->limits;
+    if (!limits->timestampComputeAndGraphics) {
+        return;
+    }
+    m_timestampPeriod = limits->timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2;
+    if (m_devFuncs->vkCreateQueryPool(m_context->device(), &queryPoolInfo, nullptr, &m_queryPool) != VK_SUCCESS) {
+        m_context->crash("failed to create query pool!");
+    }
+}
+
+void Offscreen::createRenderPass() {
+    VkDevice dev = m_context->device();
+
+    // Renderpass
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference colorAttachmentRef{};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency depth_dependency = {};
+    depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    depth_dependency.dstSubpass = 0;
+    depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depth_dependency.srcAccessMask = 0;
+    depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency dependencies[2] = { dependency, depth_dependency };
+
+    std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = dependencies;
+
+    if (m_devFuncs->vkCreateRenderPass(dev, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+        m_context->crash("failed to create render pass!");
+    }
+}
+
+void Offscreen::createFrameBuffer() {
+    std::array<VkImageView, 2> attachments = {
+        m_color->getImageView(),
+        m_depth->getImageView()
+    };
+
+    VkFramebufferCreateInfo framebufferInfo {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = m_renderPass;
+    framebufferInfo.attachmentCount = attachments.size();
+    framebufferInfo.pAttachments = attachments.data();
+    framebufferInfo.width = m_width;
+    framebufferInfo.height = m_height;
+    framebufferInfo.layers = 1;
+
+    if (m_devFuncs->vkCreateFramebuffer(m_context->device(), &framebufferInfo, nullptr, &m_frameBuffer) != VK_SUCCESS) {
+        m_context->crash("failed to create framebuffer!");
+    }
+}
+
+VkRenderPass Offscreen::getRenderPass() {
+    return m_renderPass;
+}
+
+void Offscreen::setPipeline(VkPipeline pipeline) {
+    if (m_pipeline) {
+        m_devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+        m_devFuncs->vkDestroyPipeline(m_context->device(), m_pipeline, nullptr);
+    }
+    m_pipeline = pipeline;
+}
+
+void Offscreen::clear() {
+    m_color->clear(0, 0, 0, 0);
+}
+
+void Offscreen::render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet) {
+    VkDevice dev = m_context->device();
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_context->graphicsCommandPool();
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer cb;
+    m_devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &cb);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    m_devFuncs->vkBeginCommandBuffer(cb, &beginInfo);
+    if (m_queryPool) {
+        m_devFuncs->vkCmdResetQueryPool(cb, m_queryPool, 0, 2);
+        m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, 0);
+    }
+
+    VkClearValue clearValues[2];
+    memset(clearValues, 0, sizeof(clearValues));
+    clearValues[1].depthStencil = { 1, 0 };
+
+    VkRenderPassBeginInfo rp_begin {};
+    rp_begin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    rp_begin.renderPass = m_renderPass;
+    rp_begin.framebuffer = m_frameBuffer;
+    rp_begin.renderArea.extent.width = m_width;
+    rp_begin.renderArea.extent.height = m_height;
+    rp_begin.clearValueCount = 2;
+    rp_begin.pClearValues = clearValues;
+
+    m_devFuncs->vkCmdBeginRenderPass(cb, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
+    VkViewport viewport;
+    viewport.height = m_height;
+    viewport.width = m_width;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    viewport.x = 0;
+    viewport.y = 0;
+    m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
+
+    VkRect2D scissor;
+    scissor.extent.width = m_width;
+    scissor.extent.height = m_height;
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
+
+    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                                        &descSet, 0, nullptr);
+
+    if (mesh) {
+        mesh->draw(cb);
+    } else {
+        static const VkDeviceSize zero = 0;
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, quadBuf, &zero);
+        m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
+    }
+
+    m_devFuncs->vkCmdEndRenderPass(cb);
+    if (m_queryPool) {
+        m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 1);
+    }
+    m_devFuncs->vkEndCommandBuffer(cb);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cb;
+
+    m_devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+    m_devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+    m_devFuncs->vkFreeCommandBuffers(dev, m_context->graphicsCommandPool(), 1, &cb);
+
+    uint64_t timestamps[2];
+    if (m_queryPool && m_devFuncs->vkGetQueryPoolResults(dev, m_queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                                         sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        m_renderTime = (timestamps[1]-timestamps[0])*m_timestampPeriod*1e-6f;
+    }
+}
+
+void Offscreen::createReadbackBuffer() {
+    VkDevice dev = m_context->device();
+    const VkDeviceSize size = VkDeviceSize(m_width)*m_height*4*sizeof(float);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (m_devFuncs->vkCreateBuffer(dev, &bufferInfo, nullptr, &m_readbackBuf) != VK_SUCCESS) {
+        m_context->crash("failed to create buffer!");
+    }
+
+    m_readbackBufMem = m_context->getAllocator()->allocateBuffer(m_readbackBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void Offscreen::readback(std::vector<float> &pixels) {
+    VkDevice dev = m_context->device();
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_context->graphicsCommandPool();
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer cb;
+    m_devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &cb);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    m_devFuncs->vkBeginCommandBuffer(cb, &beginInfo);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { m_width, m_height, 1 };
+    m_devFuncs->vkCmdCopyImageToBuffer(cb, m_color->getImage(), VK_IMAGE_LAYOUT_GENERAL, m_readbackBuf, 1, &region);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+    m_devFuncs->vkEndCommandBuffer(cb);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cb;
+
+    m_devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+    m_devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+    m_devFuncs->vkFreeCommandBuffers(dev, m_context->graphicsCommandPool(), 1, &cb);
+
+    const float *data = static_cast<const float *>(m_readbackBufMem.mapped);
+
+    pixels.resize(size_t(m_width)*m_height*4);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        const float count = data[i+3];
+        for (size_t c = 0; c < 3; c++) {
+            pixels[i+c] = count > 0 ? data[i+c]/count : 0.45;
+        }
+        pixels[i+3] = 1.0;
+    }
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "src/Render/vulkancontext.h"
+#include "src/Render/memoryallocator.h"
+#include "src/Texture/texture.h"
+
+class Mesh;
+class Offscreen {
+public:
+    Offscreen(VulkanContext *context, uint32_t width, uint32_t height, VkPipelineLayout &pipelineLayout);
+    ~Offscreen();
+
+    Offscreen(const Offscreen&) = delete;
+    Offscreen& operator=(const Offscreen&) = delete;
+
+    // Pipelines come from Render::createPipeline() with accumulate set, built for getRenderPass()
+    VkRenderPass getRenderPass();
+    // Takes ownership of the pipeline and destroys the previous one
+    void setPipeline(VkPipeline pipeline);
+    void clear();
+    void render(Mesh *mesh, VkBuffer *quadBuf, VkDescriptorSet descSet);
+
+    // Read back the accumulated passes as RGBA floats, background pixels get the viewport clear color
+    void readback(std::vector<float> &pixels);
+    // Sum of the passes with their count in alpha, as readback() sees it before the division
+    Texture* getColor();
+    // GPU time of the last render() in milliseconds, 0 when the device has no timestamps
+    float getRenderTime();
+
+    uint32_t getWidth();
+    uint32_t getHeight();
+
+private:
+    void createRenderPass();
+    void createFrameBuffer();
+    void createReadbackBuffer();
+    void createQueryPool();
+
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+
+    VkPipelineLayout &m_pipelineLayout;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    VkRenderPass m_renderPass = VK_NULL_HANDLE;
+    VkFramebuffer m_frameBuffer = VK_NULL_HANDLE;
+    Texture *m_color = nullptr;
+    Texture *m_depth = nullptr;
+
+    VkBuffer m_readbackBuf = VK_NULL_HANDLE;
+    MemoryAllocation m_readbackBufMem;
+
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+    float m_timestampPeriod = 1.0f;
+    float m_renderTime = 0.0f;
+
+    uint32_t m_width;
+    uint32_t m_height;
+};
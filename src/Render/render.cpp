@@ -1,17 +1,26 @@
 #include "render.h"
 #include "src/UI/vulkanwindow.h"
-#include <QVulkanFunctions>
 #include <QFile>
+#include <QFileInfo>
 #include <QCoreApplication>
+#include <algorithm>
+#include <memory>
+#include <thread>
 #include "src/Field/anisotropy.h"
 #include "src/Render/montecarlo.h"
+#include "src/Render/offscreen.h"
+#include "src/Render/errormetrics.h"
+#include "src/Render/dynamicresolution.h"
+#include "src/Render/viewcache.h"
+#include "src/Texture/imagewriter.h"
 #include "src/Render/constraints.h"
 #include "src/Render/mesh.h"
 #include "src/Texture/cubemap.h"
+#include "src/Render/stagingring.h"
 #include "src/Field/optimizer.h"
 
 Render::Render(VulkanWindow *w, Optimizer *&o, const std::vector<std::array<float, 2>> &pointList, bool msaa)
-    : m_window(w), m_optimizer(o), m_pointList(pointList) {
+    : m_context(w), m_window(w), m_optimizer(o), m_pointList(pointList) {
     if (msaa) {
         const QList<int> counts = w->supportedSampleCounts();
         qDebug() << "Supported sample counts:" << counts;
@@ -25,24 +34,47 @@ Render::Render(VulkanWindow *w, Optimizer *&o, const std::vector<std::array<floa
     }
 }
 
+// Batch rendering has no constraints to draw
+static const std::vector<std::array<float, 2>> NO_POINTS;
+
+Render::Render(VulkanContext *context, Optimizer *&o)
+    : m_context(context), m_window(nullptr), m_optimizer(o), m_pointList(NO_POINTS) {
+}
+
 void Render::initResources() {
     m_timer.start();
-    VkDevice dev = m_window->device();
-    m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    initScene();
 
-    m_anisotropy = new Anisotropy(m_window, m_monteCarloRender);
-    m_optimizer = new Optimizer(m_window, m_anisotropy);
-    m_optimizer->setDirectionTexture(m_anisotropy->getDir());
     m_constraints = new ConstraintsRenderer(m_window);
-    m_cubeMap = new CubeMap({
+    m_monteCarloRender = new MonteCarlo(m_window, m_pipelineCache, m_pipelineLayout);
+    m_dynamicResolution = new DynamicResolution(m_window, m_pipelineCache);
+    prebuildPipelines();
+    setPipeline("fast");
+
+    m_window->updateMouseLabel();
+    m_window->runStartupTask();
+}
+
+void Render::initScene() {
+    m_devFuncs = m_context->deviceFunctions();
+    m_context->createPipelineCache();
+    m_context->createAllocator();
+    m_context->createStagingRing();
+
+    m_anisotropy = new Anisotropy(m_context, m_monteCarloRender);
+    m_optimizer = new Optimizer(m_context, m_anisotropy, this, m_window);
+    m_optimizer->setDirectionTexture(m_anisotropy->getDir());
+    m_cubeMap = new CubeMap(QStringList{
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/px.hdr",
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/nx.hdr",
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/py.hdr",
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/ny.hdr",
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/pz.hdr",
                             QCoreApplication::applicationDirPath()+"/assets/textures/cubemap/nz.hdr"
-                            }, m_window);
-    m_reference = new Texture(16, 16, m_window);
+                            }, m_context, CubeMap::Quality(m_context->getEnvironmentQuality()));
+    m_reference = new Texture(16, 16, m_context);
+    createBrdfLut();
+    m_viewCache = new ViewCache(m_context, m_anisotropy);
 
     createQuadData();
     resetMeshTransform();
@@ -50,24 +82,23 @@ void Render::initResources() {
     createDescriptors();
     createPipelineLayout();
     updateAnisotropyTextureDescriptor();
-
-    m_monteCarloRender = new MonteCarlo(m_window, m_pipelineCache, m_pipelineLayout);
-    setPipeline("fast");
-
-    m_window->updateMouseLabel();
 }
 
 void Render::initSwapChainResources() {
     // Projection matrix
-    m_proj = m_window->clipCorrectionMatrix(); // adjust for Vulkan-OpenGL clip space differences
+    m_proj = m_context->clipCorrectionMatrix(); // adjust for Vulkan-OpenGL clip space differences
     const QSize sz = m_window->swapChainImageSize();
     m_proj.perspective(45.0, sz.width() / (float) sz.height(), 0.01f, 100.0f);
     m_proj.translate(0, 0, m_zoom);
     if (m_monteCarloRender) m_monteCarloRender->resizeFrameBuffer();
+    if (m_dynamicResolution) m_dynamicResolution->resizeFrameBuffer();
+    m_context->getAllocator()->trim();
 }
 
 void Render::startNextFrame() {
-    VkDevice dev = m_window->device();
+    m_context->collectGarbage();
+    swapEnvironment(m_context->currentFrame());
+    updateViewCache();
     VkCommandBuffer cb = m_window->currentCommandBuffer();
     const QSize sz = m_window->swapChainImageSize();
 
@@ -90,54 +121,43 @@ void Render::startNextFrame() {
     rpBeginInfo.clearValueCount = m_window->sampleCountFlagBits() > VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
     rpBeginInfo.pClearValues = clearValues;
 
-    float *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, m_uniformBufMem, m_uniformBufInfo[m_window->currentFrame()].offset,
-                                           43*sizeof(float), 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
-
-    QMatrix4x4 model;
-    model.translate(m_meshPosition);
-    model.rotate(m_meshRotation);
-    model.scale(m_meshScale);
+    QMatrix4x4 model = getModelMatrix();
 
-    memcpy(p, model.constData(), 16 * sizeof(float));       
-    memcpy(p+16, m_proj.constData(), 16 * sizeof(float));
-    float *projP = p+16;
-    p += 32;
-    *p++ = m_albedo[0];
-    *p++ = m_albedo[1];
-    *p++ = m_albedo[2];
-    *p++ = m_metallic;
-    *p++ = m_matAnisotropy;
-    *p++ = m_roughness;
-    *p++ = m_mesh ? 1.0 : float(m_anisotropy->getDir()->getWidth())/m_anisotropy->getDir()->getHeight();
-    *p++ = m_meshScale;
-    *p++ = m_sampleCount;
-    *p++ = m_monteCarlo ? rand()/(float)RAND_MAX + 0.52 : 0.0;
-    *p++ = m_exposure;
+    // Accurate accumulates into the scaled corner as well and its passes are timed with the frame. It
+    // keeps the scale it started with, so the scale only follows the timings when it restarts
+    if (m_dynamic) {
+        m_dynamicResolution->beginFrame(cb, !m_monteCarlo || !m_monteCarloRender->getSampleCount());
+    }
 
     if (m_monteCarlo) {
-        float r1 = rand()/(float)RAND_MAX;
-        float r2 = rand()/(float)RAND_MAX;
-
-        float offsetX = 2.0*(r1-0.5)/sz.width();
-        float offsetY = 2.0*(r2-0.5)/sz.height();
-
-        QMatrix4x4 monteCarlo;
-        monteCarlo.translate(offsetX, offsetY, 0);
-        QMatrix4x4 proj = monteCarlo*m_proj;
-        memcpy(projP, proj.constData(), 16 * sizeof(float));
+        m_monteCarloRender->setScale(m_dynamic ? m_dynamicResolution->getScale() : 1.0f);
+        const QSize extent = m_monteCarloRender->getExtent();
+        updateUniformBuffer(m_context->currentFrame(), jitter(m_proj, extent.width(), extent.height()));
+        m_monteCarloRender->render(cb, m_mesh, &m_quadBuf, m_descSet[m_context->currentFrame()]);
+    } else {
+        updateUniformBuffer(m_context->currentFrame(), m_proj);
+    }
 
-        m_monteCarloRender->render(m_mesh, &m_quadBuf, m_descSet[m_window->currentFrame()]);
+    if (m_dynamic) {
+        m_dynamicResolution->beginScene(cb);
+        drawScene(cb, m_dynamicPipeline);
+        m_dynamicResolution->endScene(cb);
     }
 
     m_frameCount++;
     if (m_timer.elapsed() > 500) {
         VkPhysicalDeviceProperties properties{};
-        m_window->vulkanInstance()->functions()->vkGetPhysicalDeviceProperties(m_window->physicalDevice(), &properties);
-        m_window->setFPSLabel((m_monteCarlo?QString::number(m_monteCarloRender->getSampleCount())+" Samples  |  ":"")+
-                              QString::number(1000.f*m_frameCount/m_timer.restart(), 'f', 1)+" FPS");
+        m_context->functions()->vkGetPhysicalDeviceProperties(m_context->physicalDevice(), &properties);
+        QString status;
+        if (m_monteCarlo) {
+            status = m_monteCarloRender->isConverged() ? "Converged at "+QString::number(m_monteCarloRender->getSampleCount())+" Samples  |  " :
+                         "Noise "+QString::number(100.f*m_monteCarloRender->getError(), 'f', 2)+"%  |  "+
+                         QString::number(100.f*m_monteCarloRender->getConvergedRatio(), 'f', 0)+"% converged  |  ";
+        }
+        if (m_dynamic) {
+            status += "Resolution "+QString::number(100.f*m_dynamicResolution->getScale(), 'f', 0)+"%  |  ";
+        }
+        m_window->setFPSLabel(status+QString::number(1000.f*m_frameCount/m_timer.restart(), 'f', 1)+" FPS");
         m_frameCount = 0;
     }
 
@@ -156,39 +176,268 @@ void Render::startNextFrame() {
     scissor.extent.height = viewport.height;
     m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
 
-    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
-    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
-                                        &m_descSet[m_window->currentFrame()], 0, nullptr);
-
-    if (m_mesh) {
-        m_mesh->draw(cb);
+    if (m_dynamic) {
+        m_dynamicResolution->upsample(cb);
     } else {
-        static const VkDeviceSize zero = 0;
-        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_quadBuf, &zero);
-        m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
+        drawScene(cb, m_pipeline);
     }
 
     if (m_monteCarlo) {
         m_monteCarloRender->resolve(cb);
     }
-    m_devFuncs->vkUnmapMemory(dev, m_uniformBufMem);
 
     if (m_showConstraints) {
         m_constraints->draw(cb, m_optimizer, m_proj*model, m_meshScale, m_lastDown, m_currentDown, m_pointList);
     }
 
     m_devFuncs->vkCmdEndRenderPass(cb);
+    if (m_dynamic) {
+        m_dynamicResolution->endFrame(cb);
+    }
 
     m_window->frameReady();
     m_window->requestUpdate();
 }
 
+void Render::drawScene(VkCommandBuffer cb, VkPipeline pipeline) {
+    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                                        &m_descSet[m_context->currentFrame()], 0, nullptr);
+
+    if (m_mesh) {
+        m_mesh->draw(cb);
+    } else {
+        static const VkDeviceSize zero = 0;
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_quadBuf, &zero);
+        m_devFuncs->vkCmdDraw(cb, 6, 1, 0, 0);
+    }
+}
+
+QMatrix4x4 Render::getModelMatrix() {
+    QMatrix4x4 model;
+    model.translate(m_meshPosition);
+    model.rotate(m_meshRotation);
+    model.scale(m_meshScale);
+    return model;
+}
+
+QMatrix4x4 Render::jitter(const QMatrix4x4 &proj, uint32_t width, uint32_t height) {
+    float r1 = rand()/(float)RAND_MAX;
+    float r2 = rand()/(float)RAND_MAX;
+
+    float offsetX = 2.0*(r1-0.5)/width;
+    float offsetY = 2.0*(r2-0.5)/height;
+
+    QMatrix4x4 monteCarlo;
+    monteCarlo.translate(offsetX, offsetY, 0);
+    return monteCarlo*proj;
+}
+
+void Render::updateUniformBuffer(int frame, const QMatrix4x4 &proj) {
+    float *p = reinterpret_cast<float *>(static_cast<char *>(m_uniformBufMem.mapped) + m_uniformBufInfo[frame].offset);
+
+    QMatrix4x4 model = getModelMatrix();
+    memcpy(p, model.constData(), 16 * sizeof(float));
+    memcpy(p+16, proj.constData(), 16 * sizeof(float));
+    p += 32;
+    *p++ = m_albedo[0];
+    *p++ = m_albedo[1];
+    *p++ = m_albedo[2];
+    *p++ = m_metallic;
+    *p++ = m_matAnisotropy;
+    *p++ = m_roughness;
+    *p++ = m_mesh ? 1.0 : float(m_anisotropy->getDir()->getWidth())/m_anisotropy->getDir()->getHeight();
+    *p++ = m_meshScale;
+    *p++ = m_sampleCount;
+    *p++ = m_monteCarlo ? rand()/(float)RAND_MAX + 0.52 : 0.0;
+    *p++ = m_exposure;
+    p++;
+    memcpy(p, m_cubeMap->getIrradiance().data(), 36 * sizeof(float));
+}
+
+bool Render::loadEnvironment(const QStringList &paths) {
+    const CubeMap::Quality quality = CubeMap::Quality(m_context->getEnvironmentQuality());
+    std::shared_ptr<CubeMap::Source> source = std::make_shared<CubeMap::Source>();
+    if (!CubeMap::prepare(paths, m_context, quality, *source)) {
+        return false;
+    }
+
+    // Decoding runs on a worker and the GPU work is polled once per frame, the current environment keeps
+    // rendering until swapEnvironment() finds the new one ready
+    std::shared_ptr<bool> decoded = std::make_shared<bool>(false);
+    m_context->startJob("Loading environment", [source, decoded](std::atomic<float> &progress) {
+        *decoded = CubeMap::decode(*source);
+        progress = 1.0f;
+    }, [this, source, decoded, quality]() {
+        // Resources are being released when jobs are flushed without a current environment
+        if (!*decoded || !m_cubeMap) {
+            if (!*decoded) {
+                qWarning("Failed to decode environment %s", qPrintable(source->paths.join(", ")));
+            }
+            CubeMap::discard(*source, m_context);
+            return;
+        }
+        // A newer load replaces one that is still prefiltering
+        delete m_pendingCubeMap;
+        m_pendingCubeMap = new CubeMap(*source, m_context, quality, true);
+    });
+    return true;
+}
+
+void Render::swapEnvironment(int frame) {
+    // Every frame switches its own set when it is recorded again, so no set is written while a frame
+    // using it is in flight. A swap only starts once the previous one reached every frame
+    if (!m_staleEnvironmentFrames && m_pendingCubeMap && m_pendingCubeMap->isReady()) {
+        m_retiredCubeMap = m_cubeMap;
+        m_cubeMap = m_pendingCubeMap;
+        m_pendingCubeMap = nullptr;
+        m_staleEnvironmentFrames = (1u << m_context->concurrentFrameCount()) - 1;
+    }
+
+    if (m_staleEnvironmentFrames & (1u << frame)) {
+        updateEnvironmentDescriptor(frame);
+        m_staleEnvironmentFrames &= ~(1u << frame);
+        if (!m_staleEnvironmentFrames) {
+            // Frames still in flight with the old images are covered by its deferred destruction
+            delete m_retiredCubeMap;
+            m_retiredCubeMap = nullptr;
+            if (m_monteCarloRender) m_monteCarloRender->clear();
+        }
+    }
+}
+
+void Render::reportEnvironmentQuality() {
+    m_cubeMap->reportQuality();
+}
+
+void Render::reportFastQuality(uint32_t width, uint32_t height, uint32_t passes, const QString &errorMapPath) {
+    m_devFuncs->vkDeviceWaitIdle(m_context->device());
+
+    QMatrix4x4 proj = m_context->clipCorrectionMatrix();
+    proj.perspective(45.0, width / (float) height, 0.01f, 100.0f);
+    proj.translate(0, 0, m_zoom);
+
+    // The descriptor set of the current frame is borrowed, the next frame rewrites its uniform buffer
+    const int frame = m_context->currentFrame();
+    const float monteCarlo = m_monteCarlo;
+    const uint32_t sampleCount = m_sampleCount;
+
+    QElapsedTimer timer;
+    timer.start();
+    Offscreen reference(m_context, width, height, m_pipelineLayout);
+    reference.setPipeline(createPipeline("accurate", reference.getRenderPass(), true));
+    m_monteCarlo = 1.0;
+    for (uint32_t i = 0; i < passes; i++) {
+        updateUniformBuffer(frame, jitter(proj, width, height));
+        reference.render(m_mesh, &m_quadBuf, m_descSet[frame]);
+    }
+    m_monteCarlo = 0.0;
+    qInfo("Fast view %ux%u against %u Monte Carlo passes, reference in %lld ms", width, height, passes, timer.elapsed());
+
+    Offscreen fast(m_context, width, height, m_pipelineLayout);
+    fast.setPipeline(createPipeline("fast", fast.getRenderPass(), true));
+    ErrorMetrics metrics(m_context, width, height);
+    auto measure = [&](uint32_t count, float &time) {
+        m_sampleCount = count;
+        updateUniformBuffer(frame, proj);
+        fast.clear();
+        time = 0;
+        for (uint32_t i = 0; i < TIMED_RUNS; i++) {
+            fast.render(m_mesh, &m_quadBuf, m_descSet[frame]);
+            time += fast.getRenderTime()/TIMED_RUNS;
+        }
+        return metrics.compare(reference.getColor(), fast.getColor());
+    };
+
+    for (uint32_t count = 1; count <= 64; count *= 2) {
+        float time;
+        const ErrorMetrics::Result result = measure(count, time);
+        // Monte Carlo efficiency, the inverse of error times cost, higher is better
+        const double efficiency = time > 0 && result.relMse > 0 ? 1.0/(result.relMse*time) : 0.0;
+        qInfo("  %2u samples %7.3f ms, RMSE %.5f, relMSE %.5f, mean dE %.3f, max dE %.2f, efficiency %.1f",
+              count, time, result.rmse, result.relMse, result.meanDeltaE, result.maxDeltaE, efficiency);
+    }
+
+    if (!errorMapPath.isEmpty()) {
+        float time;
+        measure(sampleCount, time);
+        const Texture::ExportFormat format = QFileInfo(errorMapPath).suffix().toLower() == "exr" ? Texture::ExrHalf : Texture::Png8;
+        m_context->getStagingRing()->wait(metrics.getMap()->saveToFile(errorMapPath, format));
+    }
+
+    m_sampleCount = sampleCount;
+    m_monteCarlo = monteCarlo;
+}
+
+bool Render::renderToFile(const QString &path, uint32_t width, uint32_t height, uint32_t passes) {
+    m_devFuncs->vkDeviceWaitIdle(m_context->device());
+    updateViewCache();
+
+    QMatrix4x4 proj = m_context->clipCorrectionMatrix();
+    proj.perspective(45.0, width / (float) height, 0.01f, 100.0f);
+    proj.translate(0, 0, m_zoom);
+
+    // Big outputs are split in tiles, each one rendered with a projection zoomed on its part of the
+    // screen and streamed to the file one band of BAND_ROWS rows at a time. Tiles are as tall as a band
+    // and as wide as the pixel budget allows, so memory does not grow with the output height
+    const uint32_t maxWidth = m_context->physicalDeviceProperties()->limits.maxImageDimension2D;
+    const uint32_t tileWidth = std::min({ width, TILE_PIXELS/BAND_ROWS, maxWidth });
+    const uint32_t tileHeight = std::min(height, BAND_ROWS);
+
+    // The descriptor set of the current frame is borrowed, the next frame rewrites its uniform buffer
+    const int frame = m_context->currentFrame();
+    Offscreen offscreen(m_context, tileWidth, tileHeight, m_pipelineLayout);
+    offscreen.setPipeline(createPipeline(m_pipelineName, offscreen.getRenderPass(), true));
+
+    // Up to the image size limit of the device a tile spans the whole width and goes to the file as is,
+    // only wider outputs assemble a band
+    const bool wholeRows = tileWidth == width;
+    ImageWriter writer(path, width, height);
+    std::vector<float> band(wholeRows ? 0 : size_t(width)*tileHeight*4);
+    std::vector<float> tile;
+
+    for (uint32_t y = 0; y < height; y += tileHeight) {
+        const uint32_t rows = std::min(tileHeight, height-y);
+        for (uint32_t x = 0; x < width; x += tileWidth) {
+            const uint32_t columns = std::min(tileWidth, width-x);
+
+            // Map the tile rectangle in NDC to [-1, 1], edge tiles keep the full size and get cropped
+            QMatrix4x4 tileProj;
+            tileProj.scale(width/float(tileWidth), height/float(tileHeight), 1.0f);
+            tileProj.translate(1.0f-(2.0f*x+tileWidth)/width, 1.0f-(2.0f*y+tileHeight)/height, 0.0f);
+            tileProj *= proj;
+
+            offscreen.clear();
+            for (uint32_t i = 0; i < (m_monteCarlo ? passes : 1); i++) {
+                updateUniformBuffer(frame, m_monteCarlo ? jitter(tileProj, tileWidth, tileHeight) : tileProj);
+                offscreen.render(m_mesh, &m_quadBuf, m_descSet[frame]);
+            }
+
+            offscreen.readback(tile);
+            if (!wholeRows) {
+                for (uint32_t r = 0; r < rows; r++) {
+                    memcpy(&band[(size_t(r)*width+x)*4], &tile[size_t(r)*tileWidth*4], columns*4*sizeof(float));
+                }
+            }
+        }
+        writer.writeRows(wholeRows ? tile : band, rows);
+    }
+
+    return writer.finish();
+}
+
 void Render::releaseResources() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     delete m_reference;
     m_reference = nullptr;
 
+    delete m_brdfLut;
+    m_brdfLut = nullptr;
+
+    delete m_viewCache;
+    m_viewCache = nullptr;
+
     delete m_mesh;
     m_mesh = nullptr;
 
@@ -204,34 +453,40 @@ void Render::releaseResources() {
     delete m_monteCarloRender;
     m_monteCarloRender = nullptr;
 
+    delete m_dynamicResolution;
+    m_dynamicResolution = nullptr;
+
     delete m_cubeMap;
     m_cubeMap = nullptr;
+    delete m_pendingCubeMap;
+    m_pendingCubeMap = nullptr;
+    delete m_retiredCubeMap;
+    m_retiredCubeMap = nullptr;
+    m_staleEnvironmentFrames = 0;
 
     if (m_quadBuf) {
         m_devFuncs->vkDestroyBuffer(dev, m_quadBuf, nullptr);
         m_quadBuf = VK_NULL_HANDLE;
     }
 
-    if (m_quadBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_quadBufMem, nullptr);
-        m_quadBufMem = VK_NULL_HANDLE;
-    }
+    m_context->getAllocator()->free(m_quadBufMem);
 
-    if (m_pipeline) {
-        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
-        m_pipeline = VK_NULL_HANDLE;
+    for (auto &pipeline: m_pipelines) {
+        m_devFuncs->vkDestroyPipeline(dev, pipeline.second, nullptr);
+    }
+    m_pipelines.clear();
+    m_pipeline = VK_NULL_HANDLE;
+    for (auto &pipeline: m_dynamicPipelines) {
+        m_devFuncs->vkDestroyPipeline(dev, pipeline.second, nullptr);
     }
+    m_dynamicPipelines.clear();
+    m_dynamicPipeline = VK_NULL_HANDLE;
 
     if (m_pipelineLayout) {
         m_devFuncs->vkDestroyPipelineLayout(dev, m_pipelineLayout, nullptr);
         m_pipelineLayout = VK_NULL_HANDLE;
     }
 
-    if (m_pipelineCache) {
-        m_devFuncs->vkDestroyPipelineCache(dev, m_pipelineCache, nullptr);
-        m_pipelineCache = VK_NULL_HANDLE;
-    }
-
     if (m_descSetLayout) {
         m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
         m_descSetLayout = VK_NULL_HANDLE;
@@ -247,22 +502,21 @@ void Render::releaseResources() {
         m_uniformBuf = VK_NULL_HANDLE;
     }
 
-    if (m_uniformBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_uniformBufMem, nullptr);
-        m_uniformBufMem = VK_NULL_HANDLE;
-    }
+    m_context->getAllocator()->free(m_uniformBufMem);
+
+    m_pipelineCache = VK_NULL_HANDLE;
+    m_context->destroyPipelineCache();
+    m_context->finishJobs();
+    m_context->destroyStagingRing();
+    m_context->flushGarbage();
+    m_context->destroyAllocator();
+    m_context->resetDeviceFunctions();
 }
 
 void Render::createPipelineLayout() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
-    // Pipeline cache
-    VkPipelineCacheCreateInfo pipelineCacheInfo;
-    memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
-    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VkResult err = m_devFuncs->vkCreatePipelineCache(dev, &pipelineCacheInfo, nullptr, &m_pipelineCache);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to create pipeline cache");
+    m_pipelineCache = m_context->getPipelineCache();
 
     // Pipeline layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo;
@@ -270,51 +524,32 @@ void Render::createPipelineLayout() {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
-    err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+    VkResult err = m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create pipeline layout");
+        m_context->crash("Failed to create pipeline layout");
 }
 
 void Render::createUniformBuffer() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
-    const int concurrentFrameCount = m_window->concurrentFrameCount();
-    const VkPhysicalDeviceLimits *pdevLimits = &m_window->physicalDeviceProperties()->limits;
+    const int concurrentFrameCount = m_context->concurrentFrameCount();
+    const VkPhysicalDeviceLimits *pdevLimits = &m_context->physicalDeviceProperties()->limits;
     const VkDeviceSize uniAlign = pdevLimits->minUniformBufferOffsetAlignment;
 
     VkBufferCreateInfo uniformBufInfo;
     memset(&uniformBufInfo, 0, sizeof(uniformBufInfo));
     uniformBufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    const VkDeviceSize uniformAllocSize = m_window->aligned(43*sizeof(float), uniAlign);
+    const VkDeviceSize uniformAllocSize = m_context->aligned(80*sizeof(float), uniAlign);
     uniformBufInfo.size = concurrentFrameCount * uniformAllocSize;
     uniformBufInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &uniformBufInfo, nullptr, &m_uniformBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
-
-    VkMemoryRequirements uniformMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_uniformBuf, &uniformMemReq);
-
-    VkMemoryAllocateInfo uniformMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        uniformMemReq.size,
-        m_window->findMemoryType(uniformMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &uniformMemAllocInfo, nullptr, &m_uniformBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
+        m_context->crash("Failed to create buffer");
 
-    err = m_devFuncs->vkBindBufferMemory(dev, m_uniformBuf, m_uniformBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer");
+    m_uniformBufMem = m_context->getAllocator()->allocateBuffer(m_uniformBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_uniformBufMem, 0, uniformMemReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    quint8 *p = static_cast<quint8 *>(m_uniformBufMem.mapped);
 
     QMatrix4x4 ident;
     memset(m_uniformBufInfo, 0, sizeof(m_uniformBufInfo));
@@ -325,15 +560,14 @@ void Render::createUniformBuffer() {
         m_uniformBufInfo[i].offset = offset;
         m_uniformBufInfo[i].range = uniformAllocSize;
     }
-    m_devFuncs->vkUnmapMemory(dev, m_uniformBufMem);
 }
 
 void Render::createDescriptors() {
-    VkDevice dev = m_window->device();
-    const int concurrentFrameCount = m_window->concurrentFrameCount();
+    VkDevice dev = m_context->device();
+    const int concurrentFrameCount = m_context->concurrentFrameCount();
 
     // Set up descriptor set and its layout.
-    std::array<VkDescriptorPoolSize, 6> poolSizes{};
+    std::array<VkDescriptorPoolSize, 8> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     poolSizes[0].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -346,6 +580,10 @@ void Render::createDescriptors() {
     poolSizes[4].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
     poolSizes[5].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     poolSizes[5].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
+    poolSizes[6].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[6].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
+    poolSizes[7].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[7].descriptorCount = static_cast<uint32_t>(concurrentFrameCount);
 
     VkDescriptorPoolCreateInfo descPoolInfo;
     memset(&descPoolInfo, 0, sizeof(descPoolInfo));
@@ -356,7 +594,7 @@ void Render::createDescriptors() {
     descPoolInfo.maxSets = static_cast<uint32_t>(concurrentFrameCount);
     VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor pool");
+        m_context->crash("Failed to create descriptor pool");
 
     VkDescriptorSetLayoutBinding uboLayoutBinding = {
         0, // binding
@@ -400,12 +638,28 @@ void Render::createDescriptors() {
         VK_SHADER_STAGE_FRAGMENT_BIT,
         nullptr
     };
+    VkDescriptorSetLayoutBinding brdfLutBinding = {
+        6, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding viewCacheBinding = {
+        7, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+        nullptr
+    };
 
-    std::array<VkDescriptorBindingFlags, 6> flags{0,
+    std::array<VkDescriptorBindingFlags, 8> flags{0,
+                                                  VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+                                                  0,
                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT};
 
     VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags{};
@@ -414,9 +668,10 @@ void Render::createDescriptors() {
     bindingFlags.pBindingFlags = flags.data();
     bindingFlags.bindingCount = static_cast<uint32_t>(flags.size());;
 
-    std::array<VkDescriptorSetLayoutBinding, 6> bindings = {uboLayoutBinding, anisoLayoutBinding,
+    std::array<VkDescriptorSetLayoutBinding, 8> bindings = {uboLayoutBinding, anisoLayoutBinding,
                                                             anisoLayoutDirBinding, cubemapBinding,
-                                                            referenceBinding, ggxCubemapBinding};
+                                                            referenceBinding, ggxCubemapBinding,
+                                                            brdfLutBinding, viewCacheBinding};
     VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
     descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -426,7 +681,7 @@ void Render::createDescriptors() {
 
     err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_descSetLayout);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor set layout");
+        m_context->crash("Failed to create descriptor set layout");
 
     for (int i = 0; i < concurrentFrameCount; ++i) {
         VkDescriptorSetAllocateInfo descSetAllocInfo = {
@@ -438,9 +693,9 @@ void Render::createDescriptors() {
         };
         err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSet[i]);
         if (err != VK_SUCCESS)
-            m_window->crash("Failed to allocate descriptor set");
+            m_context->crash("Failed to allocate descriptor set");
 
-        std::array<VkDescriptorImageInfo, 5> imageInfo{};
+        std::array<VkDescriptorImageInfo, 7> imageInfo{};
         imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[0].imageView = m_anisotropy->getMap()->getImageView();
         imageInfo[0].sampler = m_anisotropy->getMap()->getTextureSampler();
@@ -456,8 +711,14 @@ void Render::createDescriptors() {
         imageInfo[4].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[4].imageView = m_cubeMap->getImageView(1);
         imageInfo[4].sampler = m_cubeMap->getTextureSampler();
-
-        std::array<VkWriteDescriptorSet, 6> descWrites{};
+        imageInfo[5].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo[5].imageView = m_brdfLut->getImageView();
+        imageInfo[5].sampler = m_brdfLut->getTextureSampler();
+        imageInfo[6].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo[6].imageView = m_viewCache->getTexture()->getImageView();
+        imageInfo[6].sampler = m_viewCache->getTexture()->getTextureSampler();
+
+        std::array<VkWriteDescriptorSet, 8> descWrites{};
         descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descWrites[0].dstSet = m_descSet[i];
         descWrites[0].dstBinding = 0;
@@ -506,12 +767,123 @@ void Render::createDescriptors() {
         descWrites[5].descriptorCount = 1;
         descWrites[5].pImageInfo = &imageInfo[4];
 
+        descWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[6].dstSet = m_descSet[i];
+        descWrites[6].dstBinding = 6;
+        descWrites[6].dstArrayElement = 0;
+        descWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descWrites[6].descriptorCount = 1;
+        descWrites[6].pImageInfo = &imageInfo[5];
+
+        descWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[7].dstSet = m_descSet[i];
+        descWrites[7].dstBinding = 7;
+        descWrites[7].dstArrayElement = 0;
+        descWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descWrites[7].descriptorCount = 1;
+        descWrites[7].pImageInfo = &imageInfo[6];
+
         m_devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
     }
 }
 
+void Render::createBrdfLut() {
+    VkDevice dev = m_context->device();
+    m_brdfLut = new Texture(BRDF_LUT_SIZE, BRDF_LUT_SIZE, m_context, 1, VK_FORMAT_R16G16B16A16_SFLOAT, true, true);
+
+    // Baked once, the pass objects only live for this submission
+    VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 };
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.poolSizeCount = 1;
+    descPoolInfo.pPoolSizes = &poolSize;
+    descPoolInfo.maxSets = 1;
+    VkDescriptorPool descPool;
+    if (m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &descPool) != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor pool");
+
+    VkDescriptorSetLayoutBinding lutBinding = {
+        0, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = 1;
+    descLayoutInfo.pBindings = &lutBinding;
+    VkDescriptorSetLayout descSetLayout;
+    if (m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &descSetLayout) != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor set layout");
+
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        nullptr,
+        descPool,
+        1,
+        &descSetLayout
+    };
+    VkDescriptorSet descSet;
+    if (m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &descSet) != VK_SUCCESS)
+        m_context->crash("Failed to allocate descriptor set");
+
+    VkDescriptorImageInfo imageInfo = { VK_NULL_HANDLE, m_brdfLut->getImageView(), VK_IMAGE_LAYOUT_GENERAL };
+    VkWriteDescriptorSet descWrite{};
+    descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrite.dstSet = descSet;
+    descWrite.dstBinding = 0;
+    descWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descWrite.descriptorCount = 1;
+    descWrite.pImageInfo = &imageInfo;
+    m_devFuncs->vkUpdateDescriptorSets(dev, 1, &descWrite, 0, nullptr);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descSetLayout;
+    VkPipelineLayout pipelineLayout;
+    if (m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline layout!");
+    }
+
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("brdfLut_comp.spv"));
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = computeShaderModule;
+    pipelineInfo.stage.pName = "main";
+    VkPipeline pipeline;
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
+    }
+    m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
+
+    // No staging memory is needed, the ring only provides the command buffer and its fence
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(0);
+    m_devFuncs->vkCmdBindPipeline(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descSet, 0, nullptr);
+    m_devFuncs->vkCmdDispatch(transfer.commandBuffer, BRDF_LUT_SIZE/8, BRDF_LUT_SIZE/8, 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+    staging->wait(staging->submit(transfer));
+
+    m_devFuncs->vkDestroyPipeline(dev, pipeline, nullptr);
+    m_devFuncs->vkDestroyPipelineLayout(dev, pipelineLayout, nullptr);
+    m_devFuncs->vkDestroyDescriptorSetLayout(dev, descSetLayout, nullptr);
+    m_devFuncs->vkDestroyDescriptorPool(dev, descPool, nullptr);
+}
+
 void Render::updateAnisotropyTextureDescriptor() {
-    for (int i = 0; i < m_window->concurrentFrameCount(); ++i) {
+    for (int i = 0; i < m_context->concurrentFrameCount(); ++i) {
         std::array<VkDescriptorImageInfo, 2> imageInfo{};
         imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[0].imageView = m_anisotropy->getMap()->getImageView();
@@ -536,24 +908,150 @@ void Render::updateAnisotropyTextureDescriptor() {
         descWrites[1].descriptorCount = 1;
         descWrites[1].pImageInfo = &imageInfo[1];
 
-        m_devFuncs->vkUpdateDescriptorSets(m_window->device(), 2, descWrites.data(), 0, nullptr);
+        m_devFuncs->vkUpdateDescriptorSets(m_context->device(), 2, descWrites.data(), 0, nullptr);
+    }
+}
+
+void Render::updateViewCache() {
+    if (m_viewCache->resize()) {
+        updateViewCacheDescriptor();
+    }
+    if (ViewCache::isCached(m_pipelineName)) {
+        m_viewCache->update(m_pipelineName, m_matAnisotropy);
+    }
+}
+
+void Render::updateViewCacheDescriptor() {
+    for (int i = 0; i < m_context->concurrentFrameCount(); ++i) {
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo.imageView = m_viewCache->getTexture()->getImageView();
+        imageInfo.sampler = m_viewCache->getTexture()->getTextureSampler();
+
+        VkWriteDescriptorSet descWrite{};
+        descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrite.dstSet = m_descSet[i];
+        descWrite.dstBinding = 7;
+        descWrite.dstArrayElement = 0;
+        descWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descWrite.descriptorCount = 1;
+        descWrite.pImageInfo = &imageInfo;
+
+        m_devFuncs->vkUpdateDescriptorSets(m_context->device(), 1, &descWrite, 0, nullptr);
+    }
+}
+
+void Render::updateEnvironmentDescriptor(int frame) {
+    std::array<VkDescriptorImageInfo, 2> imageInfo{};
+    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[0].imageView = m_cubeMap->getImageView();
+    imageInfo[0].sampler = m_cubeMap->getTextureSampler();
+    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[1].imageView = m_cubeMap->getImageView(1);
+    imageInfo[1].sampler = m_cubeMap->getTextureSampler();
+
+    std::array<VkWriteDescriptorSet, 2> descWrites{};
+    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[0].dstSet = m_descSet[frame];
+    descWrites[0].dstBinding = 3;
+    descWrites[0].dstArrayElement = 0;
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[0].descriptorCount = 1;
+    descWrites[0].pImageInfo = &imageInfo[0];
+    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[1].dstSet = m_descSet[frame];
+    descWrites[1].dstBinding = 5;
+    descWrites[1].dstArrayElement = 0;
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[1].descriptorCount = 1;
+    descWrites[1].pImageInfo = &imageInfo[1];
+
+    m_devFuncs->vkUpdateDescriptorSets(m_context->device(), 2, descWrites.data(), 0, nullptr);
+}
+
+static constexpr const char *VIEWS[] = {
+    "fast", "accurate", "direction", "twilight", "sine", "reference", "bent"
+};
+
+static constexpr bool viewsEmbedded() {
+    for (const char *view: VIEWS) {
+        if (!EmbeddedShaders::exists(view, "_vert.spv") || !EmbeddedShaders::exists(view, "_frag.spv")) return false;
+    }
+    return true;
+}
+static_assert(viewsEmbedded(), "every view needs its vertex and fragment shader in SHADERS");
+
+void Render::prebuildPipelines() {
+    // Compile every view upfront on worker threads, the shared pipeline cache is internally synchronized.
+    // With a warm cache on disk this only costs the lookups, and switching view afterwards is free.
+    static const std::vector<std::string> names(std::begin(VIEWS), std::end(VIEWS));
+    static const std::vector<std::string> monteCarloNames = { "accurate" };
+
+    std::vector<VkPipeline> pipelines(names.size());
+    std::vector<VkPipeline> monteCarloPipelines(monteCarloNames.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < names.size(); i++) {
+        workers.emplace_back([&, i]() { pipelines[i] = createPipeline(names[i]); });
+    }
+    for (size_t i = 0; i < monteCarloNames.size(); i++) {
+        workers.emplace_back([&, i]() { monteCarloPipelines[i] = m_monteCarloRender->createPipeline(monteCarloNames[i]); });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    for (size_t i = 0; i < names.size(); i++) {
+        m_pipelines[names[i]] = pipelines[i];
+    }
+    for (size_t i = 0; i < monteCarloNames.size(); i++) {
+        m_monteCarloRender->addPipeline(monteCarloNames[i], monteCarloPipelines[i]);
     }
 }
 
 void Render::setPipeline(const std::string &name, bool montecarlo) {
     m_monteCarlo = montecarlo;
-    VkDevice dev = m_window->device();
+    m_pipelineName = name;
 
-    if (m_pipeline) {
-        m_devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+    // Batch rendering only builds the offscreen pipeline of the view
+    if (m_window) {
+        auto it = m_pipelines.find(name);
+        if (it == m_pipelines.end()) {
+            it = m_pipelines.emplace(name, createPipeline(name)).first;
+        }
+        m_pipeline = it->second;
     }
 
+    if (m_monteCarlo && m_monteCarloRender) m_monteCarloRender->setPipeline(name);
+
+    if (m_dynamic) m_dynamicPipeline = getDynamicPipeline(name);
+}
+
+VkPipeline Render::getDynamicPipeline(const std::string &name) {
+    // Only compiled once dynamic resolution is turned on, most sessions never need them
+    auto it = m_dynamicPipelines.find(name);
+    if (it == m_dynamicPipelines.end()) {
+        it = m_dynamicPipelines.emplace(name, createPipeline(name, m_dynamicResolution->getRenderPass())).first;
+    }
+    return it->second;
+}
+
+void Render::setDynamicResolution(bool val) {
+    m_dynamic = val;
+    if (m_dynamic) m_dynamicPipeline = getDynamicPipeline(m_pipelineName);
+    // The accumulation only takes the new scale when it restarts
+    if (m_monteCarloRender) m_monteCarloRender->clear();
+}
+
+void Render::setTargetFrameTime(float ms) {
+    if (m_dynamicResolution) m_dynamicResolution->setTargetFrameTime(ms);
+}
+
+VkPipeline Render::createPipeline(const std::string &name, VkRenderPass renderPass, bool accumulate) {
+    VkDevice dev = m_context->device();
+
     // Shaders
-    VkShaderModule vertShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                   "/assets/shaders/"+QString::fromStdString(name)+"_vert.spv");
-    VkShaderModule fragShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                   "/assets/shaders/"+QString::fromStdString(name)+"_frag.spv");
+    VkShaderModule vertShaderModule = m_context->createShader(QString::fromStdString(name)+"_vert.spv");
+    VkShaderModule fragShaderModule = m_context->createShader(QString::fromStdString(name)+"_frag.spv");
     // Graphics pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -654,7 +1152,7 @@ void Render::setPipeline(const std::string &name, bool montecarlo) {
     memset(&ms, 0, sizeof(ms));
     ms.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     // Enable multisampling.
-    ms.rasterizationSamples = m_window->sampleCountFlagBits();
+    ms.rasterizationSamples = renderPass ? VK_SAMPLE_COUNT_1_BIT : m_window->sampleCountFlagBits();
     pipelineInfo.pMultisampleState = &ms;
 
     VkPipelineDepthStencilStateCreateInfo ds;
@@ -663,7 +1161,8 @@ void Render::setPipeline(const std::string &name, bool montecarlo) {
     ds.depthTestEnable = VK_TRUE;
     ds.depthWriteEnable = VK_TRUE;
     ds.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-    ds.stencilTestEnable = VK_TRUE;
+    // Offscreen depth has no stencil
+    ds.stencilTestEnable = accumulate ? VK_FALSE : VK_TRUE;
     ds.back.compareOp = VK_COMPARE_OP_ALWAYS;
     ds.back.failOp = VK_STENCIL_OP_REPLACE;
     ds.back.depthFailOp = VK_STENCIL_OP_REPLACE;
@@ -680,6 +1179,16 @@ void Render::setPipeline(const std::string &name, bool montecarlo) {
     // no blend, write out all of rgba
     VkPipelineColorBlendAttachmentState att;
     memset(&att, 0, sizeof(att));
+    if (accumulate) {
+        // Passes are summed, alpha counts them
+        att.blendEnable = VK_TRUE;
+        att.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        att.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        att.colorBlendOp = VK_BLEND_OP_ADD;
+        att.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        att.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        att.alphaBlendOp = VK_BLEND_OP_ADD;
+    }
     att.colorWriteMask = 0xF;
     cb.attachmentCount = 1;
     cb.pAttachments = &att;
@@ -694,18 +1203,19 @@ void Render::setPipeline(const std::string &name, bool montecarlo) {
     pipelineInfo.pDynamicState = &dyn;
 
     pipelineInfo.layout = m_pipelineLayout;
-    pipelineInfo.renderPass = m_window->defaultRenderPass();
+    pipelineInfo.renderPass = renderPass ? renderPass : m_window->defaultRenderPass();
 
-    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_pipeline);
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create graphis pipeline");
+        m_context->crash("Failed to create graphis pipeline");
 
     if (vertShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, vertShaderModule, nullptr);
     if (fragShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
 
-    if (m_monteCarloRender) m_monteCarloRender->setPipeline(name);
+    return pipeline;
 }
 
 void Render::resetMeshTransform() {
@@ -713,19 +1223,21 @@ void Render::resetMeshTransform() {
     m_meshPosition = QVector3D(0.0, 0.0, 0.0);
     m_meshScale = 1.3f;
 
-    m_proj = m_window->clipCorrectionMatrix(); // adjust for Vulkan-OpenGL clip space differences
-    const QSize sz = m_window->swapChainImageSize();
-    m_proj.perspective(45.0, sz.width() / (float) sz.height(), 0.01f, 100.0f);
-    m_proj.translate(0, 0, m_zoom);
+    if (m_window) {
+        m_proj = m_context->clipCorrectionMatrix(); // adjust for Vulkan-OpenGL clip space differences
+        const QSize sz = m_window->swapChainImageSize();
+        m_proj.perspective(45.0, sz.width() / (float) sz.height(), 0.01f, 100.0f);
+        m_proj.translate(0, 0, m_zoom);
+        m_window->updateMouseLabel();
+    }
 
     if (m_monteCarloRender) m_monteCarloRender->clear();
-    m_window->updateMouseLabel();
 }
 
 void Render::setReferenceImage(const QString &path, bool resetAnisotropySize) {
     delete m_reference;
-    m_reference = new Texture(path, m_window);
-    for (int i = 0; i < m_window->concurrentFrameCount(); ++i) {
+    m_reference = new Texture(path, m_context);
+    for (int i = 0; i < m_context->concurrentFrameCount(); ++i) {
         std::array<VkDescriptorImageInfo, 1> imageInfo{};
         imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         imageInfo[0].imageView = m_reference->getImageView();
@@ -740,7 +1252,7 @@ void Render::setReferenceImage(const QString &path, bool resetAnisotropySize) {
         descWrites[0].descriptorCount = 1;
         descWrites[0].pImageInfo = &imageInfo[0];
 
-        m_devFuncs->vkUpdateDescriptorSets(m_window->device(), 1, descWrites.data(), 0, nullptr);
+        m_devFuncs->vkUpdateDescriptorSets(m_context->device(), 1, descWrites.data(), 0, nullptr);
     }
 
     if (resetAnisotropySize) {
@@ -760,7 +1272,7 @@ void Render::setAnisoDirTexture(const QString &path) {
     updateAnisotropyTextureDescriptor();
     m_optimizer->setDirectionTexture(m_anisotropy->getDir());
     if (m_monteCarloRender) m_monteCarloRender->clear();
-    m_window->updateMouseLabel();
+    if (m_window) m_window->updateMouseLabel();
 }
 
 void Render::newAnisoDirTexture(uint32_t width, uint32_t heigth) {
@@ -768,12 +1280,12 @@ void Render::newAnisoDirTexture(uint32_t width, uint32_t heigth) {
     updateAnisotropyTextureDescriptor();
     m_optimizer->setDirectionTexture(m_anisotropy->getDir());
     if (m_monteCarloRender) m_monteCarloRender->clear();
-    m_window->updateMouseLabel();
+    if (m_window) m_window->updateMouseLabel();
 }
 
 bool Render::setMesh(const QString &path) {
     delete m_mesh;
-    m_mesh = new Mesh(path, m_window);
+    m_mesh = new Mesh(path, m_context);
     if (!m_mesh->isValid()) {
         delete m_mesh;
         m_mesh = nullptr;
@@ -795,7 +1307,7 @@ void Render::setAnisoAngleTexture(const QString &path, bool half) {
     updateAnisotropyTextureDescriptor();
     m_optimizer->setDirectionTexture(m_anisotropy->getDir());
     if (m_monteCarloRender) m_monteCarloRender->clear();
-    m_window->updateMouseLabel();
+    if (m_window) m_window->updateMouseLabel();
 }
 
 void Render::setAlbedo(float r, float g, float b) {
@@ -819,7 +1331,7 @@ bool Render::getShowConstraints() {
 }
 
 void Render::createQuadData() {
-    VkDevice dev = m_window->device();
+    VkDevice dev = m_context->device();
 
     float data[] = {1.0, 0.0, 0.0, -1.0, 1.0, 1.0, 0.0, 0.0, 0.0, -1.0, 1.0, 0.0,
                     1.0, 0.0, 0.0, -1.0, 1.0, -1.0, 0.0, 0.0, 0.0, -1.0, 1.0, 1.0,
@@ -836,33 +1348,13 @@ void Render::createQuadData() {
 
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &meshBufInfo, nullptr, &m_quadBuf);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create buffer");
+        m_context->crash("Failed to create buffer");
 
-    VkMemoryRequirements meshMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_quadBuf, &meshMemReq);
+    m_quadBufMem = m_context->getAllocator()->allocateBuffer(m_quadBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkMemoryAllocateInfo meshMemAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        meshMemReq.size,
-        m_window->findMemoryType(meshMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &meshMemAllocInfo, nullptr, &m_quadBufMem);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate memory");
-
-    err = m_devFuncs->vkBindBufferMemory(dev, m_quadBuf, m_quadBufMem, 0);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to bind buffer memory");
-
-    void *p;
-    err = m_devFuncs->vkMapMemory(dev, m_quadBufMem, 0, meshMemReq.size, 0, &p);
-    if (err != VK_SUCCESS)
-        m_window->crash("Failed to map memory");
+    void *p = m_quadBufMem.mapped;
 
     memcpy(p, data, sizeof(data));
-    m_devFuncs->vkUnmapMemory(dev, m_quadBufMem);
 }
 
 void Render::updateRotation(float x, float y) {
@@ -879,7 +1371,7 @@ void Render::updateScale(float w) {
     m_meshScale *= w;
     m_meshPosition *= w;
     if (m_monteCarloRender) m_monteCarloRender->clear();
-    m_window->updateMouseLabel();
+    if (m_window) m_window->updateMouseLabel();
 }
 
 void Render::setMetallic(float val) {
@@ -891,22 +1383,26 @@ float Render::getScale() {
     return m_meshScale;
 }
 
-void Render::saveAnisoDir(const QString &path) {
-    m_anisotropy->saveAnisoDir(path);
+void Render::saveAnisoDir(const QString &path, Texture::ExportFormat format) {
+    m_anisotropy->saveAnisoDir(path, format);
 }
 
-void Render::saveAnisoAngle(const QString &path) {
-    m_anisotropy->saveAnisoAngle(path);
+void Render::saveAnisoAngle(const QString &path, Texture::ExportFormat format) {
+    m_anisotropy->saveAnisoAngle(path, format);
 }
 
-void Render::saveZebra(const QString &path) {
-    m_anisotropy->saveZebra(path);
+void Render::saveZebra(const QString &path, Texture::ExportFormat format) {
+    m_anisotropy->saveZebra(path, format);
 }
 
 void Render::setSampleCount(uint32_t val) {
     m_sampleCount = val;
 }
 
+void Render::setTargetError(float val) {
+    if (m_monteCarloRender) m_monteCarloRender->setTargetError(val);
+}
+
 bool Render::mouseToUV(QPointF mousePosition, QPointF &hitUV) {
     QMatrix4x4 view;
     view.translate(0, 0, m_zoom);
@@ -3,12 +3,15 @@
 class Anisotropy;
 class Optimizer;
 class MonteCarlo;
+class DynamicResolution;
+class ViewCache;
 class BrdfIntegrator;
 
 #include <QVulkanWindow>
-#include <QVulkanFunctions>
+#include "src/Render/vulkancontext.h"
 #include "src/Texture/texture.h"
 #include <QElapsedTimer>
+#include <map>
 
 class CubeMap;
 class Mesh;
@@ -18,8 +21,12 @@ class ConstraintsRenderer;
 class Render : public QVulkanWindowRenderer {
 public:
     Render(VulkanWindow *w, Optimizer *&o, const std::vector<std::array<float, 2>> &pointList, bool msaa = false);
+    // Batch rendering on a device without window, only initScene() and the offscreen outputs are used
+    Render(VulkanContext *context, Optimizer *&o);
 
     void initResources() override;
+    // Field, environment and descriptors, everything the offscreen outputs need
+    void initScene();
     void initSwapChainResources() override;
     void releaseResources() override;
     void startNextFrame() override;
@@ -41,13 +48,29 @@ public:
     void setExposure(float val);
     void showConstraints(bool val);
     bool getShowConstraints();
+    // Upper bound of the samples the fast view takes per pixel, fewer are used where the lobe is close to isotropic
     void setSampleCount(uint32_t val);
+    void setTargetError(float val);
+    // Scale the scene resolution to hold the target GPU frame time, overlays stay at native resolution
+    void setDynamicResolution(bool val);
+    void setTargetFrameTime(float ms);
     bool setMesh(const QString &path);
     void unloadMesh();
 
-    void saveAnisoDir(const QString &path);
-    void saveZebra(const QString &path);
-    void saveAnisoAngle(const QString &path);
+    // Render the current view offscreen at any size, accumulating passes of 16 samples per pixel in the accurate view.
+    // Outputs are rendered in tiles and streamed to the file in bands of BAND_ROWS rows.
+    bool renderToFile(const QString &path, uint32_t width, uint32_t height, uint32_t passes = 64);
+    // Six faces in +X, -X, +Y, -Y, +Z, -Z order or one equirectangular panorama. Decoding and
+    // prefiltering run in the background, false when the files can not be read at all
+    bool loadEnvironment(const QStringList &paths);
+    // Log the prefilter time and error of every environment quality tier against the reference one
+    void reportEnvironmentQuality();
+    // Log GPU time and error of the fast view against a Monte Carlo reference of the same camera for
+    // every sample count, and save the Delta E map at the current sample count when a path is given
+    void reportFastQuality(uint32_t width, uint32_t height, uint32_t passes, const QString &errorMapPath = QString());
+    void saveAnisoDir(const QString &path, Texture::ExportFormat format = Texture::Png8);
+    void saveZebra(const QString &path, Texture::ExportFormat format = Texture::Png8);
+    void saveAnisoAngle(const QString &path, Texture::ExportFormat format = Texture::Png8);
     void updateAnisotropyTextureDescriptor();
 
     bool mouseToUV(QPointF mousePosition, QPointF &hitUV);
@@ -58,11 +81,28 @@ protected:
     void createUniformBuffer();
     void createDescriptors();
     void createQuadData();
-
+    void createBrdfLut();
+    void prebuildPipelines();
+    void swapEnvironment(int frame);
+    void updateEnvironmentDescriptor(int frame);
+    // Rebake the current view when it is one of the cached ones and the field changed
+    void updateViewCache();
+    void updateViewCacheDescriptor();
+    // Pipelines for another render pass than the default one are single sampled, accumulate sums
+    // the passes in the render pass of Offscreen
+    VkPipeline createPipeline(const std::string &name, VkRenderPass renderPass = VK_NULL_HANDLE, bool accumulate = false);
+    VkPipeline getDynamicPipeline(const std::string &name);
+    void drawScene(VkCommandBuffer cb, VkPipeline pipeline);
+    void updateUniformBuffer(int frame, const QMatrix4x4 &proj);
+    QMatrix4x4 getModelMatrix();
+    QMatrix4x4 jitter(const QMatrix4x4 &proj, uint32_t width, uint32_t height);
+
+    VulkanContext *m_context;
+    // Null in batch rendering
     VulkanWindow *m_window;
-    QVulkanDeviceFunctions *m_devFuncs;
+    VulkanDeviceFunctions *m_devFuncs;
 
-    VkDeviceMemory m_uniformBufMem = VK_NULL_HANDLE;
+    MemoryAllocation m_uniformBufMem;
     VkBuffer m_uniformBuf = VK_NULL_HANDLE;
     VkDescriptorBufferInfo m_uniformBufInfo[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
 
@@ -73,6 +113,12 @@ protected:
     VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
     VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
     VkPipeline m_pipeline = VK_NULL_HANDLE;
+    std::map<std::string, VkPipeline> m_pipelines;
+    std::string m_pipelineName;
+    static constexpr uint32_t TILE_PIXELS = 2048*2048;
+    static constexpr uint32_t BAND_ROWS = 128;
+    // Renders averaged per sample count when timing the fast view
+    static constexpr uint32_t TIMED_RUNS = 8;
 
     QQuaternion m_meshRotation;
     QVector3D m_meshPosition;
@@ -91,13 +137,25 @@ protected:
 
     Anisotropy *m_anisotropy = nullptr;
     Texture *m_reference = nullptr;
+    // Specular directional albedo over (cos theta_o, roughness) as scale and bias of F0
+    Texture *m_brdfLut = nullptr;
+    static constexpr uint32_t BRDF_LUT_SIZE = 64;
+    ViewCache *m_viewCache = nullptr;
     ConstraintsRenderer *m_constraints = nullptr;
     bool m_showConstraints = true;
     Optimizer *&m_optimizer;
     const std::vector<std::array<float, 2>> &m_pointList;
     MonteCarlo *m_monteCarloRender = nullptr;
+    DynamicResolution *m_dynamicResolution = nullptr;
+    bool m_dynamic = false;
+    VkPipeline m_dynamicPipeline = VK_NULL_HANDLE;
+    std::map<std::string, VkPipeline> m_dynamicPipelines;
     CubeMap *m_cubeMap = nullptr;
-    VkDeviceMemory m_quadBufMem = VK_NULL_HANDLE;
+    // Prefiltering in the background, and the previous one until no frame's set refers to it
+    CubeMap *m_pendingCubeMap = nullptr;
+    CubeMap *m_retiredCubeMap = nullptr;
+    uint32_t m_staleEnvironmentFrames = 0;
+    MemoryAllocation m_quadBufMem;
     VkBuffer m_quadBuf = VK_NULL_HANDLE;
 
     QPointF m_currentDown;
@@ -0,0 +1,227 @@
+#include "stagingring.h"
+#include "src/Render/vulkancontext.h"
+
+StagingRing::StagingRing(VulkanContext *context) : m_context(context) {
+    VkDevice dev = m_context->device();
+    m_devFuncs = m_context->deviceFunctions();
+
+    m_buffer = createBuffer(RING_SIZE, m_memory);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_context->graphicsQueueFamilyIndex();
+
+    if (m_devFuncs->vkCreateCommandPool(dev, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        m_context->crash("failed to create staging command pool!");
+    }
+}
+
+StagingRing::~StagingRing() {
+    VkDevice dev = m_context->device();
+
+    while (!m_pending.empty()) {
+        Pending &pending = m_pending.front();
+        if (pending.fence) {
+            m_devFuncs->vkWaitForFences(dev, 1, &pending.fence, VK_TRUE, UINT64_MAX);
+        }
+        recycle(pending);
+        m_pending.pop_front();
+    }
+
+    for (VkFence fence: m_freeFences) {
+        m_devFuncs->vkDestroyFence(dev, fence, nullptr);
+    }
+    if (m_commandPool) {
+        m_devFuncs->vkDestroyCommandPool(dev, m_commandPool, nullptr);
+    }
+    if (m_buffer) {
+        m_devFuncs->vkDestroyBuffer(dev, m_buffer, nullptr);
+    }
+    m_context->getAllocator()->free(m_memory);
+}
+
+VkBuffer StagingRing::createBuffer(VkDeviceSize size, MemoryAllocation &memory) {
+    VkDevice dev = m_context->device();
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    if (m_devFuncs->vkCreateBuffer(dev, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        m_context->crash("failed to create staging buffer!");
+    }
+
+    memory = m_context->getAllocator()->allocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    return buffer;
+}
+
+void StagingRing::recycle(Pending &pending) {
+    VkDevice dev = m_context->device();
+
+    m_devFuncs->vkFreeCommandBuffers(dev, m_commandPool, 1, &pending.commandBuffer);
+    if (pending.fence) {
+        m_devFuncs->vkResetFences(dev, 1, &pending.fence);
+        m_freeFences.push_back(pending.fence);
+    }
+    if (pending.tempBuffer) {
+        m_devFuncs->vkDestroyBuffer(dev, pending.tempBuffer, nullptr);
+        m_context->getAllocator()->free(pending.tempMemory);
+    }
+}
+
+void StagingRing::collect() {
+    VkDevice dev = m_context->device();
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (!it->held && it->fence && m_devFuncs->vkGetFenceStatus(dev, it->fence) == VK_SUCCESS) {
+            recycle(*it);
+            it = m_pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool StagingRing::overlaps(VkDeviceSize offset, VkDeviceSize size) {
+    for (const Pending &pending: m_pending) {
+        if (pending.size && offset < pending.offset + pending.size && pending.offset < offset + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StagingRing::Transfer StagingRing::begin(VkDeviceSize size, bool hold) {
+    VkDevice dev = m_context->device();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    collect();
+
+    Pending pending{};
+    pending.id = m_nextId++;
+    pending.held = hold;
+
+    Transfer transfer;
+    transfer.id = pending.id;
+
+    if (size > RING_SIZE || hold) {
+        pending.tempBuffer = createBuffer(size, pending.tempMemory);
+        transfer.buffer = pending.tempBuffer;
+        transfer.offset = 0;
+        transfer.mapped = pending.tempMemory.mapped;
+    } else {
+        VkDeviceSize offset = m_context->aligned(m_head, ALIGNMENT);
+        if (offset + size > RING_SIZE) {
+            offset = 0;
+        }
+
+        // Wait for the oldest transfers until the slice is free, held ones never live in the ring
+        while (overlaps(offset, size)) {
+            auto oldest = m_pending.begin();
+            while (!oldest->size) ++oldest;
+            if (!oldest->fence) {
+                m_context->crash("staging ring exhausted by a transfer that was never submitted!");
+            }
+            m_devFuncs->vkWaitForFences(dev, 1, &oldest->fence, VK_TRUE, UINT64_MAX);
+            recycle(*oldest);
+            m_pending.erase(oldest);
+        }
+
+        m_head = offset + size;
+        pending.offset = offset;
+        pending.size = size;
+        transfer.buffer = m_buffer;
+        transfer.offset = offset;
+        transfer.mapped = static_cast<char*>(m_memory.mapped) + offset;
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_commandPool;
+    allocInfo.commandBufferCount = 1;
+    m_devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &pending.commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    m_devFuncs->vkBeginCommandBuffer(pending.commandBuffer, &beginInfo);
+
+    transfer.commandBuffer = pending.commandBuffer;
+    m_pending.push_back(pending);
+    return transfer;
+}
+
+uint64_t StagingRing::submit(const Transfer &transfer) {
+    VkDevice dev = m_context->device();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    VkFence fence;
+    if (!m_freeFences.empty()) {
+        fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    } else {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (m_devFuncs->vkCreateFence(dev, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+            m_context->crash("failed to create staging fence!");
+        }
+    }
+
+    m_devFuncs->vkEndCommandBuffer(transfer.commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &transfer.commandBuffer;
+
+    if (m_devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+        m_context->crash("failed to submit staging transfer!");
+    }
+
+    for (Pending &pending: m_pending) {
+        if (pending.id == transfer.id) {
+            pending.fence = fence;
+            break;
+        }
+    }
+    return transfer.id;
+}
+
+void StagingRing::wait(uint64_t id) {
+    // The lock is held while waiting, otherwise begin() on another thread could find the fence
+    // signaled and reset it for the next transfer while this thread is still waiting on it
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Pending &pending: m_pending) {
+        if (pending.id == id) {
+            if (pending.fence) {
+                m_devFuncs->vkWaitForFences(m_context->device(), 1, &pending.fence, VK_TRUE, UINT64_MAX);
+            }
+            break;
+        }
+    }
+}
+
+bool StagingRing::isDone(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Pending &pending: m_pending) {
+        if (pending.id == id) {
+            return pending.fence && m_devFuncs->vkGetFenceStatus(m_context->device(), pending.fence) == VK_SUCCESS;
+        }
+    }
+    // Already recycled
+    return true;
+}
+
+void StagingRing::release(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Pending &pending: m_pending) {
+        if (pending.id == id) {
+            pending.held = false;
+            break;
+        }
+    }
+    collect();
+}
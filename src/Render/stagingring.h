@@ -0,0 +1,75 @@
+#pragma once
+#include <QVulkanWindow>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "src/Render/memoryallocator.h"
+
+class VulkanContext;
+
+// Persistent host visible buffer used by every texture upload and readback. A transfer reserves
+// a slice of the ring and records all its commands in one command buffer, the slice is recycled
+// once the fence of that submission has signaled. Transfers bigger than the ring get a
+// temporary buffer released the same way. Transfers are recorded and submitted from the GUI thread
+// like every other submission, wait() and release() may be called from any thread and take the
+// same lock as begin() and submit().
+class StagingRing {
+public:
+    struct Transfer {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        void *mapped = nullptr;
+        uint64_t id = 0;
+    };
+
+    StagingRing(VulkanContext *context);
+    ~StagingRing();
+
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    // Reserve size bytes of staging memory and begin recording the copies. A held transfer stays
+    // mapped after its fence until release(), it gets its own buffer so it never pins the ring.
+    Transfer begin(VkDeviceSize size, bool hold = false);
+    // Submit to the graphics queue without waiting, returns the id to wait on
+    uint64_t submit(const Transfer &transfer);
+    // Block until the transfer is done, a readback that is not held stays valid until the next begin()
+    void wait(uint64_t id);
+    // Same as wait() without blocking, for polling from the render loop
+    bool isDone(uint64_t id);
+    void release(uint64_t id);
+
+private:
+    struct Pending {
+        uint64_t id;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        VkCommandBuffer commandBuffer;
+        VkFence fence = VK_NULL_HANDLE;
+        VkBuffer tempBuffer = VK_NULL_HANDLE;
+        MemoryAllocation tempMemory;
+        bool held = false;
+    };
+
+    void collect();
+    void recycle(Pending &pending);
+    bool overlaps(VkDeviceSize offset, VkDeviceSize size);
+    VkBuffer createBuffer(VkDeviceSize size, MemoryAllocation &memory);
+
+    static constexpr VkDeviceSize RING_SIZE = 32*1024*1024;
+    static constexpr VkDeviceSize ALIGNMENT = 256;
+
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+    std::mutex m_mutex;
+
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_memory;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+
+    VkDeviceSize m_head = 0;
+    uint64_t m_nextId = 1;
+    std::deque<Pending> m_pending;
+    std::vector<VkFence> m_freeFences;
+};
@@ -0,0 +1,230 @@
+#include "src/Render/viewcache.h"
+#include "src/Field/anisotropy.h"
+#include "src/Render/stagingring.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+ViewCache::ViewCache(VulkanContext *context, Anisotropy *anisotropy)
+    : m_context(context), m_anisotropy(anisotropy) {
+    m_devFuncs = m_context->deviceFunctions();
+
+    resize();
+    createDescriptors();
+    createPipeline();
+}
+
+ViewCache::~ViewCache() {
+    VkDevice dev = m_context->device();
+
+    delete m_texture;
+
+    if (m_pipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_pipeline, nullptr);
+    }
+    if (m_pipelineLayout) {
+        m_devFuncs->vkDestroyPipelineLayout(dev, m_pipelineLayout, nullptr);
+    }
+    if (m_descSetLayout) {
+        m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
+    }
+    if (m_descPool) {
+        m_devFuncs->vkDestroyDescriptorPool(dev, m_descPool, nullptr);
+    }
+}
+
+bool ViewCache::isCached(const std::string &view) {
+    return view == "direction" || view == "twilight" || view == "sine";
+}
+
+Texture* ViewCache::getTexture() {
+    return m_texture;
+}
+
+bool ViewCache::resize() {
+    Texture *dir = m_anisotropy->getDir();
+    uint32_t scale = 1;
+    while (dir->getHeight()*scale < MIN_SIZE && scale < MAX_UPSCALE) {
+        scale *= 2;
+    }
+    const uint32_t width = dir->getWidth()*scale;
+    const uint32_t height = dir->getHeight()*scale;
+    if (m_texture && m_texture->getWidth() == width && m_texture->getHeight() == height) {
+        return false;
+    }
+
+    // Frames still in flight with the old image are covered by its deferred destruction
+    delete m_texture;
+    m_texture = new Texture(width, height, m_context, 1, VK_FORMAT_R8G8B8A8_UNORM, true);
+    m_valid = false;
+    return true;
+}
+
+void ViewCache::update(const std::string &view, float anisotropy) {
+    // Only the sign of the anisotropy changes the image, it rotates the tangent
+    const bool rotated = anisotropy < 0;
+    if (m_valid && m_view == view && m_revision == m_anisotropy->getRevision() && m_rotated == rotated) {
+        return;
+    }
+
+    // The field textures are replaced when it is resized or loaded
+    updateDescriptors();
+
+    // Direction runs its streaks through the object space of the quad, see viewCache.comp. It spans
+    // two units across the height of the field, the cells never get smaller than the bake can hold
+    const float cells = std::min(STREAK_CELLS, m_texture->getHeight()/CELL_TEXELS);
+    struct {
+        int32_t mode;
+        float anisotropy;
+        float level;
+        float aspect;
+    } constants = {
+        view == "direction" ? 0 : view == "twilight" ? 1 : 2,
+        anisotropy,
+        cells/2,
+        float(m_anisotropy->getDir()->getWidth())/m_anisotropy->getDir()->getHeight()
+    };
+
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(0);
+
+    // Frames still in flight may sample the previous bake
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0, 0, nullptr, 0, nullptr, 0, nullptr);
+    m_devFuncs->vkCmdBindPipeline(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    m_devFuncs->vkCmdBindDescriptorSets(transfer.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descSet, 0, nullptr);
+    m_devFuncs->vkCmdPushConstants(transfer.commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    m_devFuncs->vkCmdDispatch(transfer.commandBuffer, ceil(m_texture->getWidth()/16.0), ceil(m_texture->getHeight()/16.0), 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+    m_texture->generateMipmaps(nullptr, transfer.commandBuffer);
+
+    // The staging ring shares the graphics queue, the barriers above order the frame after the bake
+    staging->submit(transfer);
+
+    m_view = view;
+    m_revision = m_anisotropy->getRevision();
+    m_rotated = rotated;
+    m_valid = true;
+}
+
+void ViewCache::createDescriptors() {
+    VkDevice dev = m_context->device();
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = 2;
+
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descPoolInfo.pPoolSizes = poolSizes.data();
+    descPoolInfo.maxSets = 1;
+    VkResult err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor pool");
+
+    VkDescriptorSetLayoutBinding cacheBinding = {
+        0, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding anisoMapBinding = {
+        1, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+    VkDescriptorSetLayoutBinding anisoDirBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {cacheBinding, anisoMapBinding, anisoDirBinding};
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    descLayoutInfo.pBindings = bindings.data();
+    err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_descSetLayout);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to create descriptor set layout");
+
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        nullptr,
+        m_descPool,
+        1,
+        &m_descSetLayout
+    };
+    err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSet);
+    if (err != VK_SUCCESS)
+        m_context->crash("Failed to allocate descriptor set");
+
+    // View, anisotropy sign, streak density and aspect ratio of the field
+    VkPushConstantRange pushConstant = { VK_SHADER_STAGE_COMPUTE_BIT, 0, 4*sizeof(float) };
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+    if (m_devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline layout!");
+    }
+}
+
+void ViewCache::createPipeline() {
+    VkDevice dev = m_context->device();
+
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("viewCache_comp.spv"));
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = m_pipelineLayout;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = computeShaderModule;
+    pipelineInfo.stage.pName = "main";
+    if (m_devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_pipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
+    }
+    m_devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
+}
+
+void ViewCache::updateDescriptors() {
+    std::array<VkDescriptorImageInfo, 3> imageInfo{};
+    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[0].imageView = m_texture->getImageView();
+    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[1].imageView = m_anisotropy->getMap()->getImageView();
+    imageInfo[1].sampler = m_anisotropy->getMap()->getTextureSampler();
+    imageInfo[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfo[2].imageView = m_anisotropy->getDir()->getImageView();
+    imageInfo[2].sampler = m_anisotropy->getDir()->getTextureSampler();
+
+    std::array<VkWriteDescriptorSet, 3> descWrites{};
+    for (uint32_t i = 0; i < descWrites.size(); i++) {
+        descWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[i].dstSet = m_descSet;
+        descWrites[i].dstBinding = i;
+        descWrites[i].dstArrayElement = 0;
+        descWrites[i].descriptorType = i ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descWrites[i].descriptorCount = 1;
+        descWrites[i].pImageInfo = &imageInfo[i];
+    }
+
+    m_devFuncs->vkUpdateDescriptorSets(m_context->device(), static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "src/Render/vulkancontext.h"
+#include <string>
+
+class Anisotropy;
+class Texture;
+
+// Bakes the Direction, Twilight and Sine views of the field into a texture their fragment shaders
+// only sample. The bake runs again when the field is rebuilt, never while the camera just moves.
+class ViewCache {
+public:
+    ViewCache(VulkanContext *context, Anisotropy *anisotropy);
+    ~ViewCache();
+
+    ViewCache(const ViewCache&) = delete;
+    ViewCache& operator=(const ViewCache&) = delete;
+
+    static bool isCached(const std::string &view);
+    // Follow the field size, true when the texture was reallocated and descriptors need a rewrite
+    bool resize();
+    // Bake the view if the field, the view or the sign of the anisotropy changed. The bake is only
+    // recorded, frames submitted after it sample the new texture
+    void update(const std::string &view, float anisotropy);
+    Texture* getTexture();
+
+private:
+    void createDescriptors();
+    void createPipeline();
+    void updateDescriptors();
+
+    VulkanContext *m_context;
+    VulkanDeviceFunctions *m_devFuncs;
+    Anisotropy *m_anisotropy;
+
+    VkDescriptorPool m_descPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSet m_descSet = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+    Texture *m_texture = nullptr;
+    // What the texture holds, the revision of the field is bumped by every rebuild of its map
+    std::string m_view;
+    uint64_t m_revision = 0;
+    bool m_rotated = false;
+    bool m_valid = false;
+
+    // The streaks of Direction have a fixed number of noise cells across the height of the field,
+    // small fields are baked upscaled so every cell still covers a few texels
+    static constexpr uint32_t STREAK_CELLS = 256;
+    static constexpr uint32_t CELL_TEXELS = 4;
+    static constexpr uint32_t MIN_SIZE = STREAK_CELLS*CELL_TEXELS;
+    static constexpr uint32_t MAX_UPSCALE = 8;
+};
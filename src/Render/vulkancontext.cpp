@@ -0,0 +1,242 @@
+#include "src/Render/vulkancontext.h"
+#include "src/Render/memoryallocator.h"
+#include "src/Render/stagingring.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+VulkanContext::~VulkanContext() {
+}
+
+VulkanFunctions *VulkanContext::functions() {
+    if (!m_functions) {
+        m_functions.reset(new VulkanFunctions(getInstanceProcAddr(), vkInstance()));
+    }
+    return m_functions.get();
+}
+
+VulkanDeviceFunctions *VulkanContext::deviceFunctions() {
+    if (!m_deviceFunctions) {
+        m_deviceFunctions.reset(new VulkanDeviceFunctions(functions(), device()));
+    }
+    return m_deviceFunctions.get();
+}
+
+void VulkanContext::resetDeviceFunctions() {
+    m_deviceFunctions.reset();
+    m_memoryProperties.reset();
+}
+
+const VkPhysicalDeviceMemoryProperties *VulkanContext::physicalDeviceMemoryProperties() {
+    if (!m_memoryProperties) {
+        m_memoryProperties.reset(new VkPhysicalDeviceMemoryProperties{});
+        functions()->vkGetPhysicalDeviceMemoryProperties(physicalDevice(), m_memoryProperties.get());
+    }
+    return m_memoryProperties.get();
+}
+
+void VulkanContext::setComputeQueueFamilyIndex(uint32_t ind) {
+    m_computeQueueFamilyIndex = ind;
+}
+
+uint32_t VulkanContext::getComputeQueueFamilyIndex() {
+    return m_computeQueueFamilyIndex;
+}
+
+void VulkanContext::crash(const QString& msg) {
+    qFatal("%s", qUtf8Printable(msg));
+}
+
+void VulkanContext::startJob(const QString &label, const std::function<void(std::atomic<float> &progress)> &work,
+                             const std::function<void()> &done) {
+    Q_UNUSED(label);
+    std::atomic<float> progress{0};
+    work(progress);
+    if (done) done();
+}
+
+void VulkanContext::finishJobs() {
+}
+
+void VulkanContext::setEnvironmentQuality(uint32_t quality) {
+    m_environmentQuality = quality;
+}
+
+uint32_t VulkanContext::getEnvironmentQuality() {
+    return m_environmentQuality;
+}
+
+uint32_t VulkanContext::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    const VkPhysicalDeviceMemoryProperties *memProperties = physicalDeviceMemoryProperties();
+
+    for (uint32_t i = 0; i < memProperties->memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties->memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    crash("failed to find suitable memory type!");
+    return 0;
+}
+
+VkDeviceSize VulkanContext::aligned(VkDeviceSize v, VkDeviceSize byteAlign) {
+    return (v + byteAlign - 1) & ~(byteAlign - 1);
+}
+
+VkShaderModule VulkanContext::createShader(const QString &name, bool allowOverride) {
+    QByteArray blob;
+    size_t size = 0;
+    const uint32_t *code = EmbeddedShaders::find(name, size);
+
+    // User editable shaders can be replaced by a file next to the executable
+    QFile file(QCoreApplication::applicationDirPath()+"/assets/shaders/"+name);
+    if (allowOverride && file.open(QIODevice::ReadOnly)) {
+        blob = file.readAll();
+        file.close();
+        code = reinterpret_cast<const uint32_t *>(blob.constData());
+        size = blob.size();
+    }
+
+    if (!code) {
+        qWarning("Unknown shader %s", qPrintable(name));
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModuleCreateInfo shaderInfo;
+    memset(&shaderInfo, 0, sizeof(shaderInfo));
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = size;
+    shaderInfo.pCode = code;
+    VkShaderModule shaderModule;
+    VkResult err = deviceFunctions()->vkCreateShaderModule(device(), &shaderInfo, nullptr, &shaderModule);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to create shader module: %d", err);
+        return VK_NULL_HANDLE;
+    }
+
+    return shaderModule;
+}
+
+QString VulkanContext::pipelineCachePath() {
+    // A driver update changes the UUID, so it starts from a new file instead of feeding stale data
+    const VkPhysicalDeviceProperties *props = physicalDeviceProperties();
+    QByteArray uuid(reinterpret_cast<const char*>(props->pipelineCacheUUID), VK_UUID_SIZE);
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/pipelines_"+uuid.toHex()+".bin";
+}
+
+VkPipelineCache VulkanContext::getPipelineCache() {
+    return m_pipelineCache;
+}
+
+void VulkanContext::createPipelineCache() {
+    QByteArray blob;
+    QFile file(pipelineCachePath());
+    if (file.open(QIODevice::ReadOnly)) {
+        blob = file.readAll();
+        file.close();
+    }
+
+    // Header: size, version, vendor ID, device ID and cache UUID. Anything not matching this device is dropped
+    const VkPhysicalDeviceProperties *props = physicalDeviceProperties();
+    uint32_t header[4];
+    if (blob.size() < int(sizeof(header)+VK_UUID_SIZE)) {
+        blob.clear();
+    } else {
+        memcpy(header, blob.constData(), sizeof(header));
+        if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || header[2] != props->vendorID || header[3] != props->deviceID ||
+            memcmp(blob.constData()+sizeof(header), props->pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            blob.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheInfo;
+    memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
+    pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheInfo.initialDataSize = blob.size();
+    pipelineCacheInfo.pInitialData = blob.isEmpty() ? nullptr : blob.constData();
+    VkResult err = deviceFunctions()->vkCreatePipelineCache(device(), &pipelineCacheInfo, nullptr, &m_pipelineCache);
+    if (err != VK_SUCCESS)
+        crash("Failed to create pipeline cache");
+}
+
+void VulkanContext::destroyPipelineCache() {
+    if (!m_pipelineCache) return;
+    VulkanDeviceFunctions *devFuncs = deviceFunctions();
+
+    size_t size = 0;
+    if (devFuncs->vkGetPipelineCacheData(device(), m_pipelineCache, &size, nullptr) == VK_SUCCESS && size > 0) {
+        QByteArray blob(size, 0);
+        if (devFuncs->vkGetPipelineCacheData(device(), m_pipelineCache, &size, blob.data()) == VK_SUCCESS) {
+            const QString path = pipelineCachePath();
+            QDir().mkpath(QFileInfo(path).absolutePath());
+            QFile file(path);
+            if (file.open(QIODevice::WriteOnly)) {
+                file.write(blob.constData(), size);
+                file.close();
+            } else {
+                qWarning("Failed to write pipeline cache %s", qPrintable(path));
+            }
+        }
+    }
+
+    devFuncs->vkDestroyPipelineCache(device(), m_pipelineCache, nullptr);
+    m_pipelineCache = VK_NULL_HANDLE;
+}
+
+MemoryAllocator *VulkanContext::getAllocator() {
+    return m_allocator;
+}
+
+void VulkanContext::createAllocator() {
+    m_allocator = new MemoryAllocator(this);
+}
+
+void VulkanContext::destroyAllocator() {
+    delete m_allocator;
+    m_allocator = nullptr;
+}
+
+StagingRing *VulkanContext::getStagingRing() {
+    return m_stagingRing;
+}
+
+void VulkanContext::createStagingRing() {
+    m_stagingRing = new StagingRing(this);
+}
+
+void VulkanContext::destroyStagingRing() {
+    delete m_stagingRing;
+    m_stagingRing = nullptr;
+}
+
+void VulkanContext::deferDestroy(const std::function<void()> &destroy) {
+    m_deletionQueue.push_back({ m_frameIndex, destroy });
+}
+
+void VulkanContext::collectGarbage() {
+    // Called at frame start, QVulkanWindow has already waited the fence of the frame
+    // concurrentFrameCount() frames back, so whatever was retired before it is idle
+    m_frameIndex++;
+    bool released = false;
+    while (!m_deletionQueue.empty() && m_deletionQueue.front().first + concurrentFrameCount() <= m_frameIndex) {
+        m_deletionQueue.front().second();
+        m_deletionQueue.pop_front();
+        released = true;
+    }
+
+    // Give back the blocks the released resources left empty, e.g. the old field after a resize
+    if (released) {
+        m_allocator->trim();
+    }
+}
+
+void VulkanContext::flushGarbage() {
+    if (m_deletionQueue.empty()) return;
+    deviceFunctions()->vkDeviceWaitIdle(device());
+    while (!m_deletionQueue.empty()) {
+        m_deletionQueue.front().second();
+        m_deletionQueue.pop_front();
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "src/Render/vulkanfunctions.h"
+#include "src/UI/embeddedshaders.h"
+#include <QString>
+#include <QMatrix4x4>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+class MemoryAllocator;
+class StagingRing;
+
+// Device and services every engine resource is built on. The editor gets the device from its
+// QVulkanWindow, batch rendering from HeadlessContext without any window system
+class VulkanContext {
+public:
+    virtual ~VulkanContext();
+
+    virtual VkInstance vkInstance() const = 0;
+    virtual PFN_vkGetInstanceProcAddr getInstanceProcAddr() const = 0;
+    virtual VkPhysicalDevice physicalDevice() const = 0;
+    virtual const VkPhysicalDeviceProperties *physicalDeviceProperties() const = 0;
+    virtual VkDevice device() const = 0;
+    virtual VkQueue graphicsQueue() const = 0;
+    virtual uint32_t graphicsQueueFamilyIndex() const = 0;
+    virtual VkCommandPool graphicsCommandPool() const = 0;
+    virtual int concurrentFrameCount() const = 0;
+    virtual int currentFrame() const = 0;
+    virtual QMatrix4x4 clipCorrectionMatrix() = 0;
+
+    VulkanFunctions *functions();
+    // Resolved on first use for the current device
+    VulkanDeviceFunctions *deviceFunctions();
+    // Once the device is destroyed, the window creates a new one after a device loss
+    void resetDeviceFunctions();
+    const VkPhysicalDeviceMemoryProperties *physicalDeviceMemoryProperties();
+
+    void setComputeQueueFamilyIndex(uint32_t ind);
+    uint32_t getComputeQueueFamilyIndex();
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    // Shaders are embedded in the executable, allowOverride prefers assets/shaders/<name> when present.
+    // Literal names go through SHADER() so a missing one fails the build.
+    VkShaderModule createShader(const QString &name, bool allowOverride = false);
+
+    // Pipeline cache shared by every pipeline, persisted on disk per driver
+    VkPipelineCache getPipelineCache();
+    void createPipelineCache();
+    void destroyPipelineCache();
+
+    // Device memory sub-allocator shared by all the resources
+    MemoryAllocator *getAllocator();
+    void createAllocator();
+    void destroyAllocator();
+
+    // Staging memory for texture uploads and readbacks
+    StagingRing *getStagingRing();
+    void createStagingRing();
+    void destroyStagingRing();
+
+    // Destroy a resource once the frames in flight that may still use it have completed
+    void deferDestroy(const std::function<void()> &destroy);
+    void collectGarbage();
+    void flushGarbage();
+    VkDeviceSize aligned(VkDeviceSize v, VkDeviceSize byteAlign);
+    virtual void crash(const QString& msg);
+
+    // Run work on a background thread, done runs back on the GUI thread. Without an event loop
+    // both run right away
+    virtual void startJob(const QString &label, const std::function<void(std::atomic<float> &progress)> &work,
+                          const std::function<void()> &done = nullptr);
+    virtual void finishJobs();
+
+    // Prefilter quality tier of the environment, read when the renderer creates it
+    void setEnvironmentQuality(uint32_t quality);
+    uint32_t getEnvironmentQuality();
+
+private:
+    QString pipelineCachePath();
+
+    std::unique_ptr<VulkanFunctions> m_functions;
+    std::unique_ptr<VulkanDeviceFunctions> m_deviceFunctions;
+    std::unique_ptr<VkPhysicalDeviceMemoryProperties> m_memoryProperties;
+    uint32_t m_computeQueueFamilyIndex = 0;
+    uint32_t m_environmentQuality = 1;
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+    MemoryAllocator *m_allocator = nullptr;
+    StagingRing *m_stagingRing = nullptr;
+    std::deque<std::pair<uint64_t, std::function<void()>>> m_deletionQueue;
+    uint64_t m_frameIndex = 0;
+};
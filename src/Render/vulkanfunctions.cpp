@@ -0,0 +1,14 @@
+#include "src/Render/vulkanfunctions.h"
+
+VulkanFunctions::VulkanFunctions(PFN_vkGetInstanceProcAddr getInstanceProcAddr, VkInstance instance) {
+#define VULKAN_RESOLVE_FUNCTION(name) name = reinterpret_cast<PFN_##name>(getInstanceProcAddr(instance, #name));
+    VULKAN_INSTANCE_FUNCTIONS(VULKAN_RESOLVE_FUNCTION)
+#undef VULKAN_RESOLVE_FUNCTION
+}
+
+VulkanDeviceFunctions::VulkanDeviceFunctions(const VulkanFunctions *functions, VkDevice device) {
+    // Device level pointers skip the dispatch of the loader
+#define VULKAN_RESOLVE_FUNCTION(name) name = reinterpret_cast<PFN_##name>(functions->vkGetDeviceProcAddr(device, #name));
+    VULKAN_DEVICE_FUNCTIONS(VULKAN_RESOLVE_FUNCTION)
+#undef VULKAN_RESOLVE_FUNCTION
+}
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef VK_NO_PROTOTYPES
+#define VK_NO_PROTOTYPES
+#endif
+#include <vulkan/vulkan.h>
+
+// Entry points used by the engine, resolved through vkGetInstanceProcAddr instead of QVulkanInstance so
+// the same code runs on a device created without any window system. Names match QVulkanFunctions and
+// QVulkanDeviceFunctions, add a function here before calling it
+#define VULKAN_INSTANCE_FUNCTIONS(F) \
+    F(vkDestroyInstance) \
+    F(vkEnumeratePhysicalDevices) \
+    F(vkGetPhysicalDeviceProperties) \
+    F(vkGetPhysicalDeviceMemoryProperties) \
+    F(vkGetPhysicalDeviceFormatProperties) \
+    F(vkGetPhysicalDeviceQueueFamilyProperties) \
+    F(vkGetPhysicalDeviceFeatures2) \
+    F(vkEnumerateDeviceExtensionProperties) \
+    F(vkCreateDevice) \
+    F(vkGetDeviceProcAddr)
+
+#define VULKAN_DEVICE_FUNCTIONS(F) \
+    F(vkDestroyDevice) \
+    F(vkDeviceWaitIdle) \
+    F(vkGetDeviceQueue) \
+    F(vkQueueSubmit) \
+    F(vkQueueWaitIdle) \
+    F(vkAllocateMemory) \
+    F(vkFreeMemory) \
+    F(vkMapMemory) \
+    F(vkBindBufferMemory) \
+    F(vkBindImageMemory) \
+    F(vkGetBufferMemoryRequirements) \
+    F(vkGetImageMemoryRequirements) \
+    F(vkCreateBuffer) \
+    F(vkDestroyBuffer) \
+    F(vkCreateImage) \
+    F(vkDestroyImage) \
+    F(vkCreateImageView) \
+    F(vkDestroyImageView) \
+    F(vkCreateSampler) \
+    F(vkDestroySampler) \
+    F(vkCreateFence) \
+    F(vkDestroyFence) \
+    F(vkResetFences) \
+    F(vkGetFenceStatus) \
+    F(vkWaitForFences) \
+    F(vkCreateQueryPool) \
+    F(vkDestroyQueryPool) \
+    F(vkGetQueryPoolResults) \
+    F(vkCreateShaderModule) \
+    F(vkDestroyShaderModule) \
+    F(vkCreatePipelineCache) \
+    F(vkDestroyPipelineCache) \
+    F(vkGetPipelineCacheData) \
+    F(vkCreateGraphicsPipelines) \
+    F(vkCreateComputePipelines) \
+    F(vkDestroyPipeline) \
+    F(vkCreatePipelineLayout) \
+    F(vkDestroyPipelineLayout) \
+    F(vkCreateDescriptorSetLayout) \
+    F(vkDestroyDescriptorSetLayout) \
+    F(vkCreateDescriptorPool) \
+    F(vkDestroyDescriptorPool) \
+    F(vkAllocateDescriptorSets) \
+    F(vkUpdateDescriptorSets) \
+    F(vkCreateFramebuffer) \
+    F(vkDestroyFramebuffer) \
+    F(vkCreateRenderPass) \
+    F(vkDestroyRenderPass) \
+    F(vkCreateCommandPool) \
+    F(vkDestroyCommandPool) \
+    F(vkAllocateCommandBuffers) \
+    F(vkFreeCommandBuffers) \
+    F(vkBeginCommandBuffer) \
+    F(vkEndCommandBuffer) \
+    F(vkCmdBindPipeline) \
+    F(vkCmdSetViewport) \
+    F(vkCmdSetScissor) \
+    F(vkCmdBindDescriptorSets) \
+    F(vkCmdBindIndexBuffer) \
+    F(vkCmdBindVertexBuffers) \
+    F(vkCmdDraw) \
+    F(vkCmdDrawIndexed) \
+    F(vkCmdDispatch) \
+    F(vkCmdCopyBuffer) \
+    F(vkCmdCopyImage) \
+    F(vkCmdBlitImage) \
+    F(vkCmdCopyBufferToImage) \
+    F(vkCmdCopyImageToBuffer) \
+    F(vkCmdClearColorImage) \
+    F(vkCmdClearDepthStencilImage) \
+    F(vkCmdPipelineBarrier) \
+    F(vkCmdResetQueryPool) \
+    F(vkCmdWriteTimestamp) \
+    F(vkCmdPushConstants) \
+    F(vkCmdBeginRenderPass) \
+    F(vkCmdEndRenderPass)
+
+#define VULKAN_DECLARE_FUNCTION(name) PFN_##name name = nullptr;
+
+class VulkanFunctions {
+public:
+    VulkanFunctions(PFN_vkGetInstanceProcAddr getInstanceProcAddr, VkInstance instance);
+
+    VULKAN_INSTANCE_FUNCTIONS(VULKAN_DECLARE_FUNCTION)
+};
+
+class VulkanDeviceFunctions {
+public:
+    VulkanDeviceFunctions(const VulkanFunctions *functions, VkDevice device);
+
+    VULKAN_DEVICE_FUNCTIONS(VULKAN_DECLARE_FUNCTION)
+};
+
+#undef VULKAN_DECLARE_FUNCTION
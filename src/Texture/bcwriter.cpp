@@ -0,0 +1,411 @@
+#include "bcwriter.h"
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <thread>
+
+namespace {
+struct Bc7Block {
+    int endpoints[2][4];
+    int pbits[2];
+    int indices[16];
+    int error;
+};
+}
+
+static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static void putLittleEndian(std::vector<uint8_t> &dst, uint64_t val, uint32_t bytes) {
+    for (uint32_t i = 0; i < bytes; i++) {
+        dst.push_back(uint8_t(val >> (8*i)));
+    }
+}
+
+// Quantize the endpoints, each with the shared bit that keeps it closest, index the pixels against
+// the palette and keep the result when it beats the best block so far
+static void fitBC7(const int pixels[16][4], const float e0[4], const float e1[4], Bc7Block &best) {
+    Bc7Block block;
+    int ends[2][4];
+    for (int k = 0; k < 2; k++) {
+        float bestError = FLT_MAX;
+        for (int p = 0; p < 2; p++) {
+            int quantized[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++) {
+                const float val = k ? e1[c] : e0[c];
+                quantized[c] = std::min(std::max(int(std::lround((val - p)*0.5f)), 0), 127);
+                error += (quantized[c]*2 + p - val)*(quantized[c]*2 + p - val);
+            }
+            if (error < bestError) {
+                bestError = error;
+                block.pbits[k] = p;
+                for (int c = 0; c < 4; c++) {
+                    block.endpoints[k][c] = quantized[c];
+                    ends[k][c] = quantized[c]*2 + p;
+                }
+            }
+        }
+    }
+
+    int palette[16][4];
+    for (int w = 0; w < 16; w++) {
+        for (int c = 0; c < 4; c++) {
+            palette[w][c] = ((64 - bc7Weights[w])*ends[0][c] + bc7Weights[w]*ends[1][c] + 32) >> 6;
+        }
+    }
+
+    // Project on the quantized segment for a first guess, the weights are close to uniform
+    // so only the neighbouring entries need to be checked
+    int axis[4];
+    int axisLength = 0;
+    for (int c = 0; c < 4; c++) {
+        axis[c] = ends[1][c] - ends[0][c];
+        axisLength += axis[c]*axis[c];
+    }
+
+    block.error = 0;
+    for (int i = 0; i < 16; i++) {
+        int guess = 0;
+        if (axisLength) {
+            int dot = 0;
+            for (int c = 0; c < 4; c++) {
+                dot += (pixels[i][c] - ends[0][c])*axis[c];
+            }
+            guess = std::min(std::max((dot*15*2 + axisLength)/(2*axisLength), 0), 15);
+        }
+
+        int bestError = INT_MAX;
+        for (int w = std::max(guess-1, 0); w <= std::min(guess+1, 15); w++) {
+            int error = 0;
+            for (int c = 0; c < 4; c++) {
+                const int d = palette[w][c] - pixels[i][c];
+                error += d*d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                block.indices[i] = w;
+            }
+        }
+        block.error += bestError;
+    }
+
+    if (block.error < best.error) {
+        best = block;
+    }
+}
+
+void BcWriter::encodeBC4(const uint8_t *block, uint32_t channel, uint8_t *out) {
+    int lo = 255, hi = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        lo = std::min(lo, int(block[i*4+channel]));
+        hi = std::max(hi, int(block[i*4+channel]));
+    }
+
+    // With the max endpoint first the palette is the two endpoints followed by six steps from max to min
+    uint64_t indices = 0;
+    if (hi > lo) {
+        for (uint32_t i = 0; i < 16; i++) {
+            const int step = ((hi - block[i*4+channel])*14 + hi - lo)/(2*(hi - lo));
+            const uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+            indices |= index << (3*i);
+        }
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (uint32_t i = 0; i < 6; i++) {
+        out[2+i] = uint8_t(indices >> (8*i));
+    }
+}
+
+void BcWriter::encodeBC7(const uint8_t *block, uint8_t *out) {
+    int pixels[16][4];
+    float mean[4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            pixels[i][c] = block[i*4+c];
+            mean[c] += pixels[i][c]/16.0f;
+        }
+    }
+
+    // Endpoints on the principal axis of the block, found by power iteration on the covariance
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < 4; a++) {
+            for (int b = 0; b < 4; b++) {
+                cov[a][b] += (pixels[i][a] - mean[a])*(pixels[i][b] - mean[b]);
+            }
+        }
+    }
+    int start = 0;
+    for (int c = 1; c < 4; c++) {
+        if (cov[c][c] > cov[start][start]) start = c;
+    }
+    float axis[4] = { cov[start][0], cov[start][1], cov[start][2], cov[start][3] };
+    for (int it = 0; it < 8; it++) {
+        float next[4] = {};
+        float norm = 0.0f;
+        for (int a = 0; a < 4; a++) {
+            for (int b = 0; b < 4; b++) {
+                next[a] += cov[a][b]*axis[b];
+            }
+            norm = std::max(norm, std::abs(next[a]));
+        }
+        if (norm == 0.0f) break;
+        for (int a = 0; a < 4; a++) {
+            axis[a] = next[a]/norm;
+        }
+    }
+
+    float axisLength = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        axisLength += axis[c]*axis[c];
+    }
+    float tMin = 0.0f, tMax = 0.0f;
+    if (axisLength > 0.0f) {
+        tMin = FLT_MAX;
+        tMax = -FLT_MAX;
+        for (int i = 0; i < 16; i++) {
+            float t = 0.0f;
+            for (int c = 0; c < 4; c++) {
+                t += (pixels[i][c] - mean[c])*axis[c];
+            }
+            tMin = std::min(tMin, t/axisLength);
+            tMax = std::max(tMax, t/axisLength);
+        }
+    }
+
+    float e0[4], e1[4];
+    for (int c = 0; c < 4; c++) {
+        e0[c] = std::min(std::max(mean[c] + axis[c]*tMin, 0.0f), 255.0f);
+        e1[c] = std::min(std::max(mean[c] + axis[c]*tMax, 0.0f), 255.0f);
+    }
+
+    Bc7Block best;
+    best.error = INT_MAX;
+    fitBC7(pixels, e0, e1, best);
+
+    // One least squares pass with the chosen weights recovers most of the error of the projection
+    if (best.error > 0) {
+        float a = 0.0f, b = 0.0f, d = 0.0f;
+        float x0[4] = {}, x1[4] = {};
+        for (int i = 0; i < 16; i++) {
+            const float w = bc7Weights[best.indices[i]]/64.0f;
+            a += (1.0f - w)*(1.0f - w);
+            b += (1.0f - w)*w;
+            d += w*w;
+            for (int c = 0; c < 4; c++) {
+                x0[c] += (1.0f - w)*pixels[i][c];
+                x1[c] += w*pixels[i][c];
+            }
+        }
+        const float det = a*d - b*b;
+        if (std::abs(det) > 1e-6f) {
+            for (int c = 0; c < 4; c++) {
+                e0[c] = std::min(std::max((d*x0[c] - b*x1[c])/det, 0.0f), 255.0f);
+                e1[c] = std::min(std::max((a*x1[c] - b*x0[c])/det, 0.0f), 255.0f);
+            }
+            fitBC7(pixels, e0, e1, best);
+        }
+    }
+
+    // The anchor index is stored without its top bit, which must be zero
+    if (best.indices[0] & 8) {
+        for (int c = 0; c < 4; c++) {
+            std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+        }
+        std::swap(best.pbits[0], best.pbits[1]);
+        for (int i = 0; i < 16; i++) {
+            best.indices[i] = 15 - best.indices[i];
+        }
+    }
+
+    uint64_t bits[2] = { 0, 0 };
+    uint32_t pos = 0;
+    auto put = [&](uint64_t val, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, pos++) {
+            bits[pos >> 6] |= ((val >> i) & 1) << (pos & 63);
+        }
+    };
+
+    put(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        put(best.endpoints[0][c], 7);
+        put(best.endpoints[1][c], 7);
+    }
+    put(best.pbits[0], 1);
+    put(best.pbits[1], 1);
+    put(best.indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        put(best.indices[i], 4);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        out[i] = uint8_t(bits[0] >> (8*i));
+        out[8+i] = uint8_t(bits[1] >> (8*i));
+    }
+}
+
+void BcWriter::writeDds(QFile &file, Format format, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>> &levels) {
+    std::vector<uint8_t> header;
+    putLittleEndian(header, 0x20534444, 4); // "DDS "
+    putLittleEndian(header, 124, 4);
+    putLittleEndian(header, 0xA1007, 4); // Caps, height, width, pixel format, mip count and linear size
+    putLittleEndian(header, height, 4);
+    putLittleEndian(header, width, 4);
+    putLittleEndian(header, levels[0].size(), 4);
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, levels.size(), 4);
+    header.resize(header.size() + 11*4, 0);
+
+    // Pixel format only points to the DX10 extension header
+    putLittleEndian(header, 32, 4);
+    putLittleEndian(header, 0x4, 4);
+    putLittleEndian(header, 0x30315844, 4); // "DX10"
+    header.resize(header.size() + 5*4, 0);
+
+    putLittleEndian(header, 0x401008, 4); // Texture, mipmap and complex
+    header.resize(header.size() + 4*4, 0);
+
+    putLittleEndian(header, format == BC5 ? 83 : 98, 4); // DXGI_FORMAT_BC5_UNORM, DXGI_FORMAT_BC7_UNORM
+    putLittleEndian(header, 3, 4); // Texture 2D
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, 1, 4);
+    putLittleEndian(header, 0, 4);
+
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    for (const std::vector<uint8_t> &level: levels) {
+        file.write(reinterpret_cast<const char*>(level.data()), level.size());
+    }
+}
+
+void BcWriter::writeKtx2(QFile &file, Format format, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>> &levels) {
+    // Data format descriptor with a single basic block, one sample per BC5 channel or one for all of BC7
+    std::vector<uint8_t> dfd;
+    const uint32_t samples = format == BC5 ? 2 : 1;
+    putLittleEndian(dfd, 4 + 24 + 16*samples, 4);
+    putLittleEndian(dfd, 0, 4);
+    putLittleEndian(dfd, 2 | ((24 + 16*samples) << 16), 4);
+    putLittleEndian(dfd, (format == BC5 ? 132 : 134) | (1 << 8) | (1 << 16), 4); // BC5 or BC7 model, BT.709, linear
+    putLittleEndian(dfd, 3 | (3 << 8), 4); // 4x4 blocks
+    putLittleEndian(dfd, 16, 4);
+    putLittleEndian(dfd, 0, 4);
+    for (uint32_t i = 0; i < samples; i++) {
+        const uint32_t bitLength = format == BC5 ? 64 : 128;
+        putLittleEndian(dfd, (i*64) | ((bitLength - 1) << 16) | (i << 24), 4);
+        putLittleEndian(dfd, 0, 4);
+        putLittleEndian(dfd, 0, 4);
+        putLittleEndian(dfd, UINT32_MAX, 4);
+    }
+
+    const uint64_t levelIndexOffset = 80;
+    const uint64_t dfdOffset = levelIndexOffset + 24*levels.size();
+    auto align = [](uint64_t val) { return (val + 15) & ~uint64_t(15); };
+
+    // Levels are stored from the smallest to the largest, each aligned to the block size
+    std::vector<uint64_t> offsets(levels.size());
+    uint64_t end = dfdOffset + dfd.size();
+    for (size_t i = levels.size(); i-- > 0;) {
+        offsets[i] = align(end);
+        end = offsets[i] + levels[i].size();
+    }
+
+    std::vector<uint8_t> header = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    putLittleEndian(header, format == BC5 ? 141 : 145, 4); // VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK
+    putLittleEndian(header, 1, 4);
+    putLittleEndian(header, width, 4);
+    putLittleEndian(header, height, 4);
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, 1, 4);
+    putLittleEndian(header, levels.size(), 4);
+    putLittleEndian(header, 0, 4);
+
+    putLittleEndian(header, dfdOffset, 4);
+    putLittleEndian(header, dfd.size(), 4);
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, 0, 4);
+    putLittleEndian(header, 0, 8);
+    putLittleEndian(header, 0, 8);
+
+    for (size_t i = 0; i < levels.size(); i++) {
+        putLittleEndian(header, offsets[i], 8);
+        putLittleEndian(header, levels[i].size(), 8);
+        putLittleEndian(header, levels[i].size(), 8);
+    }
+    header.insert(header.end(), dfd.begin(), dfd.end());
+
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    uint64_t pos = header.size();
+    for (size_t i = levels.size(); i-- > 0;) {
+        const std::vector<char> padding(offsets[i] - pos, 0);
+        file.write(padding.data(), padding.size());
+        file.write(reinterpret_cast<const char*>(levels[i].data()), levels[i].size());
+        pos = offsets[i] + levels[i].size();
+    }
+}
+
+bool BcWriter::write(const QString &path, Format format, uint32_t width, uint32_t height, uint32_t levels,
+                     const std::function<void(uint32_t level, uint32_t x, uint32_t y, uint8_t *block)> &getBlock,
+                     const std::function<void(float)> &progress) {
+    if (!width || !height || !levels) return false;
+
+    // One job per row of blocks across every level
+    struct Row {
+        uint32_t level;
+        uint32_t y;
+    };
+    std::vector<Row> rows;
+    std::vector<std::vector<uint8_t>> encoded(levels);
+    for (uint32_t level = 0; level < levels; level++) {
+        const uint32_t blocksX = (std::max(width >> level, 1u) + 3)/4;
+        const uint32_t blocksY = (std::max(height >> level, 1u) + 3)/4;
+        encoded[level].resize(size_t(blocksX)*blocksY*16);
+        for (uint32_t y = 0; y < blocksY; y++) {
+            rows.push_back({ level, y });
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> done(0);
+    const size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), rows.size()));
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threadCount; t++) {
+        workers.emplace_back([&]() {
+            uint8_t block[64];
+            for (size_t i = next++; i < rows.size(); i = next++) {
+                const Row row = rows[i];
+                const uint32_t blocksX = (std::max(width >> row.level, 1u) + 3)/4;
+                uint8_t *out = encoded[row.level].data() + size_t(row.y)*blocksX*16;
+                for (uint32_t x = 0; x < blocksX; x++, out += 16) {
+                    getBlock(row.level, x*4, row.y*4, block);
+                    if (format == BC5) {
+                        encodeBC4(block, 0, out);
+                        encodeBC4(block, 1, out+8);
+                    } else {
+                        encodeBC7(block, out);
+                    }
+                }
+                if (progress) progress(float(++done)/rows.size());
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    if (QFileInfo(path).suffix().toLower() == "ktx2") {
+        writeKtx2(file, format, width, height, encoded);
+    } else {
+        writeDds(file, format, width, height, encoded);
+    }
+    return file.error() == QFile::NoError;
+}
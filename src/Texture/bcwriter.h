@@ -0,0 +1,31 @@
+#pragma once
+#include <QString>
+#include <functional>
+#include <vector>
+
+class QFile;
+
+// Block compressed texture writer. BC5 keeps the red and green channels, BC7 keeps all four and
+// only uses mode 6 (one subset, 7 bit endpoints with a shared bit, 4 bit indices). Every mip level
+// is encoded by a pool of worker threads, one row of blocks at a time, and the result is written
+// as DDS or KTX2 depending on the suffix.
+class BcWriter {
+public:
+    enum Format {
+        BC5 = 0,
+        BC7 = 1,
+    };
+
+    // getBlock fills the 4x4 RGBA8 pixels starting at x, y of the given level, clamped to the level
+    // edges. It is called concurrently from the workers, progress with the fraction of rows done.
+    static bool write(const QString &path, Format format, uint32_t width, uint32_t height, uint32_t levels,
+                      const std::function<void(uint32_t level, uint32_t x, uint32_t y, uint8_t *block)> &getBlock,
+                      const std::function<void(float)> &progress = nullptr);
+
+private:
+    static void encodeBC4(const uint8_t *block, uint32_t channel, uint8_t *out);
+    static void encodeBC7(const uint8_t *block, uint8_t *out);
+
+    static void writeDds(QFile &file, Format format, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>> &levels);
+    static void writeKtx2(QFile &file, Format format, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>> &levels);
+};
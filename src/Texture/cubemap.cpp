@@ -1,52 +1,210 @@
 #include "src/Texture/cubemap.h"
-#include "src/Texture/stb_image.h"
-#include <QCoreApplication>
+#include "src/Texture/imagedecoder.h"
+#include "src/Render/stagingring.h"
+#include "src/Texture/exrwriter.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+CubeMap::CubeMap(const QStringList &paths, VulkanContext *context, Quality quality) : CubeMap(load(paths, context, quality), context, quality) {
+}
 
-CubeMap::CubeMap(const std::array<QString, 6> &paths, VulkanWindow *w) : m_window(w) {
-    createTextureImage(paths);
+CubeMap::CubeMap(const Source &source, VulkanContext *context, Quality quality, bool background) : m_context(context), m_quality(quality) {
+    // Upload, mip chain, irradiance and level 0 of the chain are recorded after the copies of the
+    // staging transfer and submitted together, nothing waits for them here. A cached chain was
+    // read by decode() and overwrites level 0 again
+    createTextureImage(source);
     createImageView();
     createTextureSampler();
-    generateMipmaps();
-    copyTextureImage();
+    generateMipmaps(source.transfer.commandBuffer);
+    projectIrradiance(source.transfer.commandBuffer);
+    copyTextureImage(source.transfer.commandBuffer);
+    m_cached = source.cached;
+    if (m_cached) {
+        copyPrefiltered(source.transfer, source.cacheOffset);
+    } else {
+        m_cachePath = source.cachePath;
+    }
+
+    StagingRing *staging = m_context->getStagingRing();
+    m_setupId = staging->submit(source.transfer);
+    staging->release(source.transfer.id);
+
+    if (!background) {
+        isReady(true);
+    }
+}
+
+bool CubeMap::prepare(const QStringList &paths, VulkanContext *context, Quality quality, Source &source) {
+    source.paths = paths;
+    if (paths.size() != 1 && paths.size() != 6) {
+        return false;
+    }
+    const uint32_t maxDimension = context->physicalDeviceProperties()->limits.maxImageDimension2D;
+    for (int i = 0; i < paths.size(); ++i) {
+        uint32_t width, height;
+        if (!ImageDecoder::probe(paths[i], width, height, maxDimension) || (i && (width != source.width || height != source.height))) {
+            return false;
+        }
+        source.width = width;
+        source.height = height;
+    }
+
+    // Only a cache file of the expected size gets staging memory, decode() checks its header
+    uint32_t width, height, mipLevels;
+    faceSize(source, width, height, mipLevels);
+    const VkDeviceSize facesSize = VkDeviceSize(source.width) * source.height * 4 * sizeof(float) * paths.size();
+    const VkDeviceSize chainSize = prefilteredSize(width, height, mipLevels);
+    source.cachePath = prefilteredCachePath(paths, quality);
+    if (QFileInfo(source.cachePath).size() == qint64(CACHE_HEADER_SIZE + chainSize)) {
+        source.cacheOffset = facesSize;
+        source.cacheSize = chainSize;
+    }
+
+    // Held, so a decode taking seconds never pins the ring
+    source.transfer = context->getStagingRing()->begin(facesSize + source.cacheSize, true);
+    return true;
+}
+
+bool CubeMap::decode(Source &source) {
+    // The faces are decoded in parallel, each one straight into its slice of the staging memory
+    const VkDeviceSize layerSize = VkDeviceSize(source.width) * source.height * 4 * sizeof(float);
+    std::vector<ImageDecoder::Image> images;
+    for (int i = 0; i < source.paths.size(); ++i) {
+        images.push_back({ source.paths[i], static_cast<char*>(source.transfer.mapped)+layerSize*i, source.width, source.height });
+    }
+    if (!ImageDecoder::decode(images, true)) {
+        return false;
+    }
+    source.cached = source.cacheSize && readCache(source);
+    return true;
+}
+
+void CubeMap::discard(const Source &source, VulkanContext *context) {
+    // The empty command buffer still has to be submitted for the staging memory to be recycled
+    StagingRing *staging = context->getStagingRing();
+    staging->release(staging->submit(source.transfer));
+}
+
+CubeMap::Source CubeMap::load(const QStringList &paths, VulkanContext *context, Quality quality) {
+    Source source;
+    if (!prepare(paths, context, quality, source)) {
+        context->crash("failed to load texture image: "+paths.join(", "));
+    }
+    if (!decode(source)) {
+        discard(source, context);
+        context->crash("failed to load texture image: "+paths.join(", "));
+    }
+    return source;
+}
+
+bool CubeMap::isReady(bool wait) {
+    if (m_setupId) {
+        if (!finishSetup(wait)) {
+            return false;
+        }
+        // A cached chain replaces the whole prefiltering pass, the compute objects are not even created
+        if (!m_cached) {
+            createComputeObjects();
+            m_integrateTimer.start();
+            integrate(m_quality);
+        }
+    }
+
+    // One level per submission, frames recorded in between are not stuck behind the whole chain
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+    while (m_integrateFence) {
+        if (wait) {
+            devFuncs->vkWaitForFences(dev, 1, &m_integrateFence, VK_TRUE, UINT64_MAX);
+        } else if (devFuncs->vkGetFenceStatus(dev, m_integrateFence) != VK_SUCCESS) {
+            return false;
+        }
+        if (m_integrateLevel < m_mipLevels) {
+            submitLevel();
+            continue;
+        }
+        finishIntegrate();
+
+        // Only the chain built for this environment is worth keeping, reportQuality() passes an empty path
+        if (!m_cachePath.isEmpty()) {
+            qInfo("Prefiltered the environment in %lld ms", m_integrateTimer.elapsed());
+            savePrefiltered(m_cachePath);
+            m_cachePath.clear();
+        }
+    }
+    return true;
+}
+
+bool CubeMap::finishSetup(bool wait) {
+    StagingRing *staging = m_context->getStagingRing();
+    if (wait) {
+        staging->wait(m_setupId);
+    } else if (!staging->isDone(m_setupId)) {
+        return false;
+    }
+    m_setupId = 0;
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    for (const std::function<void()> &cleanup : m_setupCleanup) {
+        cleanup();
+    }
+    m_setupCleanup.clear();
+    return true;
+}
+
+void CubeMap::createComputeObjects() {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = m_window->getComputeQueueFamilyIndex();
+    poolInfo.queueFamilyIndex = m_context->getComputeQueueFamilyIndex();
     if (devFuncs->vkCreateCommandPool(dev, &poolInfo, nullptr, &m_computeCommandPool) != VK_SUCCESS) {
-        m_window->crash("failed to create compute command pool!");
+        m_context->crash("failed to create compute command pool!");
     }
 
+    createSampleBuffer();
     createComputeDescriptorSet();
     createComputePipelineLayout();
     createComputePipeline();
-    for (uint32_t i = 1; i < m_mipLevels; ++i) {
-        integrate(i);
-    }
 }
 
 CubeMap::~CubeMap() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-    devFuncs->vkDeviceWaitIdle(dev);
-
-    if (m_textureSampler)
-        devFuncs->vkDestroySampler(dev, m_textureSampler, nullptr);
-    if (m_textureImageView[0])
-        devFuncs->vkDestroyImageView(dev, m_textureImageView[0], nullptr);
-    if (m_textureImage[0])
-        devFuncs->vkDestroyImage(dev, m_textureImage[0], nullptr);
-    if (m_textureImageMemory[0])
-        devFuncs->vkFreeMemory(dev, m_textureImageMemory[0], nullptr);
-    if (m_textureImageView[1])
-        devFuncs->vkDestroyImageView(dev, m_textureImageView[1], nullptr);
-    if (m_textureImage[1])
-        devFuncs->vkDestroyImage(dev, m_textureImage[1], nullptr);
-    if (m_textureImageMemory[1])
-        devFuncs->vkFreeMemory(dev, m_textureImageMemory[1], nullptr);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    // A background build is waited for but not carried on, an unfinished chain is not cached
+    m_cachePath.clear();
+    if (m_setupId) {
+        finishSetup(true);
+    }
+    m_integrateLevel = m_mipLevels;
+    isReady(true);
+
+    // The environment may still be sampled by frames in flight, the compute objects are not
+    VulkanContext *context = m_context;
+    VkSampler sampler = m_textureSampler;
+    std::array<VkImageView, 2> imageView = { m_textureImageView[0], m_textureImageView[1] };
+    std::array<VkImage, 2> image = { m_textureImage[0], m_textureImage[1] };
+    std::array<MemoryAllocation, 2> memory = { m_textureImageMemory[0], m_textureImageMemory[1] };
+    m_context->deferDestroy([context, sampler, imageView, image, memory]() mutable {
+        VkDevice dev = context->device();
+        VulkanDeviceFunctions *devFuncs = context->deviceFunctions();
+        if (sampler)
+            devFuncs->vkDestroySampler(dev, sampler, nullptr);
+        for (uint32_t i = 0; i < 2; i++) {
+            if (imageView[i])
+                devFuncs->vkDestroyImageView(dev, imageView[i], nullptr);
+            if (image[i])
+                devFuncs->vkDestroyImage(dev, image[i], nullptr);
+            context->getAllocator()->free(memory[i]);
+        }
+    });
 
     if (m_computeCommandPool)
         devFuncs->vkDestroyCommandPool(dev, m_computeCommandPool, nullptr);
@@ -63,13 +221,16 @@ CubeMap::~CubeMap() {
     if (m_computeDescPool)
         devFuncs->vkDestroyDescriptorPool(dev, m_computeDescPool, nullptr);
 
+    if (m_sampleBuf)
+        devFuncs->vkDestroyBuffer(dev, m_sampleBuf, nullptr);
+
+    m_context->getAllocator()->free(m_sampleBufMem);
+
 }
 
-void CubeMap::copyTextureImage() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+void CubeMap::copyTextureImage(VkCommandBuffer commandBuffer) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.image = m_textureImage[0];
@@ -85,11 +246,17 @@ void CubeMap::copyTextureImage() {
     barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
+    // The layout change of the output was recorded in the same command buffer for the fragment stage
+    std::array<VkImageMemoryBarrier, 2> barriers = { barrier, barrier };
+    barriers[1].image = m_textureImage[1];
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
     devFuncs->vkCmdPipelineBarrier(commandBuffer,
-                                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
                                    0, nullptr,
                                    0, nullptr,
-                                   1, &barrier);
+                                   static_cast<uint32_t>(barriers.size()), barriers.data());
 
     VkImageBlit blit{};
     blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -118,8 +285,6 @@ void CubeMap::copyTextureImage() {
                                    0, nullptr,
                                    0, nullptr,
                                    1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 VkImageView CubeMap::getImageView(uint32_t id) {
@@ -130,21 +295,18 @@ VkSampler CubeMap::getTextureSampler() {
     return m_textureSampler;
 }
 
-void CubeMap::generateMipmaps() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+void CubeMap::generateMipmaps(VkCommandBuffer commandBuffer) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     // Check if image format supports linear blitting
     VkFormatProperties formatProperties;
-    m_window->vulkanInstance()->functions()->
-        vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, &formatProperties);
+    m_context->functions()->
+        vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, &formatProperties);
 
     if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        m_window->crash("texture image format does not support linear blitting!");
+        m_context->crash("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.image = m_textureImage[0];
@@ -217,37 +379,6 @@ void CubeMap::generateMipmaps() {
                                    0, nullptr,
                                    0, nullptr,
                                    1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
-void CubeMap::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-
-    if (devFuncs->vkCreateBuffer(dev, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        m_window->crash("failed to create buffer!");
-    }
-
-    VkMemoryRequirements memRequirements;
-    devFuncs->vkGetBufferMemoryRequirements(dev, buffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_window->findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        m_window->crash("failed to allocate buffer memory!");
-    }
-
-    devFuncs->vkBindBufferMemory(dev, buffer, bufferMemory, 0);
 }
 
 void CubeMap::createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags properties) {
@@ -267,108 +398,366 @@ void CubeMap::createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags propert
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     if (devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &m_textureImage[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create image!");
+        m_context->crash("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    devFuncs->vkGetImageMemoryRequirements(dev, m_textureImage[0], &memRequirements);
+    m_textureImageMemory[0] = m_context->getAllocator()->allocateImage(m_textureImage[0], properties);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_window->findMemoryType(memRequirements.memoryTypeBits, properties);
+    VkImageCreateInfo imageInfo1 = imageInfo;
+    imageInfo1.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &m_textureImageMemory[0]) != VK_SUCCESS) {
-        m_window->crash("failed to allocate image memory!");
+    if (devFuncs->vkCreateImage(dev, &imageInfo1, nullptr, &m_textureImage[1]) != VK_SUCCESS) {
+        m_context->crash("failed to create image!");
     }
 
-    devFuncs->vkBindImageMemory(dev, m_textureImage[0], m_textureImageMemory[0], 0);
+    m_textureImageMemory[1] = m_context->getAllocator()->allocateImage(m_textureImage[1], properties);
+}
 
-    VkImageCreateInfo imageInfo1 = imageInfo;
-    imageInfo1.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+void CubeMap::faceSize(const Source &source, uint32_t &width, uint32_t &height, uint32_t &mipLevels) {
+    if (source.paths.size() == 1) {
+        // A face covers a quarter of the horizon, rounded down to a power of two so every level halves exactly
+        width = height = 1u << static_cast<uint32_t>(std::floor(std::log2(std::max(source.width/4, 1u))));
+    } else {
+        width = source.width;
+        height = source.height;
+    }
+    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
 
-    if (devFuncs->vkCreateImage(dev, &imageInfo1, nullptr, &m_textureImage[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create image!");
+void CubeMap::createTextureImage(const Source &source) {
+    const bool panorama = source.paths.size() == 1;
+    faceSize(source, m_width, m_height, m_mipLevels);
+
+    createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // The panorama is cut into faces on the GPU, six faces are copied as they are. Either way all
+    // the copies and the layout changes of both images go in one submission
+    if (panorama) {
+        convertPanorama(source.transfer, source.width, source.height);
+    } else {
+        const StagingRing::Transfer &transfer = source.transfer;
+        transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, transfer.commandBuffer);
+        copyBufferToImage(transfer.commandBuffer, transfer.buffer, transfer.offset, m_textureImage[0]);
+        transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, 0, transfer.commandBuffer);
+        transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1, transfer.commandBuffer);
     }
+}
 
-    VkMemoryRequirements memRequirements1;
-    devFuncs->vkGetImageMemoryRequirements(dev, m_textureImage[1], &memRequirements1);
+void CubeMap::convertPanorama(const StagingRing::Transfer &transfer, uint32_t width, uint32_t height) {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    VkMemoryAllocateInfo allocInfo1{};
-    allocInfo1.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo1.allocationSize = memRequirements1.size;
-    allocInfo1.memoryTypeIndex = m_window->findMemoryType(memRequirements1.memoryTypeBits, properties);
+    // Everything here only lives until the setup submission is done
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = { width, height, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkImage panoramaImage;
+    if (devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &panoramaImage) != VK_SUCCESS) {
+        m_context->crash("failed to create image!");
+    }
+    MemoryAllocation panoramaMemory = m_context->getAllocator()->allocateImage(panoramaImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo1, nullptr, &m_textureImageMemory[1]) != VK_SUCCESS) {
-        m_window->crash("failed to allocate image memory!");
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = panoramaImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkImageView panoramaView;
+    if (devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, &panoramaView) != VK_SUCCESS) {
+        m_context->crash("failed to create texture image view!");
+    }
+
+    viewInfo.image = m_textureImage[0];
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6 };
+    VkImageView faceView;
+    if (devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, &faceView) != VK_SUCCESS) {
+        m_context->crash("failed to create texture image view!");
     }
 
-    devFuncs->vkBindImageMemory(dev, m_textureImage[1], m_textureImageMemory[1], 0);
+    // Longitude wraps around, latitude stops at the poles
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    VkSampler sampler;
+    if (devFuncs->vkCreateSampler(dev, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+        m_context->crash("failed to create texture sampler!");
+    }
+
+    ComputePass pass = createComputePass(SHADER("equirectToCube_comp.spv"), { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE });
+
+    std::array<VkDescriptorImageInfo, 2> imageInfos{};
+    imageInfos[0] = { sampler, panoramaView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    imageInfos[1] = { VK_NULL_HANDLE, faceView, VK_IMAGE_LAYOUT_GENERAL };
+    std::array<VkWriteDescriptorSet, 2> descWrites{};
+    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[0].dstSet = pass.descSet;
+    descWrites[0].dstBinding = 0;
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrites[0].descriptorCount = 1;
+    descWrites[0].pImageInfo = &imageInfos[0];
+    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[1].dstSet = pass.descSet;
+    descWrites[1].dstBinding = 1;
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descWrites[1].descriptorCount = 1;
+    descWrites[1].pImageInfo = &imageInfos[1];
+    devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+
+    // Upload, conversion and the layout changes of both cube images go in the setup submission on
+    // the graphics queue, which also takes compute work
+    VkCommandBuffer commandBuffer = transfer.commandBuffer;
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = panoramaImage;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                   0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = transfer.offset;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageExtent = { width, height, 1 };
+    devFuncs->vkCmdCopyBufferToImage(commandBuffer, transfer.buffer, panoramaImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    std::array<VkImageMemoryBarrier, 2> barriers = { barrier, barrier };
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[1].image = m_textureImage[0];
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_mipLevels, 0, 6 };
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                   0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    devFuncs->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline);
+    devFuncs->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipelineLayout, 0, 1, &pass.descSet, 0, 0);
+    devFuncs->vkCmdDispatch(commandBuffer, (m_width+15)/16, (m_height+15)/16, 6);
+
+    // Mip generation blits from level 0 next
+    barrier.image = m_textureImage[0];
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_mipLevels, 0, 6 };
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                   0, 0, nullptr, 0, nullptr, 1, &barrier);
+    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1, commandBuffer);
+
+    m_setupCleanup.push_back([=]() mutable {
+        destroyComputePass(pass);
+        devFuncs->vkDestroySampler(dev, sampler, nullptr);
+        devFuncs->vkDestroyImageView(dev, faceView, nullptr);
+        devFuncs->vkDestroyImageView(dev, panoramaView, nullptr);
+        devFuncs->vkDestroyImage(dev, panoramaImage, nullptr);
+        m_context->getAllocator()->free(panoramaMemory);
+    });
 }
 
-void CubeMap::createTextureImage(const std::array<QString, 6> &paths) {
-    int texWidth = 0, texHeight = 0, texChannels = 0;
-    float *pixels[6]{};
-    for (int i = 0; i < 6; ++i) {
-        pixels[i] = stbi_loadf(paths[i].toUtf8(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        if (!pixels[i]) {
-            for (int j = 0; j < i; j++) {
-                stbi_image_free(pixels[j]);
-            }
-            m_window->crash("failed to load texture image: "+paths[i]);
-            return;
-        }
+void CubeMap::projectIrradiance(VkCommandBuffer commandBuffer) {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    // Nine coefficients only hold the lowest frequencies, a 64 texel wide level is plenty
+    const uint32_t level = m_mipLevels > 7 ? m_mipLevels - 7 : 0;
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_textureImage[0];
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 6 };
+    VkImageView levelView;
+    if (devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, &levelView) != VK_SUCCESS) {
+        m_context->crash("failed to create texture image view!");
     }
 
-    m_width = texWidth;
-    m_height = texHeight;
-    m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
+    // Every face writes its own partial sums, the host adds them up
+    const VkDeviceSize shSize = 6 * 9 * 4 * sizeof(float);
+    VkBufferCreateInfo bufInfo{};
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.size = shSize;
+    bufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkBuffer shBuf;
+    if (devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &shBuf) != VK_SUCCESS) {
+        m_context->crash("failed to create irradiance buffer!");
+    }
+    MemoryAllocation shMemory = m_context->getAllocator()->allocateBuffer(shBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    ComputePass pass = createComputePass(SHADER("cubeIrradiance_comp.spv"), { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER });
+
+    VkDescriptorImageInfo imageInfo = { VK_NULL_HANDLE, levelView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorBufferInfo bufferInfo = { shBuf, 0, shSize };
+    std::array<VkWriteDescriptorSet, 2> descWrites{};
+    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[0].dstSet = pass.descSet;
+    descWrites[0].dstBinding = 0;
+    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descWrites[0].descriptorCount = 1;
+    descWrites[0].pImageInfo = &imageInfo;
+    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrites[1].dstSet = pass.descSet;
+    descWrites[1].dstBinding = 1;
+    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descWrites[1].descriptorCount = 1;
+    descWrites[1].pBufferInfo = &bufferInfo;
+    devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+
+    // The last barriers of the mip chain only cover the fragment stage
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_textureImage[0];
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 6 };
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    devFuncs->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline);
+    devFuncs->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipelineLayout, 0, 1, &pass.descSet, 0, 0);
+    devFuncs->vkCmdDispatch(commandBuffer, 6, 1, 1);
+
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                   0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+    // Summed up once the setup submission is done, until then the coefficients are not read
+    m_setupCleanup.push_back([=]() mutable {
+        // Convolve with the clamped cosine (Ramamoorthi and Hanrahan 2001), the shaders only evaluate the basis
+        static const float band[9] = { float(M_PI), float(2*M_PI/3), float(2*M_PI/3), float(2*M_PI/3),
+                                       float(M_PI/4), float(M_PI/4), float(M_PI/4), float(M_PI/4), float(M_PI/4) };
+        const float *faces = static_cast<const float*>(shMemory.mapped);
+        m_irradiance.fill(0.0f);
+        for (uint32_t face = 0; face < 6; face++) {
+            for (uint32_t i = 0; i < 9*4; i++) {
+                m_irradiance[i] += faces[face*9*4 + i] * band[i/4];
+            }
+        }
 
-    VkDeviceSize imageSize = texWidth * texHeight * 4 * 6 * 4;
-    VkDeviceSize layerSize = imageSize / 6; //This is just the size of each layer.
+        destroyComputePass(pass);
+        devFuncs->vkDestroyImageView(dev, levelView, nullptr);
+        devFuncs->vkDestroyBuffer(dev, shBuf, nullptr);
+        m_context->getAllocator()->free(shMemory);
+    });
+}
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+const std::array<float, 36>& CubeMap::getIrradiance() const {
+    return m_irradiance;
+}
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingBuffer, stagingBufferMemory);
+CubeMap::ComputePass CubeMap::createComputePass(const QString &shader, const std::vector<VkDescriptorType> &types) {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+    ComputePass pass;
 
-    void* data;
-    devFuncs->vkMapMemory(dev, stagingBufferMemory, 0, imageSize, 0, &data);
-    for (int i = 0; i < 6; ++i) {
-        memcpy(static_cast<char*>(data)+layerSize*i, pixels[i], static_cast<size_t>(layerSize));
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (uint32_t i = 0; i < types.size(); i++) {
+        poolSizes.push_back({ types[i], 1 });
+        bindings.push_back({ i, types[i], 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr });
     }
-    devFuncs->vkUnmapMemory(dev, stagingBufferMemory);
 
-    for (int i = 0; i < 6; i++) {
-        stbi_image_free(pixels[i]);
+    VkDescriptorPoolCreateInfo descPoolInfo{};
+    descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descPoolInfo.maxSets = 1;
+    descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descPoolInfo.pPoolSizes = poolSizes.data();
+    if (devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &pass.descPool) != VK_SUCCESS) {
+        m_context->crash("failed to create descriptor pool!");
     }
 
-    createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
+    descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    descLayoutInfo.pBindings = bindings.data();
+    if (devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &pass.descSetLayout) != VK_SUCCESS) {
+        m_context->crash("failed to create descriptor set layout!");
+    }
 
-    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, m_textureImage[0]);
-    transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+    VkDescriptorSetAllocateInfo descSetAllocInfo{};
+    descSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descSetAllocInfo.descriptorPool = pass.descPool;
+    descSetAllocInfo.descriptorSetCount = 1;
+    descSetAllocInfo.pSetLayouts = &pass.descSetLayout;
+    if (devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &pass.descSet) != VK_SUCCESS) {
+        m_context->crash("Failed to allocate descriptor set");
+    }
 
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &pass.descSetLayout;
+    if (devFuncs->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &pass.pipelineLayout) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline layout!");
+    }
 
-    devFuncs->vkDestroyBuffer(dev, stagingBuffer, nullptr);
-    devFuncs->vkFreeMemory(dev, stagingBufferMemory, nullptr);
+    VkShaderModule computeShaderModule = m_context->createShader(shader);
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = pass.pipelineLayout;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = computeShaderModule;
+    pipelineInfo.stage.pName = "main";
+    if (devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &pass.pipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
+    }
+    devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
+    return pass;
 }
 
-void CubeMap::copyBufferToImage(VkBuffer buffer, VkImage image) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+void CubeMap::destroyComputePass(ComputePass &pass) {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+    devFuncs->vkDestroyPipeline(dev, pass.pipeline, nullptr);
+    devFuncs->vkDestroyPipelineLayout(dev, pass.pipelineLayout, nullptr);
+    devFuncs->vkDestroyDescriptorSetLayout(dev, pass.descSetLayout, nullptr);
+    devFuncs->vkDestroyDescriptorPool(dev, pass.descPool, nullptr);
+    pass = ComputePass();
+}
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+void CubeMap::copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkImage image) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -383,15 +772,12 @@ void CubeMap::copyBufferToImage(VkBuffer buffer, VkImage image) {
     };
 
     devFuncs->vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(commandBuffer);
 }
 
-void CubeMap::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t id) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+void CubeMap::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t id, VkCommandBuffer recordTo) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = recordTo ? recordTo : beginSingleTimeCommands();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -440,12 +826,14 @@ void CubeMap::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLa
         1, &barrier
         );
 
-    endSingleTimeCommands(commandBuffer);
+    if (!recordTo) {
+        endSingleTimeCommands(commandBuffer);
+    }
 }
 
 void CubeMap::createImageView() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -459,7 +847,7 @@ void CubeMap::createImageView() {
     viewInfo.subresourceRange.layerCount = 6;
 
     if (devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, &m_textureImageView[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 
     VkImageViewCreateInfo viewInfo1 = viewInfo;
@@ -467,16 +855,16 @@ void CubeMap::createImageView() {
     viewInfo1.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 
     if (devFuncs->vkCreateImageView(dev, &viewInfo1, nullptr, &m_textureImageView[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 }
 
 void CubeMap::createTextureSampler() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkPhysicalDeviceProperties properties{};
-    m_window->vulkanInstance()->functions()->vkGetPhysicalDeviceProperties(m_window->physicalDevice(), &properties);
+    m_context->functions()->vkGetPhysicalDeviceProperties(m_context->physicalDevice(), &properties);
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -495,18 +883,18 @@ void CubeMap::createTextureSampler() {
     samplerInfo.maxLod = m_mipLevels;
 
     if (devFuncs->vkCreateSampler(dev, &samplerInfo, nullptr, &m_textureSampler) != VK_SUCCESS) {
-        m_window->crash("failed to create texture sampler!");
+        m_context->crash("failed to create texture sampler!");
     }
 }
 
 VkCommandBuffer CubeMap::beginSingleTimeCommands() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
+    allocInfo.commandPool = m_context->graphicsCommandPool();
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer commandBuffer;
@@ -522,8 +910,8 @@ VkCommandBuffer CubeMap::beginSingleTimeCommands() {
 }
 
 void CubeMap::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
     devFuncs->vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
@@ -531,9 +919,9 @@ void CubeMap::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
-    devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-    devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-    devFuncs->vkFreeCommandBuffers(dev, m_window->graphicsCommandPool(), 1, &commandBuffer);
+    devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+    devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+    devFuncs->vkFreeCommandBuffers(dev, m_context->graphicsCommandPool(), 1, &commandBuffer);
 }
 
 uint32_t CubeMap::getWidth() const {
@@ -541,26 +929,28 @@ uint32_t CubeMap::getWidth() const {
 }
 
 void CubeMap::createComputeDescriptorSet() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     // Set up descriptor set and its layout.
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[0].descriptorCount = 1;
+    poolSizes[0].descriptorCount = m_mipLevels;
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    poolSizes[1].descriptorCount = 6;
+    poolSizes[1].descriptorCount = m_mipLevels;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = m_mipLevels;
 
     VkDescriptorPoolCreateInfo descPoolInfo {};
     descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     descPoolInfo.pPoolSizes = poolSizes.data();
     descPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
-    descPoolInfo.maxSets = 1;
+    descPoolInfo.maxSets = m_mipLevels;
 
     VkResult err = devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_computeDescPool);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor pool");
+        m_context->crash("Failed to create descriptor pool");
 
     VkDescriptorSetLayoutBinding cubeBinding = {
         0, // binding
@@ -576,15 +966,22 @@ void CubeMap::createComputeDescriptorSet() {
         VK_SHADER_STAGE_COMPUTE_BIT,
         nullptr
     };
+    VkDescriptorSetLayoutBinding sampleBinding = {
+        2, // binding
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        1,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        nullptr
+    };
 
-    std::array<VkDescriptorBindingFlags, 2> flags{VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT};
+    std::array<VkDescriptorBindingFlags, 3> flags{VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT};
     VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags {};
     bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
     bindingFlags.pNext = nullptr;
     bindingFlags.pBindingFlags = flags.data();
     bindingFlags.bindingCount = static_cast<uint32_t>(flags.size());;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {cubeBinding, mipBinding};
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {cubeBinding, mipBinding, sampleBinding};
     VkDescriptorSetLayoutCreateInfo descLayoutInfo{};
     descLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     descLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -594,24 +991,27 @@ void CubeMap::createComputeDescriptorSet() {
 
     err = devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_computeDescSetLayout);
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to create descriptor set layout");
+        m_context->crash("Failed to create descriptor set layout");
 
+    // Indexed by level, set 0 stays unused as level 0 is a plain copy of the input
+    std::vector<VkDescriptorSetLayout> layouts(m_mipLevels, m_computeDescSetLayout);
+    m_computeDescSets.resize(m_mipLevels);
     VkDescriptorSetAllocateInfo descSetAllocInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         nullptr,
         m_computeDescPool,
-        1,
-        &m_computeDescSetLayout
+        m_mipLevels,
+        layouts.data()
     };
 
-    err = devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_computeDescSet);
+    err = devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, m_computeDescSets.data());
     if (err != VK_SUCCESS)
-        m_window->crash("Failed to allocate descriptor set");
+        m_context->crash("Failed to allocate descriptor set");
 }
 
 void CubeMap::createComputePipelineLayout() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkPipelineLayoutCreateInfo m_computePipelineLayoutInfo{};
     m_computePipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -619,16 +1019,15 @@ void CubeMap::createComputePipelineLayout() {
     m_computePipelineLayoutInfo.pSetLayouts = &m_computeDescSetLayout;
 
     if (devFuncs->vkCreatePipelineLayout(dev, &m_computePipelineLayoutInfo, nullptr, &m_computePipelineLayout) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline layout!");
+        m_context->crash("failed to create compute pipeline layout!");
     }
 }
 
 void CubeMap::createComputePipeline() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    VkShaderModule computeShaderModule = m_window->createShader(QCoreApplication::applicationDirPath()+
-                                                                "/assets/shaders/cubeIntegrator_comp.spv");
+    VkShaderModule computeShaderModule = m_context->createShader(SHADER("cubeIntegrator_comp.spv"));
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -641,90 +1040,222 @@ void CubeMap::createComputePipeline() {
     pipelineInfo.layout = m_computePipelineLayout;
     pipelineInfo.stage = computeShaderStageInfo;
 
-    if (devFuncs->vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_computePipeline) != VK_SUCCESS) {
-        m_window->crash("failed to create compute pipeline!");
+    if (devFuncs->vkCreateComputePipelines(dev, m_context->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_computePipeline) != VK_SUCCESS) {
+        m_context->crash("failed to create compute pipeline!");
     }
 
     devFuncs->vkDestroyShaderModule(dev, computeShaderModule, nullptr);
 }
 
-void CubeMap::integrate(uint32_t lod) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-    devFuncs->vkDeviceWaitIdle(dev);
-
-    std::array<VkImageView, 2> imageView;
-    std::array<VkImageViewCreateInfo, 2> viewInfo{};
-    viewInfo[0].sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo[0].image = m_textureImage[0];
-    viewInfo[0].viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-    viewInfo[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    viewInfo[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo[0].subresourceRange.baseMipLevel = 0;
-    viewInfo[0].subresourceRange.levelCount = m_mipLevels;
-    viewInfo[0].subresourceRange.baseArrayLayer = 0;
-    viewInfo[0].subresourceRange.layerCount = 6;
-
-    viewInfo[1].sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo[1].image = m_textureImage[1];
-    viewInfo[1].viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
-    viewInfo[1].format = VK_FORMAT_R16G16B16A16_SFLOAT;
-    viewInfo[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo[1].subresourceRange.baseMipLevel = lod;
-    viewInfo[1].subresourceRange.levelCount = 1;
-    viewInfo[1].subresourceRange.baseArrayLayer = 0;
-    viewInfo[1].subresourceRange.layerCount = 6;
-
-    if (devFuncs->vkCreateImageView(dev, &viewInfo[0], nullptr, &imageView[0]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
-    }
-
-    if (devFuncs->vkCreateImageView(dev, &viewInfo[1], nullptr, &imageView[1]) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
-    }
-
-    std::array<VkDescriptorImageInfo, 2> imageInfo{};
-    imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imageInfo[0].imageView = imageView[0];
-    imageInfo[0].sampler = getTextureSampler();
-    imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imageInfo[1].imageView = imageView[1];
+void CubeMap::createSampleBuffer() {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    std::array<VkWriteDescriptorSet, 2> descWrites{};
-    descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descWrites[0].dstSet = m_computeDescSet;
-    descWrites[0].dstBinding = 0;
-    descWrites[0].dstArrayElement = 0;
-    descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descWrites[0].descriptorCount = 1;
-    descWrites[0].pImageInfo = &imageInfo[0];
-    descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descWrites[1].dstSet = m_computeDescSet;
-    descWrites[1].dstBinding = 1;
-    descWrites[1].dstArrayElement = 0;
-    descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    descWrites[1].descriptorCount = 1;
-    descWrites[1].pImageInfo = &imageInfo[1];
+    const VkDeviceSize storageAlign = m_context->physicalDeviceProperties()->limits.minStorageBufferOffsetAlignment;
+    m_sampleLevelStride = m_context->aligned(MAX_SAMPLES * 4 * sizeof(float), storageAlign);
 
-    devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+    VkBufferCreateInfo bufInfo{};
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.size = m_sampleLevelStride * m_mipLevels;
+    bufInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    if (devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_sampleBuf) != VK_SUCCESS) {
+        m_context->crash("failed to create sample buffer!");
+    }
+
+    m_sampleBufMem = m_context->getAllocator()->allocateBuffer(m_sampleBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+uint32_t CubeMap::writeSampleTable(Quality quality) {
+    // Rough levels need the most samples, the sharp ones are narrow lobes over an already filtered source
+    static const uint32_t baseCount[] = { 64, 256, 1024, MAX_SAMPLES };
+    const float resolution = m_width;
+    const float saTexel = 4.0f * M_PI / (6.0f * resolution * resolution);
+
+    m_sampleCounts.assign(m_mipLevels, 0);
+    uint32_t total = 0;
+    for (uint32_t lod = 1; lod < m_mipLevels; ++lod) {
+        const float roughness = float(lod) / std::log2(resolution);
+        const uint32_t count = quality == Reference ? MAX_SAMPLES :
+                               std::max(baseCount[quality]/8, std::min(uint32_t(baseCount[quality]*roughness + 0.5f), MAX_SAMPLES));
+        const float a = roughness*roughness;
+        const float a2 = a*a;
+
+        float *table = reinterpret_cast<float*>(static_cast<char*>(m_sampleBufMem.mapped) + m_sampleLevelStride*lod);
+        uint32_t written = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            // Hammersley point, GGX half vector around +Z and the light reflected about it with V = N
+            uint32_t bits = i;
+            bits = (bits << 16u) | (bits >> 16u);
+            bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+            bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+            bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+            bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+            const float u = float(i) / count;
+            const float v = float(bits) * 2.3283064365386963e-10f;
+
+            const float phi = 2.0f * M_PI * u;
+            const float cosTheta = std::sqrt((1.0f - v) / (1.0f + (a2 - 1.0f) * v));
+            const float sinTheta = std::sqrt(1.0f - cosTheta*cosTheta);
+            const float hx = std::cos(phi) * sinTheta;
+            const float hy = std::sin(phi) * sinTheta;
+            const float hz = cosTheta;
+
+            const float lz = 2.0f*hz*hz - 1.0f;
+            if (lz <= 0.0f) {
+                continue;
+            }
+
+            // Filtered importance sampling: read from the level whose texels cover the sample solid angle
+            const float denom = hz*hz * (a2 - 1.0f) + 1.0f;
+            const float D = a2 / (M_PI * denom * denom);
+            const float pdf = D / 4.0f + 0.0001f;
+            const float saSample = 1.0f / (float(count) * pdf + 0.0001f);
+            const float mipLevel = std::max(0.5f * std::log2(saSample / saTexel), 0.0f);
+
+            table[4*written] = 2.0f*hz*hx;
+            table[4*written+1] = 2.0f*hz*hy;
+            table[4*written+2] = lz;
+            table[4*written+3] = mipLevel;
+            written++;
+        }
+        m_sampleCounts[lod] = written;
+        total += written;
+    }
+    return total;
+}
+
+void CubeMap::integrate(Quality quality) {
+    // A single texel has no level to prefilter
+    if (m_mipLevels == 1) {
+        return;
+    }
+
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    writeSampleTable(quality);
+
+    // The input cube is shared by every level, each output level gets its own 2D array view
+    VkImageViewCreateInfo inputInfo{};
+    inputInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    inputInfo.image = m_textureImage[0];
+    inputInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+    inputInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    inputInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    inputInfo.subresourceRange.baseMipLevel = 0;
+    inputInfo.subresourceRange.levelCount = m_mipLevels;
+    inputInfo.subresourceRange.baseArrayLayer = 0;
+    inputInfo.subresourceRange.layerCount = 6;
+
+    VkImageView inputView;
+    if (devFuncs->vkCreateImageView(dev, &inputInfo, nullptr, &inputView) != VK_SUCCESS) {
+        m_context->crash("failed to create texture image view!");
+    }
+
+    std::vector<VkImageView> outputViews(m_mipLevels, VK_NULL_HANDLE);
+    for (uint32_t lod = 1; lod < m_mipLevels; ++lod) {
+        VkImageViewCreateInfo outputInfo{};
+        outputInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        outputInfo.image = m_textureImage[1];
+        outputInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        outputInfo.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        outputInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        outputInfo.subresourceRange.baseMipLevel = lod;
+        outputInfo.subresourceRange.levelCount = 1;
+        outputInfo.subresourceRange.baseArrayLayer = 0;
+        outputInfo.subresourceRange.layerCount = 6;
+
+        if (devFuncs->vkCreateImageView(dev, &outputInfo, nullptr, &outputViews[lod]) != VK_SUCCESS) {
+            m_context->crash("failed to create texture image view!");
+        }
+
+        std::array<VkDescriptorImageInfo, 2> imageInfo{};
+        imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo[0].imageView = inputView;
+        imageInfo[0].sampler = getTextureSampler();
+        imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfo[1].imageView = outputViews[lod];
+
+        VkDescriptorBufferInfo sampleInfo{};
+        sampleInfo.buffer = m_sampleBuf;
+        sampleInfo.offset = m_sampleLevelStride*lod;
+        sampleInfo.range = std::max(m_sampleCounts[lod], 1u) * 4 * sizeof(float);
+
+        std::array<VkWriteDescriptorSet, 3> descWrites{};
+        descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[0].dstSet = m_computeDescSets[lod];
+        descWrites[0].dstBinding = 0;
+        descWrites[0].dstArrayElement = 0;
+        descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descWrites[0].descriptorCount = 1;
+        descWrites[0].pImageInfo = &imageInfo[0];
+        descWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[1].dstSet = m_computeDescSets[lod];
+        descWrites[1].dstBinding = 1;
+        descWrites[1].dstArrayElement = 0;
+        descWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descWrites[1].descriptorCount = 1;
+        descWrites[1].pImageInfo = &imageInfo[1];
+        descWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descWrites[2].dstSet = m_computeDescSets[lod];
+        descWrites[2].dstBinding = 2;
+        descWrites[2].dstArrayElement = 0;
+        descWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descWrites[2].descriptorCount = 1;
+        descWrites[2].pBufferInfo = &sampleInfo;
+
+        devFuncs->vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descWrites.size()), descWrites.data(), 0, nullptr);
+    }
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandPool = m_computeCommandPool;
     allocInfo.commandBufferCount = 1;
+    devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &m_integrateCommandBuffer);
 
-    VkCommandBuffer commandBuffer;
-    devFuncs->vkAllocateCommandBuffers(dev, &allocInfo, &commandBuffer);
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (devFuncs->vkCreateFence(dev, &fenceInfo, nullptr, &m_integrateFence) != VK_SUCCESS) {
+        m_context->crash("failed to create prefilter fence!");
+    }
+
+    // The views and the command buffer live until isReady() has seen the fence of the last level.
+    // Level 0 has no output view, its slot keeps the input one
+    m_integrateViews = outputViews;
+    m_integrateViews[0] = inputView;
+    m_integrateLevel = 1;
+    submitLevel();
+}
 
+void CubeMap::submitLevel() {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    VkCommandBuffer commandBuffer = m_integrateCommandBuffer;
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
     devFuncs->vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    const uint32_t lod = m_integrateLevel++;
+    if (lod == 1) {
+        // The setup was only waited for on the host, its writes still have to be made visible
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                       0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Levels only read the input and write their own subresource, they need no barrier in between
+    const uint32_t width = std::max(m_width >> lod, 1u);
+    const uint32_t height = std::max(m_height >> lod, 1u);
     devFuncs->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_computePipeline);
-    devFuncs->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_computePipelineLayout, 0, 1, &m_computeDescSet, 0, 0);
-    devFuncs->vkCmdDispatch(commandBuffer, ceil(getWidth()/16.0), ceil(getWidth()/16.0), 1);
+    devFuncs->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_computePipelineLayout, 0, 1, &m_computeDescSets[lod], 0, 0);
+    devFuncs->vkCmdDispatch(commandBuffer, (width+15)/16, (height+15)/16, 6);
     devFuncs->vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
@@ -732,11 +1263,260 @@ void CubeMap::integrate(uint32_t lod) {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
+    // main.cpp takes the first family with compute, in practice the graphics one, so the frames
+    // recorded between two levels wait for a single level instead of the whole chain
     VkQueue computeQueue;
-    devFuncs->vkGetDeviceQueue(dev, m_window->getComputeQueueFamilyIndex(), 0, &computeQueue);
-    devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    devFuncs->vkQueueWaitIdle(computeQueue);
-    devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &commandBuffer);
-    devFuncs->vkDestroyImageView(dev, imageView[0], nullptr);
-    devFuncs->vkDestroyImageView(dev, imageView[1], nullptr);
+    devFuncs->vkGetDeviceQueue(dev, m_context->getComputeQueueFamilyIndex(), 0, &computeQueue);
+    devFuncs->vkResetFences(dev, 1, &m_integrateFence);
+    devFuncs->vkQueueSubmit(computeQueue, 1, &submitInfo, m_integrateFence);
+}
+
+void CubeMap::finishIntegrate() {
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    devFuncs->vkDestroyFence(dev, m_integrateFence, nullptr);
+    m_integrateFence = VK_NULL_HANDLE;
+    devFuncs->vkFreeCommandBuffers(dev, m_computeCommandPool, 1, &m_integrateCommandBuffer);
+    for (VkImageView view : m_integrateViews) {
+        devFuncs->vkDestroyImageView(dev, view, nullptr);
+    }
+    m_integrateViews.clear();
+}
+
+VkDeviceSize CubeMap::levelSize(uint32_t width, uint32_t height, uint32_t level) {
+    return VkDeviceSize(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 6 * 4 * sizeof(uint16_t);
+}
+
+VkDeviceSize CubeMap::prefilteredSize(uint32_t width, uint32_t height, uint32_t mipLevels) {
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < mipLevels; i++) {
+        size += levelSize(width, height, i);
+    }
+    return size;
+}
+
+VkDeviceSize CubeMap::prefilteredLevelSize(uint32_t level) const {
+    return levelSize(m_width, m_height, level);
+}
+
+QString CubeMap::prefilteredCachePath(const QStringList &sources, Quality quality) {
+    // Keyed on path, size and modification time, the files themselves are not read on the GUI thread
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (const QString &path : sources) {
+        const QFileInfo info(path);
+        hash.addData(info.absoluteFilePath().toUtf8());
+        const qint64 stamp[2] = { info.size(), info.lastModified().toMSecsSinceEpoch() };
+        hash.addData(reinterpret_cast<const char*>(stamp), sizeof(stamp));
+    }
+    const uint32_t version[2] = { INTEGRATOR_VERSION, quality };
+    hash.addData(reinterpret_cast<const char*>(version), sizeof(version));
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/environment_"+hash.result().toHex()+".bin";
+}
+
+bool CubeMap::readCache(const Source &source) {
+    QFile file(source.cachePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // Header: magic, integrator version, size and level count, then every level with its six faces
+    uint32_t width, height, mipLevels;
+    faceSize(source, width, height, mipLevels);
+    uint32_t header[5];
+    if (file.read(reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header) ||
+        header[0] != CACHE_MAGIC || header[1] != INTEGRATOR_VERSION || header[2] != width ||
+        header[3] != height || header[4] != mipLevels) {
+        qWarning("Ignoring stale environment cache %s", qPrintable(source.cachePath));
+        return false;
+    }
+    return file.read(static_cast<char*>(source.transfer.mapped)+source.cacheOffset, source.cacheSize) == qint64(source.cacheSize);
+}
+
+void CubeMap::copyPrefiltered(const StagingRing::Transfer &transfer, VkDeviceSize offset) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    std::vector<VkBufferImageCopy> regions(m_mipLevels);
+    offset += transfer.offset;
+    for (uint32_t i = 0; i < m_mipLevels; i++) {
+        regions[i].bufferOffset = offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 6;
+        regions[i].imageExtent = { std::max(m_width >> i, 1u), std::max(m_height >> i, 1u), 1 };
+        offset += prefilteredLevelSize(i);
+    }
+    // Level 0 was just written by copyTextureImage() in the same submission
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                   0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    devFuncs->vkCmdCopyBufferToImage(transfer.commandBuffer, transfer.buffer, m_textureImage[1], VK_IMAGE_LAYOUT_GENERAL,
+                                     m_mipLevels, regions.data());
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = m_textureImage[1];
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.layerCount = 6;
+    barrier.subresourceRange.levelCount = m_mipLevels;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                                   0, nullptr,
+                                   0, nullptr,
+                                   1, &barrier);
+}
+
+uint64_t CubeMap::readPrefiltered(const uchar *&data) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    const VkDeviceSize size = prefilteredSize(m_width, m_height, m_mipLevels);
+
+    // isReady() has seen the fence of the last level, only the memory dependency is left.
+    // The transfer is held, release() it once the data has been used
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(size, true);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = m_textureImage[1];
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.layerCount = 6;
+    barrier.subresourceRange.levelCount = m_mipLevels;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                   0, nullptr,
+                                   0, nullptr,
+                                   1, &barrier);
+
+    std::vector<VkBufferImageCopy> regions(m_mipLevels);
+    VkDeviceSize offset = transfer.offset;
+    for (uint32_t i = 0; i < m_mipLevels; i++) {
+        regions[i].bufferOffset = offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 6;
+        regions[i].imageExtent = { std::max(m_width >> i, 1u), std::max(m_height >> i, 1u), 1 };
+        offset += prefilteredLevelSize(i);
+    }
+    devFuncs->vkCmdCopyImageToBuffer(transfer.commandBuffer, m_textureImage[1], VK_IMAGE_LAYOUT_GENERAL, transfer.buffer,
+                                     m_mipLevels, regions.data());
+
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    devFuncs->vkCmdPipelineBarrier(transfer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                   0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+    data = static_cast<const uchar*>(transfer.mapped);
+    return staging->submit(transfer);
+}
+
+void CubeMap::savePrefiltered(const QString &path) {
+    const VkDeviceSize size = prefilteredSize(m_width, m_height, m_mipLevels);
+
+    const uchar *data;
+    StagingRing *staging = m_context->getStagingRing();
+    const uint64_t id = readPrefiltered(data);
+
+    // Writing goes through a temporary file, an interrupted run never leaves a truncated cache behind
+    const uint32_t header[5] = { CACHE_MAGIC, INTEGRATOR_VERSION, m_width, m_height, m_mipLevels };
+    m_context->startJob("Caching environment", [=](std::atomic<float> &progress) {
+        staging->wait(id);
+        QDir().mkpath(QFileInfo(path).absolutePath());
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) ||
+            file.write(reinterpret_cast<const char*>(header), sizeof(header)) != sizeof(header) ||
+            file.write(reinterpret_cast<const char*>(data), size) != qint64(size) || !file.commit()) {
+            qWarning("Failed to write environment cache %s", qPrintable(path));
+        }
+        progress = 1.0f;
+    }, [=]() {
+        staging->release(id);
+    });
+}
+
+void CubeMap::reportQuality() {
+    // The chain is rebuilt in place, nothing may be sampling it meanwhile
+    VkDevice dev = m_context->device();
+    m_context->deviceFunctions()->vkDeviceWaitIdle(dev);
+    isReady(true);
+
+    // A cached environment never created the compute objects
+    if (!m_computePipeline) {
+        createComputeObjects();
+    }
+
+    // Level 0 is a copy of the input, only the prefiltered levels are compared
+    const VkDeviceSize first = prefilteredLevelSize(0);
+    VkDeviceSize size = 0;
+    for (uint32_t i = 1; i < m_mipLevels; i++) {
+        size += prefilteredLevelSize(i);
+    }
+    const size_t count = size / sizeof(uint16_t);
+
+    StagingRing *staging = m_context->getStagingRing();
+    auto prefilter = [&](Quality quality, std::vector<float> &result) {
+        QElapsedTimer timer;
+        timer.start();
+        integrate(quality);
+        isReady(true);
+        const qint64 elapsed = timer.elapsed();
+
+        const uchar *data;
+        const uint64_t id = readPrefiltered(data);
+        staging->wait(id);
+        const uint16_t *samples = reinterpret_cast<const uint16_t*>(data + first);
+        result.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            result[i] = ExrWriter::halfToFloat(samples[i]);
+        }
+        staging->release(id);
+        return elapsed;
+    };
+
+    std::vector<float> reference, result;
+    const qint64 referenceTime = prefilter(Reference, reference);
+    double referenceSum = 0;
+    for (float val : reference) {
+        referenceSum += double(val)*val;
+    }
+    const double referenceRms = std::sqrt(referenceSum / count);
+    qInfo("Environment %ux%u, reference prefilter in %lld ms", m_width, m_height, referenceTime);
+
+    static const char *names[] = { "draft", "normal", "final" };
+    for (Quality quality : { Draft, Normal, Final }) {
+        const qint64 elapsed = prefilter(quality, result);
+        double sum = 0;
+        double maxError = 0;
+        for (size_t i = 0; i < count; i++) {
+            const double error = double(result[i]) - reference[i];
+            sum += error*error;
+            maxError = std::max(maxError, std::fabs(error));
+        }
+        const double rms = std::sqrt(sum / count);
+        qInfo("  %-6s %6lld ms, RMSE %.5f (%.2f%% of the reference), max error %.4f",
+              names[quality], elapsed, rms, referenceRms > 0 ? 100.0*rms/referenceRms : 0.0, maxError);
+    }
+
+    // Leave the chain as the selected tier built it
+    integrate(m_quality);
+    isReady(true);
 }
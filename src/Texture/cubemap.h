@@ -1,56 +1,168 @@
 #pragma once
 
 #include <QVulkanWindow>
-#include <QVulkanFunctions>
-#include "src/UI/vulkanwindow.h"
+#include "src/Render/vulkancontext.h"
+#include "src/Render/memoryallocator.h"
+#include "src/Render/stagingring.h"
+#include <QElapsedTimer>
+#include <QStringList>
+#include <array>
+#include <functional>
+#include <vector>
 
 class CubeMap {
 public:
-    CubeMap(const std::array<QString, 6> &paths, VulkanWindow *w);
+    // Prefiltering cost against noise. Reference takes 1024 samples on every level and is only
+    // used to measure the other tiers
+    enum Quality {
+        Draft = 0,
+        Normal = 1,
+        Final = 2,
+        Reference = 3,
+    };
+
+    // Decoded pixels of an environment, either six faces in +X, -X, +Y, -Y, +Z, -Z order or one
+    // equirectangular .hdr or .exr panorama that is converted to the faces on the GPU
+    struct Source {
+        QStringList paths;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        StagingRing::Transfer transfer;
+        // Prefiltered chain cached for these files, read by decode() right after the faces when
+        // cacheSize is not zero. cached tells whether it was read and is valid
+        QString cachePath;
+        VkDeviceSize cacheOffset = 0;
+        VkDeviceSize cacheSize = 0;
+        bool cached = false;
+    };
+
+    // Probe the files and reserve staging memory for them and their cached chain, GUI thread only
+    static bool prepare(const QStringList &paths, VulkanContext *context, Quality quality, Source &source);
+    // Decode and read the cache into the staging memory, safe on any thread
+    static bool decode(Source &source);
+    // Give the staging memory back when the source is not used after all
+    static void discard(const Source &source, VulkanContext *context);
+
+    CubeMap(const QStringList &paths, VulkanContext *context, Quality quality = Normal);
+    // In background nothing is waited for, isReady() advances the build one step per call while the
+    // caller keeps rendering and the cube map must not be sampled before it returns true
+    CubeMap(const Source &source, VulkanContext *context, Quality quality = Normal, bool background = false);
     ~CubeMap();
 
+    bool isReady(bool wait = false);
+
     VkImageView getImageView(uint32_t id = 0);
     VkSampler getTextureSampler();
 
     uint32_t getWidth() const;
+    // Irradiance as nine RGB spherical harmonics coefficients padded to vec4, already convolved
+    // with the cosine lobe so a shader only has to evaluate the basis at the normal
+    const std::array<float, 36>& getIrradiance() const;
+
+    // Prefilter with every tier and log its time and error against the reference chain
+    void reportQuality();
 
 private:
+    // Pipeline with its own descriptor set for a pass that runs once while the cube map is built,
+    // binding i of the set has the i-th type
+    struct ComputePass {
+        VkDescriptorPool descPool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSet descSet = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+    };
+
+    static Source load(const QStringList &paths, VulkanContext *context, Quality quality);
+    static void faceSize(const Source &source, uint32_t &width, uint32_t &height, uint32_t &mipLevels);
+
+    ComputePass createComputePass(const QString &shader, const std::vector<VkDescriptorType> &types);
+    void destroyComputePass(ComputePass &pass);
+    void projectIrradiance(VkCommandBuffer commandBuffer);
+
+    void createComputeObjects();
     void createComputeDescriptorSet();
     void createComputePipelineLayout();
     void createComputePipeline();
-    void integrate(uint32_t lod);
+    void createSampleBuffer();
+    uint32_t writeSampleTable(Quality quality);
+    bool finishSetup(bool wait);
+    void integrate(Quality quality);
+    void submitLevel();
+    void finishIntegrate();
+
+    // The prefiltered chain only depends on the faces and the integrator, it is kept on disk
+    static QString prefilteredCachePath(const QStringList &sources, Quality quality);
+    static bool readCache(const Source &source);
+    void copyPrefiltered(const StagingRing::Transfer &transfer, VkDeviceSize offset);
+    void savePrefiltered(const QString &path);
+    uint64_t readPrefiltered(const uchar *&data);
+    static VkDeviceSize prefilteredSize(uint32_t width, uint32_t height, uint32_t mipLevels);
+    static VkDeviceSize levelSize(uint32_t width, uint32_t height, uint32_t level);
+    VkDeviceSize prefilteredLevelSize(uint32_t level) const;
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
     void createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags properties);
-    void createTextureImage(const std::array<QString, 6> &paths);
+    void createTextureImage(const Source &source);
+    void convertPanorama(const StagingRing::Transfer &transfer, uint32_t width, uint32_t height);
     void createImageView();
     void createTextureSampler();
-    void generateMipmaps();
-    void copyTextureImage();
+    void generateMipmaps(VkCommandBuffer commandBuffer);
+    void copyTextureImage(VkCommandBuffer commandBuffer);
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image);
-    void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t id = 0);
+    void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkImage image);
+    void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t id = 0, VkCommandBuffer recordTo = VK_NULL_HANDLE);
 
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
-    VulkanWindow *m_window;
+    VulkanContext *m_context;
 
     VkImage m_textureImage[2];
-    VkDeviceMemory m_textureImageMemory[2];
+    MemoryAllocation m_textureImageMemory[2];
     VkImageView m_textureImageView[2];
     VkSampler m_textureSampler;
 
     uint32_t m_width;
     uint32_t m_height;
     uint32_t m_mipLevels;
+    Quality m_quality;
+    std::array<float, 36> m_irradiance;
 
     VkCommandPool m_computeCommandPool = VK_NULL_HANDLE;
 
     VkPipelineLayout m_computePipelineLayout = VK_NULL_HANDLE;
     VkPipeline m_computePipeline = VK_NULL_HANDLE;
 
-    VkDescriptorSet m_computeDescSet = VK_NULL_HANDLE;
+    // One set per output level, each level is prefiltered by its own submission
+    std::vector<VkDescriptorSet> m_computeDescSets;
+
+    // Per level sample tables, each level starts at a storage buffer offset boundary
+    MemoryAllocation m_sampleBufMem;
+    VkBuffer m_sampleBuf = VK_NULL_HANDLE;
+    VkDeviceSize m_sampleLevelStride = 0;
+    std::vector<uint32_t> m_sampleCounts;
+
+    // Upload, mip chain and irradiance in flight, the cleanups also sum up the irradiance
+    uint64_t m_setupId = 0;
+    std::vector<std::function<void()>> m_setupCleanup;
+    // The chain came from the cache with the setup, nothing is prefiltered
+    bool m_cached = false;
+
+    // Prefilter in flight, m_integrateLevel is the next level to submit and the chain is cached to
+    // m_cachePath once it is done
+    VkFence m_integrateFence = VK_NULL_HANDLE;
+    VkCommandBuffer m_integrateCommandBuffer = VK_NULL_HANDLE;
+    uint32_t m_integrateLevel = 0;
+    std::vector<VkImageView> m_integrateViews;
+    QElapsedTimer m_integrateTimer;
+    QString m_cachePath;
     VkDescriptorPool m_computeDescPool = VK_NULL_HANDLE;
     VkDescriptorSetLayout m_computeDescSetLayout = VK_NULL_HANDLE;
+
+    // Bump whenever cubeIntegrator.comp changes its output, older cache files are ignored then
+    static constexpr uint32_t INTEGRATOR_VERSION = 2;
+    static constexpr uint32_t MAX_SAMPLES = 1024;
+    static constexpr uint32_t CACHE_MAGIC = 0x43564e45; // "ENVC"
+    // Magic, integrator version, size and level count
+    static constexpr qint64 CACHE_HEADER_SIZE = 5 * sizeof(uint32_t);
 };
@@ -0,0 +1,238 @@
+#include "exrreader.h"
+#include "src/Texture/exrwriter.h"
+#include <QByteArray>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+static int32_t readI32(const uchar *data) {
+    return qFromLittleEndian<qint32>(data);
+}
+
+ExrReader::ExrReader(const QString &path, uint32_t maxDimension) : m_file(path) {
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        return;
+    }
+
+    m_isValid = parseHeader(maxDimension);
+    if (!m_isValid) {
+        qWarning("Unsupported or truncated EXR file %s", qPrintable(path));
+    }
+}
+
+bool ExrReader::isValid() {
+    return m_isValid;
+}
+
+uint32_t ExrReader::getWidth() {
+    return m_width;
+}
+
+uint32_t ExrReader::getHeight() {
+    return m_height;
+}
+
+bool ExrReader::parseHeader(uint32_t maxDimension) {
+    // Tiled, deep and multi part files are flagged in the version field, long names are fine
+    if (m_size < 8 || readI32(m_data) != 20000630 || (readI32(m_data+4) & 0xFF) != 2 || (readI32(m_data+4) & 0x1A00)) {
+        return false;
+    }
+
+    bool hasChannels = false, hasWindow = false;
+    qint64 pos = 8;
+    auto readString = [&](QByteArray &out) {
+        const uchar *end = static_cast<const uchar*>(memchr(m_data+pos, 0, m_size-pos));
+        if (!end) return false;
+        out = QByteArray(reinterpret_cast<const char*>(m_data+pos), end-(m_data+pos));
+        pos = end-m_data+1;
+        return true;
+    };
+
+    while (true) {
+        QByteArray name, type;
+        if (pos >= m_size || !readString(name)) {
+            return false;
+        }
+        if (name.isEmpty()) {
+            break;
+        }
+        if (!readString(type) || pos+4 > m_size) {
+            return false;
+        }
+        const int32_t size = readI32(m_data+pos);
+        pos += 4;
+        if (size < 0 || pos+size > m_size) {
+            return false;
+        }
+        const uchar *attr = m_data+pos;
+
+        if (name == "channels" && type == "chlist") {
+            // Channels are stored in alphabetical order, which is also their order in every scanline
+            qint64 chPos = 0;
+            while (chPos < size && attr[chPos]) {
+                const uchar *end = static_cast<const uchar*>(memchr(attr+chPos, 0, size-chPos));
+                if (!end || end-attr+17 > size) {
+                    return false;
+                }
+                QByteArray channel(reinterpret_cast<const char*>(attr+chPos));
+                channel = channel.mid(channel.lastIndexOf('.')+1);
+                const uchar *info = end+1;
+                const int32_t pixelType = readI32(info);
+                if (pixelType < 0 || pixelType > 2 || readI32(info+8) != 1 || readI32(info+12) != 1) {
+                    return false;
+                }
+                static const char *names[] = { "R", "G", "B", "A", "Y" };
+                int32_t target = -1;
+                for (int32_t i = 0; i < 5; i++) {
+                    if (channel == names[i]) target = i;
+                }
+                m_channels.push_back({ pixelType, target });
+                chPos = info+16-attr;
+            }
+            hasChannels = !m_channels.empty();
+        } else if (name == "compression" && size == 1) {
+            m_compression = attr[0];
+        } else if (name == "dataWindow" && size == 16) {
+            m_minX = readI32(attr);
+            m_minY = readI32(attr+4);
+            // The corners are any int32, their difference only fits in 64 bits
+            const qint64 width = qint64(readI32(attr+8))-m_minX+1;
+            const qint64 height = qint64(readI32(attr+12))-m_minY+1;
+            if (width < 1 || height < 1 || width > maxDimension || height > maxDimension) {
+                return false;
+            }
+            m_width = width;
+            m_height = height;
+            hasWindow = true;
+        }
+        pos += size;
+    }
+
+    // PIZ, PXR24, B44 and DWA would each need their own codec
+    switch (m_compression) {
+    case 0: case 1: case 2: m_linesPerBlock = 1; break;
+    case 3: m_linesPerBlock = 16; break;
+    default: return false;
+    }
+
+    const qint64 blocks = (qint64(m_height)+m_linesPerBlock-1)/m_linesPerBlock;
+    m_offsets = pos;
+    return hasChannels && hasWindow && m_offsets + blocks*8 <= m_size;
+}
+
+bool ExrReader::uncompress(const uchar *src, uint32_t size, std::vector<uchar> &out, size_t expected) {
+    std::vector<uchar> tmp;
+    if (m_compression == 1) {
+        // Runs are a negative count followed by literal bytes or a count followed by one repeated byte
+        const uchar *end = src+size;
+        while (src < end) {
+            const int count = int8_t(*src++);
+            if (count < 0) {
+                if (end-src < -count) return false;
+                tmp.insert(tmp.end(), src, src-count);
+                src -= count;
+            } else {
+                if (src == end) return false;
+                tmp.insert(tmp.end(), count+1, *src++);
+            }
+        }
+    } else {
+        // qUncompress wants the expected size in front of the zlib stream
+        QByteArray stream(4, 0);
+        qToBigEndian<quint32>(expected, stream.data());
+        stream.append(reinterpret_cast<const char*>(src), size);
+        const QByteArray raw = qUncompress(stream);
+        tmp.assign(raw.begin(), raw.end());
+    }
+    if (tmp.size() != expected) {
+        return false;
+    }
+
+    // Undo the delta predictor, then interleave the two halves the encoder split the bytes into
+    for (size_t i = 1; i < tmp.size(); i++) {
+        tmp[i] = uchar(tmp[i-1] + tmp[i] - 128);
+    }
+    out.resize(expected);
+    const size_t half = (expected+1)/2;
+    for (size_t i = 0; i < expected; i++) {
+        out[i] = i & 1 ? tmp[half + i/2] : tmp[i/2];
+    }
+    return true;
+}
+
+bool ExrReader::read(float *dst) {
+    if (!m_isValid) {
+        return false;
+    }
+
+    static const uint32_t typeSize[] = { 4, 2, 4 };
+    size_t lineSize = 0;
+    for (const Channel &channel : m_channels) {
+        lineSize += size_t(m_width)*typeSize[channel.type];
+    }
+
+    for (size_t i = 0; i < size_t(m_width)*m_height; i++) {
+        dst[4*i] = dst[4*i+1] = dst[4*i+2] = 0.0f;
+        dst[4*i+3] = 1.0f;
+    }
+
+    std::vector<uchar> block;
+    const uint32_t blocks = (m_height+m_linesPerBlock-1)/m_linesPerBlock;
+    for (uint32_t b = 0; b < blocks; b++) {
+        // Offsets come from the file, compare against what is left so no sum can wrap around
+        const quint64 offset = qFromLittleEndian<quint64>(m_data+m_offsets+8*b);
+        if (offset > quint64(m_size)-8) {
+            return false;
+        }
+        const qint64 firstLine = qint64(readI32(m_data+offset))-m_minY;
+        const uint32_t size = readI32(m_data+offset+4);
+        if (firstLine < 0 || firstLine >= m_height || size > quint64(m_size)-offset-8) {
+            return false;
+        }
+        const uint32_t lines = std::min<qint64>(m_linesPerBlock, m_height-firstLine);
+        const size_t expected = lineSize*lines;
+
+        // Blocks that would grow when compressed are stored as they are
+        const uchar *src = m_data+offset+8;
+        if (m_compression && size != expected) {
+            if (!uncompress(src, size, block, expected)) {
+                return false;
+            }
+            src = block.data();
+        } else if (size != expected) {
+            return false;
+        }
+
+        // Each scanline holds every channel one after the other
+        for (uint32_t l = 0; l < lines; l++) {
+            float *row = dst + size_t(firstLine+l)*m_width*4;
+            for (const Channel &channel : m_channels) {
+                for (uint32_t x = 0; x < m_width; x++, src += typeSize[channel.type]) {
+                    if (channel.target < 0) {
+                        continue;
+                    }
+                    float val;
+                    if (channel.type == 1) {
+                        val = ExrWriter::halfToFloat(qFromLittleEndian<quint16>(src));
+                    } else if (channel.type == 2) {
+                        const quint32 bits = qFromLittleEndian<quint32>(src);
+                        memcpy(&val, &bits, sizeof(float));
+                    } else {
+                        val = qFromLittleEndian<quint32>(src);
+                    }
+                    if (channel.target == 4) {
+                        row[4*x] = row[4*x+1] = row[4*x+2] = val;
+                    } else {
+                        row[4*x+channel.target] = val;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <QFile>
+#include <vector>
+#include <cstdint>
+
+// Minimal OpenEXR reader: single part scanline files, uncompressed, RLE, ZIPS or ZIP, half, float
+// or uint channels. The file is memory mapped and R, G, B and A are expanded to RGBA float, a lone
+// Y channel is read as gray and a missing alpha as one.
+class ExrReader {
+public:
+    // Files wider or taller than maxDimension are rejected while parsing the header
+    ExrReader(const QString &path, uint32_t maxDimension = UINT32_MAX);
+
+    ExrReader(const ExrReader&) = delete;
+    ExrReader& operator=(const ExrReader&) = delete;
+
+    bool isValid();
+    uint32_t getWidth();
+    uint32_t getHeight();
+
+    // Decode every scanline to dst, width*height interleaved RGBA floats top to bottom
+    bool read(float *dst);
+
+private:
+    struct Channel {
+        int32_t type;
+        int32_t target;
+    };
+
+    bool parseHeader(uint32_t maxDimension);
+    bool uncompress(const uchar *src, uint32_t size, std::vector<uchar> &out, size_t expected);
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_offsets = 0;
+
+    std::vector<Channel> m_channels;
+    uint32_t m_compression = 0;
+    uint32_t m_linesPerBlock = 1;
+    int32_t m_minX = 0;
+    int32_t m_minY = 0;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    bool m_isValid = false;
+};
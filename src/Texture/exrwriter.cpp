@@ -0,0 +1,168 @@
+#include "exrwriter.h"
+#include <QDataStream>
+#include <QtEndian>
+#include <cstring>
+#include <vector>
+
+ExrWriter::ExrWriter(const QString &path, uint32_t width, uint32_t height, uint32_t channels)
+    : m_file(path), m_width(width), m_height(height), m_channels(channels) {
+    if (channels < 1 || channels > 4 || !m_file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    QDataStream out(&m_file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    auto attribute = [&](const char *name, const char *type, int32_t size) {
+        out.writeRawData(name, strlen(name)+1);
+        out.writeRawData(type, strlen(type)+1);
+        out << size;
+    };
+
+    // Magic number and version 2, single part scanline file
+    out << int32_t(20000630) << int32_t(2);
+
+    // Channels must be listed in alphabetical order
+    static const char *names[4][4] = {{"Y"}, {"G", "R"}, {"B", "G", "R"}, {"A", "B", "G", "R"}};
+    attribute("channels", "chlist", 18*m_channels+1);
+    for (uint32_t i = 0; i < m_channels; i++) {
+        out.writeRawData(names[m_channels-1][i], 2);
+        out << int32_t(1) << int32_t(0) << int32_t(1) << int32_t(1); // HALF, pLinear + reserved, x and y sampling
+    }
+    out << uint8_t(0);
+
+    attribute("compression", "compression", 1);
+    out << uint8_t(0);
+    attribute("dataWindow", "box2i", 16);
+    out << int32_t(0) << int32_t(0) << int32_t(m_width-1) << int32_t(m_height-1);
+    attribute("displayWindow", "box2i", 16);
+    out << int32_t(0) << int32_t(0) << int32_t(m_width-1) << int32_t(m_height-1);
+    attribute("lineOrder", "lineOrder", 1);
+    out << uint8_t(0);
+    attribute("pixelAspectRatio", "float", 4);
+    out << 1.0f;
+    attribute("screenWindowCenter", "v2f", 8);
+    out << 0.0f << 0.0f;
+    attribute("screenWindowWidth", "float", 4);
+    out << 1.0f;
+    out << uint8_t(0);
+
+    // Uncompressed scanlines have a fixed size, so the offset table is known upfront
+    const uint64_t lineSize = 8 + uint64_t(m_width)*m_channels*sizeof(uint16_t);
+    const uint64_t firstLine = m_file.pos() + uint64_t(m_height)*sizeof(uint64_t);
+    for (uint32_t y = 0; y < m_height; y++) {
+        out << quint64(firstLine + y*lineSize);
+    }
+
+    m_isValid = out.status() == QDataStream::Ok;
+}
+
+ExrWriter::~ExrWriter() {
+    if (m_isValid && m_currentRow != m_height) {
+        qWarning("EXR file closed after %u of %u scanlines", m_currentRow, m_height);
+    }
+    m_file.close();
+}
+
+bool ExrWriter::isValid() {
+    return m_isValid;
+}
+
+template<typename T, typename F>
+void ExrWriter::writeScanlines(const T *data, uint32_t rows, F toHalf) {
+    if (!m_isValid) return;
+
+    QDataStream out(&m_file);
+    out.setByteOrder(QDataStream::LittleEndian);
+
+    std::vector<uint16_t> line(m_width*m_channels);
+    for (uint32_t r = 0; r < rows && m_currentRow < m_height; r++, m_currentRow++) {
+        const T *src = data + uint64_t(r)*m_width*m_channels;
+        // Scanline data is planar, one channel after the other in the same order as the header
+        for (uint32_t c = 0; c < m_channels; c++) {
+            const uint32_t srcChannel = m_channels-1-c;
+            for (uint32_t x = 0; x < m_width; x++) {
+                line[c*m_width+x] = qToLittleEndian<uint16_t>(toHalf(src[x*m_channels+srcChannel]));
+            }
+        }
+        out << int32_t(m_currentRow) << int32_t(line.size()*sizeof(uint16_t));
+        out.writeRawData(reinterpret_cast<const char*>(line.data()), line.size()*sizeof(uint16_t));
+    }
+
+    if (out.status() != QDataStream::Ok) {
+        qWarning("Failed to write EXR scanlines");
+        m_isValid = false;
+    }
+}
+
+void ExrWriter::writeRows(const float *data, uint32_t rows) {
+    writeScanlines(data, rows, floatToHalf);
+}
+
+void ExrWriter::writeRows(const uint16_t *data, uint32_t rows) {
+    writeScanlines(data, rows, [](uint16_t val) { return val; });
+}
+
+uint16_t ExrWriter::floatToHalf(float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(float));
+
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x007FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF) {
+        // Inf and NaN
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    }
+    if (exponent >= 31) {
+        return sign | 0x7C00;
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+        // Denormal, round to nearest
+        mantissa |= 0x00800000;
+        const uint32_t shift = 14 - exponent;
+        uint16_t half = mantissa >> shift;
+        if ((mantissa >> (shift-1)) & 1) half++;
+        return sign | half;
+    }
+
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    // Round to nearest, a carry into the exponent is still correct
+    if (mantissa & 0x1000) half++;
+    return half;
+}
+
+float ExrWriter::halfToFloat(uint16_t val) {
+    const uint32_t sign = uint32_t(val & 0x8000) << 16;
+    int32_t exponent = (val >> 10) & 0x1F;
+    uint32_t mantissa = val & 0x3FF;
+
+    uint32_t bits;
+    if (exponent == 0x1F) {
+        // Inf and NaN
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent == 0) {
+        if (!mantissa) {
+            bits = sign;
+        } else {
+            // Denormal, normalize it as float has the range to spare
+            exponent = 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | ((exponent + 127 - 15) << 23) | ((mantissa & 0x3FF) << 13);
+        }
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
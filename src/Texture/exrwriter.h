@@ -0,0 +1,33 @@
+#pragma once
+#include <QFile>
+
+// Minimal OpenEXR writer: single part, uncompressed, half float scanlines.
+// Rows are streamed to disk as they are written, so the full image never has to fit in memory.
+class ExrWriter {
+public:
+    ExrWriter(const QString &path, uint32_t width, uint32_t height, uint32_t channels = 4);
+    ~ExrWriter();
+
+    ExrWriter(const ExrWriter&) = delete;
+    ExrWriter& operator=(const ExrWriter&) = delete;
+
+    bool isValid();
+    // Append rows top to bottom, pixels are interleaved floats with the channel count given at construction
+    void writeRows(const float *data, uint32_t rows);
+    // Same with samples already in half float, they are written as they are
+    void writeRows(const uint16_t *data, uint32_t rows);
+
+    static uint16_t floatToHalf(float val);
+    static float halfToFloat(uint16_t val);
+
+private:
+    template<typename T, typename F>
+    void writeScanlines(const T *data, uint32_t rows, F toHalf);
+
+    QFile m_file;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_channels;
+    uint32_t m_currentRow = 0;
+    bool m_isValid = false;
+};
@@ -0,0 +1,63 @@
+#include "imagedecoder.h"
+#include <QFileInfo>
+#include <cstring>
+#include <thread>
+#include "src/Texture/exrreader.h"
+#include "src/Texture/stb_image.h"
+
+static bool isExr(const QString &path) {
+    return QFileInfo(path).suffix().toLower() == "exr";
+}
+
+bool ImageDecoder::probe(const QString &path, uint32_t &width, uint32_t &height, uint32_t maxDimension) {
+    if (isExr(path)) {
+        ExrReader reader(path, maxDimension);
+        width = reader.getWidth();
+        height = reader.getHeight();
+        return reader.isValid();
+    }
+
+    int x = 0, y = 0, channels = 0;
+    if (!stbi_info(path.toUtf8(), &x, &y, &channels) || x <= 0 || y <= 0 || uint32_t(x) > maxDimension || uint32_t(y) > maxDimension) {
+        return false;
+    }
+    width = x;
+    height = y;
+    return true;
+}
+
+bool ImageDecoder::decode(const std::vector<Image> &images, bool hdr) {
+    // Not a vector<bool>, every worker writes its own entry
+    std::vector<char> decoded(images.size(), 0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < images.size(); i++) {
+        workers.emplace_back([&, i]() {
+            const Image &image = images[i];
+            if (isExr(image.path)) {
+                ExrReader reader(image.path);
+                decoded[i] = hdr && reader.getWidth() == image.width && reader.getHeight() == image.height &&
+                             reader.read(static_cast<float*>(image.dst));
+                return;
+            }
+            int width = 0, height = 0, channels = 0;
+            void *pixels = hdr ? static_cast<void*>(stbi_loadf(image.path.toUtf8(), &width, &height, &channels, STBI_rgb_alpha))
+                               : static_cast<void*>(stbi_load(image.path.toUtf8(), &width, &height, &channels, STBI_rgb_alpha));
+            if (!pixels) {
+                return;
+            }
+            if (uint32_t(width) == image.width && uint32_t(height) == image.height) {
+                memcpy(image.dst, pixels, size_t(width)*height*4*(hdr ? sizeof(float) : 1));
+                decoded[i] = 1;
+            }
+            stbi_image_free(pixels);
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    for (char ok: decoded) {
+        if (!ok) return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <QString>
+#include <vector>
+
+// Decodes image files with stb, or ExrReader for .exr, straight into memory owned by the caller,
+// usually a slice of mapped staging memory. Every file gets its own worker thread, stb keeps its
+// error state per thread.
+class ImageDecoder {
+public:
+    struct Image {
+        QString path;
+        void *dst;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Read the size from the header without decoding the pixels, fails above maxDimension
+    static bool probe(const QString &path, uint32_t &width, uint32_t &height, uint32_t maxDimension);
+    // Decode every image to RGBA, 8 bit unorm or 32 bit float for hdr, into dst. EXR is hdr only.
+    // Fails when a file can not be decoded or its size differs from the expected one, dst is left
+    // undefined then.
+    static bool decode(const std::vector<Image> &images, bool hdr);
+};
@@ -0,0 +1,50 @@
+#include "imagewriter.h"
+#include <QFileInfo>
+#include <algorithm>
+#include <cmath>
+#include "src/Texture/exrwriter.h"
+#include "src/Texture/pngwriter.h"
+
+ImageWriter::ImageWriter(const QString &path, uint32_t width, uint32_t height)
+    : m_width(width), m_height(height) {
+    if (QFileInfo(path).suffix().toLower() == "exr") {
+        m_exr = new ExrWriter(path, width, height);
+    } else {
+        m_png = new PngWriter(path, width, height, 4, 8);
+    }
+}
+
+ImageWriter::~ImageWriter() {
+    delete m_exr;
+    delete m_png;
+}
+
+void ImageWriter::writeRows(std::vector<float> &pixels, uint32_t rows) {
+    rows = std::min(rows, m_height-m_currentRow);
+    const size_t count = size_t(m_width)*rows*4;
+
+    if (m_exr) {
+        // The shaders output display referred values, EXR stores linear ones
+        for (size_t i = 0; i < count; i++) {
+            if (i % 4 != 3) pixels[i] = pow(pixels[i], 2.2f);
+        }
+        m_exr->writeRows(pixels.data(), rows);
+    } else {
+        // Rows are quantized as the workers fetch them, the band is the only copy of the pixels
+        const uint32_t firstRow = m_currentRow;
+        m_png->writeRows([&](uint32_t y, uint8_t *row) {
+            const float *src = pixels.data() + size_t(y-firstRow)*m_width*4;
+            for (size_t i = 0; i < size_t(m_width)*4; i++) {
+                row[i] = uint8_t(std::clamp(src[i], 0.0f, 1.0f)*255.0f+0.5f);
+            }
+        }, rows);
+    }
+    m_currentRow += rows;
+}
+
+bool ImageWriter::finish() {
+    if (m_exr) {
+        return m_exr->isValid() && m_currentRow == m_height;
+    }
+    return m_png->finish();
+}
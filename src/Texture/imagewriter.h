@@ -0,0 +1,29 @@
+#pragma once
+#include <QString>
+#include <vector>
+
+class ExrWriter;
+class PngWriter;
+
+// Receives an image band by band, top to bottom, and writes it as PNG or EXR depending on the suffix.
+// Every band goes straight to disk, PNG bands are quantized and deflated on the encoder's workers.
+class ImageWriter {
+public:
+    ImageWriter(const QString &path, uint32_t width, uint32_t height);
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    // Display referred RGBA floats, width*rows pixels
+    void writeRows(std::vector<float> &pixels, uint32_t rows);
+    bool finish();
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_currentRow = 0;
+
+    ExrWriter *m_exr = nullptr;
+    PngWriter *m_png = nullptr;
+};
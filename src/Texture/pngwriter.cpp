@@ -0,0 +1,301 @@
+#include "pngwriter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "src/Texture/stb_image_write.h"
+
+// Built by the stb implementation in texture.cpp, not part of its public header
+extern "C" unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+static void putBigEndian(uint8_t *dst, uint32_t val) {
+    dst[0] = val >> 24;
+    dst[1] = val >> 16;
+    dst[2] = val >> 8;
+    dst[3] = val;
+}
+
+uint32_t PngWriter::crc(const uint8_t *data, size_t size, uint32_t crc) {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (uint32_t k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t PngWriter::adlerCombine(uint32_t adler1, uint32_t adler2, size_t size2) {
+    // Adler-32 of the concatenation from the two halves, as zlib's adler32_combine
+    const uint64_t base = 65521;
+    const uint64_t rem = size2 % base;
+    const uint64_t a1 = adler1 & 0xFFFF;
+    const uint64_t b1 = adler1 >> 16;
+    const uint64_t a2 = adler2 & 0xFFFF;
+    const uint64_t b2 = adler2 >> 16;
+
+    const uint64_t a = (a1 + a2 + base - 1) % base;
+    const uint64_t b = (b1 + b2 + rem*a1 + base - rem) % base;
+    return uint32_t(a | (b << 16));
+}
+
+size_t PngWriter::fixedBlockEnd(const uint8_t *data, size_t bit) {
+    // Walk the fixed Huffman block stb writes and return the bit right after its end of block code
+    auto bits = [&](uint32_t count) {
+        uint32_t val = 0;
+        for (uint32_t i = 0; i < count; i++, bit++) {
+            val |= ((data[bit >> 3] >> (bit & 7)) & 1) << i;
+        }
+        return val;
+    };
+    // Huffman codes are stored starting from their most significant bit
+    auto code = [&](uint32_t val, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            val = (val << 1) | bits(1);
+        }
+        return val;
+    };
+
+    bits(3);
+    for (;;) {
+        uint32_t c = code(0, 7);
+        uint32_t symbol;
+        if (c <= 23) {
+            symbol = 256 + c;
+        } else {
+            c = code(c, 1);
+            if (c >= 48 && c <= 191) {
+                symbol = c - 48;
+            } else if (c >= 192 && c <= 199) {
+                symbol = 280 + c - 192;
+            } else {
+                symbol = 144 + code(c, 1) - 400;
+            }
+        }
+
+        if (symbol < 256) continue;
+        if (symbol == 256) return bit;
+
+        if (symbol >= 265 && symbol < 285) {
+            bits((symbol - 261)/4);
+        }
+        const uint32_t distance = code(0, 5);
+        if (distance >= 4) {
+            bits((distance - 2)/2);
+        }
+    }
+}
+
+void PngWriter::encodeBand(Band &band, const std::function<void(uint32_t, uint8_t*)> &getRow, size_t rowBytes,
+                           uint32_t pixelBytes, uint32_t firstRow, uint32_t rows, bool last) {
+    std::vector<uint8_t> filtered(rows*(rowBytes+1));
+    std::vector<uint8_t> candidate(rowBytes);
+    std::vector<uint8_t> row(rowBytes);
+    std::vector<uint8_t> prev(rowBytes, 0);
+    if (firstRow) {
+        getRow(firstRow-1, prev.data());
+    }
+
+    for (uint32_t y = 0; y < rows; y++, row.swap(prev)) {
+        getRow(firstRow+y, row.data());
+        uint8_t *out = filtered.data() + y*(rowBytes+1);
+
+        // Keep the filter with the smallest sum of absolute values, the same heuristic as stb
+        uint64_t bestSum = UINT64_MAX;
+        for (uint8_t filter = 0; filter < 5; filter++) {
+            uint64_t sum = 0;
+            for (size_t x = 0; x < rowBytes; x++) {
+                // Filters work on bytes, the left neighbour is the same byte of the previous pixel
+                const int a = x >= pixelBytes ? row[x-pixelBytes] : 0;
+                const int b = prev[x];
+                const int c = x >= pixelBytes ? prev[x-pixelBytes] : 0;
+
+                int predictor = 0;
+                switch (filter) {
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) >> 1; break;
+                case 4: {
+                    const int p = a + b - c;
+                    const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                    predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                    break;
+                }
+                }
+                candidate[x] = uint8_t(row[x] - predictor);
+                sum += std::abs(int(int8_t(candidate[x])));
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                out[0] = filter;
+                memcpy(out+1, candidate.data(), rowBytes);
+            }
+        }
+    }
+
+    int size = 0;
+    uint8_t *z = stbi_zlib_compress(filtered.data(), int(filtered.size()), &size, stbi_write_png_compression_level);
+    band.size = filtered.size();
+    band.adler = (uint32_t(z[size-4]) << 24) | (uint32_t(z[size-3]) << 16) | (uint32_t(z[size-2]) << 8) | z[size-1];
+    band.deflate.assign(z+2, z+size-4);
+    free(z);
+
+    if (last) return;
+
+    // stb writes one fixed Huffman block, or a run of stored blocks when that is smaller. Every band
+    // but the last gets BFINAL cleared and must end on a byte boundary for the next one to follow.
+    uint8_t *d = band.deflate.data();
+    if (((d[0] >> 1) & 3) == 0) {
+        size_t pos = 0;
+        for (;;) {
+            const size_t len = d[pos+1] | (d[pos+2] << 8);
+            if (pos + 5 + len >= band.deflate.size()) {
+                d[pos] &= ~1;
+                break;
+            }
+            pos += 5 + len;
+        }
+    } else {
+        const size_t end = fixedBlockEnd(d, 0);
+        d[0] &= ~1;
+        // Empty stored block to realign, its 3 header bits go in the padding after the end of block when they fit
+        if ((8 - end % 8) % 8 < 3) {
+            band.deflate.push_back(0);
+        }
+        band.deflate.insert(band.deflate.end(), { 0x00, 0x00, 0xFF, 0xFF });
+    }
+}
+
+PngWriter::PngWriter(const QString &path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth)
+    : m_file(path), m_width(width), m_height(height) {
+    static const uint8_t colorTypes[] = { 0, 0, 4, 2, 6 };
+    if (!width || !height || channels < 1 || channels > 4 || (bitDepth != 8 && bitDepth != 16)) return;
+    if (!m_file.open(QIODevice::WriteOnly)) return;
+
+    m_pixelBytes = channels*bitDepth/8;
+    m_rowBytes = size_t(width)*m_pixelBytes;
+    m_lastRow.resize(m_rowBytes);
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    m_file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<uint8_t> ihdr(13, 0);
+    putBigEndian(ihdr.data(), width);
+    putBigEndian(ihdr.data()+4, height);
+    ihdr[8] = bitDepth;
+    ihdr[9] = colorTypes[channels];
+    chunk("IHDR", ihdr);
+    m_isValid = m_file.error() == QFile::NoError;
+}
+
+bool PngWriter::isValid() {
+    return m_isValid;
+}
+
+void PngWriter::chunk(const char *type, const std::vector<uint8_t> &payload) {
+    uint8_t header[8];
+    putBigEndian(header, payload.size());
+    memcpy(header+4, type, 4);
+    uint8_t footer[4];
+    putBigEndian(footer, crc(payload.data(), payload.size(), crc(header+4, 4)));
+
+    m_file.write(reinterpret_cast<const char*>(header), 8);
+    m_file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    m_file.write(reinterpret_cast<const char*>(footer), 4);
+}
+
+void PngWriter::writeRows(const std::function<void(uint32_t y, uint8_t *row)> &getRow, uint32_t rows,
+                          const std::function<void(float)> &progress) {
+    const uint32_t firstRow = m_currentRow;
+    rows = std::min(rows, m_height-firstRow);
+    if (!m_isValid || !rows) return;
+
+    // The first band filters against the last row of the previous batch, which the caller may not have anymore
+    const std::function<void(uint32_t, uint8_t*)> fetch = [&](uint32_t y, uint8_t *row) {
+        if (y < firstRow) {
+            memcpy(row, m_lastRow.data(), m_rowBytes);
+        } else {
+            getRow(y, row);
+        }
+    };
+
+    // Bands never cross a batch, only the one ending the image is the final deflate block
+    const uint32_t bandCount = (rows + BAND_ROWS - 1)/BAND_ROWS;
+    const bool lastBatch = firstRow+rows == m_height;
+    std::vector<Band> bands(bandCount);
+    std::atomic<uint32_t> next(0);
+    std::atomic<uint32_t> done(0);
+
+    const uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), bandCount));
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threadCount; t++) {
+        workers.emplace_back([&]() {
+            for (uint32_t i = next++; i < bandCount; i = next++) {
+                const uint32_t bandRow = firstRow+i*BAND_ROWS;
+                encodeBand(bands[i], fetch, m_rowBytes, m_pixelBytes, bandRow, std::min(BAND_ROWS, firstRow+rows-bandRow),
+                           lastBatch && i+1 == bandCount);
+                if (progress) progress(float(++done)/bandCount);
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    // One IDAT per band, the zlib header goes in front of the first and the checksum after the last
+    for (uint32_t i = 0; i < bandCount; i++) {
+        std::vector<uint8_t> payload;
+        if (firstRow == 0 && i == 0) {
+            payload = { 0x78, 0x5E };
+        }
+        payload.insert(payload.end(), bands[i].deflate.begin(), bands[i].deflate.end());
+        m_adler = adlerCombine(m_adler, bands[i].adler, bands[i].size);
+        if (lastBatch && i+1 == bandCount) {
+            payload.resize(payload.size()+4);
+            putBigEndian(payload.data()+payload.size()-4, m_adler);
+        }
+        chunk("IDAT", payload);
+        std::vector<uint8_t>().swap(bands[i].deflate);
+    }
+
+    getRow(firstRow+rows-1, m_lastRow.data());
+    m_currentRow += rows;
+}
+
+bool PngWriter::finish() {
+    if (!m_isValid) {
+        return false;
+    }
+    if (m_currentRow == m_height) {
+        chunk("IEND", {});
+    }
+    m_file.close();
+    return m_currentRow == m_height && m_file.error() == QFile::NoError;
+}
+
+bool PngWriter::write(const QString &path, uint32_t width, uint32_t height, uint32_t channels,
+                      const uint8_t *data, size_t stride, const std::function<void(float)> &progress) {
+    const size_t rowBytes = size_t(width)*channels;
+    return write(path, width, height, channels, 8, [=](uint32_t y, uint8_t *row) {
+        memcpy(row, data + y*stride, rowBytes);
+    }, progress);
+}
+
+bool PngWriter::write(const QString &path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+                      const std::function<void(uint32_t y, uint8_t *row)> &getRow,
+                      const std::function<void(float)> &progress) {
+    PngWriter writer(path, width, height, channels, bitDepth);
+    writer.writeRows(getRow, height, progress);
+    return writer.finish();
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <QFile>
+#include <functional>
+#include <vector>
+
+// 8 or 16 bit PNG writer that splits the rows in bands, each band is filtered and deflated on its own
+// worker thread and the deflate streams are joined into a single IDAT. Same output as stb apart
+// from matches never crossing a band boundary.
+class PngWriter {
+public:
+    // Streaming use: rows are appended top to bottom with writeRows() and each batch goes to disk as
+    // soon as it is encoded, only the last row is kept to filter the next batch
+    PngWriter(const QString &path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth);
+
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator=(const PngWriter&) = delete;
+
+    bool isValid();
+    // Encode the next rows, getRow fills one row of samples in PNG byte order (16 bit samples are
+    // big endian) and must be safe to call concurrently. progress gets the fraction of this batch done
+    void writeRows(const std::function<void(uint32_t y, uint8_t *row)> &getRow, uint32_t rows,
+                   const std::function<void(float)> &progress = nullptr);
+    // Close the file, false unless every row was written
+    bool finish();
+
+    // progress is called from the workers with the fraction of bands done
+    static bool write(const QString &path, uint32_t width, uint32_t height, uint32_t channels,
+                      const uint8_t *data, size_t stride, const std::function<void(float)> &progress = nullptr);
+    // Rows are fetched on demand from the workers, with the same requirements as writeRows()
+    static bool write(const QString &path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+                      const std::function<void(uint32_t y, uint8_t *row)> &getRow,
+                      const std::function<void(float)> &progress = nullptr);
+
+private:
+    struct Band {
+        std::vector<uint8_t> deflate;
+        uint32_t adler;
+        size_t size;
+    };
+
+    void chunk(const char *type, const std::vector<uint8_t> &payload);
+
+    static void encodeBand(Band &band, const std::function<void(uint32_t, uint8_t*)> &getRow, size_t rowBytes,
+                           uint32_t pixelBytes, uint32_t firstRow, uint32_t rows, bool last);
+    static size_t fixedBlockEnd(const uint8_t *data, size_t bit);
+    static uint32_t adlerCombine(uint32_t adler1, uint32_t adler2, size_t size2);
+    static uint32_t crc(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+    static constexpr uint32_t BAND_ROWS = 128;
+
+    QFile m_file;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_pixelBytes = 0;
+    size_t m_rowBytes = 0;
+    uint32_t m_currentRow = 0;
+    uint32_t m_adler = 1;
+    std::vector<uint8_t> m_lastRow;
+    bool m_isValid = false;
+};
@@ -1,5 +1,12 @@
 #include "texture.h"
-#include "src/UI/vulkanwindow.h"
+#include "src/Render/vulkancontext.h"
+#include "src/Render/stagingring.h"
+#include "src/Texture/pngwriter.h"
+#include "src/Texture/exrwriter.h"
+#include "src/Texture/bcwriter.h"
+#include "src/Texture/texturecontainer.h"
+#include "src/Texture/imagedecoder.h"
+#include <QFileInfo>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_WINDOWS_UTF8
@@ -9,9 +16,9 @@
 #define STBIW_WINDOWS_UTF8
 #include "src/Texture/stb_image_write.h"
 
-Texture::Texture(const QString &path, VulkanWindow *w, uint32_t depth,
+Texture::Texture(const QString &path, VulkanContext *context, uint32_t depth,
                  bool compute, bool disableMipmap, bool colorAttachment, VkSampleCountFlagBits sampleCount, bool *result)
-    : m_window(w), m_depth(depth), m_format(VK_FORMAT_R8G8B8A8_UNORM), m_sampleCount(sampleCount), m_compute(compute), m_colorAttachment(colorAttachment), m_disableMipmap(disableMipmap) {
+    : m_context(context), m_depth(depth), m_format(VK_FORMAT_R8G8B8A8_UNORM), m_sampleCount(sampleCount), m_compute(compute), m_colorAttachment(colorAttachment), m_disableMipmap(disableMipmap) {
     createTextureImage(path, result);
     if (!result || *result) {
         createImageView();
@@ -20,9 +27,9 @@ Texture::Texture(const QString &path, VulkanWindow *w, uint32_t depth,
     }
 }
 
-Texture::Texture(uint32_t width, uint32_t height, VulkanWindow *w, uint32_t depth, VkFormat fmt,
+Texture::Texture(uint32_t width, uint32_t height, VulkanContext *context, uint32_t depth, VkFormat fmt,
                  bool compute, bool disableMipmap, bool colorAttachment, bool depthAttachment, VkSampleCountFlagBits sampleCount)
-    : m_window(w), m_width(width), m_height(height), m_depth(depth), m_format(fmt), m_sampleCount(sampleCount),
+    : m_context(context), m_width(width), m_height(height), m_depth(depth), m_format(fmt), m_sampleCount(sampleCount),
     m_compute(compute), m_colorAttachment(colorAttachment), m_depthAttachment(depthAttachment), m_disableMipmap(disableMipmap) {
     createTextureImage();
     createImageView();
@@ -31,7 +38,7 @@ Texture::Texture(uint32_t width, uint32_t height, VulkanWindow *w, uint32_t dept
 }
 
 Texture::Texture(const Texture& other) {
-    m_window = other.m_window;
+    m_context = other.m_context;
     m_format = other.m_format;
     m_compute = other.m_compute;
     m_width = other.m_width;
@@ -61,22 +68,36 @@ uint32_t Texture::getHeight() {
 }
 
 Texture::~Texture() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-    devFuncs->vkDeviceWaitIdle(dev);
-
-    if (m_textureSampler)
-        devFuncs->vkDestroySampler(dev, m_textureSampler, nullptr);
-    if (m_textureImageView)
-        devFuncs->vkDestroyImageView(dev, m_textureImageView, nullptr);
-    if (m_textureImage)
-        devFuncs->vkDestroyImage(dev, m_textureImage, nullptr);
-    if (m_textureImageMemory)
-        devFuncs->vkFreeMemory(dev, m_textureImageMemory, nullptr);
+    release();
+}
+
+void Texture::release() {
+    // Frames in flight may still sample the image, destroy it once they are done
+    VulkanContext *context = m_context;
+    VkSampler sampler = m_textureSampler;
+    VkImageView imageView = m_textureImageView;
+    VkImage image = m_textureImage;
+    MemoryAllocation memory = m_textureImageMemory;
+    m_context->deferDestroy([context, sampler, imageView, image, memory]() mutable {
+        VkDevice dev = context->device();
+        VulkanDeviceFunctions *devFuncs = context->deviceFunctions();
+        if (sampler)
+            devFuncs->vkDestroySampler(dev, sampler, nullptr);
+        if (imageView)
+            devFuncs->vkDestroyImageView(dev, imageView, nullptr);
+        if (image)
+            devFuncs->vkDestroyImage(dev, image, nullptr);
+        context->getAllocator()->free(memory);
+    });
+
+    m_textureSampler = VK_NULL_HANDLE;
+    m_textureImageView = VK_NULL_HANDLE;
+    m_textureImage = VK_NULL_HANDLE;
+    m_textureImageMemory = MemoryAllocation();
 }
 
 Texture::Texture(Texture&& other) {
-    m_window = other.m_window;
+    m_context = other.m_context;
     m_textureImage = other.m_textureImage;
     m_textureImageMemory = other.m_textureImageMemory;
     m_textureImageView = other.m_textureImageView;
@@ -91,26 +112,15 @@ Texture::Texture(Texture&& other) {
     m_disableMipmap = other.m_disableMipmap;
     m_sampleCount = other.m_sampleCount;
     other.m_textureImage = VK_NULL_HANDLE;
-    other.m_textureImageMemory = VK_NULL_HANDLE;
+    other.m_textureImageMemory = MemoryAllocation();
     other.m_textureImageView = VK_NULL_HANDLE;
     other.m_textureSampler = VK_NULL_HANDLE;
 }
 
 Texture& Texture::operator=(Texture&& other) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-    devFuncs->vkDeviceWaitIdle(dev);
-
-    if (m_textureSampler)
-        devFuncs->vkDestroySampler(dev, m_textureSampler, nullptr);
-    if (m_textureImageView)
-        devFuncs->vkDestroyImageView(dev, m_textureImageView, nullptr);
-    if (m_textureImage)
-        devFuncs->vkDestroyImage(dev, m_textureImage, nullptr);
-    if (m_textureImageMemory)
-        devFuncs->vkFreeMemory(dev, m_textureImageMemory, nullptr);
-
-    m_window = other.m_window;
+    release();
+
+    m_context = other.m_context;
     m_textureImage = other.m_textureImage;
     m_textureImageMemory = other.m_textureImageMemory;
     m_textureImageView = other.m_textureImageView;
@@ -126,7 +136,7 @@ Texture& Texture::operator=(Texture&& other) {
     m_sampleCount = other.m_sampleCount;
 
     other.m_textureImage = VK_NULL_HANDLE;
-    other.m_textureImageMemory = VK_NULL_HANDLE;
+    other.m_textureImageMemory = MemoryAllocation();
     other.m_textureImageView = VK_NULL_HANDLE;
     other.m_textureSampler = VK_NULL_HANDLE;
 
@@ -146,13 +156,13 @@ VkSampler Texture::getTextureSampler() {
 }
 
 VkCommandBuffer Texture::beginSingleTimeCommands() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_window->graphicsCommandPool();
+    allocInfo.commandPool = m_context->graphicsCommandPool();
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer commandBuffer;
@@ -168,8 +178,8 @@ VkCommandBuffer Texture::beginSingleTimeCommands() {
 }
 
 void Texture::endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore *waitSemaphorePtr) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
     devFuncs->vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
@@ -183,14 +193,13 @@ void Texture::endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore *
         VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT };
         submitInfo.pWaitDstStageMask = waitStages;
     }
-    devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-    devFuncs->vkQueueWaitIdle(m_window->graphicsQueue());
-    devFuncs->vkFreeCommandBuffers(dev, m_window->graphicsCommandPool(), 1, &commandBuffer);
+    devFuncs->vkQueueSubmit(m_context->graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+    devFuncs->vkQueueWaitIdle(m_context->graphicsQueue());
+    devFuncs->vkFreeCommandBuffers(dev, m_context->graphicsCommandPool(), 1, &commandBuffer);
 }
 
 void Texture::clear(float r, float g, float b, float a) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
     if (!m_depthAttachment) {
         VkClearColorValue color = { .float32 = {r, g, b, a} };
@@ -205,11 +214,10 @@ void Texture::clear(float r, float g, float b, float a) {
 
 }
 
-void Texture::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+void Texture::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, VkCommandBuffer recordTo) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = recordTo ? recordTo : beginSingleTimeCommands();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -258,73 +266,29 @@ void Texture::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLa
         1, &barrier
         );
 
-    endSingleTimeCommands(commandBuffer);
-}
-
-void Texture::saveToPng(const QString& path) {
-    assert(m_depth == 1 && m_format == VK_FORMAT_R8G8B8A8_UNORM);
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-
-    VkImage dstImage;
-    VkDeviceMemory dstImageMemory;
-
-    VkImageCreateInfo imageInfo{};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = m_width;
-    imageInfo.extent.height = m_height;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-    imageInfo.samples = m_sampleCount;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    if (devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &dstImage) != VK_SUCCESS) {
-        m_window->crash("failed to create image!");
+    if (!recordTo) {
+        endSingleTimeCommands(commandBuffer);
     }
+}
 
-    VkMemoryRequirements memRequirements;
-    devFuncs->vkGetImageMemoryRequirements(dev, dstImage, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_window->findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &dstImageMemory) != VK_SUCCESS) {
-        m_window->crash("failed to allocate image memory!");
+uint64_t Texture::saveToFile(const QString& path, ExportFormat format) {
+    const bool half = m_format == VK_FORMAT_R16G16B16A16_SFLOAT;
+    assert(m_depth == 1 && (half || (m_format == VK_FORMAT_R8G8B8A8_UNORM && format == Png8)));
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+
+    // Block compressed files carry the whole mip chain, every level is read back one after the other
+    const uint32_t pixelSize = half ? 8 : 4;
+    const uint32_t levels = format == Bc5 || format == Bc7 ? m_mipLevels : 1;
+    std::vector<VkDeviceSize> levelOffsets(levels);
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < levels; i++) {
+        levelOffsets[i] = size;
+        size += VkDeviceSize(std::max(m_width >> i, 1u))*std::max(m_height >> i, 1u)*pixelSize;
     }
 
-    devFuncs->vkBindImageMemory(dev, dstImage, dstImageMemory, 0);
-
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-    VkImageMemoryBarrier destBarrier{};
-    destBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    destBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    destBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    destBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    destBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    destBarrier.image = dstImage;
-    destBarrier.subresourceRange.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    destBarrier.subresourceRange.baseMipLevel = 0;
-    destBarrier.subresourceRange.levelCount = 1;
-    destBarrier.subresourceRange.baseArrayLayer = 0;
-    destBarrier.subresourceRange.layerCount = 1;
-    destBarrier.srcAccessMask = 0;
-    destBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    devFuncs->vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &destBarrier);
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(size, true);
+    VkCommandBuffer commandBuffer = transfer.commandBuffer;
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -334,34 +298,29 @@ void Texture::saveToPng(const QString& path) {
     barrier.subresourceRange.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = levels;
 
     barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
     barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     devFuncs->vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
         0, nullptr,
         0, nullptr,
         1, &barrier);
 
-    VkImageCopy imageCopyRegion{};
-    imageCopyRegion.srcSubresource.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.srcSubresource.layerCount = 1;
-    imageCopyRegion.dstSubresource.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width = m_width;
-    imageCopyRegion.extent.height = m_height;
-    imageCopyRegion.extent.depth = 1;
+    std::vector<VkBufferImageCopy> regions(levels);
+    for (uint32_t i = 0; i < levels; i++) {
+        regions[i].bufferOffset = transfer.offset + levelOffsets[i];
+        regions[i].imageSubresource.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent = { std::max(m_width >> i, 1u), std::max(m_height >> i, 1u), 1 };
+    }
 
-    devFuncs->vkCmdCopyImage(
-        commandBuffer,
-        m_textureImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &imageCopyRegion);
+    devFuncs->vkCmdCopyImageToBuffer(commandBuffer, m_textureImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, transfer.buffer, levels, regions.data());
 
     barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
     barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -374,31 +333,84 @@ void Texture::saveToPng(const QString& path) {
         0, nullptr,
         1, &barrier);
 
-    endSingleTimeCommands(commandBuffer);
-
-    const uint8_t* data;
-    devFuncs->vkMapMemory(dev, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-
-    VkImageSubresource subResource { VkImageAspectFlags(m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT), 0, 0 };
-    VkSubresourceLayout subResourceLayout;
-    devFuncs->vkGetImageSubresourceLayout(dev, dstImage, &subResource, &subResourceLayout);
-    data += subResourceLayout.offset;
-
-    stbi_write_png(path.toUtf8(), m_width, m_height, 4, data, subResourceLayout.rowPitch);
-
-    devFuncs->vkUnmapMemory(dev, dstImageMemory);
-    devFuncs->vkFreeMemory(dev, dstImageMemory, nullptr);
-    devFuncs->vkDestroyImage(dev, dstImage, nullptr);
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    devFuncs->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                   0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+    const uint64_t id = staging->submit(transfer);
+
+    // Waiting for the copy and encoding run as a background job, the held staging buffer
+    // is handed back on the GUI thread once the file is written
+    const uint32_t width = m_width;
+    const uint32_t height = m_height;
+    const uint8_t *data = static_cast<const uint8_t*>(transfer.mapped);
+    m_context->startJob("Exporting "+QFileInfo(path).fileName(), [=](std::atomic<float> &progress) {
+        staging->wait(id);
+        bool ok;
+        if (format == ExrHalf) {
+            // Half samples go to disk as they are, block by block from the staging buffer
+            const uint16_t *samples = reinterpret_cast<const uint16_t*>(data);
+            ExrWriter exr(path, width, height, 4);
+            for (uint32_t y = 0; y < height && exr.isValid(); y += EXPORT_BLOCK_ROWS) {
+                exr.writeRows(samples + size_t(y)*width*4, std::min(EXPORT_BLOCK_ROWS, height-y));
+                progress = float(y)/height;
+            }
+            ok = exr.isValid();
+        } else if (format == Bc5 || format == Bc7) {
+            const uint16_t *samples = reinterpret_cast<const uint16_t*>(data);
+            ok = BcWriter::write(path, format == Bc5 ? BcWriter::BC5 : BcWriter::BC7, width, height, levels,
+                                 [=](uint32_t level, uint32_t x, uint32_t y, uint8_t *block) {
+                const uint32_t levelWidth = std::max(width >> level, 1u);
+                const uint32_t levelHeight = std::max(height >> level, 1u);
+                const uint16_t *src = samples + levelOffsets[level]/sizeof(uint16_t);
+                for (uint32_t j = 0; j < 4; j++) {
+                    const uint32_t row = std::min(y+j, levelHeight-1);
+                    for (uint32_t i = 0; i < 4; i++) {
+                        const uint32_t col = std::min(x+i, levelWidth-1);
+                        for (uint32_t c = 0; c < 4; c++) {
+                            const float val = ExrWriter::halfToFloat(src[(size_t(row)*levelWidth + col)*4 + c]);
+                            block[(j*4+i)*4+c] = uint8_t(std::min(std::max(val, 0.0f), 1.0f)*255.0f + 0.5f);
+                        }
+                    }
+                }
+            }, [&](float val) { progress = val; });
+        } else if (half) {
+            // Quantize each row when the encoder asks for it, 16 bit samples are big endian
+            const uint32_t bitDepth = format == Png16 ? 16 : 8;
+            const float scale = format == Png16 ? 65535.0f : 255.0f;
+            ok = PngWriter::write(path, width, height, 4, bitDepth, [=](uint32_t y, uint8_t *row) {
+                const uint16_t *src = reinterpret_cast<const uint16_t*>(data) + size_t(y)*width*4;
+                for (uint32_t i = 0; i < width*4; i++) {
+                    const float val = ExrWriter::halfToFloat(src[i]);
+                    const uint32_t q = uint32_t(std::min(std::max(val, 0.0f), 1.0f)*scale + 0.5f);
+                    if (bitDepth == 16) {
+                        row[2*i] = q >> 8;
+                        row[2*i+1] = q;
+                    } else {
+                        row[i] = q;
+                    }
+                }
+            }, [&](float val) { progress = val; });
+        } else {
+            ok = PngWriter::write(path, width, height, 4, data, size_t(width)*4, [&](float val) { progress = val; });
+        }
+        if (!ok) {
+            qWarning("Failed to write %s", qPrintable(path));
+        }
+    }, [=]() {
+        staging->release(id);
+    });
+    return id;
 }
 
-void Texture::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t depth) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+void Texture::copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkImage image, uint32_t width, uint32_t height, uint32_t depth) {
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = m_depthAttachment ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
@@ -413,8 +425,6 @@ void Texture::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
     };
 
     devFuncs->vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 void Texture::createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags properties) {
@@ -433,55 +443,14 @@ void Texture::createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags propert
     imageInfo.samples = m_sampleCount;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     if (devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &m_textureImage) != VK_SUCCESS) {
-        m_window->crash("failed to create image!");
-    }
-
-    VkMemoryRequirements memRequirements;
-    devFuncs->vkGetImageMemoryRequirements(dev, m_textureImage, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_window->findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &m_textureImageMemory) != VK_SUCCESS) {
-        m_window->crash("failed to allocate image memory!");
+        m_context->crash("failed to create image!");
     }
 
-    devFuncs->vkBindImageMemory(dev, m_textureImage, m_textureImageMemory, 0);
-}
-
-void Texture::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
-
-    if (devFuncs->vkCreateBuffer(dev, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        m_window->crash("failed to create buffer!");
-    }
-
-    VkMemoryRequirements memRequirements;
-    devFuncs->vkGetBufferMemoryRequirements(dev, buffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = m_window->findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    if (devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        m_window->crash("failed to allocate buffer memory!");
-    }
-
-    devFuncs->vkBindBufferMemory(dev, buffer, bufferMemory, 0);
+    m_textureImageMemory = m_context->getAllocator()->allocateImage(m_textureImage, properties);
 }
 
 void Texture::createTextureImage() {
@@ -494,50 +463,109 @@ void Texture::createTextureImage() {
 
 
 void Texture::createTextureImage(const QString& path, bool *result) {
-    int texWidth = 0, texHeight = 0, texChannels = 0;
-    stbi_uc *pixels = nullptr;
-    pixels = stbi_load(path.toUtf8(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    if (!pixels || !texWidth || !texHeight || !texChannels) {
+    if (TextureContainer::isContainer(path)) {
+        createTextureImageFromContainer(path, result);
+        return;
+    }
+
+    // The header gives the size, so the pixels can be decoded straight into the staging memory
+    uint32_t texWidth = 0, texHeight = 0;
+    bool decoded = ImageDecoder::probe(path, texWidth, texHeight, m_context->physicalDeviceProperties()->limits.maxImageDimension2D);
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer;
+    if (decoded) {
+        transfer = staging->begin(VkDeviceSize(texWidth) * texHeight * 4);
+        decoded = ImageDecoder::decode({{ path, transfer.mapped, texWidth, texHeight }}, false);
+        if (!decoded) {
+            // Nothing was recorded, submitting hands the slice back to the ring
+            staging->submit(transfer);
+        }
+    }
+    if (!decoded) {
         if (!result) {
-            m_window->crash("failed to load texture image: "+path);
+            m_context->crash("failed to load texture image: "+path);
         } else {
             *result = false;
         }
         return;
     }
 
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
     m_width = texWidth/sqrt(m_depth);
     m_height = texHeight/sqrt(m_depth);
     m_mipLevels = m_depth > 1 || m_disableMipmap ? 1 : static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (m_compute?VK_IMAGE_USAGE_STORAGE_BIT:0),
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingBuffer, stagingBufferMemory);
+    // One submission, later work on the queue is ordered by the final barrier so there is nothing to wait for
+    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, transfer.commandBuffer);
+    copyBufferToImage(transfer.commandBuffer, transfer.buffer, transfer.offset, m_textureImage, m_width, m_height, m_depth);
+    transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, transfer.commandBuffer);
+    staging->submit(transfer);
+}
 
-    void* data;
-    devFuncs->vkMapMemory(dev, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    devFuncs->vkUnmapMemory(dev, stagingBufferMemory);
-    stbi_image_free(pixels);
+void Texture::createTextureImageFromContainer(const QString& path, bool *result) {
+    TextureContainer container(path, m_context->physicalDeviceProperties()->limits.maxImageDimension2D);
+    VkFormatProperties formatProperties{};
+    if (container.isValid()) {
+        m_context->functions()->
+            vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice(), container.getFormat(), &formatProperties);
+    }
+    if (m_depth > 1 || !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        if (!result) {
+            m_context->crash("failed to load texture image: "+path);
+        } else {
+            *result = false;
+        }
+        return;
+    }
 
-    createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (m_compute?VK_IMAGE_USAGE_STORAGE_BIT:0),
+    // Levels stored in the file are uploaded as they are, only a single uncompressed level gets its chain generated
+    const std::vector<TextureContainer::Level> &levels = container.getLevels();
+    m_format = container.getFormat();
+    m_width = levels[0].width;
+    m_height = levels[0].height;
+    m_prebuiltMipmaps = levels.size() > 1 || container.isCompressed();
+    m_mipLevels = m_disableMipmap ? 1 : m_prebuiltMipmaps ? levels.size() : static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
+
+    // Every supported block and texel size divides 16, so aligned offsets suit any level
+    const uint32_t uploaded = std::min<uint32_t>(levels.size(), m_mipLevels);
+    std::vector<VkDeviceSize> offsets(uploaded);
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < uploaded; i++) {
+        offsets[i] = size;
+        size = m_context->aligned(size + levels[i].size, 16);
+    }
+
+    StagingRing *staging = m_context->getStagingRing();
+    StagingRing::Transfer transfer = staging->begin(size);
+    for (uint32_t i = 0; i < uploaded; i++) {
+        memcpy(static_cast<char*>(transfer.mapped) + offsets[i], levels[i].data, levels[i].size);
+    }
+
+    // Block compressed formats can not be storage images, compute users blit them to their own format
+    const bool storage = m_compute && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+    createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (storage?VK_IMAGE_USAGE_STORAGE_BIT:0),
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, m_textureImage, m_width, m_height, m_depth);
-    transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    std::vector<VkBufferImageCopy> regions(uploaded);
+    for (uint32_t i = 0; i < uploaded; i++) {
+        regions[i].bufferOffset = transfer.offset + offsets[i];
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent = { levels[i].width, levels[i].height, 1 };
+    }
 
-    devFuncs->vkDestroyBuffer(dev, stagingBuffer, nullptr);
-    devFuncs->vkFreeMemory(dev, stagingBufferMemory, nullptr);
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
+    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, transfer.commandBuffer);
+    devFuncs->vkCmdCopyBufferToImage(transfer.commandBuffer, transfer.buffer, m_textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uploaded, regions.data());
+    transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, transfer.commandBuffer);
+    staging->submit(transfer);
 }
 
 void Texture::copyTextureImage(const Texture& other) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     createImage(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (m_compute?VK_IMAGE_USAGE_STORAGE_BIT:0),
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -598,8 +626,7 @@ void Texture::copyTextureImage(const Texture& other) {
 }
 
 void Texture::blitTextureImage(const Texture& other) {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
     VkImageMemoryBarrier barrier{};
@@ -656,8 +683,8 @@ void Texture::blitTextureImage(const Texture& other) {
 }
 
 void Texture::createImageView() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -671,16 +698,16 @@ void Texture::createImageView() {
     viewInfo.subresourceRange.layerCount = 1;
 
     if (devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, &m_textureImageView) != VK_SUCCESS) {
-        m_window->crash("failed to create texture image view!");
+        m_context->crash("failed to create texture image view!");
     }
 }
 
 void Texture::createTextureSampler() {
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VkDevice dev = m_context->device();
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     VkPhysicalDeviceProperties properties{};
-    m_window->vulkanInstance()->functions()->vkGetPhysicalDeviceProperties(m_window->physicalDevice(), &properties);
+    m_context->functions()->vkGetPhysicalDeviceProperties(m_context->physicalDevice(), &properties);
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -699,28 +726,27 @@ void Texture::createTextureSampler() {
     samplerInfo.maxLod = static_cast<float>(m_mipLevels);
 
     if (devFuncs->vkCreateSampler(dev, &samplerInfo, nullptr, &m_textureSampler) != VK_SUCCESS) {
-        m_window->crash("failed to create texture sampler!");
+        m_context->crash("failed to create texture sampler!");
     }
 }
 
-void Texture::generateMipmaps(VkSemaphore *waitSemaphorePtr) {
-    if (m_depth > 1 || m_disableMipmap) {
+void Texture::generateMipmaps(VkSemaphore *waitSemaphorePtr, VkCommandBuffer recordTo) {
+    if (m_depth > 1 || m_disableMipmap || m_prebuiltMipmaps) {
         return;
     }
 
-    VkDevice dev = m_window->device();
-    QVulkanDeviceFunctions *devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
+    VulkanDeviceFunctions *devFuncs = m_context->deviceFunctions();
 
     // Check if image format supports linear blitting
     VkFormatProperties formatProperties;
-    m_window->vulkanInstance()->functions()->
-        vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), m_format, &formatProperties);
+    m_context->functions()->
+        vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice(), m_format, &formatProperties);
 
     if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        m_window->crash("texture image format does not support linear blitting!");
+        m_context->crash("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = recordTo ? recordTo : beginSingleTimeCommands();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -795,7 +821,9 @@ void Texture::generateMipmaps(VkSemaphore *waitSemaphorePtr) {
         0, nullptr,
         1, &barrier);
 
-    endSingleTimeCommands(commandBuffer, waitSemaphorePtr);
+    if (!recordTo) {
+        endSingleTimeCommands(commandBuffer, waitSemaphorePtr);
+    }
 }
 
 VkImage Texture::getImage() {
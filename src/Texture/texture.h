@@ -1,15 +1,15 @@
 #pragma once
 
 #include <QVulkanWindow>
-#include <QVulkanFunctions>
+#include "src/Render/memoryallocator.h"
 
-class VulkanWindow;
+class VulkanContext;
 class Texture {
 public:
-    Texture(const QString &path, VulkanWindow *w, uint32_t depth = 1,
+    Texture(const QString &path, VulkanContext *context, uint32_t depth = 1,
             bool compute = false, bool disableMipmap = false, bool colorAttachment = false, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, bool *result = nullptr);
 
-    Texture(uint32_t width, uint32_t height, VulkanWindow *w, uint32_t depth = 1, VkFormat fmt = VK_FORMAT_R8G8B8A8_SRGB,
+    Texture(uint32_t width, uint32_t height, VulkanContext *context, uint32_t depth = 1, VkFormat fmt = VK_FORMAT_R8G8B8A8_SRGB,
             bool compute = false, bool disableMipmap = false, bool colorAttachment = false, bool depthAttachment = false,
             VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT);
 
@@ -25,10 +25,21 @@ public:
     VkSampler getTextureSampler();
     VkImage getImage();
 
-    void saveToPng(const QString &path);
+    enum ExportFormat {
+        Png8 = 0,
+        Png16 = 1,
+        ExrHalf = 2,
+        Bc5 = 3,
+        Bc7 = 4,
+    };
+    // Read back the first mip level, or all of them for block compressed formats, and write it in the
+    // background. RGBA8 textures only export to 8 bit PNG, RGBA16F ones to every format. Returns the
+    // staging id the copy can be waited on with.
+    uint64_t saveToFile(const QString &path, ExportFormat format = Png8);
     void clear(float r, float g, float b, float a);
     void blitTextureImage(const Texture& other);
-    void generateMipmaps(VkSemaphore *waitSemaphorePtr = nullptr);
+    // Recorded into recordTo without waiting when one is given
+    void generateMipmaps(VkSemaphore *waitSemaphorePtr = nullptr, VkCommandBuffer recordTo = VK_NULL_HANDLE);
     uint32_t getWidth();
     uint32_t getHeight();
     uint32_t getMipLevels();
@@ -36,24 +47,25 @@ public:
 protected:
     Texture(const Texture&);
 
+    void release();
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore *waitSemaphorePtr = nullptr);
-    void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout);
+    void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, VkCommandBuffer recordTo = VK_NULL_HANDLE);
 
     void createTextureImage(const QString& path, bool *result);
+    void createTextureImageFromContainer(const QString& path, bool *result);
     void createTextureImage();
     void createImageView();
     void createTextureSampler();
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
     void createImage(VkImageUsageFlags usage, VkMemoryPropertyFlags properties);
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t depth);
+    void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkImage image, uint32_t width, uint32_t height, uint32_t depth);
     void copyTextureImage(const Texture& other);
 
-    VulkanWindow *m_window;
+    VulkanContext *m_context;
 
     VkImage m_textureImage = VK_NULL_HANDLE;
-    VkDeviceMemory m_textureImageMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_textureImageMemory;
     VkImageView m_textureImageView = VK_NULL_HANDLE;
     VkSampler m_textureSampler = VK_NULL_HANDLE;
 
@@ -69,5 +81,8 @@ protected:
     bool m_colorAttachment;
     bool m_depthAttachment = false;
     bool m_disableMipmap;
+    bool m_prebuiltMipmaps = false;
+
+    static constexpr uint32_t EXPORT_BLOCK_ROWS = 64;
 };
 
@@ -0,0 +1,254 @@
+#include "texturecontainer.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static uint32_t readU32(const uchar *data) {
+    return qFromLittleEndian<quint32>(data);
+}
+
+static uint64_t readU64(const uchar *data) {
+    return qFromLittleEndian<quint64>(data);
+}
+
+static constexpr uint32_t fourCC(const char code[5]) {
+    return uint32_t(code[0]) | (uint32_t(code[1]) << 8) | (uint32_t(code[2]) << 16) | (uint32_t(code[3]) << 24);
+}
+
+TextureContainer::TextureContainer(const QString &path, uint32_t maxDimension) : m_file(path), m_maxDimension(maxDimension) {
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        return;
+    }
+
+    const bool ok = QFileInfo(path).suffix().toLower() == "ktx2" ? parseKtx2() : parseDds();
+    if (!ok) {
+        qWarning("Unsupported or truncated texture file %s", qPrintable(path));
+        m_levels.clear();
+    }
+}
+
+bool TextureContainer::isValid() {
+    return !m_levels.empty();
+}
+
+VkFormat TextureContainer::getFormat() {
+    return m_format;
+}
+
+bool TextureContainer::isCompressed() {
+    return m_compressed;
+}
+
+const std::vector<TextureContainer::Level>& TextureContainer::getLevels() {
+    return m_levels;
+}
+
+bool TextureContainer::isContainer(const QString &path) {
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    return suffix == "dds" || suffix == "ktx2";
+}
+
+bool TextureContainer::blockSize(VkFormat format, uint32_t &bytes, bool &compressed) {
+    compressed = true;
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+        bytes = 8;
+        return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        bytes = 16;
+        return true;
+    default:
+        break;
+    }
+
+    compressed = false;
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        bytes = 4;
+        return true;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        bytes = 8;
+        return true;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        bytes = 16;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TextureContainer::checkSize(uint32_t width, uint32_t height, uint32_t count) {
+    if (!width || !height || width > m_maxDimension || height > m_maxDimension) {
+        return false;
+    }
+    // A full chain ends at 1x1, a longer one is not a valid image and would shift the size by 32 or more
+    return count <= static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+VkDeviceSize TextureContainer::levelSize(uint32_t width, uint32_t height, uint32_t bytes) {
+    // Sizes are bounded by the maximum dimension, the block count is computed in 64 bits so it can not wrap
+    return m_compressed ? ((VkDeviceSize(width)+3)/4)*((VkDeviceSize(height)+3)/4)*bytes : VkDeviceSize(width)*height*bytes;
+}
+
+bool TextureContainer::addLevels(uint32_t width, uint32_t height, uint32_t count, qint64 offset) {
+    uint32_t bytes;
+    if (!checkSize(width, height, count) || !blockSize(m_format, bytes, m_compressed)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t w = std::max(width >> i, 1u);
+        const uint32_t h = std::max(height >> i, 1u);
+        const VkDeviceSize size = levelSize(w, h, bytes);
+        if (size > VkDeviceSize(m_size - offset)) {
+            return false;
+        }
+        m_levels.push_back({ m_data + offset, size, w, h });
+        offset += size;
+    }
+    return true;
+}
+
+bool TextureContainer::parseDds() {
+    if (m_size < 128 || memcmp(m_data, "DDS ", 4)) {
+        return false;
+    }
+
+    const uchar *header = m_data + 4;
+    const uint32_t flags = readU32(header+4);
+    const uint32_t height = readU32(header+8);
+    const uint32_t width = readU32(header+12);
+    const uint32_t depth = readU32(header+20);
+    const uint32_t mipCount = flags & 0x20000 ? std::max(readU32(header+24), 1u) : 1;
+    const uint32_t pixelFlags = readU32(header+76);
+    const uint32_t code = readU32(header+80);
+    const uint32_t rgbBits = readU32(header+84);
+    const uint32_t redMask = readU32(header+88);
+    const uint32_t greenMask = readU32(header+92);
+    const uint32_t blueMask = readU32(header+96);
+    const uint32_t caps2 = readU32(header+108);
+
+    // Volumes and cube maps are not 2D textures
+    if (((flags & 0x800000) && depth > 1) || (caps2 & 0x200)) {
+        return false;
+    }
+
+    qint64 offset = 128;
+    if ((pixelFlags & 0x4) && code == fourCC("DX10")) {
+        if (m_size < 148) {
+            return false;
+        }
+        const uint32_t dxgiFormat = readU32(m_data+128);
+        const uint32_t dimension = readU32(m_data+132);
+        const uint32_t miscFlags = readU32(m_data+136);
+        const uint32_t arraySize = readU32(m_data+140);
+        if (dimension != 3 || arraySize > 1 || (miscFlags & 0x4)) {
+            return false;
+        }
+        offset = 148;
+
+        switch (dxgiFormat) {
+        case 2: m_format = VK_FORMAT_R32G32B32A32_SFLOAT; break;
+        case 10: m_format = VK_FORMAT_R16G16B16A16_SFLOAT; break;
+        case 28: m_format = VK_FORMAT_R8G8B8A8_UNORM; break;
+        case 29: m_format = VK_FORMAT_R8G8B8A8_SRGB; break;
+        case 71: m_format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+        case 72: m_format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; break;
+        case 74: m_format = VK_FORMAT_BC2_UNORM_BLOCK; break;
+        case 75: m_format = VK_FORMAT_BC2_SRGB_BLOCK; break;
+        case 77: m_format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+        case 78: m_format = VK_FORMAT_BC3_SRGB_BLOCK; break;
+        case 80: m_format = VK_FORMAT_BC4_UNORM_BLOCK; break;
+        case 81: m_format = VK_FORMAT_BC4_SNORM_BLOCK; break;
+        case 83: m_format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+        case 84: m_format = VK_FORMAT_BC5_SNORM_BLOCK; break;
+        case 87: m_format = VK_FORMAT_B8G8R8A8_UNORM; break;
+        case 91: m_format = VK_FORMAT_B8G8R8A8_SRGB; break;
+        case 95: m_format = VK_FORMAT_BC6H_UFLOAT_BLOCK; break;
+        case 96: m_format = VK_FORMAT_BC6H_SFLOAT_BLOCK; break;
+        case 98: m_format = VK_FORMAT_BC7_UNORM_BLOCK; break;
+        case 99: m_format = VK_FORMAT_BC7_SRGB_BLOCK; break;
+        default: return false;
+        }
+    } else if (pixelFlags & 0x4) {
+        if (code == fourCC("DXT1")) m_format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        else if (code == fourCC("DXT2") || code == fourCC("DXT3")) m_format = VK_FORMAT_BC2_UNORM_BLOCK;
+        else if (code == fourCC("DXT4") || code == fourCC("DXT5")) m_format = VK_FORMAT_BC3_UNORM_BLOCK;
+        else if (code == fourCC("ATI1") || code == fourCC("BC4U")) m_format = VK_FORMAT_BC4_UNORM_BLOCK;
+        else if (code == fourCC("BC4S")) m_format = VK_FORMAT_BC4_SNORM_BLOCK;
+        else if (code == fourCC("ATI2") || code == fourCC("BC5U")) m_format = VK_FORMAT_BC5_UNORM_BLOCK;
+        else if (code == fourCC("BC5S")) m_format = VK_FORMAT_BC5_SNORM_BLOCK;
+        else if (code == 113) m_format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        else if (code == 116) m_format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        else return false;
+    } else if ((pixelFlags & 0x40) && rgbBits == 32 && greenMask == 0xFF00) {
+        if (redMask == 0xFF && blueMask == 0xFF0000) m_format = VK_FORMAT_R8G8B8A8_UNORM;
+        else if (redMask == 0xFF0000 && blueMask == 0xFF) m_format = VK_FORMAT_B8G8R8A8_UNORM;
+        else return false;
+    } else {
+        return false;
+    }
+
+    return addLevels(width, height, mipCount, offset);
+}
+
+bool TextureContainer::parseKtx2() {
+    static const uchar identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    if (m_size < 80 || memcmp(m_data, identifier, sizeof(identifier))) {
+        return false;
+    }
+
+    m_format = VkFormat(readU32(m_data+12));
+    const uint32_t width = readU32(m_data+20);
+    const uint32_t height = readU32(m_data+24);
+    const uint32_t depth = readU32(m_data+28);
+    const uint32_t layers = readU32(m_data+32);
+    const uint32_t faces = readU32(m_data+36);
+    // No level count asks the reader to build the chain, only the base level is stored then
+    const uint32_t levelCount = std::max(readU32(m_data+40), 1u);
+    const uint32_t supercompression = readU32(m_data+44);
+
+    // Supercompressed payloads (Basis, zstd) would need a transcoder first
+    uint32_t bytes;
+    if (!checkSize(width, height, levelCount) || depth > 1 || layers > 1 || faces != 1 || supercompression != 0 ||
+        !blockSize(m_format, bytes, m_compressed) || 80 + 24*qint64(levelCount) > m_size) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < levelCount; i++) {
+        // Both come from the file, compare against what is left so the sum can not wrap around
+        const uint64_t offset = readU64(m_data+80+24*i);
+        const uint64_t length = readU64(m_data+80+24*i+8);
+        const uint32_t w = std::max(width >> i, 1u);
+        const uint32_t h = std::max(height >> i, 1u);
+        if (length != levelSize(w, h, bytes) || offset > uint64_t(m_size) || length > uint64_t(m_size) - offset) {
+            return false;
+        }
+        m_levels.push_back({ m_data + offset, length, w, h });
+    }
+    return true;
+}
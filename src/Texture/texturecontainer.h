@@ -0,0 +1,47 @@
+#pragma once
+#include <QFile>
+#include <QVulkanWindow>
+#include <vector>
+
+// Reads DDS and KTX2 files with their mip chain as stored on disk. The file is memory mapped and
+// every level is handed out untouched, ready to be copied to staging memory and uploaded.
+class TextureContainer {
+public:
+    struct Level {
+        const uchar *data;
+        VkDeviceSize size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Files wider or taller than maxDimension, or with more levels than their size allows, are rejected
+    TextureContainer(const QString &path, uint32_t maxDimension);
+
+    TextureContainer(const TextureContainer&) = delete;
+    TextureContainer& operator=(const TextureContainer&) = delete;
+
+    bool isValid();
+    VkFormat getFormat();
+    bool isCompressed();
+    const std::vector<Level>& getLevels();
+
+    // DDS and KTX2 are picked by suffix, anything else goes through stb
+    static bool isContainer(const QString &path);
+
+private:
+    bool parseDds();
+    bool parseKtx2();
+    bool checkSize(uint32_t width, uint32_t height, uint32_t count);
+    bool addLevels(uint32_t width, uint32_t height, uint32_t count, qint64 offset);
+    bool blockSize(VkFormat format, uint32_t &bytes, bool &compressed);
+    VkDeviceSize levelSize(uint32_t width, uint32_t height, uint32_t bytes);
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    uint32_t m_maxDimension;
+
+    VkFormat m_format = VK_FORMAT_UNDEFINED;
+    bool m_compressed = false;
+    std::vector<Level> m_levels;
+};
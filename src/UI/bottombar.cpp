@@ -13,6 +13,13 @@ BottomBar::BottomBar() {
     layout->addWidget(m_mouse);
     layout->addStretch();
 
+    m_progress = new QProgressBar;
+    m_progress->setMaximumWidth(300);
+    m_progress->setRange(0, 100);
+    m_progress->hide();
+    layout->addWidget(m_progress);
+    layout->addSpacing(10);
+
     m_fps = new QLabel("");
     m_fps->setAlignment(Qt::AlignRight);
     layout->addWidget(m_fps);
@@ -25,3 +32,13 @@ void BottomBar::setFPSLabel(const QString& str) {
 void BottomBar::setMouseLabel(const QString& str) {
     m_mouse->setText(str);
 }
+
+void BottomBar::setProgress(const QString& str, int percent) {
+    if (percent < 0) {
+        m_progress->hide();
+        return;
+    }
+    m_progress->setFormat(str+" %p%");
+    m_progress->setValue(percent);
+    m_progress->show();
+}
@@ -1,14 +1,18 @@
 #pragma once
 #include <QWidget>
 #include <QLabel>
+#include <QProgressBar>
 
 class BottomBar : public QWidget {
 public:
     BottomBar();
     void setFPSLabel(const QString& str);
     void setMouseLabel(const QString& str);
+    // Shows the background jobs, a negative percent hides the bar
+    void setProgress(const QString& str, int percent);
 
 private:
     QLabel *m_fps;
     QLabel *m_mouse;
+    QProgressBar *m_progress;
 };
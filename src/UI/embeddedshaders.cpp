@@ -0,0 +1,24 @@
+#include "embeddedshaders.h"
+#include <cstring>
+
+namespace {
+struct Shader {
+    const char *name;
+    const uint32_t *code;
+    size_t size;
+};
+
+// Generated by qmake, defines the code arrays and the "shaders" table from the glslc output
+#include "shaders.inc"
+}
+
+const uint32_t *EmbeddedShaders::find(const QString &name, size_t &size) {
+    const QByteArray key = name.toUtf8();
+    for (const Shader &shader: shaders) {
+        if (strcmp(shader.name, key.constData()) == 0) {
+            size = shader.size;
+            return shader.code;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <QString>
+
+// SPIR-V of every shader in Editor.pro, compiled into the executable at build time
+namespace EmbeddedShaders {
+    // Look up a module by its file name, e.g. "fast_frag.spv". Returns nullptr if it is unknown
+    const uint32_t *find(const QString &name, size_t &size);
+
+    // Generated by qmake next to the table, only the file names
+    constexpr const char *names[] = {
+#include "shaderNames.inc"
+    };
+
+    // Compare name followed by suffix against an embedded file name
+    constexpr bool matches(const char *embedded, const char *name, const char *suffix) {
+        while (*name) {
+            if (*embedded++ != *name++) return false;
+        }
+        while (*suffix) {
+            if (*embedded++ != *suffix++) return false;
+        }
+        return !*embedded;
+    }
+
+    // Usable in static_assert, exists("fast", "_frag.spv") checks a view by its base name
+    constexpr bool exists(const char *name, const char *suffix = "") {
+        for (const char *embedded: names) {
+            if (matches(embedded, name, suffix)) return true;
+        }
+        return false;
+    }
+}
+
+// A shader file name that fails the build when it is not in the SHADERS list of Editor.pro
+#define SHADER(name) ([]() { static_assert(EmbeddedShaders::exists(name), "shader " name " is not in SHADERS"); return name; }())
@@ -6,6 +6,8 @@
 #include "src/Field/optimizer.h"
 #include "src/UI/mainapp.h"
 #include <QMessageBox>
+#include <QInputDialog>
+#include <algorithm>
 
 MenuBar::~MenuBar() {
     delete m_helpTextEdit;
@@ -39,7 +41,7 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->clearDownKeys();
         QString fileName = QFileDialog::getOpenFileName(nullptr, "Open image",
             getFileDir(),
-            "Images (*.png *.jpg *.jpeg *.bmp)");
+            "Images (*.png *.jpg *.jpeg *.bmp *.dds *.ktx2)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
             vulkanWindow->getRender()->setReferenceImage(fileName, true);
@@ -123,13 +125,42 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->clearDownKeys();
         QString fileName = QFileDialog::getOpenFileName(nullptr, "Open image",
             getFileDir(),
-            "Images (*.png *.jpg *.jpeg *.bmp)");
+            "Images (*.png *.jpg *.jpeg *.bmp *.dds *.ktx2)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
             vulkanWindow->getRender()->setReferenceImage(fileName);
             referenceRender->setEnabled(true);
         }
     });
+    QAction *loadEnvironment = fileMenu->addAction("Load environment");
+    loadEnvironment->setShortcut(Qt::CTRL | Qt::SHIFT | Qt::Key_H);
+    QObject::connect(loadEnvironment, &QAction::triggered, [=](){
+        vulkanWindow->clearDownKeys();
+        QStringList fileNames = QFileDialog::getOpenFileNames(nullptr, "Open a panorama or six cube faces",
+            getFileDir(),
+            "HDR images (*.hdr *.exr)");
+        if (!fileNames.isEmpty()) {
+            m_fileDir = QFileInfo(fileNames[0]).absolutePath();
+            // Faces are told apart by the px, nx, py, ny, pz and nz their names end with
+            if (fileNames.size() == 6) {
+                static const QStringList faces = { "px", "nx", "py", "ny", "pz", "nz" };
+                auto face = [&](const QString &name) {
+                    const QString base = QFileInfo(name).completeBaseName().toLower();
+                    for (int i = 0; i < faces.size(); i++) {
+                        if (base.endsWith(faces[i])) return i;
+                    }
+                    return -1;
+                };
+                std::sort(fileNames.begin(), fileNames.end(), [&](const QString &a, const QString &b) { return face(a) < face(b); });
+            }
+            if (!vulkanWindow->getRender()->loadEnvironment(fileNames)) {
+                QMessageBox *errorBox = new QMessageBox();
+                errorBox->critical(0, "Environment can not be loaded!", "Pick one panorama or six faces of the same size");
+                errorBox->setAttribute(Qt::WA_DeleteOnClose);
+            }
+        }
+        vulkanWindow->clearDownKeys();
+    });
     fileMenu->addSeparator();
 
     m_imageLoadTimer.setSingleShot(true);
@@ -156,7 +187,7 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->clearDownKeys();
         QString fileName = QFileDialog::getOpenFileName(nullptr, "Open File",
                                                         getFileDir(),
-                                                        "Images (*.png *.jpg *.jpeg *.bmp)");
+                                                        "Images (*.png *.jpg *.jpeg *.bmp *.dds *.ktx2)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
             vulkanWindow->getOptimizer()->clear();
@@ -177,7 +208,7 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->clearDownKeys();
         QString fileName = QFileDialog::getOpenFileName(nullptr, "Open File",
                                                         getFileDir(),
-                                                        "Images (*.png *.jpg *.jpeg *.bmp)");
+                                                        "Images (*.png *.jpg *.jpeg *.bmp *.dds *.ktx2)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
             vulkanWindow->getOptimizer()->clear();
@@ -198,7 +229,7 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->clearDownKeys();
         QString fileName = QFileDialog::getOpenFileName(nullptr, "Open image",
             getFileDir(),
-            "Images (*.png *.jpg *.jpeg *.bmp)");
+            "Images (*.png *.jpg *.jpeg *.bmp *.dds *.ktx2)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
             vulkanWindow->getOptimizer()->clear();
@@ -224,12 +255,10 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
     saveAnisoAngle->setShortcut(Qt::CTRL | Qt::Key_E);
     QObject::connect(saveAnisoAngle, &QAction::triggered, [=](){
         vulkanWindow->clearDownKeys();
-        QString fileName = QFileDialog::getSaveFileName(nullptr, "Save image",
-                                                        getFileDir() + "/angle.png",
-                                                        "Images (*.png)");
+        Texture::ExportFormat format;
+        QString fileName = getExportFileName("angle.png", Texture::Bc7, format);
         if (fileName != "") {
-            m_fileDir = QFileInfo(fileName).absolutePath();
-            vulkanWindow->getRender()->saveAnisoAngle(fileName);
+            vulkanWindow->getRender()->saveAnisoAngle(fileName, format);
         }
     });
 
@@ -237,12 +266,10 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
     saveAnisoDir->setShortcut(Qt::CTRL | Qt::ALT | Qt::Key_E);
     QObject::connect(saveAnisoDir, &QAction::triggered, [=](){
         vulkanWindow->clearDownKeys();
-        QString fileName = QFileDialog::getSaveFileName(nullptr, "Save image",
-                                                        getFileDir() + "/vector.png",
-                                                        "Images (*.png)");
+        Texture::ExportFormat format;
+        QString fileName = getExportFileName("vector.png", Texture::Bc5, format);
         if (fileName != "") {
-            m_fileDir = QFileInfo(fileName).absolutePath();
-            vulkanWindow->getRender()->saveAnisoDir(fileName);
+            vulkanWindow->getRender()->saveAnisoDir(fileName, format);
         }
     });
 
@@ -250,12 +277,30 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
     saveZebra->setShortcut(Qt::CTRL | Qt::SHIFT | Qt::Key_E);
     QObject::connect(saveZebra, &QAction::triggered, [=](){
         vulkanWindow->clearDownKeys();
+        Texture::ExportFormat format;
+        QString fileName = getExportFileName("sines.png", Texture::Bc7, format);
+        if (fileName != "") {
+            vulkanWindow->getRender()->saveZebra(fileName, format);
+        }
+    });
+
+    QAction *renderToFile = fileMenu->addAction("Render to file");
+    QObject::connect(renderToFile, &QAction::triggered, [=](){
+        vulkanWindow->clearDownKeys();
+        bool ok;
+        const QSize sz = vulkanWindow->swapChainImageSize();
+        int width = QInputDialog::getInt(nullptr, "Render to file", "Width (height follows the viewport):",
+                                         sz.width()*2, 16, 65536, 1, &ok);
+        if (!ok) {
+            return;
+        }
         QString fileName = QFileDialog::getSaveFileName(nullptr, "Save image",
-                                                        getFileDir() + "/sines.png",
-                                                        "Images (*.png)");
+                                                        getFileDir() + "/render.png",
+                                                        "Images (*.png *.exr)");
         if (fileName != "") {
             m_fileDir = QFileInfo(fileName).absolutePath();
-            vulkanWindow->getRender()->saveZebra(fileName);
+            int height = std::max(1, int(width*sz.height()/float(sz.width())));
+            vulkanWindow->getRender()->renderToFile(fileName, width, height);
         }
     });
 
@@ -375,6 +420,13 @@ MenuBar::MenuBar(VulkanWindow *vulkanWindow) : m_window(vulkanWindow) {
         vulkanWindow->getRender()->showConstraints(val);
     });
 
+    QAction *dynamicResolution = viewMenu->addAction("Dynamic Resolution");
+    dynamicResolution->setShortcut(Qt::Key_D);
+    dynamicResolution->setCheckable(true);
+    QObject::connect(dynamicResolution, &QAction::triggered, [=](bool val){
+        vulkanWindow->getRender()->setDynamicResolution(val);
+    });
+
     viewMenu->addSeparator();
     QAction *fullscreen = viewMenu->addAction("Fullscreen");
     fullscreen->setShortcut(Qt::Key_F11);
@@ -421,3 +473,54 @@ void MenuBar::dirtyUndoMenu() {
 QString MenuBar::getFileDir() {
     return m_fileDir == "" ? QStandardPaths::writableLocation(QStandardPaths::DesktopLocation) : m_fileDir;
 }
+
+QString MenuBar::getExportFileName(const QString &name, Texture::ExportFormat compressed, Texture::ExportFormat &format) {
+    struct Filter {
+        QString name;
+        QString suffix;
+        Texture::ExportFormat format;
+    };
+    const QString block = compressed == Texture::Bc5 ? "BC5" : "BC7";
+    const Filter filters[] = {
+        { "PNG 8 bit (*.png)", "png", Texture::Png8 },
+        { "PNG 16 bit (*.png)", "png", Texture::Png16 },
+        { "OpenEXR half float (*.exr)", "exr", Texture::ExrHalf },
+        { "DDS " + block + " with mipmaps (*.dds)", "dds", compressed },
+        { "KTX2 " + block + " with mipmaps (*.ktx2)", "ktx2", compressed },
+    };
+
+    QStringList names;
+    for (const Filter &filter: filters) {
+        names << filter.name;
+    }
+    QString selected = filters[0].name;
+    QString fileName = QFileDialog::getSaveFileName(nullptr, "Save image",
+                                                    getFileDir() + "/" + name,
+                                                    names.join(";;"), &selected);
+    if (fileName == "") {
+        return fileName;
+    }
+
+    // A typed .exr, .dds or .ktx2 suffix wins over the selected filter, which otherwise fixes up a
+    // leftover .png one
+    QFileInfo info(fileName);
+    m_fileDir = info.absolutePath();
+    const QString suffix = info.suffix().toLower();
+    const Filter *chosen = &filters[0];
+    for (const Filter &filter: filters) {
+        if (filter.name == selected) chosen = &filter;
+    }
+    if (suffix != chosen->suffix) {
+        const Filter *typed = nullptr;
+        for (const Filter &filter: filters) {
+            if (!typed && suffix != "png" && filter.suffix == suffix) typed = &filter;
+        }
+        if (typed) {
+            chosen = typed;
+        } else {
+            fileName = m_fileDir + "/" + info.completeBaseName() + "." + chosen->suffix;
+        }
+    }
+    format = chosen->format;
+    return fileName;
+}
@@ -7,6 +7,7 @@
 #include "src/UI/renderingsettings.h"
 #include "src/UI/optimizersettings.h"
 #include "src/UI/newproject.h"
+#include "src/Texture/texture.h"
 
 class MenuBar : public QMenuBar {
 public:
@@ -17,6 +18,7 @@ public:
 
 private:
     QString getFileDir();
+    QString getExportFileName(const QString &name, Texture::ExportFormat compressed, Texture::ExportFormat &format);
 
     QTextEdit *m_helpTextEdit;
     RenderingSettings *m_renderingSettings;
@@ -7,6 +7,7 @@
 #include <QSlider>
 #include <QPushButton>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 
 #include <memory>
 #include <string>
@@ -104,12 +105,45 @@ RenderingSettings::RenderingSettings(VulkanWindow *window): m_window(window) {
     QSpinBox *iteration = new QSpinBox(this);
     iteration->setRange(8, 64);
     iteration->setValue(32);
-    layoutIteration->addWidget(new QLabel("Samples count (fast only): "));
+    layoutIteration->addWidget(new QLabel("Max samples (fast only): "));
     layoutIteration->addWidget(iteration);
     QObject::connect(iteration, &QSpinBox::valueChanged, [&](int val){
         m_window->getRender()->setSampleCount(val);
     });
     verLayoutBrdf->addWidget(iterationWidget);
+
+    QWidget *noiseWidget = new QWidget();
+    layout->addWidget(noiseWidget);
+    QHBoxLayout *layoutNoise = new QHBoxLayout;
+    layoutNoise->setContentsMargins(QMargins(0,0,0,0));
+    noiseWidget->setLayout(layoutNoise);
+    QDoubleSpinBox *noise = new QDoubleSpinBox(this);
+    noise->setRange(0.05, 5.0);
+    noise->setSingleStep(0.05);
+    noise->setDecimals(2);
+    noise->setValue(0.4);
+    noise->setSuffix("%");
+    layoutNoise->addWidget(new QLabel("Reference noise target: "));
+    layoutNoise->addWidget(noise);
+    QObject::connect(noise, &QDoubleSpinBox::valueChanged, [&](double val){
+        m_window->getRender()->setTargetError(val/100.0f);
+    });
+    verLayoutBrdf->addWidget(noiseWidget);
+
+    QWidget *fpsWidget = new QWidget();
+    layout->addWidget(fpsWidget);
+    QHBoxLayout *layoutFps = new QHBoxLayout;
+    layoutFps->setContentsMargins(QMargins(0,0,0,0));
+    fpsWidget->setLayout(layoutFps);
+    QSpinBox *fps = new QSpinBox(this);
+    fps->setRange(10, 240);
+    fps->setValue(60);
+    layoutFps->addWidget(new QLabel("Dynamic resolution target FPS: "));
+    layoutFps->addWidget(fps);
+    QObject::connect(fps, &QSpinBox::valueChanged, [&](int val){
+        m_window->getRender()->setTargetFrameTime(1000.0f/val);
+    });
+    verLayoutBrdf->addWidget(fpsWidget);
     setLayout(layout);
 }
 
@@ -1,15 +1,59 @@
 #include "vulkanwindow.h"
 #include <QMouseEvent>
-#include <QFile>
 #include "src/UI/mainapp.h"
 #include <QMessageBox>
 #include <QListWidget>
+#include <QTimer>
 #include "src/Field/optimizer.h"
 
 VulkanWindow::VulkanWindow(MainApp *mainApp) : m_mainApp(mainApp) {
     m_doubleClickTimer.start();
 }
 
+VkInstance VulkanWindow::vkInstance() const {
+    return vulkanInstance()->vkInstance();
+}
+
+PFN_vkGetInstanceProcAddr VulkanWindow::getInstanceProcAddr() const {
+    return reinterpret_cast<PFN_vkGetInstanceProcAddr>(vulkanInstance()->getInstanceProcAddr("vkGetInstanceProcAddr"));
+}
+
+VkPhysicalDevice VulkanWindow::physicalDevice() const {
+    return QVulkanWindow::physicalDevice();
+}
+
+const VkPhysicalDeviceProperties *VulkanWindow::physicalDeviceProperties() const {
+    return QVulkanWindow::physicalDeviceProperties();
+}
+
+VkDevice VulkanWindow::device() const {
+    return QVulkanWindow::device();
+}
+
+VkQueue VulkanWindow::graphicsQueue() const {
+    return QVulkanWindow::graphicsQueue();
+}
+
+uint32_t VulkanWindow::graphicsQueueFamilyIndex() const {
+    return QVulkanWindow::graphicsQueueFamilyIndex();
+}
+
+VkCommandPool VulkanWindow::graphicsCommandPool() const {
+    return QVulkanWindow::graphicsCommandPool();
+}
+
+int VulkanWindow::concurrentFrameCount() const {
+    return QVulkanWindow::concurrentFrameCount();
+}
+
+int VulkanWindow::currentFrame() const {
+    return QVulkanWindow::currentFrame();
+}
+
+QMatrix4x4 VulkanWindow::clipCorrectionMatrix() {
+    return QVulkanWindow::clipCorrectionMatrix();
+}
+
 float VulkanWindow::uvToAngle(QPointF uv, int32_t id) {
     return atan2((1.0 - uv.y()) - m_optimizer->getConstraints()[id].centerY,
                  uv.x() - m_optimizer->getConstraints()[id].centerX);
@@ -186,14 +230,6 @@ void VulkanWindow::clearDownKeys() {
     m_mainApp->dirtyToolBar();
 }
 
-void VulkanWindow::setComputeQueueFamilyIndex(uint32_t ind) {
-    m_computeQueueFamilyIndex = ind;
-}
-
-uint32_t VulkanWindow::getComputeQueueFamilyIndex() {
-    return m_computeQueueFamilyIndex;
-}
-
 void VulkanWindow::mousePressEvent(QMouseEvent* event) {
     if (event->button() == Qt::LeftButton) {
         uint64_t time = m_doubleClickTimer.elapsed();
@@ -372,6 +408,77 @@ void VulkanWindow::wheelEvent(QWheelEvent* event) {
     event->accept();
 }
 
+void VulkanWindow::startJob(const QString &label, const std::function<void(std::atomic<float> &progress)> &work,
+                            const std::function<void()> &done) {
+    m_jobs.emplace_back(new Job);
+    Job *job = m_jobs.back().get();
+    job->label = label;
+    job->done = done;
+    job->thread = std::thread([job, work]() {
+        work(job->progress);
+        job->finished = true;
+    });
+
+    if (!m_jobTimer) {
+        m_jobTimer = new QTimer(this);
+        QObject::connect(m_jobTimer, &QTimer::timeout, [this]() { updateJobs(); });
+    }
+    m_jobTimer->start(100);
+    updateJobs();
+}
+
+void VulkanWindow::updateJobs() {
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+        if ((*it)->finished) {
+            (*it)->thread.join();
+            if ((*it)->done) (*it)->done();
+            it = m_jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (m_jobs.empty()) {
+        m_jobTimer->stop();
+        m_mainApp->getBottomBar()->setProgress("", -1);
+        return;
+    }
+
+    float progress = 0;
+    for (auto &job: m_jobs) {
+        progress += job->progress;
+    }
+    QString label = m_jobs.front()->label;
+    if (m_jobs.size() > 1) {
+        label += QString(" (+%1)").arg(m_jobs.size()-1);
+    }
+    m_mainApp->getBottomBar()->setProgress(label, 100*progress/m_jobs.size());
+}
+
+void VulkanWindow::finishJobs() {
+    for (auto &job: m_jobs) {
+        job->thread.join();
+        if (job->done) job->done();
+    }
+    m_jobs.clear();
+    if (m_jobTimer) {
+        m_jobTimer->stop();
+        m_mainApp->getBottomBar()->setProgress("", -1);
+    }
+}
+
+void VulkanWindow::setStartupTask(const std::function<void()> &task) {
+    m_startupTask = task;
+}
+
+void VulkanWindow::runStartupTask() {
+    if (m_startupTask) {
+        std::function<void()> task = m_startupTask;
+        m_startupTask = nullptr;
+        QTimer::singleShot(0, task);
+    }
+}
+
 Render *VulkanWindow::getRender() {
     return m_renderer;
 }
@@ -414,45 +521,3 @@ QVulkanWindowRenderer *VulkanWindow::createRenderer() {
     requestActivate();
     return m_renderer = new Render(this, m_optimizer, m_pointList, true);
 }
-
-uint32_t VulkanWindow::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vulkanInstance()->functions()->vkGetPhysicalDeviceMemoryProperties(physicalDevice(), &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-    crash("failed to find suitable memory type!");
-    return 0;
-}
-
-VkDeviceSize VulkanWindow::aligned(VkDeviceSize v, VkDeviceSize byteAlign) {
-    return (v + byteAlign - 1) & ~(byteAlign - 1);
-}
-
-VkShaderModule VulkanWindow::createShader(const QString &name) {
-    QFile file(name);
-    if (!file.open(QIODevice::ReadOnly)) {
-        qWarning("Failed to read shader %s", qPrintable(name));
-        return VK_NULL_HANDLE;
-    }
-    QByteArray blob = file.readAll();
-    file.close();
-
-    VkShaderModuleCreateInfo shaderInfo;
-    memset(&shaderInfo, 0, sizeof(shaderInfo));
-    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderInfo.codeSize = blob.size();
-    shaderInfo.pCode = reinterpret_cast<const uint32_t *>(blob.constData());
-    VkShaderModule shaderModule;
-    VkResult err = vulkanInstance()->deviceFunctions(device())->
-                   vkCreateShaderModule(device(), &shaderInfo, nullptr, &shaderModule);
-    if (err != VK_SUCCESS) {
-        qWarning("Failed to create shader module: %d", err);
-        return VK_NULL_HANDLE;
-    }
-
-    return shaderModule;
-}
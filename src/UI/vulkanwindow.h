@@ -1,15 +1,35 @@
 #pragma once
 #include <QVulkanWindow>
 #include <QElapsedTimer>
+#include <functional>
+#include <deque>
+#include <list>
+#include <memory>
+#include <thread>
+#include <atomic>
 #include "src/Render/render.h"
+#include "src/Render/vulkancontext.h"
 
 class MainApp;
 class Optimizer;
 class QListWidget;
-class VulkanWindow : public QVulkanWindow {
+class QTimer;
+class VulkanWindow : public QVulkanWindow, public VulkanContext {
 public:
     VulkanWindow(MainApp *mainApp);
 
+    VkInstance vkInstance() const override;
+    PFN_vkGetInstanceProcAddr getInstanceProcAddr() const override;
+    VkPhysicalDevice physicalDevice() const override;
+    const VkPhysicalDeviceProperties *physicalDeviceProperties() const override;
+    VkDevice device() const override;
+    VkQueue graphicsQueue() const override;
+    uint32_t graphicsQueueFamilyIndex() const override;
+    VkCommandPool graphicsCommandPool() const override;
+    int concurrentFrameCount() const override;
+    int currentFrame() const override;
+    QMatrix4x4 clipCorrectionMatrix() override;
+
     QVulkanWindowRenderer *createRenderer() override;
     Render *getRender();
     Optimizer *getOptimizer();
@@ -39,24 +59,37 @@ public:
     void keyPressEvent(QKeyEvent *event) override;
     void keyReleaseEvent(QKeyEvent *event) override;
 
-    void setComputeQueueFamilyIndex(uint32_t ind);
-    uint32_t getComputeQueueFamilyIndex();
     void clearDownKeys();
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-    VkShaderModule createShader(const QString &name);
-    VkDeviceSize aligned(VkDeviceSize v, VkDeviceSize byteAlign);
     QListWidget *&getConstraintWidgetList();
-    void crash(const QString& msg);
+    void crash(const QString& msg) override;
 
     void dirtyUndoMenu();
     void setFPSLabel(const QString& str);
     void updateMouseLabel();
 
+    // Run work on a background thread while the bottom bar shows its progress, done runs back on the GUI thread
+    void startJob(const QString &label, const std::function<void(std::atomic<float> &progress)> &work,
+                  const std::function<void()> &done = nullptr) override;
+    void finishJobs() override;
+
+    // Run once the renderer has created its resources, used by the command line reports
+    void setStartupTask(const std::function<void()> &task);
+    void runStartupTask();
+
 private:
     int32_t getConstraint(QPointF uv, bool doubleClick);
     bool tryPick(uint32_t id, QPointF uv);
     float uvToAngle(QPointF uv, int32_t id);
+    void updateJobs();
+
+    struct Job {
+        QString label;
+        std::thread thread;
+        std::atomic<float> progress{0};
+        std::atomic<bool> finished{false};
+        std::function<void()> done;
+    };
 
     QPointF m_lastDragPosition;
     QPointF m_lastPressPosition;
@@ -65,7 +98,6 @@ private:
     Render *m_renderer = nullptr;
     Optimizer *m_optimizer = nullptr;
     uint32_t m_downKeys = 0;
-    uint32_t m_computeQueueFamilyIndex;
 
     enum {
         LeftMouseButton = 1 << 0,
@@ -96,4 +128,7 @@ private:
     std::vector<std::array<float, 2>> m_pointList;
     QElapsedTimer m_doubleClickTimer;
     uint64_t m_lastPressTime = 0;
+    std::function<void()> m_startupTask;
+    std::list<std::unique_ptr<Job>> m_jobs;
+    QTimer *m_jobTimer = nullptr;
 };
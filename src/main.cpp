@@ -2,19 +2,70 @@
 #include <QLoggingCategory>
 #include <QFile>
 #include <QScreen>
+#include <QCommandLineParser>
 #include "src/UI/vulkanwindow.h"
 #include "src/UI/mainapp.h"
+#include "src/Render/headlesscontext.h"
+#include "src/Render/render.h"
+#include "src/Field/optimizer.h"
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
+#include <memory>
 
 Q_LOGGING_CATEGORY(lcVk, "qt.vulkan")
 
 int main(int argc, char *argv[]) {
     srand(static_cast <unsigned> (time(0)));
 
-    QApplication app(argc, argv);
+    // Rendering to a file never opens a window, so it also runs on machines without a display
+    bool batch = false;
+    for (int i = 1; i < argc; i++) {
+        if (QByteArray(argv[i]).startsWith("--render")) batch = true;
+    }
+    std::unique_ptr<QCoreApplication> app(batch ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
     QLoggingCategory::setFilterRules(QStringLiteral("qt.vulkan=true"));
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Tangent Field Editor");
+    parser.addHelpOption();
+    QCommandLineOption renderOption("render", "Render the project to <file> (.png or .exr) and quit.", "file");
+    QCommandLineOption projectOption("project", "Project to open before rendering.", "file");
+    QCommandLineOption viewOption("view", "View to render: fast, accurate, direction, twilight, sine or bent.", "name", "fast");
+    QCommandLineOption widthOption("width", "Width of the rendered image.", "pixels", "1920");
+    QCommandLineOption heightOption("height", "Height of the rendered image.", "pixels", "1080");
+    QCommandLineOption passesOption("passes", "Passes accumulated by the accurate view, each one takes 16 samples per pixel.", "count", "256");
+    QCommandLineOption environmentQualityOption("environment-quality", "Prefilter quality of the environment: draft, normal or final.", "tier", "normal");
+    QCommandLineOption environmentReportOption("environment-report", "Log prefilter time and error of every quality tier and quit.");
+    QCommandLineOption fastReportOption("fast-report", "Log GPU time and error of the fast view against the accurate one for every sample count and quit.");
+    QCommandLineOption errorMapOption("error-map", "Save the Delta E map of the fast view to <file> (.png or .exr) with --fast-report.", "file");
+    parser.addOptions({ renderOption, projectOption, viewOption, widthOption, heightOption, passesOption,
+                        environmentQualityOption, environmentReportOption, fastReportOption, errorMapOption });
+    parser.process(*app);
+
+    const QStringList tiers = { "draft", "normal", "final" };
+    const int tier = tiers.indexOf(parser.value(environmentQualityOption).toLower());
+    const uint32_t environmentQuality = tier < 0 ? 1 : tier;
+
+    if (parser.isSet(renderOption)) {
+        HeadlessContext context;
+        context.setEnvironmentQuality(environmentQuality);
+        Optimizer *optimizer = nullptr;
+        Render render(&context, optimizer);
+        render.initScene();
+        if (parser.isSet(projectOption)) {
+            optimizer->load(parser.value(projectOption));
+        }
+        const std::string view = parser.value(viewOption).toStdString();
+        render.setPipeline(view, view == "accurate");
+        bool ok = render.renderToFile(parser.value(renderOption),
+                                      std::max(parser.value(widthOption).toUInt(), 1u),
+                                      std::max(parser.value(heightOption).toUInt(), 1u),
+                                      std::max(parser.value(passesOption).toUInt(), 1u));
+        render.releaseResources();
+        return ok ? 0 : 1;
+    }
+
     MainApp mainApp;
     mainApp.resize(1024, 576);
     mainApp.show();
@@ -68,5 +119,25 @@ int main(int argc, char *argv[]) {
     });
 
     mainApp.init(&vulkanWindow);
-    return app.exec();
+
+    vulkanWindow.setEnvironmentQuality(environmentQuality);
+
+    if (parser.isSet(environmentReportOption)) {
+        vulkanWindow.setStartupTask([&]() {
+            vulkanWindow.getRender()->reportEnvironmentQuality();
+            QCoreApplication::exit(0);
+        });
+    } else if (parser.isSet(fastReportOption)) {
+        vulkanWindow.setStartupTask([&]() {
+            if (parser.isSet(projectOption)) {
+                vulkanWindow.getOptimizer()->load(parser.value(projectOption));
+            }
+            vulkanWindow.getRender()->reportFastQuality(std::max(parser.value(widthOption).toUInt(), 1u),
+                                                        std::max(parser.value(heightOption).toUInt(), 1u),
+                                                        std::max(parser.value(passesOption).toUInt(), 1u),
+                                                        parser.value(errorMapOption));
+            QCoreApplication::exit(0);
+        });
+    }
+    return app->exec();
 }